@@ -135,8 +135,9 @@ typedef struct aas_routingcache_s
 	int travelflags;							//combinations of the travel flags
 	struct aas_routingcache_s *prev, *next;
 	struct aas_routingcache_s *time_prev, *time_next;
+	int numtraveltimes;							//number of travel times and reachabilities
 	unsigned char *reachabilities;				//reachabilities used for routing
-	unsigned short int traveltimes[1];			//travel time for every area (variable sized)
+	unsigned short int *traveltimes;			//travel time for every area, after the cache or in the route cache file
 } aas_routingcache_t;
 
 //fields for the routing algorithm
@@ -248,6 +249,11 @@ typedef struct aas_s
 	aas_routingupdate_t *portalupdate;
 	//number of routing updates during a frame (reset every frame)
 	int frameroutingupdates;
+	//milliseconds spent on routing updates during a frame (reset every frame)
+	int frameroutingtime;
+	//worst frame since the routing was initialized
+	int maxframeroutingupdates;
+	int maxframeroutingtime;
 	//reversed reachability links
 	aas_reversedreachability_t *reversedreachability;
 	//travel times within the areas
@@ -258,6 +264,14 @@ typedef struct aas_s
 	//cache list sorted on time
 	aas_routingcache_t *oldestcache;		// start of cache list sorted on time
 	aas_routingcache_t *newestcache;		// end of cache list sorted on time
+	//route cache file, caches are created from it when first used
+	byte *routecachefile;
+	int routecachefilelength;
+	int routecachefilemapped;				// true when memory mapped
+	int *routecacheportalindex;				// file offset of the first portal cache of every area
+	int **routecacheareaindex;				// file offset of the first cache of every area in every cluster
+	byte *routecachestaleclusters;			// clusters with areas enabled or disabled since the file was read
+	int routecachestaleportals;
 	//maximum travel time through portal areas
 	int *portalmaxtraveltimes;
 	//areas the reachabilities go through
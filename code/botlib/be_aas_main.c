@@ -154,8 +154,17 @@ int AAS_StartFrame(float time)
 	AAS_InvalidateEntities();
 	//initialize AAS
 	AAS_ContinueInit(time);
-	//
+	//remember the worst frame for the routing report
+	if (aasworld.frameroutingupdates > aasworld.maxframeroutingupdates)
+	{
+		aasworld.maxframeroutingupdates = aasworld.frameroutingupdates;
+	} //end if
+	if (aasworld.frameroutingtime > aasworld.maxframeroutingtime)
+	{
+		aasworld.maxframeroutingtime = aasworld.frameroutingtime;
+	} //end if
 	aasworld.frameroutingupdates = 0;
+	aasworld.frameroutingtime = 0;
 	//
 	if (botDeveloper)
 	{
@@ -57,6 +57,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 //maximum number of routing updates each frame
 #define MAX_FRAMEROUTINGUPDATES		10
+//maximum number of threads precomputing the routing cache
+#define MAX_ROUTINGTHREADS			16
 
 
 /*
@@ -84,6 +86,10 @@ int numportalcacheupdates;
 int routingcachesize;
 int max_routingcachesize;
 
+//nesting of routing updates and the time the outer one started
+static int routingupdatedepth;
+static int routingupdatestart;
+
 //===========================================================================
 //
 // Parameter:			-
@@ -279,13 +285,21 @@ void AAS_RemoveRoutingCacheUsingArea( int areanum )
 	{
 		//remove all the cache in the cluster the area is in
 		AAS_RemoveRoutingCacheInCluster( clusternum );
+		if (aasworld.routecachefile) aasworld.routecachestaleclusters[clusternum] = qtrue;
 	} //end if
 	else
 	{
 		// if this is a portal remove all cache in both the front and back cluster
 		AAS_RemoveRoutingCacheInCluster( aasworld.portals[-clusternum].frontcluster );
 		AAS_RemoveRoutingCacheInCluster( aasworld.portals[-clusternum].backcluster );
+		if (aasworld.routecachefile)
+		{
+			aasworld.routecachestaleclusters[aasworld.portals[-clusternum].frontcluster] = qtrue;
+			aasworld.routecachestaleclusters[aasworld.portals[-clusternum].backcluster] = qtrue;
+		} //end if
 	} //end else
+	//the route cache file was made with the area in the other state
+	aasworld.routecachestaleportals = qtrue;
 	// remove all portal cache
 	for (i = 0; i < aasworld.numareas; i++)
 	{
@@ -746,6 +760,8 @@ aas_routingcache_t *AAS_AllocRoutingCache(int numtraveltimes)
 	routingcachesize += size;
 	//
 	cache = (aas_routingcache_t *) GetClearedMemory(size);
+	cache->numtraveltimes = numtraveltimes;
+	cache->traveltimes = (unsigned short int *) ((unsigned char *) cache + sizeof(aas_routingcache_t));
 	cache->reachabilities = (unsigned char *) cache + sizeof(aas_routingcache_t)
 								+ numtraveltimes * sizeof(unsigned short int);
 	cache->size = size;
@@ -915,8 +931,13 @@ void AAS_CreateAllRoutingCache(void)
 //===========================================================================
 
 //the route cache header
-//this header is followed by numportalcache + numareacache aas_routingcache_t
-//structures that store routing cache
+//this header is followed by the portal cache index, the area cache index
+//and numportalcache + numareacache routecacherecord_t records
+//
+//the file only contains offsets so it can be used straight from a memory
+//mapping, the index arrays hold the offset of the first record for every
+//area and every area in every cluster, records of the same area are chained
+//through their next offset, an offset of 0 ends the chain
 typedef struct routecacheheader_s
 {
 	int ident;
@@ -927,41 +948,330 @@ typedef struct routecacheheader_s
 	int clustercrc;
 	int numportalcache;
 	int numareacache;
+	int portalindexofs;				//numareas record offsets
+	int areaindexofs;				//record offsets for the areas of every cluster
 } routecacheheader_t;
 
+//one routing cache in the route cache file
+//followed by numtraveltimes travel times and numtraveltimes
+//reachabilities, padded to a multiple of 4 bytes
+typedef struct routecacherecord_s
+{
+	int next;						//offset of the next record of the same area
+	int cluster;
+	int areanum;
+	vec3_t origin;
+	float starttraveltime;
+	int travelflags;
+	int numtraveltimes;
+} routecacherecord_t;
+
 #define RCID						(('C'<<24)+('R'<<16)+('E'<<8)+'M')
-#define RCVERSION					2
+#define RCVERSION					3
+
+#define RECORDSIZE(n)				(sizeof(routecacherecord_t) + (((n) * 3 + 3) & ~3))
 
 //void AAS_DecompressVis(byte *in, int numareas, byte *decompressed);
 //int AAS_CompressVis(byte *vis, int numareas, byte *dest);
 
-void AAS_WriteRouteCache(void)
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static int AAS_NumClusterAreas(void)
+{
+	int i, numclusterareas;
+
+	for (numclusterareas = 0, i = 0; i < aasworld.numclusters; i++)
+	{
+		numclusterareas += aasworld.clusters[i].numareas;
+	} //end for
+	return numclusterareas;
+} //end of the function AAS_NumClusterAreas
+//===========================================================================
+// sets the offsets of a chain of caches and returns the offset after it
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static int AAS_IndexCacheChain(aas_routingcache_t *cache, int *index, int ofs, int *numcache)
+{
+	*index = cache ? ofs : 0;
+	for (; cache; cache = cache->next)
+	{
+		ofs += RECORDSIZE(cache->numtraveltimes);
+		(*numcache)++;
+	} //end for
+	return ofs;
+} //end of the function AAS_IndexCacheChain
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static int AAS_WriteCacheChain(aas_routingcache_t *cache, int ofs, fileHandle_t fp)
+{
+	routecacherecord_t record;
+	int size, pad;
+
+	pad = 0;
+	for (; cache; cache = cache->next)
+	{
+		size = RECORDSIZE(cache->numtraveltimes);
+		record.next = cache->next ? ofs + size : 0;
+		record.cluster = cache->cluster;
+		record.areanum = cache->areanum;
+		VectorCopy(cache->origin, record.origin);
+		record.starttraveltime = cache->starttraveltime;
+		record.travelflags = cache->travelflags;
+		record.numtraveltimes = cache->numtraveltimes;
+		botimport.FS_Write(&record, sizeof(record), fp);
+		botimport.FS_Write(cache->traveltimes, cache->numtraveltimes * sizeof(unsigned short int), fp);
+		botimport.FS_Write(cache->reachabilities, cache->numtraveltimes * sizeof(unsigned char), fp);
+		botimport.FS_Write(&pad, size - sizeof(record) - cache->numtraveltimes * 3, fp);
+		ofs += size;
+	} //end for
+	return ofs;
+} //end of the function AAS_WriteCacheChain
+//===========================================================================
+// returns the record at ofs in the route cache file if it is valid
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static routecacherecord_t *AAS_RouteCacheRecord(int ofs, int numtraveltimes)
+{
+	routecacherecord_t *record;
+
+	if (ofs <= 0 || ofs & 3 || ofs > aasworld.routecachefilelength - (int) sizeof(routecacherecord_t)) return NULL;
+	record = (routecacherecord_t *) (aasworld.routecachefile + ofs);
+	//the file was checked against the map, but not every record
+	if (record->numtraveltimes != numtraveltimes) return NULL;
+	if (ofs > aasworld.routecachefilelength - (int) RECORDSIZE(numtraveltimes)) return NULL;
+	return record;
+} //end of the function AAS_RouteCacheRecord
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static routecacherecord_t *AAS_FindRouteCacheRecord(int ofs, int numtraveltimes, int travelflags)
+{
+	routecacherecord_t *record;
+
+	for (record = AAS_RouteCacheRecord(ofs, numtraveltimes); record;
+			record = AAS_RouteCacheRecord(record->next, numtraveltimes))
+	{
+		if (record->travelflags == travelflags) return record;
+	} //end for
+	return NULL;
+} //end of the function AAS_FindRouteCacheRecord
+//===========================================================================
+// returns the record in the route cache file for the area in the cluster
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static routecacherecord_t *AAS_FindAreaRouteCacheRecord(int clusternum, int clusterareanum, int travelflags)
+{
+	if (!aasworld.routecachefile) return NULL;
+	if (aasworld.routecachestaleclusters[clusternum]) return NULL;
+	return AAS_FindRouteCacheRecord(aasworld.routecacheareaindex[clusternum][clusterareanum],
+						aasworld.clusters[clusternum].numreachabilityareas, travelflags);
+} //end of the function AAS_FindAreaRouteCacheRecord
+//===========================================================================
+// returns the record in the route cache file for the portals to the area
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static routecacherecord_t *AAS_FindPortalRouteCacheRecord(int areanum, int travelflags)
+{
+	if (!aasworld.routecachefile) return NULL;
+	if (aasworld.routecachestaleportals) return NULL;
+	return AAS_FindRouteCacheRecord(aasworld.routecacheportalindex[areanum],
+						aasworld.numportals, travelflags);
+} //end of the function AAS_FindPortalRouteCacheRecord
+//===========================================================================
+// creates a cache that uses the travel times and reachabilities
+// in the route cache file without copying them
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static aas_routingcache_t *AAS_RouteCacheFromRecord(routecacherecord_t *record)
 {
-	int i, j, numportalcache, numareacache, totalsize;
 	aas_routingcache_t *cache;
+
+	cache = (aas_routingcache_t *) GetClearedMemory(sizeof(aas_routingcache_t));
+	cache->size = sizeof(aas_routingcache_t);
+	routingcachesize += cache->size;
+	cache->cluster = record->cluster;
+	cache->areanum = record->areanum;
+	VectorCopy(record->origin, cache->origin);
+	cache->starttraveltime = record->starttraveltime;
+	cache->travelflags = record->travelflags;
+	cache->numtraveltimes = record->numtraveltimes;
+	cache->traveltimes = (unsigned short int *) (record + 1);
+	cache->reachabilities = (unsigned char *) (cache->traveltimes + record->numtraveltimes);
+	return cache;
+} //end of the function AAS_RouteCacheFromRecord
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_FreeRouteCacheFile(void)
+{
+	if (!aasworld.routecachefile) return;
+	if (aasworld.routecachefilemapped)
+	{
+		botimport.FS_UnmapFile(aasworld.routecachefile, aasworld.routecachefilelength);
+	} //end if
+	else
+	{
+		FreeMemory(aasworld.routecachefile);
+	} //end else
+	FreeMemory(aasworld.routecacheareaindex);
+	aasworld.routecachefile = NULL;
+	aasworld.routecachefilelength = 0;
+	aasworld.routecachefilemapped = qfalse;
+	aasworld.routecacheportalindex = NULL;
+	aasworld.routecacheareaindex = NULL;
+	aasworld.routecachestaleclusters = NULL;
+	aasworld.routecachestaleportals = qfalse;
+} //end of the function AAS_FreeRouteCacheFile
+//===========================================================================
+// creates a cache for every record in the route cache file that isn't
+// used yet and stops using the file, so it can be overwritten
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_ReleaseRouteCacheFile(void)
+{
+	int i, j, numtraveltimes;
+	byte *copy;
+	aas_routingcache_t *cache, **chain;
+	routecacherecord_t *record;
+
+	if (!aasworld.routecachefile) return;
+	//a mapped file can't be changed while it is mapped
+	if (aasworld.routecachefilemapped)
+	{
+		copy = (byte *) GetMemory(aasworld.routecachefilelength);
+		Com_Memcpy(copy, aasworld.routecachefile, aasworld.routecachefilelength);
+		for (cache = aasworld.oldestcache; cache; cache = cache->time_next)
+		{
+			if ((byte *) cache->traveltimes < aasworld.routecachefile ||
+				(byte *) cache->traveltimes >= aasworld.routecachefile + aasworld.routecachefilelength) continue;
+			cache->traveltimes = (unsigned short int *) (copy + ((byte *) cache->traveltimes - aasworld.routecachefile));
+			cache->reachabilities = copy + (cache->reachabilities - aasworld.routecachefile);
+		} //end for
+		aasworld.routecacheportalindex = (int *) (copy + ((byte *) aasworld.routecacheportalindex - aasworld.routecachefile));
+		for (i = 0; i < aasworld.numclusters; i++)
+		{
+			aasworld.routecacheareaindex[i] = (int *) (copy + ((byte *) aasworld.routecacheareaindex[i] - aasworld.routecachefile));
+		} //end for
+		botimport.FS_UnmapFile(aasworld.routecachefile, aasworld.routecachefilelength);
+		aasworld.routecachefile = copy;
+		aasworld.routecachefilemapped = qfalse;
+	} //end if
+	//create the caches that haven't been used
+	for (i = 0; i < aasworld.numareas && !aasworld.routecachestaleportals; i++)
+	{
+		for (record = AAS_RouteCacheRecord(aasworld.routecacheportalindex[i], aasworld.numportals); record;
+				record = AAS_RouteCacheRecord(record->next, aasworld.numportals))
+		{
+			for (cache = aasworld.portalcache[i]; cache; cache = cache->next)
+			{
+				if (cache->travelflags == record->travelflags) break;
+			} //end for
+			if (cache) continue;
+			cache = AAS_RouteCacheFromRecord(record);
+			cache->type = CACHETYPE_PORTAL;
+			chain = &aasworld.portalcache[i];
+			cache->next = *chain;
+			if (*chain) (*chain)->prev = cache;
+			*chain = cache;
+			cache->time = AAS_RoutingTime();
+			AAS_LinkCache(cache);
+		} //end for
+	} //end for
+	for (i = 0; i < aasworld.numclusters; i++)
+	{
+		if (aasworld.routecachestaleclusters[i]) continue;
+		numtraveltimes = aasworld.clusters[i].numreachabilityareas;
+		for (j = 0; j < aasworld.clusters[i].numareas; j++)
+		{
+			for (record = AAS_RouteCacheRecord(aasworld.routecacheareaindex[i][j], numtraveltimes); record;
+					record = AAS_RouteCacheRecord(record->next, numtraveltimes))
+			{
+				for (cache = aasworld.clusterareacache[i][j]; cache; cache = cache->next)
+				{
+					if (cache->travelflags == record->travelflags) break;
+				} //end for
+				if (cache) continue;
+				cache = AAS_RouteCacheFromRecord(record);
+				cache->type = CACHETYPE_AREA;
+				chain = &aasworld.clusterareacache[i][j];
+				cache->next = *chain;
+				if (*chain) (*chain)->prev = cache;
+				*chain = cache;
+				cache->time = AAS_RoutingTime();
+				AAS_LinkCache(cache);
+			} //end for
+		} //end for
+	} //end for
+	//the caches keep pointing into the copy until they are freed
+	aasworld.routecachestaleportals = qtrue;
+	Com_Memset(aasworld.routecachestaleclusters, 1, aasworld.numclusters);
+} //end of the function AAS_ReleaseRouteCacheFile
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_WriteRouteCache(void)
+{
+	int i, j, k, numportalcache, numareacache, numclusterareas, totalsize;
+	int *portalindex, *areaindex;
 	aas_cluster_t *cluster;
 	fileHandle_t fp;
 	char filename[MAX_QPATH];
 	routecacheheader_t routecacheheader;
 
+	AAS_ReleaseRouteCacheFile();
+	//
+	numclusterareas = AAS_NumClusterAreas();
+	portalindex = (int *) GetClearedMemory(aasworld.numareas * sizeof(int));
+	areaindex = (int *) GetClearedMemory(numclusterareas * sizeof(int));
+	//find where all the records go
+	totalsize = sizeof(routecacheheader_t) + (aasworld.numareas + numclusterareas) * sizeof(int);
 	numportalcache = 0;
 	for (i = 0; i < aasworld.numareas; i++)
 	{
-		for (cache = aasworld.portalcache[i]; cache; cache = cache->next)
-		{
-			numportalcache++;
-		} //end for
+		totalsize = AAS_IndexCacheChain(aasworld.portalcache[i], &portalindex[i], totalsize, &numportalcache);
 	} //end for
 	numareacache = 0;
-	for (i = 0; i < aasworld.numclusters; i++)
+	for (k = 0, i = 0; i < aasworld.numclusters; i++)
 	{
 		cluster = &aasworld.clusters[i];
-		for (j = 0; j < cluster->numareas; j++)
+		for (j = 0; j < cluster->numareas; j++, k++)
 		{
-			for (cache = aasworld.clusterareacache[i][j]; cache; cache = cache->next)
-			{
-				numareacache++;
-			} //end for
+			totalsize = AAS_IndexCacheChain(aasworld.clusterareacache[i][j], &areaindex[k], totalsize, &numareacache);
 		} //end for
 	} //end for
 	// open the file for writing
@@ -969,6 +1279,8 @@ void AAS_WriteRouteCache(void)
 	botimport.FS_FOpenFile( filename, &fp, FS_WRITE );
 	if (!fp)
 	{
+		FreeMemory(portalindex);
+		FreeMemory(areaindex);
 		AAS_Error("Unable to open file: %s\n", filename);
 		return;
 	} //end if
@@ -981,71 +1293,36 @@ void AAS_WriteRouteCache(void)
 	routecacheheader.clustercrc = CRC_ProcessString( (unsigned char *)aasworld.clusters, sizeof(aas_cluster_t) * aasworld.numclusters );
 	routecacheheader.numportalcache = numportalcache;
 	routecacheheader.numareacache = numareacache;
-	//write the header
+	routecacheheader.portalindexofs = sizeof(routecacheheader_t);
+	routecacheheader.areaindexofs = sizeof(routecacheheader_t) + aasworld.numareas * sizeof(int);
+	//write the header and the index
 	botimport.FS_Write(&routecacheheader, sizeof(routecacheheader_t), fp);
-	//
-	totalsize = 0;
-	//write all the cache
+	botimport.FS_Write(portalindex, aasworld.numareas * sizeof(int), fp);
+	botimport.FS_Write(areaindex, numclusterareas * sizeof(int), fp);
+	//write all the cache in the same order as it was indexed
+	totalsize = sizeof(routecacheheader_t) + (aasworld.numareas + numclusterareas) * sizeof(int);
 	for (i = 0; i < aasworld.numareas; i++)
 	{
-		for (cache = aasworld.portalcache[i]; cache; cache = cache->next)
-		{
-			botimport.FS_Write(cache, cache->size, fp);
-			totalsize += cache->size;
-		} //end for
+		totalsize = AAS_WriteCacheChain(aasworld.portalcache[i], totalsize, fp);
 	} //end for
 	for (i = 0; i < aasworld.numclusters; i++)
 	{
 		cluster = &aasworld.clusters[i];
 		for (j = 0; j < cluster->numareas; j++)
 		{
-			for (cache = aasworld.clusterareacache[i][j]; cache; cache = cache->next)
-			{
-				botimport.FS_Write(cache, cache->size, fp);
-				totalsize += cache->size;
-			} //end for
+			totalsize = AAS_WriteCacheChain(aasworld.clusterareacache[i][j], totalsize, fp);
 		} //end for
 	} //end for
-	// write the visareas
-	/*
-	for (i = 0; i < aasworld.numareas; i++)
-	{
-		if (!aasworld.areavisibility[i]) {
-			size = 0;
-			botimport.FS_Write(&size, sizeof(int), fp);
-			continue;
-		}
-		AAS_DecompressVis( aasworld.areavisibility[i], aasworld.numareas, aasworld.decompressedvis );
-		size = AAS_CompressVis( aasworld.decompressedvis, aasworld.numareas, aasworld.decompressedvis );
-		botimport.FS_Write(&size, sizeof(int), fp);
-		botimport.FS_Write(aasworld.decompressedvis, size, fp);
-	}
-	*/
 	//
 	botimport.FS_FCloseFile(fp);
+	FreeMemory(portalindex);
+	FreeMemory(areaindex);
 	botimport.Print(PRT_MESSAGE, "\nroute cache written to %s\n", filename);
 	botimport.Print(PRT_MESSAGE, "written %d bytes of routing cache\n", totalsize);
 } //end of the function AAS_WriteRouteCache
 //===========================================================================
-//
-// Parameter:			-
-// Returns:				-
-// Changes Globals:		-
-//===========================================================================
-aas_routingcache_t *AAS_ReadCache(fileHandle_t fp)
-{
-	int size;
-	aas_routingcache_t *cache;
-
-	botimport.FS_Read(&size, sizeof(size), fp);
-	cache = (aas_routingcache_t *) GetMemory(size);
-	cache->size = size;
-	botimport.FS_Read((unsigned char *)cache + sizeof(size), size - sizeof(size), fp);
-	cache->reachabilities = (unsigned char *) cache + sizeof(aas_routingcache_t) - sizeof(unsigned short) +
-		(size - sizeof(aas_routingcache_t) + sizeof(unsigned short)) / 3 * 2;
-	return cache;
-} //end of the function AAS_ReadCache
-//===========================================================================
+// the route cache file is memory mapped when possible, otherwise it is
+// read in one piece, the caches are created from it when first used
 //
 // Parameter:			-
 // Returns:				-
@@ -1053,87 +1330,89 @@ aas_routingcache_t *AAS_ReadCache(fileHandle_t fp)
 //===========================================================================
 int AAS_ReadRouteCache(void)
 {
-	int i, clusterareanum;//, size;
+	int i, length, numclusterareas;
+	int *areaindex;
 	fileHandle_t fp;
 	char filename[MAX_QPATH];
-	routecacheheader_t routecacheheader;
-	aas_routingcache_t *cache;
+	routecacheheader_t *routecacheheader;
+	byte *buffer, *ptr;
+	qboolean mapped;
 
 	Com_sprintf(filename, MAX_QPATH, "maps/%s.rcd", aasworld.mapname);
-	botimport.FS_FOpenFile( filename, &fp, FS_READ );
-	if (!fp)
+	buffer = NULL;
+	mapped = qfalse;
+	if (botimport.FS_MapFile)
 	{
-		return qfalse;
+		buffer = (byte *) botimport.FS_MapFile(filename, &length);
+		mapped = (buffer != NULL);
 	} //end if
-	botimport.FS_Read(&routecacheheader, sizeof(routecacheheader_t), fp );
-	if (routecacheheader.ident != RCID)
+	if (!buffer)
 	{
-		AAS_Error("%s is not a route cache dump\n", filename);
-		return qfalse;
-	} //end if
-	if (routecacheheader.version != RCVERSION)
-	{
-		AAS_Error("route cache dump has wrong version %d, should be %d\n", routecacheheader.version, RCVERSION);
-		return qfalse;
+		//not on disk outside a pk3, read it in one piece
+		length = botimport.FS_FOpenFile( filename, &fp, FS_READ );
+		if (!fp)
+		{
+			return qfalse;
+		} //end if
+		if (length < (int) sizeof(routecacheheader_t))
+		{
+			botimport.FS_FCloseFile(fp);
+			return qfalse;
+		} //end if
+		buffer = (byte *) GetMemory(length);
+		botimport.FS_Read(buffer, length, fp);
+		botimport.FS_FCloseFile(fp);
 	} //end if
-	if (routecacheheader.numareas != aasworld.numareas)
+	aasworld.routecachefile = buffer;
+	aasworld.routecachefilelength = length;
+	aasworld.routecachefilemapped = mapped;
+	//
+	numclusterareas = AAS_NumClusterAreas();
+	routecacheheader = (routecacheheader_t *) buffer;
+	if (length < (int) sizeof(routecacheheader_t) || routecacheheader->ident != RCID)
 	{
-		//AAS_Error("route cache dump has wrong number of areas\n");
+		AAS_FreeRouteCacheFile();
+		AAS_Error("%s is not a route cache dump\n", filename);
 		return qfalse;
 	} //end if
-	if (routecacheheader.numclusters != aasworld.numclusters)
+	if (routecacheheader->version != RCVERSION)
 	{
-		//AAS_Error("route cache dump has wrong number of clusters\n");
+		AAS_FreeRouteCacheFile();
+		botimport.Print(PRT_WARNING, "route cache dump has old version %d, should be %d\n", routecacheheader->version, RCVERSION);
 		return qfalse;
 	} //end if
-	if (routecacheheader.areacrc !=
-		CRC_ProcessString( (unsigned char *)aasworld.areas, sizeof(aas_area_t) * aasworld.numareas ))
+	if (routecacheheader->numareas != aasworld.numareas ||
+		routecacheheader->numclusters != aasworld.numclusters ||
+		routecacheheader->areacrc != CRC_ProcessString( (unsigned char *)aasworld.areas, sizeof(aas_area_t) * aasworld.numareas ) ||
+		routecacheheader->clustercrc != CRC_ProcessString( (unsigned char *)aasworld.clusters, sizeof(aas_cluster_t) * aasworld.numclusters ))
 	{
-		//AAS_Error("route cache dump area CRC incorrect\n");
+		//the route cache is for another version of the map
+		AAS_FreeRouteCacheFile();
 		return qfalse;
 	} //end if
-	if (routecacheheader.clustercrc !=
-		CRC_ProcessString( (unsigned char *)aasworld.clusters, sizeof(aas_cluster_t) * aasworld.numclusters ))
+	if (routecacheheader->portalindexofs != sizeof(routecacheheader_t) ||
+		routecacheheader->areaindexofs != routecacheheader->portalindexofs + aasworld.numareas * (int) sizeof(int) ||
+		routecacheheader->areaindexofs + numclusterareas * (int) sizeof(int) > length)
 	{
-		//AAS_Error("route cache dump cluster CRC incorrect\n");
+		AAS_FreeRouteCacheFile();
+		AAS_Error("%s is truncated\n", filename);
 		return qfalse;
 	} //end if
-	//read all the portal cache
-	for (i = 0; i < routecacheheader.numportalcache; i++)
-	{
-		cache = AAS_ReadCache(fp);
-		cache->next = aasworld.portalcache[cache->areanum];
-		cache->prev = NULL;
-		if (aasworld.portalcache[cache->areanum])
-			aasworld.portalcache[cache->areanum]->prev = cache;
-		aasworld.portalcache[cache->areanum] = cache;
-	} //end for
-	//read all the cluster area cache
-	for (i = 0; i < routecacheheader.numareacache; i++)
+	//the index of every cluster in the file and the stale clusters
+	ptr = (byte *) GetClearedMemory(aasworld.numclusters * (sizeof(int *) + sizeof(byte)));
+	aasworld.routecacheareaindex = (int **) ptr;
+	aasworld.routecachestaleclusters = ptr + aasworld.numclusters * sizeof(int *);
+	aasworld.routecacheportalindex = (int *) (buffer + routecacheheader->portalindexofs);
+	areaindex = (int *) (buffer + routecacheheader->areaindexofs);
+	for (i = 0; i < aasworld.numclusters; i++)
 	{
-		cache = AAS_ReadCache(fp);
-		clusterareanum = AAS_ClusterAreaNum(cache->cluster, cache->areanum);
-		cache->next = aasworld.clusterareacache[cache->cluster][clusterareanum];
-		cache->prev = NULL;
-		if (aasworld.clusterareacache[cache->cluster][clusterareanum])
-			aasworld.clusterareacache[cache->cluster][clusterareanum]->prev = cache;
-		aasworld.clusterareacache[cache->cluster][clusterareanum] = cache;
+		aasworld.routecacheareaindex[i] = areaindex;
+		areaindex += aasworld.clusters[i].numareas;
 	} //end for
-	// read the visareas
-	/*
-	aasworld.areavisibility = (byte **) GetClearedMemory(aasworld.numareas * sizeof(byte *));
-	aasworld.decompressedvis = (byte *) GetClearedMemory(aasworld.numareas * sizeof(byte));
-	for (i = 0; i < aasworld.numareas; i++)
-	{
-		botimport.FS_Read(&size, sizeof(size), fp );
-		if (size) {
-			aasworld.areavisibility[i] = (byte *) GetMemory(size);
-			botimport.FS_Read(aasworld.areavisibility[i], size, fp );
-		}
-	}
-	*/
 	//
-	botimport.FS_FCloseFile(fp);
+	botimport.Print(PRT_MESSAGE, "%s: %d portal and %d area caches%s\n", filename,
+					routecacheheader->numportalcache, routecacheheader->numareacache,
+					mapped ? " (mapped)" : "");
 	return qtrue;
 } //end of the function AAS_ReadRouteCache
 //===========================================================================
@@ -1245,6 +1524,8 @@ void AAS_InitRouting(void)
 	max_routingcachesize = 1024 * (int) LibVarValue("max_routingcache", "4096");
 	// read any routing cache if available
 	AAS_ReadRouteCache();
+	// create the rest of the area caches on worker threads
+	AAS_PrecomputeRoutingCache();
 } //end of the function AAS_InitRouting
 //===========================================================================
 //
@@ -1254,10 +1535,21 @@ void AAS_InitRouting(void)
 //===========================================================================
 void AAS_FreeRoutingCaches(void)
 {
+#ifdef ROUTING_DEBUG
+	// report how much routing the bots had to do while playing
+	if (aasworld.clusterareacache)
+	{
+		botimport.Print(PRT_MESSAGE, "routing cache: %d area and %d portal updates, worst frame %d updates in %d msec\n",
+						numareacacheupdates, numportalcacheupdates,
+						aasworld.maxframeroutingupdates, aasworld.maxframeroutingtime);
+	} //end if
+#endif //ROUTING_DEBUG
 	// free all the existing cluster area cache
 	AAS_FreeAllClusterAreaCache();
 	// free all the existing portal cache
 	AAS_FreeAllPortalCache();
+	// free the route cache file the caches came from
+	AAS_FreeRouteCacheFile();
 	// free cached travel times within areas
 	if (aasworld.areatraveltimes) FreeMemory(aasworld.areatraveltimes);
 	aasworld.areatraveltimes = NULL;
@@ -1283,13 +1575,15 @@ void AAS_FreeRoutingCaches(void)
 	aasworld.areacontentstravelflags = NULL;
 } //end of the function AAS_FreeRoutingCaches
 //===========================================================================
-// update the given routing cache
+// calculate the travel times of the given routing cache, areaupdate
+// is the routing update scratch space for the cluster
 //
 // Parameter:			areacache		: routing cache to update
+//						areaupdate		: routing update fields
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
+void AAS_ComputeAreaRoutingCache(aas_routingcache_t *areacache, aas_routingupdate_t *areaupdate)
 {
 	int i, nextareanum, cluster, badtravelflags, clusterareanum, linknum;
 	int numreachabilityareas;
@@ -1299,15 +1593,10 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 	aas_reversedreachability_t *revreach;
 	aas_reversedlink_t *revlink;
 
-#ifdef ROUTING_DEBUG
-	numareacacheupdates++;
-#endif //ROUTING_DEBUG
 	//number of reachability areas within this cluster
 	numreachabilityareas = aasworld.clusters[areacache->cluster].numreachabilityareas;
-	//
-	aasworld.frameroutingupdates++;
 	//clear the routing update fields
-//	Com_Memset(aasworld.areaupdate, 0, aasworld.numareas * sizeof(aas_routingupdate_t));
+//	Com_Memset(areaupdate, 0, aasworld.numareas * sizeof(aas_routingupdate_t));
 	//
 	badtravelflags = ~areacache->travelflags;
 	//
@@ -1316,7 +1605,7 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 	//
 	Com_Memset(startareatraveltimes, 0, sizeof(startareatraveltimes));
 	//
-	curupdate = &aasworld.areaupdate[clusterareanum];
+	curupdate = &areaupdate[clusterareanum];
 	curupdate->areanum = areacache->areanum;
 	//VectorCopy(areacache->origin, curupdate->start);
 	curupdate->areatraveltimes = startareatraveltimes;
@@ -1372,7 +1661,7 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 			{
 				areacache->traveltimes[clusterareanum] = t;
 				areacache->reachabilities[clusterareanum] = linknum - aasworld.areasettings[nextareanum].firstreachablearea;
-				nextupdate = &aasworld.areaupdate[clusterareanum];
+				nextupdate = &areaupdate[clusterareanum];
 				nextupdate->areanum = nextareanum;
 				nextupdate->tmptraveltime = t;
 				//VectorCopy(reach->start, nextupdate->start);
@@ -1393,8 +1682,200 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 			} //end if
 		} //end for
 	} //end while
+} //end of the function AAS_ComputeAreaRoutingCache
+//===========================================================================
+// update the given routing cache
+//
+// Parameter:			areacache		: routing cache to update
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
+{
+#ifdef ROUTING_DEBUG
+	numareacacheupdates++;
+#endif //ROUTING_DEBUG
+	//
+	aasworld.frameroutingupdates++;
+	//
+	AAS_ComputeAreaRoutingCache(areacache, aasworld.areaupdate);
 } //end of the function AAS_UpdateAreaRoutingCache
 //===========================================================================
+// time spent on routing updates is added to the frame once for
+// the outermost update, portal updates also update area caches
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_StartRoutingUpdate(void)
+{
+	if (!routingupdatedepth++ && botimport.Milliseconds)
+	{
+		routingupdatestart = botimport.Milliseconds();
+	} //end if
+} //end of the function AAS_StartRoutingUpdate
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_StopRoutingUpdate(void)
+{
+	if (!--routingupdatedepth && botimport.Milliseconds)
+	{
+		aasworld.frameroutingtime += botimport.Milliseconds() - routingupdatestart;
+	} //end if
+} //end of the function AAS_StopRoutingUpdate
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+typedef struct routingjobs_s
+{
+	aas_routingcache_t **caches;
+	int numcaches;
+	int numlanes;
+	aas_routingupdate_t *areaupdate[MAX_ROUTINGTHREADS];
+} routingjobs_t;
+
+static void AAS_RoutingCacheJob(void *data, int lane)
+{
+	routingjobs_t *jobs;
+	int i;
+
+	jobs = (routingjobs_t *) data;
+	//every lane has its own routing update fields
+	for (i = lane; i < jobs->numcaches; i += jobs->numlanes)
+	{
+		AAS_ComputeAreaRoutingCache(jobs->caches[i], jobs->areaupdate[lane]);
+	} //end for
+} //end of the function AAS_RoutingCacheJob
+//===========================================================================
+// create the default travel flags area cache of every reachability
+// area in every cluster on the routingthreads worker threads, so the
+// bots don't have to create them while they think
+//
+// the caches are allocated and linked here, the worker threads only
+// fill in the travel times of their own caches and all of them have
+// finished before the bots use any of them
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_PrecomputeRoutingCache(void)
+{
+	int i, j, k, numthreads, clusterareanum, size, maxreachabilityareas, starttime;
+	int *clusterareas, **areanums;
+	aas_cluster_t *cluster;
+	aas_routingcache_t *cache;
+	routingjobs_t jobs;
+
+	numthreads = (int) LibVarValue("routingthreads", "0");
+	if (numthreads <= 0 || !botimport.RunJobs) return;
+	if (numthreads > MAX_ROUTINGTHREADS) numthreads = MAX_ROUTINGTHREADS;
+	//
+	starttime = botimport.Milliseconds();
+	//area number of every reachability area in every cluster
+	maxreachabilityareas = 0;
+	for (size = 0, i = 0; i < aasworld.numclusters; i++)
+	{
+		size += aasworld.clusters[i].numreachabilityareas;
+		if (aasworld.clusters[i].numreachabilityareas > maxreachabilityareas)
+		{
+			maxreachabilityareas = aasworld.clusters[i].numreachabilityareas;
+		} //end if
+	} //end for
+	areanums = (int **) GetClearedMemory(aasworld.numclusters * sizeof(int *) + size * sizeof(int));
+	clusterareas = (int *) (areanums + aasworld.numclusters);
+	for (i = 0; i < aasworld.numclusters; i++)
+	{
+		areanums[i] = clusterareas;
+		clusterareas += aasworld.clusters[i].numreachabilityareas;
+	} //end for
+	for (i = 1; i < aasworld.numareas; i++)
+	{
+		k = aasworld.areasettings[i].cluster;
+		if (k > 0)
+		{
+			clusterareanum = aasworld.areasettings[i].clusterareanum;
+			if (clusterareanum < aasworld.clusters[k].numreachabilityareas) areanums[k][clusterareanum] = i;
+		} //end if
+		else if (k < 0)
+		{
+			//a portal is in both the front and the back cluster
+			for (j = 0; j < 2; j++)
+			{
+				k = j ? aasworld.portals[-aasworld.areasettings[i].cluster].backcluster
+						: aasworld.portals[-aasworld.areasettings[i].cluster].frontcluster;
+				clusterareanum = aasworld.portals[-aasworld.areasettings[i].cluster].clusterareanum[j];
+				if (clusterareanum < aasworld.clusters[k].numreachabilityareas) areanums[k][clusterareanum] = i;
+			} //end for
+		} //end else if
+	} //end for
+	//allocate the caches of all the clusters that fit in the routing cache size
+	jobs.caches = (aas_routingcache_t **) GetMemory(size * sizeof(aas_routingcache_t *));
+	jobs.numcaches = 0;
+	for (i = 0; i < aasworld.numclusters; i++)
+	{
+		cluster = &aasworld.clusters[i];
+		size = cluster->numreachabilityareas * (sizeof(aas_routingcache_t) +
+					cluster->numreachabilityareas * (sizeof(unsigned short int) + sizeof(unsigned char)));
+		if (routingcachesize + size > max_routingcachesize) continue;
+		if (botimport.AvailableMemory() - size < 2 * 1024 * 1024) continue;
+		for (j = 0; j < cluster->numreachabilityareas; j++)
+		{
+			if (!areanums[i][j]) continue;
+			//skip caches read from the route cache file
+			for (cache = aasworld.clusterareacache[i][j]; cache; cache = cache->next)
+			{
+				if (cache->travelflags == (TFL_DEFAULT)) break;
+			} //end for
+			if (cache) continue;
+			if (AAS_FindAreaRouteCacheRecord(i, j, TFL_DEFAULT)) continue;
+			//
+			cache = AAS_AllocRoutingCache(cluster->numreachabilityareas);
+			cache->cluster = i;
+			cache->areanum = areanums[i][j];
+			VectorCopy(aasworld.areas[cache->areanum].center, cache->origin);
+			cache->starttraveltime = 1;
+			cache->travelflags = TFL_DEFAULT;
+			cache->prev = NULL;
+			cache->next = aasworld.clusterareacache[i][j];
+			if (cache->next) cache->next->prev = cache;
+			aasworld.clusterareacache[i][j] = cache;
+			cache->time = AAS_RoutingTime();
+			cache->type = CACHETYPE_AREA;
+			AAS_LinkCache(cache);
+			jobs.caches[jobs.numcaches++] = cache;
+		} //end for
+	} //end for
+	//
+	if (jobs.numcaches)
+	{
+		jobs.numlanes = numthreads;
+		for (i = 0; i < jobs.numlanes; i++)
+		{
+			jobs.areaupdate[i] = (aas_routingupdate_t *) GetClearedMemory(
+						maxreachabilityareas * sizeof(aas_routingupdate_t));
+		} //end for
+		botimport.RunJobs(numthreads, AAS_RoutingCacheJob, &jobs, jobs.numlanes);
+		for (i = 0; i < jobs.numlanes; i++)
+		{
+			FreeMemory(jobs.areaupdate[i]);
+		} //end for
+	} //end if
+	FreeMemory(jobs.caches);
+	FreeMemory(areanums);
+	//
+	botimport.Print(PRT_MESSAGE, "%d routing caches created on %d threads in %d msec\n",
+					jobs.numcaches, numthreads, botimport.Milliseconds() - starttime);
+} //end of the function AAS_PrecomputeRoutingCache
+//===========================================================================
 //
 // Parameter:			-
 // Returns:				-
@@ -1404,6 +1885,7 @@ aas_routingcache_t *AAS_GetAreaRoutingCache(int clusternum, int areanum, int tra
 {
 	int clusterareanum;
 	aas_routingcache_t *cache, *clustercache;
+	routecacherecord_t *record;
 
 	//number of the area in the cluster
 	clusterareanum = AAS_ClusterAreaNum(clusternum, areanum);
@@ -1418,17 +1900,31 @@ aas_routingcache_t *AAS_GetAreaRoutingCache(int clusternum, int areanum, int tra
 	//if there was no cache
 	if (!cache)
 	{
-		cache = AAS_AllocRoutingCache(aasworld.clusters[clusternum].numreachabilityareas);
-		cache->cluster = clusternum;
-		cache->areanum = areanum;
-		VectorCopy(aasworld.areas[areanum].center, cache->origin);
-		cache->starttraveltime = 1;
-		cache->travelflags = travelflags;
+		record = AAS_FindAreaRouteCacheRecord(clusternum, clusterareanum, travelflags);
+		if (record)
+		{
+			//use the travel times in the route cache file
+			cache = AAS_RouteCacheFromRecord(record);
+		} //end if
+		else
+		{
+			cache = AAS_AllocRoutingCache(aasworld.clusters[clusternum].numreachabilityareas);
+			cache->cluster = clusternum;
+			cache->areanum = areanum;
+			VectorCopy(aasworld.areas[areanum].center, cache->origin);
+			cache->starttraveltime = 1;
+			cache->travelflags = travelflags;
+		} //end else
 		cache->prev = NULL;
 		cache->next = clustercache;
 		if (clustercache) clustercache->prev = cache;
 		aasworld.clusterareacache[clusternum][clusterareanum] = cache;
-		AAS_UpdateAreaRoutingCache(cache);
+		if (!record)
+		{
+			AAS_StartRoutingUpdate();
+			AAS_UpdateAreaRoutingCache(cache);
+			AAS_StopRoutingUpdate();
+		} //end if
 	} //end if
 	else
 	{
@@ -1547,6 +2043,7 @@ void AAS_UpdatePortalRoutingCache(aas_routingcache_t *portalcache)
 aas_routingcache_t *AAS_GetPortalRoutingCache(int clusternum, int areanum, int travelflags)
 {
 	aas_routingcache_t *cache;
+	routecacherecord_t *record;
 
 	//find the cached portal routing if existing
 	for (cache = aasworld.portalcache[areanum]; cache; cache = cache->next)
@@ -1556,19 +2053,33 @@ aas_routingcache_t *AAS_GetPortalRoutingCache(int clusternum, int areanum, int t
 	//if the portal routing isn't cached
 	if (!cache)
 	{
-		cache = AAS_AllocRoutingCache(aasworld.numportals);
-		cache->cluster = clusternum;
-		cache->areanum = areanum;
-		VectorCopy(aasworld.areas[areanum].center, cache->origin);
-		cache->starttraveltime = 1;
-		cache->travelflags = travelflags;
+		record = AAS_FindPortalRouteCacheRecord(areanum, travelflags);
+		if (record)
+		{
+			//use the travel times in the route cache file
+			cache = AAS_RouteCacheFromRecord(record);
+		} //end if
+		else
+		{
+			cache = AAS_AllocRoutingCache(aasworld.numportals);
+			cache->cluster = clusternum;
+			cache->areanum = areanum;
+			VectorCopy(aasworld.areas[areanum].center, cache->origin);
+			cache->starttraveltime = 1;
+			cache->travelflags = travelflags;
+		} //end else
 		//add the cache to the cache list
 		cache->prev = NULL;
 		cache->next = aasworld.portalcache[areanum];
 		if (aasworld.portalcache[areanum]) aasworld.portalcache[areanum]->prev = cache;
 		aasworld.portalcache[areanum] = cache;
 		//update the cache
-		AAS_UpdatePortalRoutingCache(cache);
+		if (!record)
+		{
+			AAS_StartRoutingUpdate();
+			AAS_UpdatePortalRoutingCache(cache);
+			AAS_StopRoutingUpdate();
+		} //end if
 	} //end if
 	else
 	{
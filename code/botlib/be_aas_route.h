@@ -38,6 +38,7 @@ void AAS_FreeRoutingCaches(void);
 unsigned short int AAS_AreaTravelTime(int areanum, vec3_t start, vec3_t end);
 //
 void AAS_CreateAllRoutingCache(void);
+void AAS_PrecomputeRoutingCache(void);
 void AAS_WriteRouteCache(void);
 //
 void AAS_RoutingInfo(void);
@@ -196,6 +196,8 @@ typedef struct botlib_import_s
 	int			(*FS_Write)( const void *buffer, int len, fileHandle_t f );
 	void		(*FS_FCloseFile)( fileHandle_t f );
 	int			(*FS_Seek)( fileHandle_t f, long offset, int origin );
+	void		*(*FS_MapFile)( const char *qpath, int *length );	// NULL if the file can't be mapped
+	void		(*FS_UnmapFile)( void *buffer, int length );
 	//debug visualisation stuff
 	int			(*DebugLineCreate)(void);
 	void		(*DebugLineDelete)(int line);
@@ -203,6 +205,10 @@ typedef struct botlib_import_s
 	//
 	int			(*DebugPolygonCreate)(int color, int numPoints, vec3_t *points);
 	void		(*DebugPolygonDelete)(int id);
+	//run func(data, 0) to func(data, count - 1) spread over numThreads threads
+	void		(*RunJobs)(int numThreads, void (*func)(void *data, int index), void *data, int count);
+	//time in milliseconds, for profiling
+	int			(*Milliseconds)(void);
 } botlib_import_t;
 
 typedef struct aas_export_s
@@ -485,6 +491,7 @@ name:						default:			module(s):			description:
 
 "max_aaslinks"				"4096"				be_aas_sample.c		maximum links in the AAS
 "max_routingcache"			"4096"				be_aas_route.c		maximum routing cache size in KB
+"routingthreads"			"0"					be_aas_route.c		threads that precompute the routing cache
 "forceclustering"			"0"					be_aas_main.c		force recalculation of clusters
 "forcereachability"			"0"					be_aas_main.c		force recalculation of reachabilities
 "forcewrite"				"0"					be_aas_main.c		force writing of aas file
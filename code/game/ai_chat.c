@@ -311,13 +311,51 @@ char *BotRandomWeaponName(void) {
 /*
 ==================
 BotVisibleEnemies
+
+Same answer as BotEntityVisible with a 360 degrees fov for every
+enemy, but the line of sight traces of all the enemies are done
+with one batched trace. Fog only changes how visible an enemy is,
+not whether it is visible, so only water needs the full check.
 ==================
 */
+static traceRequest_t visrequests[MAX_CLIENTS * 3];
+static trace_t visresults[MAX_CLIENTS * 3];
+
 int BotVisibleEnemies(bot_state_t *bs) {
 	float vis;
-	int i;
+	int i, j, numrequests, numenemies;
+	int enemies[MAX_CLIENTS];
 	aas_entityinfo_t entinfo;
-
+	vec3_t middle;
+	traceRequest_t *req;
+
+	numenemies = 0;
+	numrequests = 0;
+	//if the eye is in water BotEntityVisible traces the other way around and
+	//adds the liquid contents, which the batch can't do, so do the full check
+	if (trap_AAS_PointContents(bs->eye) & (CONTENTS_LAVA|CONTENTS_SLIME|CONTENTS_WATER)) {
+		for (i = 0; i < MAX_CLIENTS; i++) {
+
+			if (i == bs->client) continue;
+			//
+			BotEntityInfo(i, &entinfo);
+			//
+			if (!entinfo.valid) continue;
+			//if the enemy isn't dead and the enemy isn't the bot self
+			if (EntityIsDead(&entinfo) || entinfo.number == bs->entitynum) continue;
+			//if the enemy is invisible and not shooting
+			if (EntityIsInvisible(&entinfo) && !EntityIsShooting(&entinfo)) {
+				continue;
+			}
+			//if on the same team
+			if (BotSameTeam(bs, i)) continue;
+			//check if the enemy is visible
+			vis = BotEntityVisible(bs->entitynum, bs->eye, bs->viewangles, 360, i);
+			if (vis > 0) return qtrue;
+		}
+		return qfalse;
+	}
+	//
 	for (i = 0; i < MAX_CLIENTS; i++) {
 
 		if (i == bs->client) continue;
@@ -333,9 +371,43 @@ int BotVisibleEnemies(bot_state_t *bs) {
 		}
 		//if on the same team
 		if (BotSameTeam(bs, i)) continue;
-		//check if the enemy is visible
-		vis = BotEntityVisible(bs->entitynum, bs->eye, bs->viewangles, 360, i);
-		if (vis > 0) return qtrue;
+		//a 360 degrees field of vision always contains the enemy
+		//the middle, bottom and top of the bounding box like BotEntityVisible
+		VectorAdd(entinfo.mins, entinfo.maxs, middle);
+		VectorScale(middle, 0.5, middle);
+		VectorAdd(entinfo.origin, middle, middle);
+		for (j = 0; j < 3; j++) {
+			//if the enemy is in water do the full check
+			if (trap_AAS_PointContents(middle) & (CONTENTS_LAVA|CONTENTS_SLIME|CONTENTS_WATER)) {
+				break;
+			}
+			req = &visrequests[numrequests + j];
+			VectorCopy(bs->eye, req->start);
+			VectorCopy(middle, req->end);
+			VectorClear(req->mins);
+			VectorClear(req->maxs);
+			req->passEntityNum = bs->entitynum;
+			req->contentmask = CONTENTS_SOLID|CONTENTS_PLAYERCLIP;
+			//
+			if (j == 0) middle[2] += entinfo.mins[2];
+			else if (j == 1) middle[2] += entinfo.maxs[2] - entinfo.mins[2];
+		}
+		if (j < 3) {
+			vis = BotEntityVisible(bs->entitynum, bs->eye, bs->viewangles, 360, i);
+			if (vis > 0) return qtrue;
+			continue;
+		}
+		enemies[numenemies++] = i;
+		numrequests += 3;
+	}
+	//
+	if (!numrequests) return qfalse;
+	trap_TraceBatch(visresults, visrequests, numrequests);
+	//if a full trace or the enemy was hit
+	for (i = 0; i < numrequests; i++) {
+		if (visresults[i].fraction >= 1 || visresults[i].entityNum == enemies[i / 3]) {
+			return qtrue;
+		}
 	}
 	return qfalse;
 }
@@ -80,6 +80,7 @@ vmCvar_t bot_interbreedchar;
 vmCvar_t bot_interbreedbots;
 vmCvar_t bot_interbreedcycle;
 vmCvar_t bot_interbreedwrite;
+vmCvar_t bot_visbatch;
 
 
 void ExitLevel( void );
@@ -1393,6 +1394,88 @@ int BotAILoadMap( int restart ) {
 void ProximityMine_Trigger( gentity_t *trigger, gentity_t *other, trace_t *trace );
 #endif
 
+/*
+==================
+BotAIBatchVisibility
+
+Issues the line of sight traces BotEntityVisible starts with, from the
+eye of every bot that thinks this frame to the middle, bottom and top of
+every other client, as a few trace batches.  The server clips the batches
+to the world on its trace threads and keeps the results in its trace
+cache, so the bots get the same traces back from it when they think one
+after the other in client order.  Anything that moves or relinks an
+entity in between clears the cache and the bots trace again, so the
+bot input is exactly what it would have been without the batches.
+==================
+*/
+#define MAX_VISBATCH		1024
+
+static void BotAIBatchVisibility(int thinktime, int elapsed_time) {
+	static traceRequest_t requests[MAX_VISBATCH];
+	static trace_t results[MAX_VISBATCH];
+	traceRequest_t *req;
+	playerState_t ps;
+	aas_entityinfo_t entinfo;
+	vec3_t eye, middle;
+	int i, j, k, numrequests;
+
+	numrequests = 0;
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (!botstates[i] || !botstates[i]->inuse) {
+			continue;
+		}
+		//only the bots that will think this frame
+		if (botstates[i]->botthink_residual + elapsed_time < thinktime) {
+			continue;
+		}
+		if (g_entities[i].client->pers.connected != CON_CONNECTED) {
+			continue;
+		}
+		//the eye like BotAI calculates it
+		if (!BotAI_GetClientState(i, &ps)) {
+			continue;
+		}
+		VectorCopy(ps.origin, eye);
+		eye[2] += ps.viewheight;
+		//under water the traces go the other way
+		if (trap_AAS_PointContents(eye) & (CONTENTS_LAVA|CONTENTS_SLIME|CONTENTS_WATER)) {
+			continue;
+		}
+		for (j = 0; j < level.maxclients; j++) {
+			if (j == i) continue;
+			BotEntityInfo(j, &entinfo);
+			if (!entinfo.valid) continue;
+			//the middle, bottom and top of the bounding box like BotEntityVisible
+			VectorAdd(entinfo.mins, entinfo.maxs, middle);
+			VectorScale(middle, 0.5, middle);
+			VectorAdd(entinfo.origin, middle, middle);
+			for (k = 0; k < 3; k++) {
+				//points in water use another contents mask
+				if (trap_AAS_PointContents(middle) & (CONTENTS_LAVA|CONTENTS_SLIME|CONTENTS_WATER)) {
+					break;
+				}
+				if (numrequests >= MAX_VISBATCH) {
+					trap_TraceBatch(results, requests, numrequests);
+					numrequests = 0;
+				}
+				req = &requests[numrequests++];
+				VectorCopy(eye, req->start);
+				VectorCopy(middle, req->end);
+				VectorClear(req->mins);
+				VectorClear(req->maxs);
+				req->passEntityNum = i;
+				req->contentmask = CONTENTS_SOLID|CONTENTS_PLAYERCLIP;
+				//
+				if (k == 0) middle[2] += entinfo.mins[2];
+				else if (k == 1) middle[2] += entinfo.maxs[2] - entinfo.mins[2];
+			}
+		}
+	}
+	if (numrequests) {
+		trap_TraceBatch(results, requests, numrequests);
+	}
+}
+
 /*
 ==================
 BotAIStartFrame
@@ -1419,6 +1502,7 @@ int BotAIStartFrame(int time) {
 	trap_Cvar_Update(&bot_saveroutingcache);
 	trap_Cvar_Update(&bot_pause);
 	trap_Cvar_Update(&bot_report);
+	trap_Cvar_Update(&bot_visbatch);
 
 	if (bot_report.integer) {
 //		BotTeamplayReport();
@@ -1550,6 +1634,13 @@ int BotAIStartFrame(int time) {
 
 	floattime = trap_AAS_Time();
 
+	// line of sight checks for the bots about to think, only useful
+	// when the server can keep the results around
+	if (bot_visbatch.integer && trap_AAS_Initialized() &&
+		trap_Cvar_VariableIntegerValue("sv_traceCache")) {
+		BotAIBatchVisibility(thinktime, elapsed_time);
+	}
+
 	// execute scheduled bot AI
 	for( i = 0; i < MAX_CLIENTS; i++ ) {
 		if( !botstates[i] || !botstates[i]->inuse ) {
@@ -1678,6 +1769,7 @@ int BotAISetup( int restart ) {
 	trap_Cvar_Register(&bot_interbreedbots, "bot_interbreedbots", "10", 0);
 	trap_Cvar_Register(&bot_interbreedcycle, "bot_interbreedcycle", "20", 0);
 	trap_Cvar_Register(&bot_interbreedwrite, "bot_interbreedwrite", "", 0);
+	trap_Cvar_Register(&bot_visbatch, "bot_visbatch", "0", 0);
 
 	//if the game is restarted for a tournament
 	if (restart) {
@@ -230,6 +230,10 @@ typedef enum {
 	// 1.32
 	G_FS_SEEK,
 
+	G_TRACE_BATCH,	// ( trace_t *results, const traceRequest_t *requests, int numRequests );
+	// same as a G_TRACE for each request, but the entities near all of
+	// them are only gathered once, numRequests is at most MAX_GENTITIES
+
 	BOTLIB_SETUP = 200,				// ( void );
 	BOTLIB_SHUTDOWN,				// ( void );
 	BOTLIB_LIBVAR_SET,
@@ -267,7 +267,15 @@ SHOTGUN
 // client predicts same spreads
 #define	DEFAULT_SHOTGUN_DAMAGE	10
 
-qboolean ShotgunPellet( vec3_t start, vec3_t end, gentity_t *ent ) {
+/*
+================
+ShotgunPellet
+
+If first is not NULL it is the result of the first trace of the
+pellet, already done by a batched trace
+================
+*/
+qboolean ShotgunPellet( vec3_t start, vec3_t end, gentity_t *ent, const trace_t *first ) {
 	trace_t		tr;
 	int			damage, i, passent;
 	gentity_t	*traceEnt;
@@ -281,7 +289,11 @@ qboolean ShotgunPellet( vec3_t start, vec3_t end, gentity_t *ent ) {
 	VectorCopy( start, tr_start );
 	VectorCopy( end, tr_end );
 	for (i = 0; i < 10; i++) {
-		trap_Trace (&tr, tr_start, NULL, NULL, tr_end, passent, MASK_SHOT);
+		if ( i == 0 && first ) {
+			tr = *first;
+		} else {
+			trap_Trace (&tr, tr_start, NULL, NULL, tr_end, passent, MASK_SHOT);
+		}
 		traceEnt = &g_entities[ tr.entityNum ];
 
 		// send bullet impact
@@ -319,11 +331,15 @@ qboolean ShotgunPellet( vec3_t start, vec3_t end, gentity_t *ent ) {
 
 // this should match CG_ShotgunPattern
 void ShotgunPattern( vec3_t origin, vec3_t origin2, int seed, gentity_t *ent ) {
-	int			i;
-	float		r, u;
-	vec3_t		end;
-	vec3_t		forward, right, up;
-	qboolean	hitClient = qfalse;
+	int				i;
+	float			r, u;
+	vec3_t			forward, right, up;
+	qboolean		hitClient = qfalse;
+	qboolean		batched = qtrue;
+	traceRequest_t	pellets[DEFAULT_SHOTGUN_COUNT];
+	trace_t			results[DEFAULT_SHOTGUN_COUNT];
+	gentity_t		*traceEnt;
+	qboolean		damageable;
 
 	// derive the right and up vectors from the forward vector, because
 	// the client won't have any other information
@@ -332,16 +348,42 @@ void ShotgunPattern( vec3_t origin, vec3_t origin2, int seed, gentity_t *ent ) {
 	CrossProduct( forward, right, up );
 
 	// generate the "random" spread pattern
+	memset( pellets, 0, sizeof( pellets ) );
 	for ( i = 0 ; i < DEFAULT_SHOTGUN_COUNT ; i++ ) {
 		r = Q_crandom( &seed ) * DEFAULT_SHOTGUN_SPREAD * 16;
 		u = Q_crandom( &seed ) * DEFAULT_SHOTGUN_SPREAD * 16;
-		VectorMA( origin, 8192 * 16, forward, end);
-		VectorMA (end, r, right, end);
-		VectorMA (end, u, up, end);
-		if( ShotgunPellet( origin, end, ent ) && !hitClient ) {
+		VectorCopy( origin, pellets[i].start );
+		VectorMA( origin, 8192 * 16, forward, pellets[i].end );
+		VectorMA( pellets[i].end, r, right, pellets[i].end );
+		VectorMA( pellets[i].end, u, up, pellets[i].end );
+		pellets[i].passEntityNum = ent->s.number;
+		pellets[i].contentmask = MASK_SHOT;
+	}
+
+	// all the pellets start at the same point and go the same way,
+	// so trace them together
+	trap_TraceBatch( results, pellets, DEFAULT_SHOTGUN_COUNT );
+
+	for ( i = 0 ; i < DEFAULT_SHOTGUN_COUNT ; i++ ) {
+		traceEnt = &g_entities[ results[i].entityNum ];
+		damageable = batched && traceEnt->takedamage;
+
+		if( ShotgunPellet( origin, pellets[i].end, ent, batched ? &results[i] : NULL ) && !hitClient ) {
 			hitClient = qtrue;
 			ent->client->accuracy_hits++;
 		}
+
+		// damage to a living client doesn't move anything, but a kill
+		// changes the bounds of the body and other targets can have
+		// any side effects, so the rest of the pellets trace again
+		if ( damageable && !( traceEnt->client && traceEnt->health > 0 ) ) {
+			batched = qfalse;
+		}
+#ifdef MISSIONPACK
+		if ( damageable && traceEnt->client && traceEnt->client->invulnerabilityTime > level.time ) {
+			batched = qfalse;	// bounced off to who knows where
+		}
+#endif
 	}
 }
 
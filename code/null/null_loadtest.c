@@ -0,0 +1,966 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// null_loadtest.c -- headless clients for load testing a server
+
+#include "../qcommon/q_shared.h"
+#include "../qcommon/qcommon.h"
+
+/*
+=============================================================================
+
+LOAD TEST
+
+loadtest <server> <clients> [seconds] [script]
+
+Connects a number of headless clients to a server and feeds them scripted
+usercmds, reporting snapshot rate, ping and packet loss every second.
+Every client has its own socket, qport and netchan, so the server sees
+separate players.  The handshake and the packet layout follow cl_main.c,
+cl_input.c and cl_parse.c; entities and playerstates are only decoded far
+enough to stay in step with the bitstream.
+
+The server needs sv_pure 0 and enough sv_maxclients.  getchallenge is rate
+limited per address, so clients from a single host join at about ten per
+second.
+
+The script file has one usercmd per line and is played in a loop:
+<msec> <forward> <right> <up> <buttons> <weapon> <yaw degrees per second>
+
+=============================================================================
+*/
+
+#define	LT_MAX_CLIENTS		256
+#define	LT_PACKET_MSEC		33		// cl_maxpackets 30
+#define	LT_RESEND_MSEC		1000
+#define	LT_TIMEOUT_MSEC		15000
+#define	LT_MAX_SCRIPT		256
+#define	LT_PING_BUCKETS		1000	// one per msec, the last one collects the rest
+
+typedef struct {
+	int			msec;
+	signed char	forwardmove, rightmove, upmove;
+	int			buttons;
+	int			weapon;
+	float		yawSpeed;
+} ltScriptCmd_t;
+
+// run, jump, strafe while firing, back off turning
+static const ltScriptCmd_t ltDefaultScript[] = {
+	{ 2000, 127, 0, 0, 0, 2, 45 },
+	{ 500, 127, 0, 127, 0, 2, 0 },
+	{ 1500, 0, 127, 0, BUTTON_ATTACK, 2, -90 },
+	{ 1000, -127, -127, 0, 0, 2, 180 }
+};
+
+typedef enum {
+	LT_CHALLENGING,		// sending getchallenge
+	LT_CONNECTING,		// sending connect
+	LT_CONNECTED,		// netchan is up, waiting for the gamestate
+	LT_PRIMED,			// have the gamestate, sending usercmds
+	LT_ACTIVE,			// in the game
+	LT_DROPPED
+} ltState_t;
+
+typedef struct {
+	ltState_t	state;
+	int			sock;
+	int			qport;
+	int			clientChallenge;
+	int			challenge;
+	int			startTime;
+	int			activeTime;			// 0 until the first active snapshot
+	int			lastResendTime;
+	int			lastSendTime;
+	int			lastPacketTime;		// last netchan message from the server
+	char		lastPrint[128];		// last connectionless print, usually a rejection
+
+	netchan_t	netchan;
+
+	int			serverId;
+	int			checksumFeed;
+	int			serverMessageSequence;
+	int			serverCommandSequence;
+	int			serverCommandKeys[MAX_RELIABLE_COMMANDS];	// MSG_HashKey of each server command
+	int			reliableSequence;	// the only command ever sent is the final disconnect
+	int			reliableAcknowledge;
+
+	int				snapMessageNum;		// last valid snapshot, -1 for none
+	int				snapServerTime;
+	int				snapRealtime;
+	qboolean		snapValid[PACKET_BACKUP];
+	int				snapMessageNums[PACKET_BACKUP];
+	playerState_t	snapPs[PACKET_BACKUP];
+
+	int			outRealtime[PACKET_BACKUP];
+	int			outServerTime[PACKET_BACKUP];
+
+	usercmd_t	cmd, oldCmd;
+	int			lastCmdTime;
+	int			scriptCmd;
+	int			scriptTime;
+	float		yaw;
+} ltClient_t;
+
+typedef struct {
+	int			snapshots;
+	int			packets;
+	int			dropped;
+	int			bytesIn;
+	int			bytesOut;
+	int			pings;
+	int			pingTotal;
+	int			pingMax;
+} ltStats_t;
+
+typedef struct {
+	netadr_t		serverAddress;
+	ltClient_t		*clients;
+	int				numClients;
+	int				socks[LT_MAX_CLIENTS];
+	int				numSocks;
+
+	ltScriptCmd_t	script[LT_MAX_SCRIPT];
+	int				numScript;
+
+	ltStats_t		frame;		// since the last status line
+	ltStats_t		total;
+	int				pingHistogram[LT_PING_BUCKETS];
+	int				numDropped;
+} loadTest_t;
+
+static loadTest_t	lt;
+
+/*
+==================
+LoadTest_Drop
+==================
+*/
+static void LoadTest_Drop( ltClient_t *cl, const char *reason ) {
+	if ( cl->state == LT_DROPPED ) {
+		return;
+	}
+	Com_Printf( "loadtest%i dropped: %s\n", (int)( cl - lt.clients ), reason );
+	cl->state = LT_DROPPED;
+	lt.numDropped++;
+}
+
+/*
+==================
+LoadTest_OutOfBand
+
+Same framing as NET_OutOfBandPrint / NET_OutOfBandData
+==================
+*/
+static void LoadTest_OutOfBand( ltClient_t *cl, const char *data, qboolean compress ) {
+	byte	string[MAX_MSGLEN*2];
+	msg_t	mbuf;
+	int		len;
+
+	len = strlen( data );
+	string[0] = 0xff;
+	string[1] = 0xff;
+	string[2] = 0xff;
+	string[3] = 0xff;
+	Com_Memcpy( string + 4, data, len + 1 );
+
+	mbuf.data = string;
+	mbuf.cursize = len + 4;
+	if ( compress ) {
+		Huff_Compress( &mbuf, 12 );
+	}
+
+	NET_SendExtra( cl->sock, mbuf.cursize, mbuf.data, &lt.serverAddress );
+	lt.frame.bytesOut += mbuf.cursize;
+}
+
+/*
+==================
+LoadTest_SendConnect
+==================
+*/
+static void LoadTest_SendConnect( ltClient_t *cl ) {
+	char	info[MAX_INFO_STRING];
+	char	data[MAX_INFO_STRING + 16];
+
+	info[0] = 0;
+	Info_SetValueForKey( info, "name", va( "loadtest%i", (int)( cl - lt.clients ) ) );
+	Info_SetValueForKey( info, "model", "sarge" );
+	Info_SetValueForKey( info, "headmodel", "sarge" );
+	Info_SetValueForKey( info, "handicap", "100" );
+	Info_SetValueForKey( info, "rate", "25000" );
+	Info_SetValueForKey( info, "snaps", "20" );
+	Info_SetValueForKey( info, "protocol", va( "%i", com_protocol->integer ) );
+	Info_SetValueForKey( info, "qport", va( "%i", cl->qport ) );
+	Info_SetValueForKey( info, "challenge", va( "%i", cl->challenge ) );
+
+	Com_sprintf( data, sizeof( data ), "connect \"%s\"", info );
+	LoadTest_OutOfBand( cl, data, qtrue );
+}
+
+/*
+==================
+LoadTest_BuildCmd
+
+Advances the script and makes a new usercmd, keeping the previous one
+for packet duplication
+==================
+*/
+static void LoadTest_BuildCmd( ltClient_t *cl, int now ) {
+	const ltScriptCmd_t	*sc;
+	int		msec;
+	int		serverTime;
+
+	msec = cl->lastCmdTime ? now - cl->lastCmdTime : 0;
+	cl->lastCmdTime = now;
+
+	cl->scriptTime += msec;
+	while ( cl->scriptTime >= lt.script[cl->scriptCmd].msec ) {
+		cl->scriptTime -= lt.script[cl->scriptCmd].msec;
+		cl->scriptCmd = ( cl->scriptCmd + 1 ) % lt.numScript;
+	}
+	sc = &lt.script[cl->scriptCmd];
+	cl->yaw = AngleNormalize360( cl->yaw + sc->yawSpeed * msec * 0.001f );
+
+	// extrapolate the server time from the last snapshot
+	serverTime = cl->snapServerTime + ( now - cl->snapRealtime );
+	if ( serverTime <= cl->cmd.serverTime ) {
+		serverTime = cl->cmd.serverTime + 1;
+	}
+
+	cl->oldCmd = cl->cmd;
+	Com_Memset( &cl->cmd, 0, sizeof( cl->cmd ) );
+	cl->cmd.serverTime = serverTime;
+	cl->cmd.angles[YAW] = ANGLE2SHORT( cl->yaw );
+	cl->cmd.forwardmove = sc->forwardmove;
+	cl->cmd.rightmove = sc->rightmove;
+	cl->cmd.upmove = sc->upmove;
+	cl->cmd.buttons = sc->buttons;
+	cl->cmd.weapon = sc->weapon;
+}
+
+/*
+==================
+LoadTest_WritePacket
+
+Builds a message like CL_WritePacket and sends it with the netchan header
+of Netchan_Transmit, which can't be used directly because it sends through
+the shared client socket and qport
+==================
+*/
+static void LoadTest_WritePacket( ltClient_t *cl, int now ) {
+	msg_t		buf, packet;
+	byte		data[MAX_MSGLEN];
+	byte		packetData[MAX_MSGLEN];
+	usercmd_t	nullcmd;
+	usercmd_t	*oldcmd;
+	int			packetNum;
+	int			key;
+
+	Com_Memset( &nullcmd, 0, sizeof( nullcmd ) );
+	oldcmd = &nullcmd;
+
+	MSG_Init( &buf, data, sizeof( data ) );
+	MSG_Bitstream( &buf );
+	MSG_WriteLong( &buf, cl->serverId );
+	MSG_WriteLong( &buf, cl->serverMessageSequence );
+	MSG_WriteLong( &buf, cl->serverCommandSequence );
+
+	if ( cl->reliableSequence > cl->reliableAcknowledge ) {
+		MSG_WriteByte( &buf, clc_clientCommand );
+		MSG_WriteLong( &buf, cl->reliableSequence );
+		MSG_WriteString( &buf, "disconnect" );
+	}
+
+	if ( cl->state >= LT_PRIMED ) {
+		LoadTest_BuildCmd( cl, now );
+
+		if ( cl->snapMessageNum < 0 || cl->serverMessageSequence != cl->snapMessageNum ) {
+			MSG_WriteByte( &buf, clc_moveNoDelta );
+		} else {
+			MSG_WriteByte( &buf, clc_move );
+		}
+
+		// the previous command goes along, like cl_packetdup 1
+		MSG_WriteByte( &buf, 2 );
+
+		key = cl->checksumFeed;
+		key ^= cl->serverMessageSequence;
+		key ^= cl->serverCommandKeys[cl->serverCommandSequence & ( MAX_RELIABLE_COMMANDS - 1 )];
+
+		MSG_WriteDeltaUsercmdKey( &buf, key, oldcmd, &cl->oldCmd );
+		MSG_WriteDeltaUsercmdKey( &buf, key, &cl->oldCmd, &cl->cmd );
+		oldcmd = &cl->cmd;
+	}
+
+	// CL_WritePacket and CL_Netchan_Transmit both end the message
+	MSG_WriteByte( &buf, clc_EOF );
+	MSG_WriteByte( &buf, clc_EOF );
+
+	packetNum = cl->netchan.outgoingSequence & PACKET_MASK;
+	cl->outRealtime[packetNum] = now;
+	cl->outServerTime[packetNum] = oldcmd->serverTime;
+	cl->lastSendTime = now;
+
+	MSG_InitOOB( &packet, packetData, sizeof( packetData ) );
+	MSG_WriteLong( &packet, cl->netchan.outgoingSequence );
+	MSG_WriteShort( &packet, cl->qport );
+	MSG_WriteLong( &packet, NETCHAN_GENCHECKSUM( cl->challenge, cl->netchan.outgoingSequence ) );
+	MSG_WriteData( &packet, buf.data, buf.cursize );
+	cl->netchan.outgoingSequence++;
+
+	NET_SendExtra( cl->sock, packet.cursize, packet.data, &lt.serverAddress );
+	lt.frame.bytesOut += packet.cursize;
+}
+
+/*
+==================
+LoadTest_AddPing
+==================
+*/
+static void LoadTest_AddPing( int ping ) {
+	lt.frame.pings++;
+	lt.frame.pingTotal += ping;
+	if ( ping > lt.frame.pingMax ) {
+		lt.frame.pingMax = ping;
+	}
+	lt.pingHistogram[MIN( ping, LT_PING_BUCKETS - 1 )]++;
+}
+
+/*
+==================
+LoadTest_ParseCommandString
+==================
+*/
+static void LoadTest_ParseCommandString( ltClient_t *cl, msg_t *msg ) {
+	int		seq;
+	char	*s;
+
+	seq = MSG_ReadLong( msg );
+	s = MSG_ReadString( msg );
+
+	if ( cl->serverCommandSequence >= seq ) {
+		return;
+	}
+	cl->serverCommandSequence = seq;
+	cl->serverCommandKeys[seq & ( MAX_RELIABLE_COMMANDS - 1 )] = MSG_HashKey( s, 32 );
+
+	Cmd_TokenizeString( s );
+	if ( !strcmp( Cmd_Argv( 0 ), "disconnect" ) ) {
+		LoadTest_Drop( cl, Cmd_Argc() > 1 ? Cmd_Argv( 1 ) : "server disconnected" );
+	} else if ( !strcmp( Cmd_Argv( 0 ), "cs" ) && atoi( Cmd_Argv( 1 ) ) == CS_SYSTEMINFO ) {
+		// map_restart changes the server id without a new gamestate
+		cl->serverId = atoi( Info_ValueForKey( Cmd_Argv( 2 ), "sv_serverid" ) );
+	}
+}
+
+/*
+==================
+LoadTest_ParseGamestate
+==================
+*/
+static void LoadTest_ParseGamestate( ltClient_t *cl, msg_t *msg ) {
+	entityState_t	nullstate, es;
+	int				cmd;
+	int				i;
+	char			*s;
+
+	cl->serverCommandSequence = MSG_ReadLong( msg );
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	while ( 1 ) {
+		if ( msg->readcount > msg->cursize ) {
+			LoadTest_Drop( cl, "read past end of gamestate" );
+			return;
+		}
+
+		cmd = MSG_ReadByte( msg );
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		if ( cmd == svc_configstring ) {
+			i = MSG_ReadShort( msg );
+			s = MSG_ReadBigString( msg );
+			if ( i == CS_SYSTEMINFO ) {
+				cl->serverId = atoi( Info_ValueForKey( s, "sv_serverid" ) );
+			}
+		} else if ( cmd == svc_baseline ) {
+			i = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			MSG_ReadDeltaEntity( msg, &nullstate, &es, i );
+		} else {
+			LoadTest_Drop( cl, "bad gamestate command byte" );
+			return;
+		}
+	}
+
+	MSG_ReadLong( msg );	// clientNum
+	cl->checksumFeed = MSG_ReadLong( msg );
+
+	// nothing from before the gamestate can be delta compressed against
+	Com_Memset( cl->snapValid, 0, sizeof( cl->snapValid ) );
+	cl->snapMessageNum = -1;
+	cl->state = LT_PRIMED;
+}
+
+/*
+==================
+LoadTest_ParseSnapshot
+
+Follows CL_ParseSnapshot.  The playerstate is kept for the ping, entities
+are read into scratch states: deltas are coded with presence bits, so the
+base values don't change how much of the stream is consumed.
+==================
+*/
+static void LoadTest_ParseSnapshot( ltClient_t *cl, msg_t *msg, int now ) {
+	playerState_t	ps;
+	playerState_t	*oldPs;
+	entityState_t	from, to;
+	byte			areamask[MAX_MAP_AREA_BYTES];
+	int				messageNum, deltaNum, oldMessageNum;
+	int				serverTime, snapFlags;
+	int				len, num, i, packetNum;
+	qboolean		valid;
+
+	messageNum = cl->serverMessageSequence;
+	serverTime = MSG_ReadLong( msg );
+	deltaNum = MSG_ReadByte( msg );
+	deltaNum = deltaNum ? messageNum - deltaNum : -1;
+	snapFlags = MSG_ReadByte( msg );
+
+	oldPs = NULL;
+	valid = qfalse;
+	if ( deltaNum <= 0 ) {
+		valid = qtrue;
+	} else if ( cl->snapValid[deltaNum & PACKET_MASK] && cl->snapMessageNums[deltaNum & PACKET_MASK] == deltaNum ) {
+		oldPs = &cl->snapPs[deltaNum & PACKET_MASK];
+		valid = qtrue;
+	}
+
+	len = MSG_ReadByte( msg );
+	if ( len > sizeof( areamask ) ) {
+		LoadTest_Drop( cl, va( "invalid size %d for areamask", len ) );
+		return;
+	}
+	MSG_ReadData( msg, areamask, len );
+
+	MSG_ReadDeltaPlayerstate( msg, oldPs, &ps );
+
+	Com_Memset( &from, 0, sizeof( from ) );
+	while ( 1 ) {
+		num = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( num == MAX_GENTITIES - 1 ) {
+			break;
+		}
+		if ( msg->readcount > msg->cursize ) {
+			LoadTest_Drop( cl, "read past end of snapshot" );
+			return;
+		}
+		MSG_ReadDeltaEntity( msg, &from, &to, num );
+	}
+
+	if ( !valid ) {
+		return;
+	}
+
+	// frames skipped since the last good one can't be deltas anymore
+	oldMessageNum = cl->snapMessageNum + 1;
+	if ( messageNum - oldMessageNum >= PACKET_BACKUP ) {
+		oldMessageNum = messageNum - ( PACKET_BACKUP - 1 );
+	}
+	for ( ; oldMessageNum < messageNum ; oldMessageNum++ ) {
+		cl->snapValid[oldMessageNum & PACKET_MASK] = qfalse;
+	}
+
+	cl->snapMessageNum = messageNum;
+	cl->snapServerTime = serverTime;
+	cl->snapRealtime = now;
+	cl->snapValid[messageNum & PACKET_MASK] = qtrue;
+	cl->snapMessageNums[messageNum & PACKET_MASK] = messageNum;
+	cl->snapPs[messageNum & PACKET_MASK] = ps;
+	lt.frame.snapshots++;
+
+	if ( cl->state == LT_ACTIVE ) {
+		for ( i = 0 ; i < PACKET_BACKUP ; i++ ) {
+			packetNum = ( cl->netchan.outgoingSequence - 1 - i ) & PACKET_MASK;
+			if ( ps.commandTime >= cl->outServerTime[packetNum] ) {
+				LoadTest_AddPing( now - cl->outRealtime[packetNum] );
+				break;
+			}
+		}
+	} else if ( cl->state == LT_PRIMED && !( snapFlags & SNAPFLAG_NOT_ACTIVE ) ) {
+		cl->state = LT_ACTIVE;
+		if ( !cl->activeTime ) {
+			cl->activeTime = now;
+		}
+	}
+}
+
+/*
+==================
+LoadTest_ParseServerMessage
+==================
+*/
+static void LoadTest_ParseServerMessage( ltClient_t *cl, msg_t *msg, int now ) {
+	int		cmd;
+
+	MSG_Bitstream( msg );
+	cl->reliableAcknowledge = MSG_ReadLong( msg );
+
+	while ( cl->state != LT_DROPPED ) {
+		if ( msg->readcount > msg->cursize ) {
+			LoadTest_Drop( cl, "read past end of server message" );
+			return;
+		}
+
+		cmd = MSG_ReadByte( msg );
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		switch ( cmd ) {
+		case svc_nop:
+			break;
+		case svc_serverCommand:
+			LoadTest_ParseCommandString( cl, msg );
+			break;
+		case svc_gamestate:
+			LoadTest_ParseGamestate( cl, msg );
+			break;
+		case svc_snapshot:
+			LoadTest_ParseSnapshot( cl, msg, now );
+			break;
+		default:
+			// downloads and voip are never asked for
+			return;
+		}
+	}
+}
+
+/*
+==================
+LoadTest_ConnectionlessPacket
+==================
+*/
+static void LoadTest_ConnectionlessPacket( ltClient_t *cl, msg_t *msg, int now ) {
+	char	*c;
+
+	MSG_BeginReadingOOB( msg );
+	MSG_ReadLong( msg );	// skip the -1
+
+	Cmd_TokenizeString( MSG_ReadStringLine( msg ) );
+	c = Cmd_Argv( 0 );
+
+	if ( !Q_stricmp( c, "challengeResponse" ) ) {
+		if ( cl->state != LT_CHALLENGING || atoi( Cmd_Argv( 2 ) ) != cl->clientChallenge ) {
+			return;
+		}
+		cl->challenge = atoi( Cmd_Argv( 1 ) );
+		cl->state = LT_CONNECTING;
+		cl->lastResendTime = now - LT_RESEND_MSEC;
+	} else if ( !Q_stricmp( c, "connectResponse" ) ) {
+		if ( cl->state != LT_CONNECTING || atoi( Cmd_Argv( 1 ) ) != cl->challenge ) {
+			return;
+		}
+		Netchan_Setup( NS_CLIENT, &cl->netchan, lt.serverAddress, cl->qport, cl->challenge, qfalse );
+		cl->state = LT_CONNECTED;
+		cl->lastPacketTime = now;
+		cl->lastSendTime = now - LT_RESEND_MSEC;
+	} else if ( !Q_stricmp( c, "print" ) ) {
+		// rejections like "Server is full." come as prints
+		Q_strncpyz( cl->lastPrint, MSG_ReadString( msg ), sizeof( cl->lastPrint ) );
+	} else if ( !Q_stricmp( c, "disconnect" ) && cl->state >= LT_CONNECTED ) {
+		LoadTest_Drop( cl, "server disconnected" );
+	}
+}
+
+/*
+==================
+LoadTest_ReadPackets
+==================
+*/
+static void LoadTest_ReadPackets( ltClient_t *cl, int now ) {
+	static byte	data[MAX_MSGLEN + 1];
+	netadr_t	from;
+	msg_t		msg;
+
+	MSG_Init( &msg, data, sizeof( data ) );
+	while ( NET_GetExtraPacket( cl->sock, &from, &msg ) ) {
+		if ( !NET_CompareAdr( from, lt.serverAddress ) ) {
+			continue;
+		}
+		lt.frame.bytesIn += msg.cursize;
+
+		if ( msg.cursize >= 4 && *(int *)msg.data == -1 ) {
+			LoadTest_ConnectionlessPacket( cl, &msg, now );
+			continue;
+		}
+		if ( cl->state < LT_CONNECTED || cl->state == LT_DROPPED || msg.cursize < 4 ) {
+			continue;
+		}
+		if ( !Netchan_Process( &cl->netchan, &msg ) ) {
+			continue;
+		}
+
+		lt.frame.packets++;
+		if ( cl->netchan.dropped > 0 ) {
+			lt.frame.dropped += cl->netchan.dropped;
+		}
+
+		cl->serverMessageSequence = LittleLong( *(int *)msg.data );
+		cl->lastPacketTime = now;
+		LoadTest_ParseServerMessage( cl, &msg, now );
+	}
+}
+
+/*
+==================
+LoadTest_SendPackets
+==================
+*/
+static void LoadTest_SendPackets( ltClient_t *cl, int now ) {
+	switch ( cl->state ) {
+	case LT_CHALLENGING:
+		if ( now - cl->lastResendTime >= LT_RESEND_MSEC ) {
+			cl->lastResendTime = now;
+			LoadTest_OutOfBand( cl, va( "getchallenge %d %s", cl->clientChallenge, com_gamename->string ), qfalse );
+		}
+		break;
+	case LT_CONNECTING:
+		if ( now - cl->lastResendTime >= LT_RESEND_MSEC ) {
+			cl->lastResendTime = now;
+			LoadTest_SendConnect( cl );
+		}
+		break;
+	case LT_CONNECTED:
+	case LT_PRIMED:
+	case LT_ACTIVE:
+		if ( now - cl->lastPacketTime > LT_TIMEOUT_MSEC ) {
+			LoadTest_Drop( cl, "timed out" );
+			break;
+		}
+		// like CL_ReadyToSendPacket, only a packet a second until primed
+		if ( now - cl->lastSendTime >= ( cl->state == LT_CONNECTED ? LT_RESEND_MSEC : LT_PACKET_MSEC ) ) {
+			LoadTest_WritePacket( cl, now );
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+==================
+LoadTest_LoadScript
+==================
+*/
+static void LoadTest_LoadScript( const char *filename ) {
+	ltScriptCmd_t	*sc;
+	union {
+		char	*c;
+		void	*v;
+	} buffer;
+	char		*text, *token;
+	float		values[6];
+	int			i;
+
+	lt.numScript = 0;
+
+	if ( filename ) {
+		if ( FS_ReadFile( filename, &buffer.v ) <= 0 ) {
+			Com_Printf( "Couldn't load %s, using the default script\n", filename );
+		} else {
+			text = buffer.c;
+			while ( 1 ) {
+				token = COM_ParseExt( &text, qtrue );
+				if ( !token[0] ) {
+					break;
+				}
+				if ( lt.numScript == LT_MAX_SCRIPT ) {
+					Com_Printf( "WARNING: %s has more than %i commands\n", filename, LT_MAX_SCRIPT );
+					break;
+				}
+
+				sc = &lt.script[lt.numScript];
+				sc->msec = atoi( token );
+				for ( i = 0 ; i < 6 ; i++ ) {
+					values[i] = atof( COM_ParseExt( &text, qfalse ) );
+				}
+				if ( sc->msec <= 0 ) {
+					continue;
+				}
+				sc->forwardmove = ClampChar( values[0] );
+				sc->rightmove = ClampChar( values[1] );
+				sc->upmove = ClampChar( values[2] );
+				sc->buttons = values[3];
+				sc->weapon = values[4];
+				sc->yawSpeed = values[5];
+				lt.numScript++;
+			}
+			FS_FreeFile( buffer.v );
+		}
+	}
+
+	if ( !lt.numScript ) {
+		lt.numScript = ARRAY_LEN( ltDefaultScript );
+		Com_Memcpy( lt.script, ltDefaultScript, sizeof( ltDefaultScript ) );
+	}
+}
+
+/*
+==================
+LoadTest_Status
+==================
+*/
+static void LoadTest_Status( int seconds ) {
+	ltClient_t	*cl;
+	int			connected, active;
+	int			i;
+
+	connected = active = 0;
+	for ( i = 0, cl = lt.clients ; i < lt.numClients ; i++, cl++ ) {
+		if ( cl->state == LT_ACTIVE ) {
+			active++;
+		} else if ( cl->state >= LT_CONNECTED && cl->state != LT_DROPPED ) {
+			connected++;
+		}
+	}
+
+	Com_Printf( "%4i s: %3i active %3i connecting %3i dropped, %5i snaps, ping %3i avg %3i max, %3i lost, %5i/%5i kB in/out\n",
+		seconds, active, connected, lt.numDropped, lt.frame.snapshots,
+		lt.frame.pings ? lt.frame.pingTotal / lt.frame.pings : 0, lt.frame.pingMax,
+		lt.frame.dropped, lt.frame.bytesIn / 1024, lt.frame.bytesOut / 1024 );
+
+	lt.total.snapshots += lt.frame.snapshots;
+	lt.total.packets += lt.frame.packets;
+	lt.total.dropped += lt.frame.dropped;
+	lt.total.bytesIn += lt.frame.bytesIn;
+	lt.total.bytesOut += lt.frame.bytesOut;
+	lt.total.pings += lt.frame.pings;
+	lt.total.pingTotal += lt.frame.pingTotal;
+	lt.total.pingMax = MAX( lt.total.pingMax, lt.frame.pingMax );
+	Com_Memset( &lt.frame, 0, sizeof( lt.frame ) );
+}
+
+/*
+==================
+LoadTest_PingPercentile
+==================
+*/
+static int LoadTest_PingPercentile( int percent ) {
+	int		count, target;
+	int		i;
+
+	target = ( lt.total.pings * percent + 99 ) / 100;
+	for ( i = 0, count = 0 ; i < LT_PING_BUCKETS ; i++ ) {
+		count += lt.pingHistogram[i];
+		if ( count >= target ) {
+			return i;
+		}
+	}
+	return LT_PING_BUCKETS - 1;
+}
+
+/*
+==================
+LoadTest_Summary
+==================
+*/
+static void LoadTest_Summary( int msec ) {
+	ltClient_t	*cl;
+	const char	*rejection;
+	int			joined, joinTotal, joinMax;
+	int			i;
+
+	joined = joinTotal = joinMax = 0;
+	rejection = NULL;
+	for ( i = 0, cl = lt.clients ; i < lt.numClients ; i++, cl++ ) {
+		if ( cl->activeTime ) {
+			joined++;
+			joinTotal += cl->activeTime - cl->startTime;
+			joinMax = MAX( joinMax, cl->activeTime - cl->startTime );
+		} else if ( cl->lastPrint[0] ) {
+			rejection = cl->lastPrint;
+		}
+	}
+
+	Com_Printf( "----- loadtest %s -----\n", NET_AdrToStringwPort( lt.serverAddress ) );
+	Com_Printf( "%i of %i clients got into the game, %i dropped\n", joined, lt.numClients, lt.numDropped );
+	if ( joined ) {
+		Com_Printf( "join time: %i ms avg, %i ms max\n", joinTotal / joined, joinMax );
+	}
+	if ( rejection ) {
+		Com_Printf( "last rejection: %s", rejection );
+	}
+	if ( joined && msec > 0 ) {
+		Com_Printf( "snapshots: %i, %.1f per client per second\n", lt.total.snapshots,
+			lt.total.snapshots * 1000.0f / msec / joined );
+	}
+	if ( lt.total.pings ) {
+		Com_Printf( "ping: %i avg, %i p50, %i p90, %i p99, %i max\n", lt.total.pingTotal / lt.total.pings,
+			LoadTest_PingPercentile( 50 ), LoadTest_PingPercentile( 90 ), LoadTest_PingPercentile( 99 ),
+			lt.total.pingMax );
+	}
+	if ( lt.total.packets ) {
+		Com_Printf( "packet loss: %i of %i (%.2f%%)\n", lt.total.dropped, lt.total.packets + lt.total.dropped,
+			100.0f * lt.total.dropped / ( lt.total.packets + lt.total.dropped ) );
+	}
+	Com_Printf( "traffic: %i kB in, %i kB out\n", lt.total.bytesIn / 1024, lt.total.bytesOut / 1024 );
+}
+
+/*
+==================
+LoadTest_CloseSockets
+==================
+*/
+static void LoadTest_CloseSockets( void ) {
+	int		i;
+
+	for ( i = 0 ; i < lt.numSocks ; i++ ) {
+		NET_CloseExtraSocket( lt.socks[i] );
+	}
+	lt.numSocks = 0;
+}
+
+/*
+==================
+CL_LoadTest_f
+
+Runs until the time is up, the local event loop doesn't run meanwhile
+==================
+*/
+void CL_LoadTest_f( void ) {
+	ltClient_t	*cl;
+	int			numClients, seconds;
+	int			start, now, nextStatus;
+	int			i;
+
+	if ( Cmd_Argc() < 3 ) {
+		Com_Printf( "usage: loadtest <server> <clients> [seconds] [script]\n" );
+		return;
+	}
+	if ( com_sv_running->integer ) {
+		Com_Printf( "loadtest can't run while a local server is running\n" );
+		return;
+	}
+
+	// sockets left over if an earlier run was cut short by an error
+	LoadTest_CloseSockets();
+	Com_Memset( &lt, 0, sizeof( lt ) );
+
+	if ( !NET_StringToAdr( Cmd_Argv( 1 ), &lt.serverAddress, NA_UNSPEC ) ) {
+		Com_Printf( "Bad server address %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+	if ( !lt.serverAddress.port ) {
+		lt.serverAddress.port = BigShort( PORT_SERVER );
+	}
+	if ( lt.serverAddress.type != NA_IP && lt.serverAddress.type != NA_IP6 ) {
+		Com_Printf( "loadtest needs an IPv4 or IPv6 server address\n" );
+		return;
+	}
+
+	numClients = atoi( Cmd_Argv( 2 ) );
+	if ( numClients < 1 || numClients > LT_MAX_CLIENTS ) {
+		Com_Printf( "clients must be between 1 and %i\n", LT_MAX_CLIENTS );
+		return;
+	}
+	seconds = Cmd_Argc() > 3 ? atoi( Cmd_Argv( 3 ) ) : 30;
+	if ( seconds < 1 ) {
+		seconds = 1;
+	}
+
+	LoadTest_LoadScript( Cmd_Argc() > 4 ? Cmd_Argv( 4 ) : NULL );
+
+	lt.clients = Hunk_AllocateTempMemory( numClients * sizeof( *lt.clients ) );
+	Com_Memset( lt.clients, 0, numClients * sizeof( *lt.clients ) );
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < numClients ; i++ ) {
+		cl = &lt.clients[i];
+		cl->sock = NET_OpenExtraSocket( lt.serverAddress.type );
+		if ( cl->sock < 0 ) {
+			break;
+		}
+		lt.socks[lt.numSocks++] = cl->sock;
+
+		cl->state = LT_CHALLENGING;
+		cl->qport = ( start + i * 7919 ) & 0xffff;
+		cl->clientChallenge = ( ( rand() << 16 ) ^ rand() ) ^ start;
+		cl->startTime = start;
+		cl->snapMessageNum = -1;
+		// spread the first requests over a second, the server only
+		// answers a few getchallenges per address at a time
+		cl->lastResendTime = start - LT_RESEND_MSEC + ( i * 97 ) % LT_RESEND_MSEC;
+		cl->scriptTime = i * 397;
+		cl->yaw = ( i * 37 ) % 360;
+	}
+	lt.numClients = i;
+
+	if ( !lt.numClients ) {
+		Hunk_FreeTempMemory( lt.clients );
+		lt.clients = NULL;
+		return;
+	}
+
+	Com_Printf( "loadtest: %i clients to %s for %i seconds, %i script commands\n",
+		lt.numClients, NET_AdrToStringwPort( lt.serverAddress ), seconds, lt.numScript );
+
+	nextStatus = start + 1000;
+	while ( 1 ) {
+		now = Sys_Milliseconds();
+		if ( now - start >= seconds * 1000 ) {
+			break;
+		}
+
+		for ( i = 0, cl = lt.clients ; i < lt.numClients ; i++, cl++ ) {
+			LoadTest_ReadPackets( cl, now );
+			LoadTest_SendPackets( cl, now );
+		}
+
+		if ( now >= nextStatus ) {
+			LoadTest_Status( ( now - start ) / 1000 );
+			nextStatus += 1000;
+		}
+
+		NET_WaitExtraSockets( lt.socks, lt.numSocks, 1000 );
+	}
+
+	LoadTest_Status( seconds );
+
+	// send the disconnect a few times like CL_Disconnect
+	now = Sys_Milliseconds();
+	for ( i = 0, cl = lt.clients ; i < lt.numClients ; i++, cl++ ) {
+		if ( cl->state < LT_CONNECTED || cl->state == LT_DROPPED ) {
+			continue;
+		}
+		cl->reliableSequence++;
+		LoadTest_WritePacket( cl, now );
+		LoadTest_WritePacket( cl, now );
+		LoadTest_WritePacket( cl, now );
+	}
+
+	LoadTest_Summary( now - start );
+
+	LoadTest_CloseSockets();
+	Hunk_FreeTempMemory( lt.clients );
+	lt.clients = NULL;
+}
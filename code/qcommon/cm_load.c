@@ -63,6 +63,9 @@ cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
 #endif
+#ifdef CM_SIMD
+cvar_t		*cm_simd;
+#endif
 
 cmodel_t	box_model;
 cplane_t	*box_planes;
@@ -224,6 +227,43 @@ void CM_BoundBrush( cbrush_t *b ) {
 }
 
 
+#ifdef CM_SIMD
+/*
+=================
+CM_SetBrushSidePlanes
+
+Repacks the side planes of each brush as groups of four normal x, y, z
+and dist values.  The last group of a brush is padded with zeros, the
+box brush is left without because its planes change with every use.
+=================
+*/
+static void CM_SetBrushSidePlanes( void ) {
+	cbrush_t	*brush;
+	cplane_t	*plane;
+	float		*out;
+	int			i, j, k, numGroups;
+
+	numGroups = 0;
+	for ( i = 0, brush = cm.brushes ; i < cm.numBrushes ; i++, brush++ ) {
+		numGroups += ( brush->numsides + 3 ) >> 2;
+	}
+
+	out = Hunk_Alloc( numGroups * 16 * sizeof( *out ), h_high );
+
+	for ( i = 0, brush = cm.brushes ; i < cm.numBrushes ; i++, brush++ ) {
+		brush->sidePlanes = out;
+		for ( j = 0 ; j < brush->numsides ; j++ ) {
+			plane = brush->sides[j].plane;
+			for ( k = 0 ; k < 3 ; k++ ) {
+				out[ ( j >> 2 ) * 16 + k * 4 + ( j & 3 ) ] = plane->normal[k];
+			}
+			out[ ( j >> 2 ) * 16 + 12 + ( j & 3 ) ] = plane->dist;
+		}
+		out += ( ( brush->numsides + 3 ) >> 2 ) * 16;
+	}
+}
+#endif
+
 /*
 =================
 CMod_LoadBrushes
@@ -259,6 +299,9 @@ void CMod_LoadBrushes( lump_t *l ) {
 		CM_BoundBrush( out );
 	}
 
+#ifdef CM_SIMD
+	CM_SetBrushSidePlanes();
+#endif
 }
 
 /*
@@ -584,6 +627,9 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	cm_noAreas = Cvar_Get ("cm_noAreas", "0", CVAR_CHEAT);
 	cm_noCurves = Cvar_Get ("cm_noCurves", "0", CVAR_CHEAT);
 	cm_playerCurveClip = Cvar_Get ("cm_playerCurveClip", "1", CVAR_ARCHIVE|CVAR_CHEAT );
+#endif
+#ifdef CM_SIMD
+	cm_simd = Cvar_Get ("cm_simd", "1", CVAR_ARCHIVE );
 #endif
 	Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
 
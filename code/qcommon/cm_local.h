@@ -62,6 +62,7 @@ typedef struct {
 	vec3_t		bounds[2];
 	int			numsides;
 	cbrushside_t	*sides;
+	float		*sidePlanes;	// normal x, y, z and dist of each group of four sides for SIMD tests
 	int			checkcount;		// to avoid repeated testings
 } cbrush_t;
 
@@ -140,6 +141,12 @@ extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
 
+// brush side tests four planes at a time
+#if idsse && !defined(BSPC)
+#define CM_SIMD
+extern	cvar_t		*cm_simd;
+#endif
+
 // cm_test.c
 
 // Used for oriented capsule collision detection
@@ -162,6 +169,7 @@ typedef struct {
 	vec3_t		modelOrigin;// origin of the model tracing through
 	int			contents;	// ored contents of the model tracing through
 	qboolean	isPoint;	// optimized case
+	qboolean	concurrent;	// on a worker thread, leave checkcounts and statistics alone
 	trace_t		trace;		// returned from trace call
 	sphere_t	sphere;		// sphere for oriendted capsule collision
 } traceWork_t;
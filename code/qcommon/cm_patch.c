@@ -1325,12 +1325,14 @@ void CM_TracePointThroughPatchCollide( traceWork_t *tw, const struct patchCollid
 		if ( j == facet->numBorders ) {
 			// we hit this facet
 #ifndef BSPC
-			if (!cv) {
-				cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-			}
-			if (cv->integer) {
-				debugPatchCollide = pc;
-				debugFacet = facet;
+			if (!tw->concurrent) {
+				if (!cv) {
+					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
+				}
+				if (cv->integer) {
+					debugPatchCollide = pc;
+					debugFacet = facet;
+				}
 			}
 #endif //BSPC
 			planes = &pc->planes[facet->surfacePlane];
@@ -1512,12 +1514,14 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *
 					enterFrac = 0;
 				}
 #ifndef BSPC
-				if (!cv) {
-					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-				}
-				if (cv && cv->integer) {
-					debugPatchCollide = pc;
-					debugFacet = facet;
+				if (!tw->concurrent) {
+					if (!cv) {
+						cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
+					}
+					if (cv && cv->integer) {
+						debugPatchCollide = pc;
+						debugFacet = facet;
+					}
 				}
 #endif //BSPC
 
@@ -21,6 +21,16 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "cm_local.h"
 
+#ifdef CM_SIMD
+#include <xmmintrin.h>
+
+// the SIMD and scalar brush side tests only match without reassociation,
+// the Makefile passes -fno-associative-math for this file
+#ifdef _MSC_VER
+#pragma float_control( precise, on )
+#endif
+#endif
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -153,6 +163,52 @@ POSITION TESTING
 ===============================================================================
 */
 
+#ifdef CM_SIMD
+/*
+================
+CM_SideDistances
+
+Computes the start (and end, if d2 is given) distances from the group of
+four brush side planes, expanded for the trace box.  The operations are
+done in the same order as the scalar code so the results are the same,
+which also needs this file to be compiled without -fassociative-math.
+================
+*/
+static ID_INLINE void CM_SideDistances( const traceWork_t *tw, const float *planes, __m128 *d1, __m128 *d2 ) {
+	__m128	nx, ny, nz, dist;
+	__m128	neg, ox, oy, oz, zero;
+
+	nx = _mm_loadu_ps( planes );
+	ny = _mm_loadu_ps( planes + 4 );
+	nz = _mm_loadu_ps( planes + 8 );
+	dist = _mm_loadu_ps( planes + 12 );
+	zero = _mm_setzero_ps();
+
+	// tw->offsets[ plane->signbits ] uses the maxs on each axis the normal points back on
+	neg = _mm_cmplt_ps( nx, zero );
+	ox = _mm_or_ps( _mm_and_ps( neg, _mm_set1_ps( tw->size[1][0] ) ), _mm_andnot_ps( neg, _mm_set1_ps( tw->size[0][0] ) ) );
+	neg = _mm_cmplt_ps( ny, zero );
+	oy = _mm_or_ps( _mm_and_ps( neg, _mm_set1_ps( tw->size[1][1] ) ), _mm_andnot_ps( neg, _mm_set1_ps( tw->size[0][1] ) ) );
+	neg = _mm_cmplt_ps( nz, zero );
+	oz = _mm_or_ps( _mm_and_ps( neg, _mm_set1_ps( tw->size[1][2] ) ), _mm_andnot_ps( neg, _mm_set1_ps( tw->size[0][2] ) ) );
+
+	// adjust the plane distance appropriately for mins/maxs
+	dist = _mm_sub_ps( dist, _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) ) );
+
+	*d1 = _mm_sub_ps( _mm_add_ps( _mm_add_ps(
+		_mm_mul_ps( _mm_set1_ps( tw->start[0] ), nx ),
+		_mm_mul_ps( _mm_set1_ps( tw->start[1] ), ny ) ),
+		_mm_mul_ps( _mm_set1_ps( tw->start[2] ), nz ) ), dist );
+
+	if ( d2 ) {
+		*d2 = _mm_sub_ps( _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( _mm_set1_ps( tw->end[0] ), nx ),
+			_mm_mul_ps( _mm_set1_ps( tw->end[1] ), ny ) ),
+			_mm_mul_ps( _mm_set1_ps( tw->end[2] ), nz ) ), dist );
+	}
+}
+#endif
+
 /*
 ================
 CM_TestBoxInBrush
@@ -208,20 +264,45 @@ void CM_TestBoxInBrush( traceWork_t *tw, cbrush_t *brush ) {
 			}
 		}
 	} else {
-		// the first six planes are the axial planes, so we only
-		// need to test the remainder
-		for ( i = 6 ; i < brush->numsides ; i++ ) {
-			side = brush->sides + i;
-			plane = side->plane;
+#ifdef CM_SIMD
+		if ( brush->sidePlanes && cm_simd->integer ) {
+			__m128	v1;
+			int		front;
+
+			// the padding in the last group is never in front
+			for ( i = 4 ; i < brush->numsides ; i += 4 ) {
+				CM_SideDistances( tw, brush->sidePlanes + ( i >> 2 ) * 16, &v1, NULL );
+				front = _mm_movemask_ps( _mm_cmpgt_ps( v1, _mm_setzero_ps() ) );
+
+				// the first six planes are the axial planes, so we only
+				// need to test the remainder
+				if ( i == 4 ) {
+					front &= ~3;
+				}
 
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+				// if completely in front of face, no intersection
+				if ( front ) {
+					return;
+				}
+			}
+		} else
+#endif
+		{
+			// the first six planes are the axial planes, so we only
+			// need to test the remainder
+			for ( i = 6 ; i < brush->numsides ; i++ ) {
+				side = brush->sides + i;
+				plane = side->plane;
 
-			d1 = DotProduct( tw->start, plane->normal ) - dist;
+				// adjust the plane distance appropriately for mins/maxs
+				dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
 
-			// if completely in front of face, no intersection
-			if ( d1 > 0 ) {
-				return;
+				d1 = DotProduct( tw->start, plane->normal ) - dist;
+
+				// if completely in front of face, no intersection
+				if ( d1 > 0 ) {
+					return;
+				}
 			}
 		}
 	}
@@ -249,10 +330,12 @@ void CM_TestInLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
 		b = &cm.brushes[brushnum];
-		if (b->checkcount == cm.checkcount) {
-			continue;	// already checked this brush in another leaf
+		if ( !tw->concurrent ) {
+			if (b->checkcount == cm.checkcount) {
+				continue;	// already checked this brush in another leaf
+			}
+			b->checkcount = cm.checkcount;
 		}
-		b->checkcount = cm.checkcount;
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -275,10 +358,12 @@ void CM_TestInLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
-				continue;	// already checked this brush in another leaf
+			if ( !tw->concurrent ) {
+				if ( patch->checkcount == cm.checkcount ) {
+					continue;	// already checked this brush in another leaf
+				}
+				patch->checkcount = cm.checkcount;
 			}
-			patch->checkcount = cm.checkcount;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -428,12 +513,16 @@ void CM_PositionTest( traceWork_t *tw ) {
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
 
-	cm.checkcount++;
+	if ( !tw->concurrent ) {
+		cm.checkcount++;
+	}
 
 	CM_BoxLeafnums_r( &ll, 0 );
 
 
-	cm.checkcount++;
+	if ( !tw->concurrent ) {
+		cm.checkcount++;
+	}
 
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
@@ -462,7 +551,9 @@ CM_TraceThroughPatch
 void CM_TraceThroughPatch( traceWork_t *tw, cPatch_t *patch ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	if ( !tw->concurrent ) {
+		c_patch_traces++;
+	}
 
 	oldFrac = tw->trace.fraction;
 
@@ -491,6 +582,11 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 	float		t;
 	vec3_t		startp;
 	vec3_t		endp;
+#ifdef CM_SIMD
+	qboolean	simd;
+	__m128		v1, v2;
+	float		d1s[4], d2s[4];
+#endif
 
 	enterFrac = -1.0;
 	leaveFrac = 1.0;
@@ -500,7 +596,9 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 		return;
 	}
 
-	c_brush_traces++;
+	if ( !tw->concurrent ) {
+		c_brush_traces++;
+	}
 
 	getout = qfalse;
 	startout = qfalse;
@@ -575,6 +673,10 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 			}
 		}
 	} else {
+#ifdef CM_SIMD
+		simd = ( brush->sidePlanes && cm_simd->integer );
+#endif
+
 		//
 		// compare the trace against all planes of the brush
 		// find the latest time the trace crosses a plane towards the interior
@@ -584,11 +686,32 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 			side = brush->sides + i;
 			plane = side->plane;
 
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+#ifdef CM_SIMD
+			if ( simd ) {
+				if ( !( i & 3 ) ) {
+					CM_SideDistances( tw, brush->sidePlanes + ( i >> 2 ) * 16, &v1, &v2 );
+
+					// if any of the four is completely in front of its face, there is no
+					// intersection with the entire brush, whatever the sides before it did
+					if ( _mm_movemask_ps( _mm_and_ps( _mm_cmpgt_ps( v1, _mm_setzero_ps() ),
+						_mm_or_ps( _mm_cmpge_ps( v2, _mm_set1_ps( SURFACE_CLIP_EPSILON ) ), _mm_cmpge_ps( v2, v1 ) ) ) ) ) {
+						return;
+					}
 
-			d1 = DotProduct( tw->start, plane->normal ) - dist;
-			d2 = DotProduct( tw->end, plane->normal ) - dist;
+					_mm_storeu_ps( d1s, v1 );
+					_mm_storeu_ps( d2s, v2 );
+				}
+				d1 = d1s[i & 3];
+				d2 = d2s[i & 3];
+			} else
+#endif
+			{
+				// adjust the plane distance appropriately for mins/maxs
+				dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+
+				d1 = DotProduct( tw->start, plane->normal ) - dist;
+				d2 = DotProduct( tw->end, plane->normal ) - dist;
+			}
 
 			if (d2 > 0) {
 				getout = qtrue;	// endpoint is not in solid
@@ -677,10 +800,12 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
 
 		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
-			continue;	// already checked this brush in another leaf
+		if ( !tw->concurrent ) {
+			if ( b->checkcount == cm.checkcount ) {
+				continue;	// already checked this brush in another leaf
+			}
+			b->checkcount = cm.checkcount;
 		}
-		b->checkcount = cm.checkcount;
 
 		if ( !(b->contents & tw->contents) ) {
 			continue;
@@ -708,10 +833,12 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
-				continue;	// already checked this patch in another leaf
+			if ( !tw->concurrent ) {
+				if ( patch->checkcount == cm.checkcount ) {
+					continue;	// already checked this patch in another leaf
+				}
+				patch->checkcount = cm.checkcount;
 			}
-			patch->checkcount = cm.checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1143,10 +1270,16 @@ void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t
 /*
 ==================
 CM_Trace
+
+With concurrent set, brushes and patches that are in more than one leaf
+are clipped again in every leaf instead of being marked with the
+checkcount.  Clipping is only taken when it is closer than the current
+fraction, so that gives the same trace, and several threads can trace
+at the same time as nothing in cm is written.
 ==================
 */
 void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mins, vec3_t maxs,
-						  clipHandle_t model, const vec3_t origin, int brushmask, int capsule, sphere_t *sphere ) {
+						  clipHandle_t model, const vec3_t origin, int brushmask, int capsule, sphere_t *sphere, qboolean concurrent ) {
 	int			i;
 	traceWork_t	tw;
 	vec3_t		offset;
@@ -1154,13 +1287,16 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mi
 
 	cmod = CM_ClipHandleToModel( model );
 
-	cm.checkcount++;		// for multi-check avoidance
+	if ( !concurrent ) {
+		cm.checkcount++;		// for multi-check avoidance
 
-	c_traces++;				// for statistics, may be zeroed
+		c_traces++;				// for statistics, may be zeroed
+	}
 
 	// fill in a default trace
 	Com_Memset( &tw, 0, sizeof(tw) );
 	tw.trace.fraction = 1;	// assume it goes the entire distance until shown otherwise
+	tw.concurrent = concurrent;
 	VectorCopy(origin, tw.modelOrigin);
 
 	if (!cm.numNodes) {
@@ -1366,7 +1502,21 @@ CM_BoxTrace
 void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  clipHandle_t model, int brushmask, int capsule ) {
-	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
+	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL, qfalse );
+}
+
+/*
+==================
+CM_BoxTraceConcurrent
+
+Same as CM_BoxTrace, but safe to call from several threads at once as
+long as nothing loads or changes the collision map meanwhile
+==================
+*/
+void CM_BoxTraceConcurrent( trace_t *results, const vec3_t start, const vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  clipHandle_t model, int brushmask, int capsule ) {
+	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL, qtrue );
 }
 
 /*
@@ -1451,7 +1601,7 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 	}
 
 	// sweep the box through the model
-	CM_Trace( &trace, start_l, end_l, symetricSize[0], symetricSize[1], model, origin, brushmask, capsule, &sphere );
+	CM_Trace( &trace, start_l, end_l, symetricSize[0], symetricSize[1], model, origin, brushmask, capsule, &sphere, qfalse );
 
 	// if the bmodel was rotated and there was a collision
 	if ( rotated && trace.fraction != 1.0 ) {
@@ -1468,3 +1618,86 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 
 	*results = trace;
 }
+
+/*
+==================
+CM_SimdTest_f
+
+Sweeps a fixed series of pseudo random boxes through the world with
+and without cm_simd and reports every trace that comes out different
+==================
+*/
+void CM_SimdTest_f( void ) {
+#ifdef CM_SIMD
+	static trace_t	scalar[256], simd[256];
+	vec3_t		starts[256], ends[256], mins[256], maxs[256];
+	vec3_t		worldMins, worldMaxs, dir;
+	int			i, j, k, count, numTraces, seed;
+	int			mismatches, simdWas;
+
+	if ( !cm.numBrushes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	numTraces = 100000;
+	if ( Cmd_Argc() > 1 ) {
+		numTraces = atoi( Cmd_Argv( 1 ) );
+	}
+
+	CM_ModelBounds( 0, worldMins, worldMaxs );
+	simdWas = cm_simd->integer;
+	seed = 0x5eed;
+	mismatches = 0;
+
+	for ( i = 0 ; i < numTraces ; i += count ) {
+		count = numTraces - i;
+		if ( count > ARRAY_LEN( scalar ) ) {
+			count = ARRAY_LEN( scalar );
+		}
+
+		// mix of point, player and odd sized boxes, moving or testing a position
+		for ( j = 0 ; j < count ; j++ ) {
+			for ( k = 0 ; k < 3 ; k++ ) {
+				starts[j][k] = worldMins[k] + Q_random( &seed ) * ( worldMaxs[k] - worldMins[k] );
+				dir[k] = Q_crandom( &seed ) * 1024;
+				maxs[j][k] = ( j & 1 ) ? Q_random( &seed ) * 32 : 0;
+				mins[j][k] = -maxs[j][k];
+			}
+			if ( j & 2 ) {
+				VectorCopy( starts[j], ends[j] );
+			} else {
+				VectorAdd( starts[j], dir, ends[j] );
+			}
+		}
+
+		Cvar_Set( "cm_simd", "0" );
+		for ( j = 0 ; j < count ; j++ ) {
+			CM_BoxTrace( &scalar[j], starts[j], ends[j], mins[j], maxs[j], 0, -1, qfalse );
+		}
+
+		Cvar_Set( "cm_simd", "1" );
+		for ( j = 0 ; j < count ; j++ ) {
+			CM_BoxTrace( &simd[j], starts[j], ends[j], mins[j], maxs[j], 0, -1, qfalse );
+		}
+
+		for ( j = 0 ; j < count ; j++ ) {
+			if ( memcmp( &scalar[j], &simd[j], sizeof( trace_t ) ) ) {
+				if ( mismatches < 10 ) {
+					Com_Printf( "mismatch: (%f %f %f) to (%f %f %f), fraction %f / %f\n",
+						starts[j][0], starts[j][1], starts[j][2],
+						ends[j][0], ends[j][1], ends[j][2],
+						scalar[j].fraction, simd[j].fraction );
+				}
+				mismatches++;
+			}
+		}
+	}
+
+	Cvar_Set( "cm_simd", simdWas ? "1" : "0" );
+
+	Com_Printf( "%i traces, %i mismatches\n", numTraces, mismatches );
+#else
+	Com_Printf( "No SIMD brush tests in this build.\n" );
+#endif
+}
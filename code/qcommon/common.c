@@ -111,6 +111,9 @@ cvar_t  *con_autochat;
 int		time_game;
 int		time_frontend;		// renderer frontend time
 int		time_backend;		// renderer backend time
+int		time_snapBuild;		// server snapshot entity culling
+int		time_snapEncode;	// server snapshot delta compression
+int		time_snapSend;		// server snapshot transmission
 
 int			com_frameTime;
 int			com_frameNumber;
@@ -205,7 +208,12 @@ void QDECL Com_Printf( const char *fmt, ... ) {
 			time( &aclock );
 			newtime = localtime( &aclock );
 
-			logfile = FS_FOpenFileWrite( "qconsole.log" );
+			// a buffered log goes through the writer thread, logfile 2
+			// writes synchronously so we get valid data even if we are crashing
+			if ( com_logfile->integer > 1 )
+				logfile = FS_FOpenFileWrite( "qconsole.log" );
+			else
+				logfile = FS_OpenAsyncWrite( "qconsole.log", qfalse, 0 );
 			
 			if(logfile)
 			{
@@ -2631,6 +2639,181 @@ static void Com_DetectSSE(void)
 
 #endif
 
+/*
+==============================================================================
+
+						PARALLEL JOBS
+
+Optional worker threads that split independent pieces of work over several
+cores.  Job functions run concurrently with each other and with the main
+thread, so they must not call Com_Printf, Com_Error, the zone or hunk
+allocators, or anything else that touches shared engine state.
+
+==============================================================================
+*/
+
+typedef struct {
+	void		*threads[MAX_JOB_THREADS];
+	int			numThreads;
+
+	void		*lock;
+	void		*wake;		// posted once for each worker that should run
+	void		*done;		// posted by each worker when the job list is drained
+	qboolean	quit;
+
+	jobFunc_t	func;
+	void		*data;
+	int			count;
+	int			next;
+} jobPool_t;
+
+static jobPool_t	jobs;
+
+/*
+=================
+Com_DrainJobs
+
+Runs jobs until the list is empty
+=================
+*/
+static void Com_DrainJobs( void ) {
+	int		index;
+
+	while ( 1 ) {
+		Sys_LockMutex( jobs.lock );
+		index = jobs.next++;
+		Sys_UnlockMutex( jobs.lock );
+
+		if ( index >= jobs.count ) {
+			return;
+		}
+		jobs.func( jobs.data, index );
+	}
+}
+
+/*
+=================
+Com_JobThread
+=================
+*/
+static void Com_JobThread( void *arg ) {
+	while ( 1 ) {
+		Sys_SemaphoreWait( jobs.wake );
+		if ( jobs.quit ) {
+			return;
+		}
+		Com_DrainJobs();
+		Sys_SemaphorePost( jobs.done );
+	}
+}
+
+/*
+=================
+Com_StartJobThreads
+
+Returns the number of workers available, which may be less than requested
+if the platform can't start more threads
+=================
+*/
+static int Com_StartJobThreads( int numThreads ) {
+	void	*thread;
+
+	if ( numThreads > MAX_JOB_THREADS ) {
+		numThreads = MAX_JOB_THREADS;
+	}
+
+	if ( !jobs.lock ) {
+		jobs.lock = Sys_CreateMutex();
+		jobs.wake = Sys_CreateSemaphore();
+		jobs.done = Sys_CreateSemaphore();
+	}
+
+	while ( jobs.numThreads < numThreads ) {
+		thread = Sys_CreateThread( Com_JobThread, NULL );
+		if ( !thread ) {
+			Com_Printf( "WARNING: couldn't start job thread %i\n", jobs.numThreads );
+			break;
+		}
+		jobs.threads[jobs.numThreads++] = thread;
+	}
+
+	return jobs.numThreads;
+}
+
+/*
+=================
+Com_RunJobs
+
+Calls func( data, 0 ) through func( data, count - 1 ) spread over up to
+numThreads threads, including the calling one, and returns when all of
+them have finished.  The order the jobs run in is undefined.  Must only
+be called from the main thread.
+=================
+*/
+void Com_RunJobs( int numThreads, jobFunc_t func, void *data, int count ) {
+	int		i, numWorkers;
+
+	if ( numThreads > count ) {
+		numThreads = count;
+	}
+
+	numWorkers = 0;
+	if ( numThreads > 1 ) {
+		numWorkers = Com_StartJobThreads( numThreads - 1 );
+		if ( numWorkers > numThreads - 1 ) {
+			numWorkers = numThreads - 1;
+		}
+	}
+
+	if ( !numWorkers ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			func( data, i );
+		}
+		return;
+	}
+
+	jobs.func = func;
+	jobs.data = data;
+	jobs.count = count;
+	jobs.next = 0;
+
+	for ( i = 0 ; i < numWorkers ; i++ ) {
+		Sys_SemaphorePost( jobs.wake );
+	}
+
+	Com_DrainJobs();
+
+	for ( i = 0 ; i < numWorkers ; i++ ) {
+		Sys_SemaphoreWait( jobs.done );
+	}
+}
+
+/*
+=================
+Com_ShutdownJobs
+=================
+*/
+static void Com_ShutdownJobs( void ) {
+	int		i;
+
+	if ( !jobs.lock ) {
+		return;
+	}
+
+	jobs.quit = qtrue;
+	for ( i = 0 ; i < jobs.numThreads ; i++ ) {
+		Sys_SemaphorePost( jobs.wake );
+	}
+	for ( i = 0 ; i < jobs.numThreads ; i++ ) {
+		Sys_JoinThread( jobs.threads[i] );
+	}
+
+	Sys_DestroySemaphore( jobs.done );
+	Sys_DestroySemaphore( jobs.wake );
+	Sys_DestroyMutex( jobs.lock );
+	Com_Memset( &jobs, 0, sizeof( jobs ) );
+}
+
 /*
 =================
 Com_InitRand
@@ -2713,6 +2896,12 @@ void Com_Init( char *commandLine ) {
 	}
 	Cmd_AddCommand ("quit", Com_Quit_f);
 	Cmd_AddCommand ("changeVectors", MSG_ReportChangeVectors_f );
+	Cmd_AddCommand ("huffbench", MSG_HuffmanBench_f );
+	Cmd_AddCommand ("msgfuzz", MSG_Fuzz_f );
+	Cmd_AddCommand ("snapbench", MSG_SnapBench_f );
+#ifdef DEDICATED
+	Cmd_AddCommand ("loadtest", CL_LoadTest_f );
+#endif
 	Cmd_AddCommand ("writeconfig", Com_WriteConfig_f );
 	Cmd_SetCommandCompletionFunc( "writeconfig", Cmd_CompleteCfgName );
 	Cmd_AddCommand("game_restart", Com_GameRestart_f);
@@ -2917,7 +3106,7 @@ void Com_ReadFromPipe( void )
 void Com_WriteConfigToFile( const char *filename ) {
 	fileHandle_t	f;
 
-	f = FS_FOpenFileWrite( filename );
+	f = FS_OpenAsyncWrite( filename, qfalse, 0 );
 	if ( !f ) {
 		Com_Printf ("Couldn't write %s.\n", filename );
 		return;
@@ -3076,6 +3265,14 @@ void Com_Frame( void ) {
 	int		msec, minMsec;
 	int		timeVal, timeValSV;
 	static int	lastTime = 0, bias = 0;
+
+	// dedicated servers are scheduled on the microsecond clock, what is
+	// left of a millisecond carries into the next frame's msec
+	static int64_t	lastFrameUsec = 0;
+	static int		frameUsecCarry = 0;
+	qboolean	usecTiming;
+	int64_t		deadline, now, waitUsec;
+	int			late = 0;
  
 	int		timeBeforeFirstEvents;
 	int		timeBeforeServer;
@@ -3134,25 +3331,61 @@ void Com_Frame( void ) {
 	else
 		minMsec = 1;
 
-	do
+	usecTiming = com_dedicated->integer && !com_timedemo->integer;
+
+	if(usecTiming)
 	{
-		if(com_sv_running->integer)
+		if(!lastFrameUsec)
+			lastFrameUsec = Sys_Microseconds();
+
+		// wake up when the server has a whole frame, not on the next
+		// millisecond after it
+		deadline = lastFrameUsec + MAX(minMsec, 1) * 1000 - frameUsecCarry;
+
+		do
 		{
-			timeValSV = SV_SendQueuedPackets();
+			waitUsec = deadline - Sys_Microseconds();
+
+			if(com_sv_running->integer)
+			{
+				timeValSV = SV_SendQueuedPackets();
+
+				if((int64_t) timeValSV * 1000 < waitUsec)
+					waitUsec = (int64_t) timeValSV * 1000;
+			}
+
+			if(com_busyWait->integer || waitUsec < 0)
+				waitUsec = 0;
+
+			NET_SleepMicroseconds(waitUsec);
+		} while((now = Sys_Microseconds()) < deadline);
+
+		late = now - deadline;
+	}
+	else
+	{
+		do
+		{
+			if(com_sv_running->integer)
+			{
+				timeValSV = SV_SendQueuedPackets();
+				
+				timeVal = Com_TimeVal(minMsec);
+
+				if(timeValSV < timeVal)
+					timeVal = timeValSV;
+			}
+			else
+				timeVal = Com_TimeVal(minMsec);
 			
-			timeVal = Com_TimeVal(minMsec);
+			if(com_busyWait->integer || timeVal < 1)
+				NET_Sleep(0);
+			else
+				NET_Sleep(timeVal - 1);
+		} while(Com_TimeVal(minMsec));
 
-			if(timeValSV < timeVal)
-				timeVal = timeValSV;
-		}
-		else
-			timeVal = Com_TimeVal(minMsec);
-		
-		if(com_busyWait->integer || timeVal < 1)
-			NET_Sleep(0);
-		else
-			NET_Sleep(timeVal - 1);
-	} while(Com_TimeVal(minMsec));
+		now = Sys_Microseconds();
+	}
 	
 	IN_Frame();
 
@@ -3161,6 +3394,18 @@ void Com_Frame( void ) {
 	
 	msec = com_frameTime - lastTime;
 
+	if(usecTiming)
+	{
+		int64_t elapsed = now - lastFrameUsec + frameUsecCarry;
+
+		msec = elapsed / 1000;
+		frameUsecCarry = elapsed % 1000;
+	}
+	else
+		frameUsecCarry = 0;
+
+	lastFrameUsec = now;
+
 	Cbuf_Execute ();
 
 	if (com_altivec->modified)
@@ -3243,11 +3488,18 @@ void Com_Frame( void ) {
 		sv = timeBeforeEvents - timeBeforeServer;
 		ev = timeBeforeServer - timeBeforeFirstEvents + timeBeforeClient - timeBeforeEvents;
 		cl = timeAfter - timeBeforeClient;
-		sv -= time_game;
+		sv -= time_game + time_snapBuild + time_snapEncode + time_snapSend;
 		cl -= time_frontend + time_backend;
 
-		Com_Printf ("frame:%i all:%3i sv:%3i ev:%3i cl:%3i gm:%3i rf:%3i bk:%3i\n", 
-					 com_frameNumber, all, sv, ev, cl, time_game, time_frontend, time_backend );
+		Com_Printf ("frame:%i all:%3i sv:%3i ev:%3i cl:%3i gm:%3i sb:%3i se:%3i ss:%3i rf:%3i bk:%3i", 
+					 com_frameNumber, all, sv, ev, cl, time_game, time_snapBuild, time_snapEncode, time_snapSend,
+					 time_frontend, time_backend );
+
+		// how many microseconds after its deadline the frame woke up
+		if ( usecTiming )
+			Com_Printf (" late:%4ius", late);
+
+		Com_Printf ("\n");
 	}	
 
 	//
@@ -3277,6 +3529,8 @@ Com_Shutdown
 =================
 */
 void Com_Shutdown (void) {
+	Com_ShutdownJobs();
+
 	if (logfile) {
 		FS_FCloseFile (logfile);
 		logfile = 0;
@@ -3292,6 +3546,8 @@ void Com_Shutdown (void) {
 		FS_HomeRemove( com_pipefile->string );
 	}
 
+	// we may be about to exit without FS_Shutdown
+	FS_WaitAsyncWrites();
 }
 
 /*
@@ -229,6 +229,8 @@ typedef struct {
 	int				hashSize;					// hash table size (power of 2)
 	fileInPack_t*	*hashTable;					// hash table
 	fileInPack_t*	buildBuffer;				// buffer with the filenames etc.
+	byte			*mapBase;					// the whole pk3 with fs_mapPaks
+	int				mapLength;
 } pack_t;
 
 typedef struct {
@@ -242,6 +244,7 @@ typedef struct searchpath_s {
 
 	pack_t		*pack;		// only one of pack / dir will be non NULL
 	directory_t	*dir;
+	int			order;		// position in fs_searchpaths, for the file index
 } searchpath_t;
 
 static	char		fs_gamedir[MAX_OSPATH];	// this will be a single file name with no separators
@@ -285,6 +288,12 @@ typedef struct {
 	int			zipFileLen;
 	qboolean	zipFile;
 	char		name[MAX_ZPATH];
+	struct fsAsync_s	*async;		// FS_OpenAsyncWrite
+	const byte	*mapData;		// the file in a mapped pk3, read without unzip
+	int			mapDataLen;		// compressed length
+	int			mapPos;			// uncompressed bytes read
+	qboolean	mapDeflated;
+	z_stream	*mapStream;
 } fileHandleData_t;
 
 static fileHandleData_t	fsh[MAX_FILE_HANDLES];
@@ -392,9 +401,451 @@ static long FS_HashFileName( const char *fname, int hashSize ) {
 	return hash;
 }
 
+/*
+=============================================================================
+
+ASYNC WRITES
+
+Files opened with FS_OpenAsyncWrite queue their writes in a ring buffer that
+a single writer thread drains, so a slow disk doesn't stall the frame.
+FS_Write only waits when the ring is full, FS_FCloseFile hands the close to
+the writer thread.  FS_Flush waits until everything queued is written,
+FS_Sync also waits for the disk unless asked not to.
+
+The main thread owns head and the requests, the writer thread tail and the
+FILE; both are read under fs_asyncLock.
+
+=============================================================================
+*/
+
+#define	FS_ASYNC_DEFAULT_BUFFER	( 64 * 1024 )
+#define	FS_ASYNC_MAX_BUFFER		( 16 * 1024 * 1024 )
+
+typedef struct fsAsync_s {
+	FILE			*file;
+	byte			*ring;
+	unsigned int	size;			// power of two
+	unsigned int	head;			// bytes queued
+	unsigned int	tail;			// bytes written
+
+	int				flushRequest;	// fflush once drained
+	int				flushDone;
+	int				syncRequest;	// fsync once drained
+	int				syncDone;
+	qboolean		flushEach;		// FS_APPEND_SYNC or FS_ForceFlush
+	qboolean		closing;		// fclose once drained
+	qboolean		closed;
+
+	// back-pressure
+	unsigned int	highWater;		// most bytes ever queued
+	int				stalls;			// writes that found the ring full
+	int				stallMsec;		// time spent waiting for the writer
+	int				syncs;
+	int				errors;			// failed writes, the data is dropped
+} fsAsync_t;
+
+static	cvar_t		*fs_asyncWrite;
+
+static	fsAsync_t	*fs_asyncFiles[MAX_FILE_HANDLES];
+static	void		*fs_asyncLock;
+static	void		*fs_asyncWake;
+static	void		*fs_asyncThread;
+static	qboolean	fs_asyncSignaled;
+static	qboolean	fs_asyncFailed;		// no thread, write synchronously
+static	int			fs_asyncOpen;		// handles with an fsAsync_t, main thread only
+static	int			fs_asyncClosing;	// of those, the ones waiting to be reaped
+
+// totals of the closed files
+static	int			fs_asyncClosedFiles;
+static	int			fs_asyncClosedKB;
+static	int			fs_asyncClosedStalls;
+static	int			fs_asyncClosedStallMsec;
+static	int			fs_asyncClosedSyncs;
+static	int			fs_asyncClosedErrors;
+
+/*
+================
+FS_AsyncWriterThread
+================
+*/
+static void FS_AsyncWriterThread( void *arg ) {
+	fsAsync_t		*a;
+	unsigned int	head, tail, offset;
+	int				flushRequest, syncRequest;
+	qboolean		flushEach, closing, progress;
+	int				i, len, written;
+
+	while ( 1 ) {
+		Sys_SemaphoreWait( fs_asyncWake );
+
+		do {
+			Sys_LockMutex( fs_asyncLock );
+			fs_asyncSignaled = qfalse;
+			Sys_UnlockMutex( fs_asyncLock );
+
+			progress = qfalse;
+			for ( i = 1 ; i < MAX_FILE_HANDLES ; i++ ) {
+				Sys_LockMutex( fs_asyncLock );
+				a = fs_asyncFiles[i];
+				if ( !a || a->closed ) {
+					Sys_UnlockMutex( fs_asyncLock );
+					continue;
+				}
+				head = a->head;
+				tail = a->tail;
+				flushRequest = a->flushRequest;
+				syncRequest = a->syncRequest;
+				flushEach = a->flushEach;
+				closing = a->closing;
+				Sys_UnlockMutex( fs_asyncLock );
+
+				if ( head != tail ) {
+					offset = tail & ( a->size - 1 );
+					len = head - tail;
+					if ( len > a->size - offset ) {
+						len = a->size - offset;
+					}
+
+					written = fwrite( a->ring + offset, 1, len, a->file );
+					if ( flushEach && tail + len == head ) {
+						fflush( a->file );
+					}
+
+					Sys_LockMutex( fs_asyncLock );
+					a->tail += len;
+					if ( written != len ) {
+						a->errors++;
+					}
+					Sys_UnlockMutex( fs_asyncLock );
+				} else if ( syncRequest != a->syncDone ) {
+					if ( !Sys_FSync( a->file ) ) {
+						Sys_LockMutex( fs_asyncLock );
+						a->errors++;
+						Sys_UnlockMutex( fs_asyncLock );
+					}
+
+					Sys_LockMutex( fs_asyncLock );
+					a->syncDone = syncRequest;
+					a->flushDone = flushRequest;
+					a->syncs++;
+					Sys_UnlockMutex( fs_asyncLock );
+				} else if ( flushRequest != a->flushDone ) {
+					fflush( a->file );
+
+					Sys_LockMutex( fs_asyncLock );
+					a->flushDone = flushRequest;
+					Sys_UnlockMutex( fs_asyncLock );
+				} else if ( closing ) {
+					fclose( a->file );
+
+					Sys_LockMutex( fs_asyncLock );
+					a->closed = qtrue;
+					Sys_UnlockMutex( fs_asyncLock );
+				} else {
+					continue;
+				}
+				progress = qtrue;
+			}
+		} while ( progress );
+	}
+}
+
+/*
+================
+FS_AsyncSignal
+================
+*/
+static void FS_AsyncSignal( void ) {
+	qboolean	signaled;
+
+	Sys_LockMutex( fs_asyncLock );
+	signaled = fs_asyncSignaled;
+	fs_asyncSignaled = qtrue;
+	Sys_UnlockMutex( fs_asyncLock );
+
+	if ( !signaled ) {
+		Sys_SemaphorePost( fs_asyncWake );
+	}
+}
+
+/*
+================
+FS_AsyncStartThread
+================
+*/
+static qboolean FS_AsyncStartThread( void ) {
+	if ( fs_asyncThread ) {
+		return qtrue;
+	}
+	if ( fs_asyncFailed ) {
+		return qfalse;
+	}
+
+	fs_asyncLock = Sys_CreateMutex();
+	fs_asyncWake = Sys_CreateSemaphore();
+	if ( fs_asyncLock && fs_asyncWake ) {
+		fs_asyncThread = Sys_CreateThread( FS_AsyncWriterThread, NULL );
+	}
+
+	if ( !fs_asyncThread ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't start the file writer thread, writing synchronously\n" );
+		if ( fs_asyncWake ) {
+			Sys_DestroySemaphore( fs_asyncWake );
+		}
+		if ( fs_asyncLock ) {
+			Sys_DestroyMutex( fs_asyncLock );
+		}
+		fs_asyncWake = fs_asyncLock = NULL;
+		fs_asyncFailed = qtrue;
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+================
+FS_AsyncReap
+
+Frees the handles the writer thread has closed
+================
+*/
+static void FS_AsyncReap( void ) {
+	fsAsync_t	*a;
+	int			i, errors;
+	qboolean	closed;
+	char		name[MAX_ZPATH];
+
+	if ( !fs_asyncClosing ) {
+		return;
+	}
+
+	for ( i = 1 ; i < MAX_FILE_HANDLES && fs_asyncClosing ; i++ ) {
+		// only the main thread sets closing, so it can be read unlocked
+		a = fsh[i].async;
+		if ( !a || !a->closing ) {
+			continue;
+		}
+
+		Sys_LockMutex( fs_asyncLock );
+		closed = a->closed;
+		if ( closed ) {
+			fs_asyncFiles[i] = NULL;
+		}
+		Sys_UnlockMutex( fs_asyncLock );
+
+		if ( !closed ) {
+			continue;
+		}
+
+		fs_asyncClosedFiles++;
+		fs_asyncClosedKB += a->head / 1024;
+		fs_asyncClosedStalls += a->stalls;
+		fs_asyncClosedStallMsec += a->stallMsec;
+		fs_asyncClosedSyncs += a->syncs;
+		fs_asyncClosedErrors += a->errors;
+
+		errors = a->errors;
+		Q_strncpyz( name, fsh[i].name, sizeof( name ) );
+		fs_asyncOpen--;
+		fs_asyncClosing--;
+
+		Z_Free( a->ring );
+		Z_Free( a );
+		Com_Memset( &fsh[i], 0, sizeof( fsh[i] ) );
+
+		// printing may open the console log
+		if ( errors ) {
+			Com_Printf( S_COLOR_YELLOW "WARNING: %i writes to %s failed\n", errors, name );
+		}
+	}
+}
+
+/*
+================
+FS_AsyncWait
+
+Waits until the writer thread has written everything queued and answered
+all requests, including a pending close
+================
+*/
+static void FS_AsyncWait( fsAsync_t *a ) {
+	qboolean	idle;
+
+	while ( 1 ) {
+		Sys_LockMutex( fs_asyncLock );
+		idle = a->tail == a->head && a->flushDone == a->flushRequest
+			&& a->syncDone == a->syncRequest && a->closing == a->closed;
+		Sys_UnlockMutex( fs_asyncLock );
+
+		if ( idle ) {
+			return;
+		}
+
+		FS_AsyncSignal();
+		Sys_Sleep( 1 );
+	}
+}
+
+/*
+================
+FS_WaitAsyncWrites
+
+Finishes every queued write and close, before the filesystem goes away
+================
+*/
+void FS_WaitAsyncWrites( void ) {
+	int		i;
+
+	if ( !fs_asyncOpen ) {
+		return;
+	}
+
+	for ( i = 1 ; i < MAX_FILE_HANDLES ; i++ ) {
+		if ( fsh[i].async ) {
+			FS_AsyncWait( fsh[i].async );
+		}
+	}
+	FS_AsyncReap();
+}
+
+/*
+================
+FS_AsyncWaitName
+
+Reading a file that is still being written would see stale data
+================
+*/
+static void FS_AsyncWaitName( const char *qpath ) {
+	int		i;
+
+	// this is on every lookup, don't walk the handles for nothing
+	if ( !fs_asyncOpen ) {
+		return;
+	}
+
+	for ( i = 1 ; i < MAX_FILE_HANDLES ; i++ ) {
+		if ( fsh[i].async && !Q_stricmp( fsh[i].name, qpath ) ) {
+			FS_AsyncWait( fsh[i].async );
+		}
+	}
+	FS_AsyncReap();
+}
+
+/*
+================
+FS_AsyncQueue
+
+Copies the data into the ring, waiting for the writer thread only if it is full
+================
+*/
+static void FS_AsyncQueue( fsAsync_t *a, const byte *data, int len ) {
+	unsigned int	queued, offset;
+	int				space, n;
+	int				stallStart;
+
+	stallStart = 0;
+	while ( len > 0 ) {
+		Sys_LockMutex( fs_asyncLock );
+		space = a->size - ( a->head - a->tail );
+		Sys_UnlockMutex( fs_asyncLock );
+
+		if ( !space ) {
+			if ( !stallStart ) {
+				stallStart = Sys_Milliseconds();
+				a->stalls++;
+			}
+			FS_AsyncSignal();
+			Sys_Sleep( 1 );
+			continue;
+		}
+
+		offset = a->head & ( a->size - 1 );
+		n = MIN( len, space );
+		n = MIN( n, a->size - offset );
+		Com_Memcpy( a->ring + offset, data, n );
+
+		Sys_LockMutex( fs_asyncLock );
+		a->head += n;
+		queued = a->head - a->tail;
+		Sys_UnlockMutex( fs_asyncLock );
+
+		if ( queued > a->highWater ) {
+			a->highWater = queued;
+		}
+		data += n;
+		len -= n;
+	}
+
+	if ( stallStart ) {
+		a->stallMsec += Sys_Milliseconds() - stallStart;
+	}
+
+	FS_AsyncSignal();
+}
+
+/*
+================
+FS_AsyncClose
+
+Leaves the handle reserved until the writer thread has closed the file
+================
+*/
+static void FS_AsyncClose( fileHandle_t f ) {
+	fsAsync_t	*a = fsh[f].async;
+
+	Sys_LockMutex( fs_asyncLock );
+	a->closing = qtrue;
+	Sys_UnlockMutex( fs_asyncLock );
+	fs_asyncClosing++;
+
+	FS_AsyncSignal();
+}
+
+/*
+================
+FS_AsyncWriteStats_f
+================
+*/
+static void FS_AsyncWriteStats_f( void ) {
+	fsAsync_t		*a;
+	unsigned int	queued;
+	int				i, open;
+
+	FS_AsyncReap();
+
+	Com_Printf( "async writes: %s\n", fs_asyncThread ? "writer thread running" :
+		fs_asyncFailed ? "no writer thread" : "nothing written yet" );
+
+	open = 0;
+	for ( i = 1 ; i < MAX_FILE_HANDLES ; i++ ) {
+		a = fsh[i].async;
+		if ( !a ) {
+			continue;
+		}
+		if ( !open++ ) {
+			Com_Printf( " handle   queued  ring kB  high kB    written kB  stalls  msec  syncs  errors  file\n" );
+		}
+
+		Sys_LockMutex( fs_asyncLock );
+		queued = a->head - a->tail;
+		Sys_UnlockMutex( fs_asyncLock );
+
+		Com_Printf( "%7i %8u %8u %8u %13u %7i %5i %6i %7i  %s%s\n", i, queued, a->size / 1024,
+			a->highWater / 1024, a->tail / 1024, a->stalls, a->stallMsec, a->syncs, a->errors,
+			fsh[i].name, a->closing ? " (closing)" : "" );
+	}
+
+	Com_Printf( "%i open, %i closed: %i kB, %i stalls (%i msec), %i syncs, %i errors\n",
+		open, fs_asyncClosedFiles, fs_asyncClosedKB, fs_asyncClosedStalls,
+		fs_asyncClosedStallMsec, fs_asyncClosedSyncs, fs_asyncClosedErrors );
+}
+
 static fileHandle_t	FS_HandleForFile(void) {
 	int		i;
 
+	FS_AsyncReap();
+
 	for ( i = 1 ; i < MAX_FILE_HANDLES ; i++ ) {
 		if ( fsh[i].handleFiles.file.o == NULL ) {
 			return i;
@@ -421,6 +872,13 @@ static FILE	*FS_FileForHandle( fileHandle_t f ) {
 void	FS_ForceFlush( fileHandle_t f ) {
 	FILE *file;
 
+	if ( fsh[f].async ) {
+		Sys_LockMutex( fs_asyncLock );
+		fsh[f].async->flushEach = qtrue;
+		Sys_UnlockMutex( fs_asyncLock );
+		return;
+	}
+
 	file = FS_FileForHandle(f);
 	setvbuf( file, NULL, _IONBF, 0 );
 }
@@ -862,81 +1320,303 @@ void FS_Rename( const char *from, const char *to ) {
 }
 
 /*
-==============
-FS_FCloseFile
+=============================================================================
 
-If the FILE pointer is an open pak file, leave it open.
+MAPPED PK3 FILES
 
-For some reason, other dll's can't just cal fclose()
-on files returned by FS_FOpenFile...
-==============
+With fs_mapPaks the whole pk3 is mapped when it is loaded.  Files in it are
+then read without the shared unzip handle: stored entries are copied or
+handed out straight from the mapping by FS_MapFile, deflated ones inflate
+from the mapping.  If the zip headers aren't what we expect, the file goes
+through unzip as before.
+
+A mapped pk3 must not be overwritten or truncated in place while the game
+is running.  Reads past the new end of the file fault instead of coming
+back short.  The mappings also take address space for as long as the pak
+is loaded, so fs_mapPaks defaults to 0 on 32 bit builds.
+
+=============================================================================
 */
-void FS_FCloseFile( fileHandle_t f ) {
-	if ( !fs_searchpaths ) {
-		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+
+#define	ZIP_CENTRAL_SIGNATURE	0x02014b50
+#define	ZIP_CENTRAL_SIZE		46
+#define	ZIP_LOCAL_SIGNATURE		0x04034b50
+#define	ZIP_LOCAL_SIZE			30
+
+#define	MAX_PAK_VIEWS			64
+
+static	cvar_t		*fs_mapPaks;
+
+// pointers FS_MapFile gave out into pk3 mappings, FS_UnmapFile leaves them
+// alone even after the pak has been freed
+static	const byte	*fs_pakViews[MAX_PAK_VIEWS];
+
+static unsigned int FS_ZipShort( const byte *p ) {
+	return p[0] | ( p[1] << 8 );
+}
+
+static unsigned int FS_ZipLong( const byte *p ) {
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned int)p[3] << 24 );
+}
+
+/*
+================
+FS_MapPak
+================
+*/
+static void FS_MapPak( pack_t *pack ) {
+	FILE	*f;
+	long	len;
+
+	if ( !fs_mapPaks || !fs_mapPaks->integer ) {
+		return;
 	}
 
-	if (fsh[f].zipFile == qtrue) {
-		unzCloseCurrentFile( fsh[f].handleFiles.file.z );
-		if ( fsh[f].handleFiles.unique ) {
-			unzClose( fsh[f].handleFiles.file.z );
-		}
-		Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
+	f = Sys_FOpen( pack->pakFilename, "rb" );
+	if ( !f ) {
 		return;
 	}
 
-	// we didn't find it as a pak, so close it as a unique file
-	if (fsh[f].handleFiles.file.o) {
-		fclose (fsh[f].handleFiles.file.o);
+	len = FS_fplength( f );
+	if ( len > 0 && len < 0x7fffffff ) {
+		pack->mapBase = Sys_MapFile( f, len );
+		if ( pack->mapBase ) {
+			pack->mapLength = len;
+		}
 	}
-	Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
+	fclose( f );
 }
 
 /*
-===========
-FS_FOpenFileWrite
+================
+FS_PakEntryData
 
-===========
+Finds the data of a file in a mapped pk3, from the central directory
+entry at pakFile->pos
+================
 */
-fileHandle_t FS_FOpenFileWrite( const char *filename ) {
-	char			*ospath;
-	fileHandle_t	f;
+static qboolean FS_PakEntryData( pack_t *pack, fileInPack_t *pakFile,
+	const byte **data, int *compressedLen, qboolean *deflated ) {
+	const byte		*p;
+	unsigned int	method, csize, usize, local, start;
 
-	if ( !fs_searchpaths ) {
-		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	if ( !pack->mapBase || pakFile->pos + ZIP_CENTRAL_SIZE > pack->mapLength ) {
+		return qfalse;
 	}
 
-	f = FS_HandleForFile();
-	fsh[f].zipFile = qfalse;
-
-	ospath = FS_BuildOSPath( fs_homepath->string, fs_gamedir, filename );
-
-	if ( fs_debug->integer ) {
-		Com_Printf( "FS_FOpenFileWrite: %s\n", ospath );
+	p = pack->mapBase + pakFile->pos;
+	if ( FS_ZipLong( p ) != ZIP_CENTRAL_SIGNATURE || ( FS_ZipShort( p + 8 ) & 1 ) ) {
+		return qfalse;		// moved or encrypted
 	}
 
-	FS_CheckFilenameIsMutable( ospath, __func__ );
+	method = FS_ZipShort( p + 10 );
+	csize = FS_ZipLong( p + 20 );
+	usize = FS_ZipLong( p + 24 );
+	local = FS_ZipLong( p + 42 );
 
-	if( FS_CreatePath( ospath ) ) {
-		return 0;
+	if ( ( method != 0 && method != Z_DEFLATED ) || usize != pakFile->len ) {
+		return qfalse;
+	}
+	if ( method == 0 && csize != usize ) {
+		return qfalse;
 	}
 
-	// enabling the following line causes a recursive function call loop
-	// when running with +set logfile 1 +set developer 1
-	//Com_DPrintf( "writing to: %s\n", ospath );
-	fsh[f].handleFiles.file.o = Sys_FOpen( ospath, "wb" );
-
-	Q_strncpyz( fsh[f].name, filename, sizeof( fsh[f].name ) );
+	if ( local > pack->mapLength - ZIP_LOCAL_SIZE ) {
+		return qfalse;
+	}
+	p = pack->mapBase + local;
+	if ( FS_ZipLong( p ) != ZIP_LOCAL_SIGNATURE ) {
+		return qfalse;
+	}
 
-	fsh[f].handleSync = qfalse;
-	if (!fsh[f].handleFiles.file.o) {
-		f = 0;
+	start = local + ZIP_LOCAL_SIZE + FS_ZipShort( p + 26 ) + FS_ZipShort( p + 28 );
+	if ( start > pack->mapLength || csize > pack->mapLength - start ) {
+		return qfalse;
 	}
-	return f;
+
+	*data = pack->mapBase + start;
+	*compressedLen = csize;
+	*deflated = method == Z_DEFLATED;
+	return qtrue;
 }
 
 /*
-===========
+================
+FS_RewindMapped
+================
+*/
+static void FS_RewindMapped( fileHandle_t f ) {
+	fileHandleData_t	*fh = &fsh[f];
+
+	fh->mapPos = 0;
+	if ( fh->mapStream ) {
+		inflateReset( fh->mapStream );
+		fh->mapStream->next_in = (Bytef *)fh->mapData;
+		fh->mapStream->avail_in = fh->mapDataLen;
+	}
+}
+
+/*
+================
+FS_ReadMapped
+================
+*/
+static int FS_ReadMapped( fileHandle_t f, void *buffer, int len ) {
+	fileHandleData_t	*fh = &fsh[f];
+	z_stream			*s;
+	int					err;
+
+	len = MIN( len, fh->zipFileLen - fh->mapPos );
+	if ( len <= 0 ) {
+		return 0;
+	}
+
+	if ( !fh->mapDeflated ) {
+		Com_Memcpy( buffer, fh->mapData + fh->mapPos, len );
+		fh->mapPos += len;
+		return len;
+	}
+
+	if ( !fh->mapStream ) {
+		s = Z_Malloc( sizeof( *s ) );
+		s->next_in = (Bytef *)fh->mapData;
+		s->avail_in = fh->mapDataLen;
+		if ( inflateInit2( s, -MAX_WBITS ) != Z_OK ) {
+			Z_Free( s );
+			return 0;
+		}
+		fh->mapStream = s;
+	}
+
+	s = fh->mapStream;
+	s->next_out = buffer;
+	s->avail_out = len;
+	do {
+		err = inflate( s, Z_SYNC_FLUSH );
+	} while ( err == Z_OK && s->avail_out );
+
+	len -= s->avail_out;
+	fh->mapPos += len;
+	return len;
+}
+
+/*
+================
+FS_CloseMapped
+================
+*/
+static void FS_CloseMapped( fileHandle_t f ) {
+	if ( fsh[f].mapStream ) {
+		inflateEnd( fsh[f].mapStream );
+		Z_Free( fsh[f].mapStream );
+	}
+	Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
+}
+
+/*
+================
+FS_UnmapPak
+================
+*/
+static void FS_UnmapPak( pack_t *pack ) {
+	if ( pack->mapBase ) {
+		Sys_UnmapFile( pack->mapBase, pack->mapLength );
+		pack->mapBase = NULL;
+	}
+}
+
+/*
+==============
+FS_FCloseFile
+
+If the FILE pointer is an open pak file, leave it open.
+
+For some reason, other dll's can't just cal fclose()
+on files returned by FS_FOpenFile...
+==============
+*/
+void FS_FCloseFile( fileHandle_t f ) {
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	if ( fsh[f].mapData ) {
+		FS_CloseMapped( f );
+		return;
+	}
+
+	if (fsh[f].zipFile == qtrue) {
+		unzCloseCurrentFile( fsh[f].handleFiles.file.z );
+		if ( fsh[f].handleFiles.unique ) {
+			unzClose( fsh[f].handleFiles.file.z );
+		}
+		Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
+		return;
+	}
+
+	// the writer thread closes it once everything is written
+	if ( fsh[f].async ) {
+		if ( !fsh[f].async->closing ) {
+			FS_AsyncClose( f );
+		}
+		return;
+	}
+
+	// we didn't find it as a pak, so close it as a unique file
+	if (fsh[f].handleFiles.file.o) {
+		fclose (fsh[f].handleFiles.file.o);
+	}
+	Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
+}
+
+/*
+===========
+FS_FOpenFileWrite
+
+===========
+*/
+fileHandle_t FS_FOpenFileWrite( const char *filename ) {
+	char			*ospath;
+	fileHandle_t	f;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	// don't race the writer thread for the same file
+	FS_AsyncWaitName( filename );
+
+	f = FS_HandleForFile();
+	fsh[f].zipFile = qfalse;
+
+	ospath = FS_BuildOSPath( fs_homepath->string, fs_gamedir, filename );
+
+	if ( fs_debug->integer ) {
+		Com_Printf( "FS_FOpenFileWrite: %s\n", ospath );
+	}
+
+	FS_CheckFilenameIsMutable( ospath, __func__ );
+
+	if( FS_CreatePath( ospath ) ) {
+		return 0;
+	}
+
+	// enabling the following line causes a recursive function call loop
+	// when running with +set logfile 1 +set developer 1
+	//Com_DPrintf( "writing to: %s\n", ospath );
+	fsh[f].handleFiles.file.o = Sys_FOpen( ospath, "wb" );
+
+	Q_strncpyz( fsh[f].name, filename, sizeof( fsh[f].name ) );
+
+	fsh[f].handleSync = qfalse;
+	if (!fsh[f].handleFiles.file.o) {
+		f = 0;
+	}
+	return f;
+}
+
+/*
+===========
 FS_FOpenFileAppend
 
 ===========
@@ -949,6 +1629,9 @@ fileHandle_t FS_FOpenFileAppend( const char *filename ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
 	}
 
+	// don't race the writer thread for the same file
+	FS_AsyncWaitName( filename );
+
 	f = FS_HandleForFile();
 	fsh[f].zipFile = qfalse;
 
@@ -977,6 +1660,51 @@ fileHandle_t FS_FOpenFileAppend( const char *filename ) {
 	return f;
 }
 
+/*
+===========
+FS_OpenAsyncWrite
+
+Opens a file for writing like FS_FOpenFileWrite or FS_FOpenFileAppend, but
+the writes are done by the writer thread.  bufferSize is the most that can
+be queued before FS_Write waits, 0 for the default.  Falls back to ordinary
+writes if fs_asyncWrite is 0 or there is no thread.
+===========
+*/
+fileHandle_t FS_OpenAsyncWrite( const char *filename, qboolean append, int bufferSize ) {
+	fileHandle_t	f;
+	fsAsync_t		*a;
+	unsigned int	size;
+
+	f = append ? FS_FOpenFileAppend( filename ) : FS_FOpenFileWrite( filename );
+	if ( !f || !fs_asyncWrite || !fs_asyncWrite->integer ) {
+		return f;
+	}
+
+	if ( !FS_AsyncStartThread() ) {
+		return f;
+	}
+
+	if ( bufferSize <= 0 ) {
+		bufferSize = FS_ASYNC_DEFAULT_BUFFER;
+	}
+	bufferSize = MIN( bufferSize, FS_ASYNC_MAX_BUFFER );
+	for ( size = 1024 ; size < bufferSize ; size <<= 1 ) {
+	}
+
+	a = Z_Malloc( sizeof( *a ) );
+	a->file = fsh[f].handleFiles.file.o;
+	a->ring = Z_Malloc( size );
+	a->size = size;
+	fsh[f].async = a;
+	fs_asyncOpen++;
+
+	Sys_LockMutex( fs_asyncLock );
+	fs_asyncFiles[f] = a;
+	Sys_UnlockMutex( fs_asyncLock );
+
+	return f;
+}
+
 /*
 ===========
 FS_FCreateOpenPipeFile
@@ -1280,7 +2008,14 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 					if(strstr(filename, "ui.qvm"))
 						pak->referenced |= FS_UI_REF;
 
-					if(uniqueFILE)
+					if(FS_PakEntryData(pak, pakFile, &fsh[*file].mapData,
+						&fsh[*file].mapDataLen, &fsh[*file].mapDeflated))
+					{
+						// read it from the mapping, nothing is shared
+						fsh[*file].handleFiles.file.z = pak->handle;
+						fsh[*file].handleFiles.unique = qfalse;
+					}
+					else if(uniqueFILE)
 					{
 						// open a new file on the pakfile
 						fsh[*file].handleFiles.file.z = unzOpen(pak->pakFilename);
@@ -1294,11 +2029,14 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 					Q_strncpyz(fsh[*file].name, filename, sizeof(fsh[*file].name));
 					fsh[*file].zipFile = qtrue;
 
-					// set the file position in the zip file (also sets the current file info)
-					unzSetOffset(fsh[*file].handleFiles.file.z, pakFile->pos);
+					if(!fsh[*file].mapData)
+					{
+						// set the file position in the zip file (also sets the current file info)
+						unzSetOffset(fsh[*file].handleFiles.file.z, pakFile->pos);
 
-					// open the file in the zip
-					unzOpenCurrentFile(fsh[*file].handleFiles.file.z);
+						// open the file in the zip
+						unzOpenCurrentFile(fsh[*file].handleFiles.file.z);
+					}
 					fsh[*file].zipFilePos = pakFile->pos;
 					fsh[*file].zipFileLen = pakFile->len;
 
@@ -1369,98 +2107,324 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 }
 
 /*
-===========
-FS_FOpenFileRead
+=============================================================================
 
-Finds the file in the search path.
-Returns filesize and an open FILE pointer.
-Used for streaming data out of either a
-separate file or a ZIP file.
-===========
+FILE INDEX
+
+One hash table over the files of every pk3, built in FS_Startup, so a lookup
+doesn't have to probe each pak in turn.  Directories can change while we run
+and are still checked on disk; FS_LookupNext merges them with the paks that
+have the file by their place in fs_searchpaths, so the pure order and all the
+checks in FS_FOpenFileReadDir stay the same as walking the whole chain.
+
+=============================================================================
 */
-long FS_FOpenFileRead(const char *filename, fileHandle_t *file, qboolean uniqueFILE)
-{
-	searchpath_t *search;
-	long len;
-	qboolean isLocalConfig;
 
-	if(!fs_searchpaths)
-		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
+#define	FS_LOOKUP_MAX_HITS	64		// more paks with the file walk the chain
 
-	isLocalConfig = !strcmp(filename, "autoexec.cfg") || !strcmp(filename, Q3CONFIG_CFG);
-	for(search = fs_searchpaths; search; search = search->next)
-	{
-		// autoexec.cfg and q3config.cfg can only be loaded outside of pk3 files.
-		if (isLocalConfig && search->pack)
-			continue;
+typedef struct {
+	fileInPack_t	*file;
+	searchpath_t	*search;
+	int				next;			// -1 ends the chain
+} fsIndexHit_t;
 
-		len = FS_FOpenFileReadDir(filename, search, file, uniqueFILE, qfalse);
+static	cvar_t			*fs_index;
 
-		if(file == NULL)
-		{
-			if(len > 0)
-				return len;
-		}
-		else
-		{
-			if(len >= 0 && *file)
-				return len;
-		}
+static	int				*fs_indexHeads;
+static	int				fs_indexSize;			// power of two
+static	fsIndexHit_t	*fs_indexHits;
+static	int				fs_numIndexHits;
+static	int				fs_indexMsec;
 
-	}
-	
-#ifdef FS_MISSING
-	if(missingFiles)
-		fprintf(missingFiles, "%s\n", filename);
-#endif
+static	searchpath_t	*fs_indexDirs[MAX_SEARCH_PATHS];
+static	int				fs_numIndexDirs;
 
-	if(file)
-	{
-		*file = 0;
-		return -1;
-	}
-	else
-	{
-		// When file is NULL, we're querying the existence of the file
-		// If we've got here, it doesn't exist
-		return 0;
+typedef struct {
+	searchpath_t	*chain;			// next in fs_searchpaths without the index
+	qboolean		indexed;
+	fsIndexHit_t	*hits[FS_LOOKUP_MAX_HITS];
+	int				numHits;
+	int				hit;
+	int				dir;
+} fsLookup_t;
+
+/*
+================
+FS_IndexHash
+
+Case and separator insensitive like FS_FilenameCompare
+================
+*/
+static unsigned int FS_IndexHash( const char *name ) {
+	unsigned int	hash;
+	int				c;
+
+	hash = 5381;
+	while ( ( c = *name++ ) != '\0' ) {
+		if ( c >= 'a' && c <= 'z' ) {
+			c -= 'a' - 'A';
+		}
+		if ( c == '\\' || c == ':' ) {
+			c = '/';
+		}
+		hash = hash * 33 + c;
 	}
+	return hash;
 }
 
 /*
-=================
-FS_FindVM
+================
+FS_IndexOrder
 
-Find a suitable VM file in search path order.
+Numbers the search paths and lists the directories, after every change
+to the order of fs_searchpaths
+================
+*/
+static void FS_IndexOrder( void ) {
+	searchpath_t	*search;
+	int				order;
 
-In each searchpath try:
- - open DLL file if DLL loading enabled
- - open QVM file
+	fs_numIndexDirs = 0;
+	for ( search = fs_searchpaths, order = 0 ; search ; search = search->next, order++ ) {
+		search->order = order;
+		if ( search->dir && fs_numIndexDirs < MAX_SEARCH_PATHS ) {
+			fs_indexDirs[fs_numIndexDirs++] = search;
+		}
+	}
+}
 
-Enable search for DLL by setting enableDll to FSVM_ENABLEDLL
+/*
+================
+FS_FreeIndex
+================
+*/
+static void FS_FreeIndex( void ) {
+	if ( fs_indexHeads ) {
+		Z_Free( fs_indexHeads );
+	}
+	if ( fs_indexHits ) {
+		Z_Free( fs_indexHits );
+	}
+	fs_indexHeads = NULL;
+	fs_indexHits = NULL;
+	fs_indexSize = 0;
+	fs_numIndexHits = 0;
+	fs_numIndexDirs = 0;
+}
 
-write found DLL or QVM to "found" and return VMI_NATIVE if DLL, VMI_COMPILED if QVM
-Return the searchpath in "startSearch".
-=================
+/*
+================
+FS_BuildIndex
+================
 */
+static void FS_BuildIndex( void ) {
+	searchpath_t	*search;
+	fsIndexHit_t	*hit;
+	unsigned int	h;
+	int				i, start;
 
-int FS_FindVM(void **startSearch, char *found, int foundlen, const char *name, int enableDll)
-{
-	searchpath_t *search, *lastSearch;
-	directory_t *dir;
-	pack_t *pack;
-	char dllName[MAX_OSPATH], qvmName[MAX_OSPATH];
-	char *netpath;
+	FS_FreeIndex();
+	FS_IndexOrder();
 
-	if(!fs_searchpaths)
-		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
+	if ( !fs_packFiles ) {
+		return;
+	}
 
-	if(enableDll)
-		Com_sprintf(dllName, sizeof(dllName), "%s" ARCH_STRING DLL_EXT, name);
+	start = Sys_Milliseconds();
 
-	Com_sprintf(qvmName, sizeof(qvmName), "vm/%s.qvm", name);
+	for ( fs_indexSize = 1024 ; fs_indexSize < fs_packFiles * 2 ; fs_indexSize <<= 1 ) {
+	}
+	fs_indexHeads = Z_Malloc( fs_indexSize * sizeof( *fs_indexHeads ) );
+	Com_Memset( fs_indexHeads, 0xff, fs_indexSize * sizeof( *fs_indexHeads ) );
+	fs_indexHits = Z_Malloc( fs_packFiles * sizeof( *fs_indexHits ) );
 
-	lastSearch = *startSearch;
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		if ( !search->pack ) {
+			continue;
+		}
+		for ( i = 0 ; i < search->pack->numfiles && fs_numIndexHits < fs_packFiles ; i++ ) {
+			// a broken zip directory leaves the rest unnamed
+			if ( !search->pack->buildBuffer[i].name ) {
+				break;
+			}
+			h = FS_IndexHash( search->pack->buildBuffer[i].name ) & ( fs_indexSize - 1 );
+			hit = &fs_indexHits[fs_numIndexHits];
+			hit->file = &search->pack->buildBuffer[i];
+			hit->search = search;
+			hit->next = fs_indexHeads[h];
+			fs_indexHeads[h] = fs_numIndexHits++;
+		}
+	}
+
+	fs_indexMsec = Sys_Milliseconds() - start;
+}
+
+/*
+================
+FS_LookupBegin
+================
+*/
+static void FS_LookupBegin( fsLookup_t *l, const char *filename ) {
+	fsIndexHit_t	*hit;
+	int				i, j;
+
+	l->chain = fs_searchpaths;
+	l->indexed = qfalse;
+	l->numHits = l->hit = l->dir = 0;
+
+	if ( !fs_indexHeads || !fs_index->integer ) {
+		return;
+	}
+
+	if ( filename[0] == '/' || filename[0] == '\\' ) {
+		filename++;
+	}
+
+	for ( i = fs_indexHeads[FS_IndexHash( filename ) & ( fs_indexSize - 1 )] ; i >= 0 ; i = hit->next ) {
+		hit = &fs_indexHits[i];
+		if ( FS_FilenameCompare( hit->file->name, filename ) ) {
+			continue;
+		}
+		if ( l->numHits == FS_LOOKUP_MAX_HITS ) {
+			return;
+		}
+
+		// keep them in search order
+		for ( j = l->numHits ; j > 0 && l->hits[j - 1]->search->order > hit->search->order ; j-- ) {
+			l->hits[j] = l->hits[j - 1];
+		}
+		l->hits[j] = hit;
+		l->numHits++;
+	}
+
+	l->indexed = qtrue;
+}
+
+/*
+================
+FS_LookupNext
+
+The next search path that may have the file, NULL when there are no more
+================
+*/
+static searchpath_t *FS_LookupNext( fsLookup_t *l ) {
+	searchpath_t	*search;
+
+	if ( !l->indexed ) {
+		search = l->chain;
+		if ( search ) {
+			l->chain = search->next;
+		}
+		return search;
+	}
+
+	if ( l->hit < l->numHits && ( l->dir >= fs_numIndexDirs
+		|| l->hits[l->hit]->search->order < fs_indexDirs[l->dir]->order ) ) {
+		return l->hits[l->hit++]->search;
+	}
+	if ( l->dir < fs_numIndexDirs ) {
+		return fs_indexDirs[l->dir++];
+	}
+	return NULL;
+}
+
+/*
+===========
+FS_FOpenFileRead
+
+Finds the file in the search path.
+Returns filesize and an open FILE pointer.
+Used for streaming data out of either a
+separate file or a ZIP file.
+===========
+*/
+long FS_FOpenFileRead(const char *filename, fileHandle_t *file, qboolean uniqueFILE)
+{
+	searchpath_t *search;
+	fsLookup_t lookup;
+	long len;
+	qboolean isLocalConfig;
+
+	if(!fs_searchpaths)
+		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
+
+	FS_AsyncWaitName(filename);
+
+	isLocalConfig = !strcmp(filename, "autoexec.cfg") || !strcmp(filename, Q3CONFIG_CFG);
+	FS_LookupBegin(&lookup, filename);
+	while((search = FS_LookupNext(&lookup)) != NULL)
+	{
+		// autoexec.cfg and q3config.cfg can only be loaded outside of pk3 files.
+		if (isLocalConfig && search->pack)
+			continue;
+
+		len = FS_FOpenFileReadDir(filename, search, file, uniqueFILE, qfalse);
+
+		if(file == NULL)
+		{
+			if(len > 0)
+				return len;
+		}
+		else
+		{
+			if(len >= 0 && *file)
+				return len;
+		}
+
+	}
+	
+#ifdef FS_MISSING
+	if(missingFiles)
+		fprintf(missingFiles, "%s\n", filename);
+#endif
+
+	if(file)
+	{
+		*file = 0;
+		return -1;
+	}
+	else
+	{
+		// When file is NULL, we're querying the existence of the file
+		// If we've got here, it doesn't exist
+		return 0;
+	}
+}
+
+/*
+=================
+FS_FindVM
+
+Find a suitable VM file in search path order.
+
+In each searchpath try:
+ - open DLL file if DLL loading enabled
+ - open QVM file
+
+Enable search for DLL by setting enableDll to FSVM_ENABLEDLL
+
+write found DLL or QVM to "found" and return VMI_NATIVE if DLL, VMI_COMPILED if QVM
+Return the searchpath in "startSearch".
+=================
+*/
+
+int FS_FindVM(void **startSearch, char *found, int foundlen, const char *name, int enableDll)
+{
+	searchpath_t *search, *lastSearch;
+	directory_t *dir;
+	pack_t *pack;
+	char dllName[MAX_OSPATH], qvmName[MAX_OSPATH];
+	char *netpath;
+
+	if(!fs_searchpaths)
+		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
+
+	if(enableDll)
+		Com_sprintf(dllName, sizeof(dllName), "%s" ARCH_STRING DLL_EXT, name);
+
+	Com_sprintf(qvmName, sizeof(qvmName), "vm/%s.qvm", name);
+
+	lastSearch = *startSearch;
 	if(*startSearch == NULL)
 		search = fs_searchpaths;
 	else
@@ -1569,6 +2533,8 @@ int FS_Read( void *buffer, int len, fileHandle_t f ) {
 			buf += read;
 		}
 		return len;
+	} else if (fsh[f].mapData) {
+		return FS_ReadMapped(f, buffer, len);
 	} else {
 		return unzReadCurrentFile(fsh[f].handleFiles.file.z, buffer, len);
 	}
@@ -1599,6 +2565,11 @@ int FS_Write( const void *buffer, int len, fileHandle_t h ) {
 	f = FS_FileForHandle(h);
 	buf = (byte *)buffer;
 
+	if ( fsh[h].async ) {
+		FS_AsyncQueue( fsh[h].async, buf, len );
+		return len;
+	}
+
 	remaining = len;
 	tries = 0;
 	while (remaining) {
@@ -1638,6 +2609,79 @@ void QDECL FS_Printf( fileHandle_t h, const char *fmt, ... ) {
 	FS_Write(msg, strlen(msg), h);
 }
 
+/*
+=================
+FS_MapFile
+
+Maps a file read-only into memory. Returns NULL if the file can't be found,
+is compressed or misaligned in a pk3 or can't be mapped, callers should fall
+back to FS_Read.
+Files stored in a mapped pk3 point into the pk3 mapping, they must be
+unmapped before the next FS_Restart.
+=================
+*/
+void *FS_MapFile( const char *qpath, int *length ) {
+	fileHandle_t	f;
+	long			len;
+	void			*buffer;
+	int				i;
+
+	*length = 0;
+
+	len = FS_FOpenFileRead( qpath, &f, qtrue );
+	if ( !f ) {
+		return NULL;
+	}
+
+	if ( fsh[f].zipFile ) {
+		buffer = NULL;
+		// callers cast the buffer to structures, so it has to be aligned
+		if ( fsh[f].mapData && !fsh[f].mapDeflated && len > 0 && !( (intptr_t)fsh[f].mapData & 7 ) ) {
+			for ( i = 0 ; i < MAX_PAK_VIEWS ; i++ ) {
+				if ( !fs_pakViews[i] ) {
+					fs_pakViews[i] = fsh[f].mapData;
+					buffer = (void *)fsh[f].mapData;
+					*length = len;
+					break;
+				}
+			}
+		}
+		FS_FCloseFile( f );
+		return buffer;
+	}
+
+	buffer = Sys_MapFile( fsh[f].handleFiles.file.o, len );
+	FS_FCloseFile( f );
+
+	if ( buffer ) {
+		*length = len;
+	}
+	return buffer;
+}
+
+/*
+=================
+FS_UnmapFile
+=================
+*/
+void FS_UnmapFile( void *buffer, int length ) {
+	int		i;
+
+	if ( !buffer ) {
+		return;
+	}
+
+	// the pk3 mapping stays
+	for ( i = 0 ; i < MAX_PAK_VIEWS ; i++ ) {
+		if ( fs_pakViews[i] == buffer ) {
+			fs_pakViews[i] = NULL;
+			return;
+		}
+	}
+
+	Sys_UnmapFile( buffer, length );
+}
+
 #define PK3_SEEK_BUFFER_SIZE 65536
 
 /*
@@ -1654,6 +2698,10 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 		return -1;
 	}
 
+	if ( fsh[f].async ) {
+		FS_AsyncWait( fsh[f].async );
+	}
+
 	if (fsh[f].zipFile == qtrue) {
 		//FIXME: this is really, really crappy
 		//(but better than what was here before)
@@ -1661,6 +2709,26 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 		int		remainder;
 		int		currentPosition = FS_FTell( f );
 
+		// stored files in a mapped pk3 just move the position
+		if ( fsh[f].mapData && !fsh[f].mapDeflated ) {
+			switch( origin ) {
+				case FS_SEEK_END:
+					remainder = fsh[f].zipFileLen + offset;
+					break;
+				case FS_SEEK_CUR:
+					remainder = currentPosition + offset;
+					break;
+				case FS_SEEK_SET:
+					remainder = offset;
+					break;
+				default:
+					Com_Error( ERR_FATAL, "Bad origin in FS_Seek" );
+					return -1;
+			}
+			fsh[f].mapPos = Com_Clamp( 0, fsh[f].zipFileLen, remainder );
+			return offset;
+		}
+
 		// change negative offsets into FS_SEEK_SET
 		if ( offset < 0 ) {
 			switch( origin ) {
@@ -1696,8 +2764,12 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 				if ( remainder == currentPosition ) {
 					return offset;
 				}
-				unzSetOffset(fsh[f].handleFiles.file.z, fsh[f].zipFilePos);
-				unzOpenCurrentFile(fsh[f].handleFiles.file.z);
+				if ( fsh[f].mapData ) {
+					FS_RewindMapped( f );
+				} else {
+					unzSetOffset(fsh[f].handleFiles.file.z, fsh[f].zipFilePos);
+					unzOpenCurrentFile(fsh[f].handleFiles.file.z);
+				}
 				//fallthrough
 
 			case FS_SEEK_END:
@@ -1825,6 +2897,8 @@ long FS_ReadFileDir(const char *qpath, void *searchPath, qboolean unpure, void *
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
 	}
 
+	FS_AsyncWaitName( qpath );
+
 	if ( !qpath || !qpath[0] ) {
 		Com_Error( ERR_FATAL, "FS_ReadFile with empty name" );
 	}
@@ -1919,202 +2993,855 @@ long FS_ReadFileDir(const char *qpath, void *searchPath, qboolean unpure, void *
 	buf = Hunk_AllocateTempMemory(len+1);
 	*buffer = buf;
 
-	FS_Read (buf, len, h);
+	FS_Read (buf, len, h);
+
+	// guarantee that it will have a trailing 0 for string operations
+	buf[len] = 0;
+	FS_FCloseFile( h );
+
+	// if we are journalling and it is a config file, write it to the journal file
+	if ( isConfig && com_journal && com_journal->integer == 1 ) {
+		Com_DPrintf( "Writing %s to journal file.\n", qpath );
+		FS_Write( &len, sizeof( len ), com_journalDataFile );
+		FS_Write( buf, len, com_journalDataFile );
+		FS_Flush( com_journalDataFile );
+	}
+	return len;
+}
+
+/*
+============
+FS_ReadFile
+
+Filename are relative to the quake search path
+a null buffer will just return the file length without loading
+============
+*/
+long FS_ReadFile(const char *qpath, void **buffer)
+{
+	return FS_ReadFileDir(qpath, NULL, qfalse, buffer);
+}
+
+/*
+=============
+FS_FreeFile
+=============
+*/
+void FS_FreeFile( void *buffer ) {
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+	if ( !buffer ) {
+		Com_Error( ERR_FATAL, "FS_FreeFile( NULL )" );
+	}
+	fs_loadStack--;
+
+	Hunk_FreeTempMemory( buffer );
+
+	// if all of our temp files are free, clear all of our space
+	if ( fs_loadStack == 0 ) {
+		Hunk_ClearTempMemory();
+	}
+}
+
+/*
+============
+FS_WriteFile
+
+Filename are relative to the quake search path
+============
+*/
+void FS_WriteFile( const char *qpath, const void *buffer, int size ) {
+	fileHandle_t f;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	if ( !qpath || !buffer ) {
+		Com_Error( ERR_FATAL, "FS_WriteFile: NULL parameter" );
+	}
+
+	f = FS_FOpenFileWrite( qpath );
+	if ( !f ) {
+		Com_Printf( "Failed to open %s\n", qpath );
+		return;
+	}
+
+	FS_Write( buffer, size, f );
+
+	FS_FCloseFile( f );
+}
+
+
+
+/*
+==========================================================================
+
+ZIP FILE LOADING
+
+Reading the central directory of every pk3 is most of the filesystem
+startup time when there are a lot of them, so it is split in two.
+FS_ScanZipFile parses the directory into a malloc'd pakScan_t and touches
+nothing but the file itself, which lets FS_AddGameDirectory scan all the
+pk3s of a directory on the job pool.  FS_BuildPak then turns the scans into
+pack_t's on the main thread, in paksort order, so the search path comes out
+exactly as it would have serially.
+
+With fs_pakCache the scans are also saved in pakcache.dat in the home path,
+keyed by the path, size and modification time of the pk3, and a pk3 that
+hasn't changed since then isn't parsed at all.  Its end of central directory
+record is still read to catch a pk3 rewritten with the same size and time.
+Only the crcs are kept, the checksums depend on fs_checksumFeed and are
+computed when the pack is built.
+
+==========================================================================
+*/
+
+#define	PAKCACHE_NAME		"pakcache.dat"
+#define	PAKCACHE_IDENT		(('C'<<24)+('K'<<16)+('A'<<8)+'P')
+#define	PAKCACHE_VERSION	2
+#define	PAKCACHE_HASH_SIZE	256
+
+typedef struct {
+	unsigned int	pos;			// central directory offset, as unzGetOffset
+	unsigned int	len;			// uncompressed size
+	unsigned int	name;			// offset in names
+} pakScanEntry_t;
+
+// a scan and its arrays are a single malloc'd block
+typedef struct pakScan_s {
+	char			ospath[MAX_OSPATH];
+	int64_t			size;
+	int64_t			mtime;
+
+	// the end of central directory record, checked again before a cached
+	// scan is used in case the pk3 was rewritten with the same size and time
+	int				endPos;
+	unsigned int	endEntries;
+	unsigned int	endDirSize;
+	unsigned int	endDirOfs;
+
+	int				numEntries;
+	pakScanEntry_t	*entries;
+	int				numCrcs;
+	int				*crcs;			// of the files that aren't empty
+	int				namesLen;
+	char			*names;
+
+	qboolean		cached;			// owned by the cache, don't free
+	qboolean		used;			// looked up by this startup
+	struct pakScan_s	*next;		// in the cache hash chain
+} pakScan_t;
+
+typedef struct {
+	char			ospath[MAX_OSPATH];
+	pakScan_t		*scan;			// NULL if it isn't a zip file
+} pakScanJob_t;
+
+static	cvar_t		*fs_loadThreads;
+static	cvar_t		*fs_pakCache;
+
+static	pakScan_t	*fs_pakCacheHash[PAKCACHE_HASH_SIZE];
+static	qboolean	fs_pakCacheLoaded;
+static	qboolean	fs_pakCacheDirty;
+
+static	int			fs_pakScanned;		// parsed by this startup
+static	int			fs_pakCacheHits;	// taken from the cache
+static	int			fs_pakScanMsec;
+
+/*
+=================
+FS_AllocPakScan
+=================
+*/
+static pakScan_t *FS_AllocPakScan( int numEntries, int numCrcs, int namesLen ) {
+	pakScan_t	*scan;
+
+	scan = calloc( 1, sizeof( *scan ) + numEntries * sizeof( pakScanEntry_t )
+		+ numCrcs * sizeof( int ) + namesLen );
+	if ( !scan ) {
+		return NULL;
+	}
+
+	scan->entries = (pakScanEntry_t *)( scan + 1 );
+	scan->crcs = (int *)( scan->entries + numEntries );
+	scan->names = (char *)( scan->crcs + numCrcs );
+
+	return scan;
+}
+
+/*
+=================
+FS_ScanZipFile
+
+Parses the central directory of a zip file the same way unzip.c walks it.
+Safe to call from a job thread, returns NULL if it isn't a zip file.
+=================
+*/
+static pakScan_t *FS_ScanZipFile( const char *ospath, int64_t size, int64_t mtime ) {
+	FILE			*f;
+	byte			*buf, *p;
+	pakScan_t		*scan;
+	pakScanEntry_t	*entry;
+	int				tailLen, i, central;
+	unsigned int	numEntries, dirSize, dirOfs, ofs, crc, len;
+	int				nameLen, extraLen, commentLen, fileLen;
+	int				byteBefore;
+
+	if ( size < 22 || size > 0x7fffffff ) {
+		return NULL;
+	}
+	f = Sys_FOpen( ospath, "rb" );
+	if ( !f ) {
+		return NULL;
+	}
+
+	// the end of central directory record is within the last 64k
+	tailLen = size < 0xffff ? (int)size : 0xffff;
+	buf = malloc( tailLen );
+	if ( !buf || fseek( f, (long)( size - tailLen ), SEEK_SET ) || fread( buf, 1, tailLen, f ) != tailLen ) {
+		free( buf );
+		fclose( f );
+		return NULL;
+	}
+
+	for ( i = tailLen - 4 ; i >= 0 ; i-- ) {
+		if ( buf[i] == 'P' && buf[i+1] == 'K' && buf[i+2] == 5 && buf[i+3] == 6 ) {
+			break;
+		}
+	}
+	if ( i < 0 || i + 22 > tailLen ) {
+		free( buf );
+		fclose( f );
+		return NULL;
+	}
+
+	p = buf + i;
+	central = (int)( size - tailLen ) + i;
+	numEntries = p[10] | ( p[11] << 8 );
+	dirSize = p[12] | ( p[13] << 8 ) | ( p[14] << 16 ) | ( (unsigned int)p[15] << 24 );
+	dirOfs = p[16] | ( p[17] << 8 ) | ( p[18] << 16 ) | ( (unsigned int)p[19] << 24 );
+
+	// no multi disk archives
+	if ( ( p[4] | p[5] | p[6] | p[7] ) || numEntries != ( p[8] | ( p[9] << 8 ) )
+		|| (unsigned int)central < dirOfs || (unsigned int)central - dirOfs < dirSize ) {
+		free( buf );
+		fclose( f );
+		return NULL;
+	}
+	byteBefore = central - ( dirOfs + dirSize );
+	free( buf );
+
+	buf = malloc( dirSize + 1 );
+	if ( !buf || fseek( f, dirOfs + byteBefore, SEEK_SET ) || fread( buf, 1, dirSize, f ) != dirSize ) {
+		free( buf );
+		fclose( f );
+		return NULL;
+	}
+	fclose( f );
+
+	// each name and its terminator fit in the record it came from
+	scan = FS_AllocPakScan( numEntries, numEntries, dirSize );
+	if ( !scan ) {
+		free( buf );
+		return NULL;
+	}
+	Q_strncpyz( scan->ospath, ospath, sizeof( scan->ospath ) );
+	scan->size = size;
+	scan->mtime = mtime;
+	scan->endPos = central;
+	scan->endEntries = numEntries;
+	scan->endDirSize = dirSize;
+	scan->endDirOfs = dirOfs;
+
+	ofs = 0;
+	for ( i = 0 ; i < numEntries ; i++ ) {
+		if ( dirSize - ofs < 46 ) {
+			break;
+		}
+		p = buf + ofs;
+		if ( p[0] != 'P' || p[1] != 'K' || p[2] != 1 || p[3] != 2 ) {
+			break;
+		}
+
+		crc = p[16] | ( p[17] << 8 ) | ( p[18] << 16 ) | ( (unsigned int)p[19] << 24 );
+		len = p[24] | ( p[25] << 8 ) | ( p[26] << 16 ) | ( (unsigned int)p[27] << 24 );
+		nameLen = p[28] | ( p[29] << 8 );
+		extraLen = p[30] | ( p[31] << 8 );
+		commentLen = p[32] | ( p[33] << 8 );
+		if ( dirSize - ofs - 46 < nameLen ) {
+			break;
+		}
+
+		if ( len > 0 ) {
+			scan->crcs[scan->numCrcs++] = crc;
+		}
+
+		fileLen = nameLen < MAX_ZPATH - 1 ? nameLen : MAX_ZPATH - 1;
+		entry = &scan->entries[scan->numEntries++];
+		entry->pos = dirOfs + ofs;
+		entry->len = len;
+		entry->name = scan->namesLen;
+		Com_Memcpy( scan->names + scan->namesLen, p + 46, fileLen );
+		scan->names[scan->namesLen + fileLen] = 0;
+		Q_strlwr( scan->names + scan->namesLen );
+		scan->namesLen += strlen( scan->names + scan->namesLen ) + 1;
+
+		ofs += 46 + nameLen + extraLen + commentLen;
+		if ( ofs > dirSize ) {
+			break;
+		}
+	}
+
+	free( buf );
+	return scan;
+}
+
+/*
+=================
+FS_BuildPak
+
+Creates the pack_t for a scanned zip file
+=================
+*/
+static pack_t *FS_BuildPak( const pakScan_t *scan, const char *zipfile, const char *basename ) {
+	fileInPack_t	*buildBuffer;
+	pack_t			*pack;
+	unzFile			uf;
+	int				i;
+	long			hash;
+	int				*fs_headerLongs;
+	char			*namePtr;
+
+	uf = unzOpen( zipfile );
+	if ( !uf ) {
+		return NULL;
+	}
+
+	buildBuffer = Z_Malloc( ( scan->numEntries * sizeof( fileInPack_t ) ) + scan->namesLen );
+	namePtr = ( (char *) buildBuffer ) + scan->numEntries * sizeof( fileInPack_t );
+	Com_Memcpy( namePtr, scan->names, scan->namesLen );
+
+	// get the hash table size from the number of files in the zip
+	// because lots of custom pk3 files have less than 32 or 64 files
+	for ( i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1 ) {
+		if ( i > scan->numEntries ) {
+			break;
+		}
+	}
+
+	pack = Z_Malloc( sizeof( pack_t ) + i * sizeof(fileInPack_t *) );
+	pack->hashSize = i;
+	pack->hashTable = (fileInPack_t **) ( ( (char *) pack ) + sizeof( pack_t ) );
+	for ( i = 0; i < pack->hashSize; i++ ) {
+		pack->hashTable[i] = NULL;
+	}
+
+	Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
+	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
+
+	// strip .pk3 if needed
+	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
+		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+	}
+
+	pack->handle = uf;
+	pack->numfiles = scan->numEntries;
+
+	for ( i = 0; i < scan->numEntries; i++ ) {
+		buildBuffer[i].name = namePtr + scan->entries[i].name;
+		hash = FS_HashFileName( buildBuffer[i].name, pack->hashSize );
+		// store the file position in the zip
+		buildBuffer[i].pos = scan->entries[i].pos;
+		buildBuffer[i].len = scan->entries[i].len;
+		buildBuffer[i].next = pack->hashTable[hash];
+		pack->hashTable[hash] = &buildBuffer[i];
+	}
+
+	fs_headerLongs = Z_Malloc( ( scan->numCrcs + 1 ) * sizeof(int) );
+	fs_headerLongs[0] = LittleLong( fs_checksumFeed );
+	for ( i = 0; i < scan->numCrcs; i++ ) {
+		fs_headerLongs[i + 1] = LittleLong( scan->crcs[i] );
+	}
+
+	pack->checksum = Com_BlockChecksum( &fs_headerLongs[ 1 ], sizeof(*fs_headerLongs) * scan->numCrcs );
+	pack->pure_checksum = Com_BlockChecksum( fs_headerLongs, sizeof(*fs_headerLongs) * ( scan->numCrcs + 1 ) );
+	pack->checksum = LittleLong( pack->checksum );
+	pack->pure_checksum = LittleLong( pack->pure_checksum );
+
+	Z_Free(fs_headerLongs);
+
+	pack->buildBuffer = buildBuffer;
+	FS_MapPak( pack );
+	return pack;
+}
+
+/*
+=================
+FS_LoadZipFile
+
+Creates a new pak_t in the search chain for the contents
+of a zip file.
+=================
+*/
+static pack_t *FS_LoadZipFile(const char *zipfile, const char *basename)
+{
+	pakScan_t	*scan;
+	pack_t		*pack;
+	int64_t		size, mtime;
+
+	if ( !Sys_FileStat( zipfile, &size, &mtime ) ) {
+		return NULL;
+	}
+
+	scan = FS_ScanZipFile( zipfile, size, mtime );
+	if ( !scan ) {
+		return NULL;
+	}
+
+	pack = FS_BuildPak( scan, zipfile, basename );
+	free( scan );
+	return pack;
+}
+
+/*
+=================
+FS_PakCacheHash
+=================
+*/
+static int FS_PakCacheHash( const char *ospath ) {
+	unsigned int	hash;
+
+	hash = 0;
+	while ( *ospath ) {
+		hash = hash * 31 + (byte)*ospath++;
+	}
+
+	return hash & ( PAKCACHE_HASH_SIZE - 1 );
+}
+
+/*
+=================
+FS_PakCacheFind
+
+Returns the cached scan of an unchanged pk3.  Only reads the cache, so it
+is safe on the job threads while the main thread waits for them.
+=================
+*/
+static pakScan_t *FS_PakCacheFind( const char *ospath, int64_t size, int64_t mtime ) {
+	pakScan_t	*scan;
+
+	for ( scan = fs_pakCacheHash[FS_PakCacheHash( ospath )] ; scan ; scan = scan->next ) {
+		if ( !strcmp( scan->ospath, ospath ) ) {
+			if ( scan->size == size && scan->mtime == mtime ) {
+				return scan;
+			}
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
 
-	// guarantee that it will have a trailing 0 for string operations
-	buf[len] = 0;
-	FS_FCloseFile( h );
+/*
+=================
+FS_PakCacheInsert
 
-	// if we are journalling and it is a config file, write it to the journal file
-	if ( isConfig && com_journal && com_journal->integer == 1 ) {
-		Com_DPrintf( "Writing %s to journal file.\n", qpath );
-		FS_Write( &len, sizeof( len ), com_journalDataFile );
-		FS_Write( buf, len, com_journalDataFile );
-		FS_Flush( com_journalDataFile );
+Hands a new scan over to the cache, replacing an older one of the same pk3
+=================
+*/
+static void FS_PakCacheInsert( pakScan_t *scan ) {
+	pakScan_t	**prev, *old;
+	int			hash;
+
+	hash = FS_PakCacheHash( scan->ospath );
+	for ( prev = &fs_pakCacheHash[hash] ; *prev ; prev = &(*prev)->next ) {
+		if ( !strcmp( (*prev)->ospath, scan->ospath ) ) {
+			old = *prev;
+			*prev = old->next;
+			free( old );
+			break;
+		}
 	}
-	return len;
+
+	scan->cached = qtrue;
+	scan->next = fs_pakCacheHash[hash];
+	fs_pakCacheHash[hash] = scan;
+	fs_pakCacheDirty = qtrue;
 }
 
 /*
-============
-FS_ReadFile
+=================
+FS_FreePakCache
+=================
+*/
+static void FS_FreePakCache( void ) {
+	pakScan_t	*scan, *next;
+	int			i;
+
+	for ( i = 0 ; i < PAKCACHE_HASH_SIZE ; i++ ) {
+		for ( scan = fs_pakCacheHash[i] ; scan ; scan = next ) {
+			next = scan->next;
+			free( scan );
+		}
+		fs_pakCacheHash[i] = NULL;
+	}
 
-Filename are relative to the quake search path
-a null buffer will just return the file length without loading
-============
+	fs_pakCacheLoaded = qfalse;
+	fs_pakCacheDirty = qfalse;
+}
+
+/*
+=================
+FS_PakCachePath
+=================
 */
-long FS_ReadFile(const char *qpath, void **buffer)
-{
-	return FS_ReadFileDir(qpath, NULL, qfalse, buffer);
+static char *FS_PakCachePath( void ) {
+	static char	ospath[MAX_OSPATH];
+
+	Com_sprintf( ospath, sizeof( ospath ), "%s%c%s", fs_homepath->string, PATH_SEP, PAKCACHE_NAME );
+	return ospath;
 }
 
 /*
-=============
-FS_FreeFile
-=============
+=================
+FS_LoadPakCache
+
+The cache is only for this machine, so it is in native byte order and
+thrown away if the ident doesn't match.
+=================
 */
-void FS_FreeFile( void *buffer ) {
-	if ( !fs_searchpaths ) {
-		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+static void FS_LoadPakCache( void ) {
+	FILE		*f;
+	byte		*buf;
+	int			header[4], count, i, j;
+	int			fields[8], entrySize;
+	int64_t		stamp[2];
+	pakScan_t	*scan;
+	long		length, ofs;
+
+	FS_FreePakCache();
+	fs_pakCacheLoaded = qtrue;
+
+	if ( !fs_pakCache->integer || !fs_homepath->string[0] ) {
+		return;
 	}
-	if ( !buffer ) {
-		Com_Error( ERR_FATAL, "FS_FreeFile( NULL )" );
+
+	f = Sys_FOpen( FS_PakCachePath(), "rb" );
+	if ( !f ) {
+		return;
 	}
-	fs_loadStack--;
 
-	Hunk_FreeTempMemory( buffer );
+	length = FS_fplength( f );
+	if ( length < sizeof( header ) || fread( header, sizeof( header ), 1, f ) != 1
+		|| header[0] != PAKCACHE_IDENT || header[1] != PAKCACHE_VERSION ) {
+		fclose( f );
+		return;
+	}
 
-	// if all of our temp files are free, clear all of our space
-	if ( fs_loadStack == 0 ) {
-		Hunk_ClearTempMemory();
+	length -= sizeof( header );
+	buf = malloc( length + 1 );
+	if ( !buf || fread( buf, 1, length, f ) != length || Com_BlockChecksum( buf, length ) != header[3] ) {
+		free( buf );
+		fclose( f );
+		return;
+	}
+	fclose( f );
+
+	count = header[2];
+	ofs = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( length - ofs < sizeof( fields ) + sizeof( stamp ) ) {
+			break;
+		}
+		Com_Memcpy( fields, buf + ofs, sizeof( fields ) );
+		ofs += sizeof( fields );
+		Com_Memcpy( stamp, buf + ofs, sizeof( stamp ) );
+		ofs += sizeof( stamp );
+
+		// fields are the path length, entries, crcs and names length, then
+		// the end of central directory values
+		if ( fields[0] <= 0 || fields[0] > MAX_OSPATH || fields[1] < 0 || fields[1] > 0xffff
+			|| fields[2] < 0 || fields[2] > fields[1] || fields[3] < 0 || fields[3] > fields[1] * MAX_ZPATH ) {
+			break;
+		}
+		entrySize = fields[0] + fields[1] * sizeof( pakScanEntry_t ) + fields[2] * sizeof( int ) + fields[3];
+		if ( length - ofs < entrySize ) {
+			break;
+		}
+
+		scan = FS_AllocPakScan( fields[1], fields[2], fields[3] );
+		if ( !scan ) {
+			break;
+		}
+		Com_Memcpy( scan->ospath, buf + ofs, fields[0] );
+		scan->ospath[fields[0] - 1] = 0;
+		ofs += fields[0];
+		scan->size = stamp[0];
+		scan->mtime = stamp[1];
+		scan->endPos = fields[4];
+		scan->endEntries = fields[5];
+		scan->endDirSize = fields[6];
+		scan->endDirOfs = fields[7];
+		scan->numEntries = fields[1];
+		Com_Memcpy( scan->entries, buf + ofs, fields[1] * sizeof( pakScanEntry_t ) );
+		ofs += fields[1] * sizeof( pakScanEntry_t );
+		scan->numCrcs = fields[2];
+		Com_Memcpy( scan->crcs, buf + ofs, fields[2] * sizeof( int ) );
+		ofs += fields[2] * sizeof( int );
+		scan->namesLen = fields[3];
+		Com_Memcpy( scan->names, buf + ofs, fields[3] );
+		ofs += fields[3];
+
+		// the names must stay in bounds whatever is in the file
+		for ( j = 0 ; j < scan->numEntries ; j++ ) {
+			if ( scan->entries[j].name >= scan->namesLen ) {
+				break;
+			}
+		}
+		if ( j < scan->numEntries || ( scan->namesLen && scan->names[scan->namesLen - 1] ) ) {
+			free( scan );
+			break;
+		}
+
+		FS_PakCacheInsert( scan );
 	}
+
+	free( buf );
+	fs_pakCacheDirty = qfalse;
 }
 
 /*
-============
-FS_WriteFile
+=================
+FS_WritePakCache
 
-Filename are relative to the quake search path
-============
+Rewrites the cache if this startup scanned anything.  Entries that weren't
+used are kept as long as their pk3 is still there unchanged, so switching
+fs_game back and forth doesn't drop them.
+=================
 */
-void FS_WriteFile( const char *qpath, const void *buffer, int size ) {
-	fileHandle_t f;
-
-	if ( !fs_searchpaths ) {
-		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+static void FS_WritePakCache( void ) {
+	FILE		*f;
+	pakScan_t	*scan;
+	byte		*buf;
+	int			header[4], i, pathLen, fields[8];
+	int64_t		stamp[2];
+	long		length, ofs;
+	char		ospath[MAX_OSPATH], tmpPath[MAX_OSPATH + 16];
+	qboolean	written;
+
+	if ( !fs_pakCacheLoaded || !fs_pakCacheDirty || !fs_pakCache->integer || !fs_homepath->string[0] ) {
+		FS_FreePakCache();
+		return;
 	}
 
-	if ( !qpath || !buffer ) {
-		Com_Error( ERR_FATAL, "FS_WriteFile: NULL parameter" );
+	// drop the pk3s that are gone or changed
+	length = 0;
+	for ( i = 0 ; i < PAKCACHE_HASH_SIZE ; i++ ) {
+		for ( scan = fs_pakCacheHash[i] ; scan ; scan = scan->next ) {
+			if ( !scan->used && ( !Sys_FileStat( scan->ospath, &stamp[0], &stamp[1] )
+				|| stamp[0] != scan->size || stamp[1] != scan->mtime ) ) {
+				continue;
+			}
+			scan->used = qtrue;
+			length += sizeof( fields ) + sizeof( stamp ) + strlen( scan->ospath ) + 1
+				+ scan->numEntries * sizeof( pakScanEntry_t ) + scan->numCrcs * sizeof( int ) + scan->namesLen;
+		}
 	}
 
-	f = FS_FOpenFileWrite( qpath );
-	if ( !f ) {
-		Com_Printf( "Failed to open %s\n", qpath );
+	buf = malloc( length + 1 );
+	if ( !buf ) {
+		FS_FreePakCache();
 		return;
 	}
 
-	FS_Write( buffer, size, f );
+	header[0] = PAKCACHE_IDENT;
+	header[1] = PAKCACHE_VERSION;
+	header[2] = 0;
 
-	FS_FCloseFile( f );
-}
+	ofs = 0;
+	for ( i = 0 ; i < PAKCACHE_HASH_SIZE ; i++ ) {
+		for ( scan = fs_pakCacheHash[i] ; scan ; scan = scan->next ) {
+			if ( !scan->used ) {
+				continue;
+			}
+
+			pathLen = strlen( scan->ospath ) + 1;
+			fields[0] = pathLen;
+			fields[1] = scan->numEntries;
+			fields[2] = scan->numCrcs;
+			fields[3] = scan->namesLen;
+			fields[4] = scan->endPos;
+			fields[5] = scan->endEntries;
+			fields[6] = scan->endDirSize;
+			fields[7] = scan->endDirOfs;
+			stamp[0] = scan->size;
+			stamp[1] = scan->mtime;
+
+			Com_Memcpy( buf + ofs, fields, sizeof( fields ) );
+			ofs += sizeof( fields );
+			Com_Memcpy( buf + ofs, stamp, sizeof( stamp ) );
+			ofs += sizeof( stamp );
+			Com_Memcpy( buf + ofs, scan->ospath, pathLen );
+			ofs += pathLen;
+			Com_Memcpy( buf + ofs, scan->entries, scan->numEntries * sizeof( pakScanEntry_t ) );
+			ofs += scan->numEntries * sizeof( pakScanEntry_t );
+			Com_Memcpy( buf + ofs, scan->crcs, scan->numCrcs * sizeof( int ) );
+			ofs += scan->numCrcs * sizeof( int );
+			Com_Memcpy( buf + ofs, scan->names, scan->namesLen );
+			ofs += scan->namesLen;
+			header[2]++;
+		}
+	}
+	header[3] = Com_BlockChecksum( buf, length );
 
+	// servers sharing a home path can write at the same time, so each
+	// writes its own file and renames it over the cache
+	Q_strncpyz( ospath, FS_PakCachePath(), sizeof( ospath ) );
+	Com_sprintf( tmpPath, sizeof( tmpPath ), "%s.%i.tmp", ospath, Sys_PID() );
+	FS_CreatePath( tmpPath );
+	f = Sys_FOpen( tmpPath, "wb" );
+	if ( f ) {
+		written = fwrite( header, sizeof( header ), 1, f ) == 1 && fwrite( buf, 1, length, f ) == length;
+		if ( fclose( f ) || !written ) {
+			remove( tmpPath );
+		} else {
+#ifdef _WIN32
+			remove( ospath );
+#endif
+			if ( rename( tmpPath, ospath ) ) {
+				remove( tmpPath );
+			}
+		}
+	}
 
+	free( buf );
+	FS_FreePakCache();
+}
 
 /*
-==========================================================================
-
-ZIP FILE LOADING
+=================
+FS_CheckZipEnd
 
-==========================================================================
+Reads the end of central directory record again to make sure a cached scan
+still describes the pk3.  Safe to call from a job thread.
+=================
 */
+static qboolean FS_CheckZipEnd( const pakScan_t *scan ) {
+	FILE		*f;
+	byte		p[22];
+	qboolean	match;
+
+	f = Sys_FOpen( scan->ospath, "rb" );
+	if ( !f ) {
+		return qfalse;
+	}
+	match = !fseek( f, scan->endPos, SEEK_SET ) && fread( p, 1, sizeof( p ), f ) == sizeof( p );
+	fclose( f );
+
+	return match
+		&& p[0] == 'P' && p[1] == 'K' && p[2] == 5 && p[3] == 6
+		&& FS_ZipShort( p + 10 ) == scan->endEntries
+		&& FS_ZipLong( p + 12 ) == scan->endDirSize
+		&& FS_ZipLong( p + 16 ) == scan->endDirOfs
+		&& scan->endPos + sizeof( p ) + FS_ZipShort( p + 20 ) == scan->size;
+}
 
 /*
 =================
-FS_LoadZipFile
+FS_ScanPakJob
 
-Creates a new pak_t in the search chain for the contents
-of a zip file.
+Runs on the job pool, so it doesn't print or allocate from the zone
 =================
 */
-static pack_t *FS_LoadZipFile(const char *zipfile, const char *basename)
-{
-	fileInPack_t	*buildBuffer;
-	pack_t			*pack;
-	unzFile			uf;
-	int				err;
-	unz_global_info gi;
-	char			filename_inzip[MAX_ZPATH];
-	unz_file_info	file_info;
-	int				i, len;
-	long			hash;
-	int				fs_numHeaderLongs;
-	int				*fs_headerLongs;
-	char			*namePtr;
+static void FS_ScanPakJob( void *data, int index ) {
+	pakScanJob_t	*job;
+	int64_t			size, mtime;
 
-	fs_numHeaderLongs = 0;
+	job = &( (pakScanJob_t *)data )[index];
+	job->scan = NULL;
 
-	uf = unzOpen(zipfile);
-	err = unzGetGlobalInfo (uf,&gi);
-
-	if (err != UNZ_OK)
-		return NULL;
+	if ( !Sys_FileStat( job->ospath, &size, &mtime ) ) {
+		return;
+	}
 
-	len = 0;
-	unzGoToFirstFile(uf);
-	for (i = 0; i < gi.number_entry; i++)
-	{
-		err = unzGetCurrentFileInfo(uf, &file_info, filename_inzip, sizeof(filename_inzip), NULL, 0, NULL, 0);
-		if (err != UNZ_OK) {
-			break;
-		}
-		len += strlen(filename_inzip) + 1;
-		unzGoToNextFile(uf);
+	job->scan = FS_PakCacheFind( job->ospath, size, mtime );
+	if ( job->scan && !FS_CheckZipEnd( job->scan ) ) {
+		job->scan = NULL;
 	}
+	if ( !job->scan ) {
+		job->scan = FS_ScanZipFile( job->ospath, size, mtime );
+	}
+}
 
-	buildBuffer = Z_Malloc( (gi.number_entry * sizeof( fileInPack_t )) + len );
-	namePtr = ((char *) buildBuffer) + gi.number_entry * sizeof( fileInPack_t );
-	fs_headerLongs = Z_Malloc( ( gi.number_entry + 1 ) * sizeof(int) );
-	fs_headerLongs[ fs_numHeaderLongs++ ] = LittleLong( fs_checksumFeed );
+/*
+=================
+FS_ScanPakFiles
 
-	// get the hash table size from the number of files in the zip
-	// because lots of custom pk3 files have less than 32 or 64 files
-	for (i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1) {
-		if (i > gi.number_entry) {
-			break;
-		}
-	}
+Scans all the pk3s of a game directory, the results are in the same order
+as pakfiles
+=================
+*/
+static pakScanJob_t *FS_ScanPakFiles( const char *path, const char *dir, char **pakfiles, int numfiles ) {
+	pakScanJob_t	*jobs;
+	int				i, start;
 
-	pack = Z_Malloc( sizeof( pack_t ) + i * sizeof(fileInPack_t *) );
-	pack->hashSize = i;
-	pack->hashTable = (fileInPack_t **) (((char *) pack) + sizeof( pack_t ));
-	for(i = 0; i < pack->hashSize; i++) {
-		pack->hashTable[i] = NULL;
+	if ( !numfiles ) {
+		return NULL;
+	}
+	if ( !fs_pakCacheLoaded ) {
+		FS_LoadPakCache();
 	}
 
-	Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
-	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
+	start = Sys_Milliseconds();
 
-	// strip .pk3 if needed
-	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
-		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+	jobs = Z_Malloc( numfiles * sizeof( *jobs ) );
+	for ( i = 0 ; i < numfiles ; i++ ) {
+		Q_strncpyz( jobs[i].ospath, FS_BuildOSPath( path, dir, pakfiles[i] ), sizeof( jobs[i].ospath ) );
 	}
 
-	pack->handle = uf;
-	pack->numfiles = gi.number_entry;
-	unzGoToFirstFile(uf);
+	Com_RunJobs( fs_loadThreads->integer, FS_ScanPakJob, jobs, numfiles );
 
-	for (i = 0; i < gi.number_entry; i++)
-	{
-		err = unzGetCurrentFileInfo(uf, &file_info, filename_inzip, sizeof(filename_inzip), NULL, 0, NULL, 0);
-		if (err != UNZ_OK) {
-			break;
+	for ( i = 0 ; i < numfiles ; i++ ) {
+		if ( !jobs[i].scan ) {
+			continue;
 		}
-		if (file_info.uncompressed_size > 0) {
-			fs_headerLongs[fs_numHeaderLongs++] = LittleLong(file_info.crc);
+		if ( jobs[i].scan->cached ) {
+			fs_pakCacheHits++;
+		} else {
+			fs_pakScanned++;
+			if ( fs_pakCache->integer ) {
+				FS_PakCacheInsert( jobs[i].scan );
+			}
 		}
-		Q_strlwr( filename_inzip );
-		hash = FS_HashFileName(filename_inzip, pack->hashSize);
-		buildBuffer[i].name = namePtr;
-		strcpy( buildBuffer[i].name, filename_inzip );
-		namePtr += strlen(filename_inzip) + 1;
-		// store the file position in the zip
-		buildBuffer[i].pos = unzGetOffset(uf);
-		buildBuffer[i].len = file_info.uncompressed_size;
-		buildBuffer[i].next = pack->hashTable[hash];
-		pack->hashTable[hash] = &buildBuffer[i];
-		unzGoToNextFile(uf);
+		jobs[i].scan->used = qtrue;
 	}
 
-	pack->checksum = Com_BlockChecksum( &fs_headerLongs[ 1 ], sizeof(*fs_headerLongs) * ( fs_numHeaderLongs - 1 ) );
-	pack->pure_checksum = Com_BlockChecksum( fs_headerLongs, sizeof(*fs_headerLongs) * fs_numHeaderLongs );
-	pack->checksum = LittleLong( pack->checksum );
-	pack->pure_checksum = LittleLong( pack->pure_checksum );
+	fs_pakScanMsec += Sys_Milliseconds() - start;
 
-	Z_Free(fs_headerLongs);
+	return jobs;
+}
 
-	pack->buildBuffer = buildBuffer;
-	return pack;
+/*
+=================
+FS_FreePakScans
+=================
+*/
+static void FS_FreePakScans( pakScanJob_t *jobs, int numfiles ) {
+	int		i;
+
+	if ( !jobs ) {
+		return;
+	}
+
+	for ( i = 0 ; i < numfiles ; i++ ) {
+		if ( jobs[i].scan && !jobs[i].scan->cached ) {
+			free( jobs[i].scan );
+		}
+	}
+
+	Z_Free( jobs );
 }
 
 /*
@@ -2127,6 +3854,7 @@ Frees a pak structure and releases all associated resources
 
 static void FS_FreePak(pack_t *thepak)
 {
+	FS_UnmapPak(thepak);
 	unzClose(thepak->handle);
 	Z_Free(thepak->buildBuffer);
 	Z_Free(thepak);
@@ -2879,6 +4607,74 @@ void FS_Which_f( void ) {
 	Com_Printf("File not found: \"%s\"\n", filename);
 }
 
+/*
+============
+FS_LookupBench_f
+
+Looks up every file in the paks, and the same names with a suffix that
+can't be found, by walking the search paths and through the index
+============
+*/
+static void FS_LookupBench_f( void ) {
+	searchpath_t	*search;
+	char	name[MAX_ZPATH];
+	char	saved[MAX_CVAR_VALUE_STRING];
+	int		passes, pass, useIndex, miss, i, paths;
+	int		start, msec[2][2], found[2][2];
+
+	if ( !fs_indexHeads ) {
+		Com_Printf( "No pk3 files are indexed.\n" );
+		return;
+	}
+
+	passes = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 1;
+	passes = Com_Clamp( 1, 100, passes );
+
+	Q_strncpyz( saved, fs_index->string, sizeof( saved ) );
+
+	for ( useIndex = 0 ; useIndex < 2 ; useIndex++ ) {
+		Cvar_Set( "fs_index", useIndex ? "1" : "0" );
+
+		for ( miss = 0 ; miss < 2 ; miss++ ) {
+			found[useIndex][miss] = 0;
+			start = Sys_Milliseconds();
+
+			for ( pass = 0 ; pass < passes ; pass++ ) {
+				for ( i = 0 ; i < fs_numIndexHits ; i++ ) {
+					if ( miss ) {
+						Com_sprintf( name, sizeof( name ), "%s.missing", fs_indexHits[i].file->name );
+					} else {
+						Q_strncpyz( name, fs_indexHits[i].file->name, sizeof( name ) );
+					}
+					if ( FS_FOpenFileRead( name, NULL, qfalse ) > 0 ) {
+						found[useIndex][miss]++;
+					}
+				}
+			}
+
+			msec[useIndex][miss] = Sys_Milliseconds() - start;
+		}
+	}
+
+	Cvar_Set( "fs_index", saved );
+
+	paths = 0;
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		paths++;
+	}
+
+	Com_Printf( "%i lookups of %i files in %i search paths (%i directories), index built in %i msec\n",
+		passes * fs_numIndexHits, fs_numIndexHits, paths,
+		fs_numIndexDirs, fs_indexMsec );
+	Com_Printf( "found:   chain walk %6i msec, index %6i msec\n", msec[0][0], msec[1][0] );
+	Com_Printf( "missing: chain walk %6i msec, index %6i msec\n", msec[0][1], msec[1][1] );
+
+	if ( found[0][0] != found[1][0] || found[0][1] != found[1][1] ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: the index found %i/%i files, the chain walk %i/%i\n",
+			found[1][0], found[1][1], found[0][0], found[0][1] );
+	}
+}
+
 
 //===========================================================================
 
@@ -2916,6 +4712,7 @@ void FS_AddGameDirectory( const char *path, const char *dir ) {
 
 	int				pakwhich;
 	int				len;
+	pakScanJob_t	*scans;
 
 	// Unique
 	for ( sp = fs_searchpaths ; sp ; sp = sp->next ) {
@@ -2947,6 +4744,8 @@ void FS_AddGameDirectory( const char *path, const char *dir ) {
 		qsort( pakdirs, numdirs, sizeof(char *), paksort );
 	}
 
+	scans = FS_ScanPakFiles( path, dir, pakfiles, numfiles );
+
 	pakfilesi = 0;
 	pakdirsi = 0;
 
@@ -2972,7 +4771,7 @@ void FS_AddGameDirectory( const char *path, const char *dir ) {
 		if (pakwhich) {
 			// The next .pk3 file is before the next .pk3dir
 			pakfile = FS_BuildOSPath(path, dir, pakfiles[pakfilesi]);
-			if ((pak = FS_LoadZipFile(pakfile, pakfiles[pakfilesi])) == 0) {
+			if (!scans[pakfilesi].scan || (pak = FS_BuildPak(scans[pakfilesi].scan, pakfile, pakfiles[pakfilesi])) == 0) {
 				// This isn't a .pk3! Next!
 				pakfilesi++;
 				continue;
@@ -3019,6 +4818,7 @@ void FS_AddGameDirectory( const char *path, const char *dir ) {
 	}
 
 	// done
+	FS_FreePakScans( scans, numfiles );
 	Sys_FreeFileList( pakfiles );
 	Sys_FreeFileList( pakdirs );
 
@@ -3235,6 +5035,12 @@ void FS_Shutdown( qboolean closemfp ) {
 		}
 	}
 
+	// files still open, like the console log, stay async
+	FS_WaitAsyncWrites();
+
+	// the index points into the paks
+	FS_FreeIndex();
+
 	// free everything
 	for(p = fs_searchpaths; p; p = next)
 	{
@@ -3256,6 +5062,8 @@ void FS_Shutdown( qboolean closemfp ) {
 	Cmd_RemoveCommand( "fdir" );
 	Cmd_RemoveCommand( "touchFile" );
 	Cmd_RemoveCommand( "which" );
+	Cmd_RemoveCommand( "fs_asyncstats" );
+	Cmd_RemoveCommand( "fs_lookupbench" );
 
 #ifdef FS_MISSING
 	if (closemfp) {
@@ -3321,8 +5129,21 @@ static void FS_Startup( const char *gameName )
 	Com_Printf( "----- FS_Startup -----\n" );
 
 	fs_packFiles = 0;
+	fs_pakScanned = 0;
+	fs_pakCacheHits = 0;
+	fs_pakScanMsec = 0;
 
 	fs_debug = Cvar_Get( "fs_debug", "0", 0 );
+	fs_asyncWrite = Cvar_Get( "fs_asyncWrite", "1", CVAR_ARCHIVE );
+	Cvar_CheckRange( fs_asyncWrite, 0, 1, qtrue );
+	fs_index = Cvar_Get( "fs_index", "1", 0 );
+	Cvar_CheckRange( fs_index, 0, 1, qtrue );
+	fs_mapPaks = Cvar_Get( "fs_mapPaks", sizeof( void * ) > 4 ? "1" : "0", CVAR_INIT );
+	Cvar_CheckRange( fs_mapPaks, 0, 1, qtrue );
+	fs_loadThreads = Cvar_Get( "fs_loadThreads", "4", CVAR_INIT );
+	Cvar_CheckRange( fs_loadThreads, 0, MAX_JOB_THREADS, qtrue );
+	fs_pakCache = Cvar_Get( "fs_pakCache", "1", CVAR_INIT );
+	Cvar_CheckRange( fs_pakCache, 0, 1, qtrue );
 	fs_basepath = Cvar_Get ("fs_basepath", Sys_DefaultInstallPath(), CVAR_INIT|CVAR_PROTECTED );
 	fs_basegame = Cvar_Get ("fs_basegame", "", CVAR_INIT );
 	homePath = Sys_DefaultHomePath();
@@ -3416,6 +5237,8 @@ static void FS_Startup( const char *gameName )
 		}
 	}
 
+	FS_WritePakCache();
+
 #ifndef STANDALONE
 	if (!com_standalone->integer) {
 		Com_ReadCDKey(BASEGAME);
@@ -3431,11 +5254,15 @@ static void FS_Startup( const char *gameName )
 	Cmd_AddCommand ("fdir", FS_NewDir_f );
 	Cmd_AddCommand ("touchFile", FS_TouchFile_f );
 	Cmd_AddCommand ("which", FS_Which_f );
+	Cmd_AddCommand ("fs_asyncstats", FS_AsyncWriteStats_f );
+	Cmd_AddCommand ("fs_lookupbench", FS_LookupBench_f );
 
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=506
 	// reorder the pure pk3 files according to server order
 	FS_ReorderPurePaks();
 
+	FS_BuildIndex();
+
 	// print the current search paths
 	FS_Path_f();
 
@@ -3449,6 +5276,10 @@ static void FS_Startup( const char *gameName )
 	}
 #endif
 	Com_Printf( "%d files in pk3 files\n", fs_packFiles );
+	Com_Printf( "%d pk3 files scanned, %d cached, in %i msec\n", fs_pakScanned, fs_pakCacheHits, fs_pakScanMsec );
+	if ( fs_indexHeads ) {
+		Com_Printf( "indexed in %i msec\n", fs_indexMsec );
+	}
 }
 
 #ifndef STANDALONE
@@ -4204,7 +6035,10 @@ qboolean FS_ConditionalRestart(int checksumFeed, qboolean disconnect)
 	if(checksumFeed != fs_checksumFeed)
 		FS_Restart(checksumFeed);
 	else if(fs_numServerPaks && !fs_reordered)
+	{
 		FS_ReorderPurePaks();
+		FS_IndexOrder();
+	}
 
 	return qfalse;
 }
@@ -4228,7 +6062,7 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode ) {
 			r = FS_FOpenFileRead( qpath, f, qtrue );
 			break;
 		case FS_WRITE:
-			*f = FS_FOpenFileWrite( qpath );
+			*f = FS_OpenAsyncWrite( qpath, qfalse, 0 );
 			r = 0;
 			if (*f == 0) {
 				r = -1;
@@ -4237,7 +6071,7 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode ) {
 		case FS_APPEND_SYNC:
 			sync = qtrue;
 		case FS_APPEND:
-			*f = FS_FOpenFileAppend( qpath );
+			*f = FS_OpenAsyncWrite( qpath, qtrue, 0 );
 			r = 0;
 			if (*f == 0) {
 				r = -1;
@@ -4256,13 +6090,21 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode ) {
 		fsh[*f].fileSize = r;
 	}
 	fsh[*f].handleSync = sync;
+	if ( sync && fsh[*f].async ) {
+		FS_ForceFlush( *f );
+	}
 
 	return r;
 }
 
 int		FS_FTell( fileHandle_t f ) {
 	int pos;
-	if (fsh[f].zipFile == qtrue) {
+	if ( fsh[f].async ) {
+		FS_AsyncWait( fsh[f].async );
+	}
+	if (fsh[f].mapData) {
+		pos = fsh[f].mapPos;
+	} else if (fsh[f].zipFile == qtrue) {
 		pos = unztell(fsh[f].handleFiles.file.z);
 	} else {
 		pos = ftell(fsh[f].handleFiles.file.o);
@@ -4271,9 +6113,57 @@ int		FS_FTell( fileHandle_t f ) {
 }
 
 void	FS_Flush( fileHandle_t f ) {
+	fsAsync_t	*a = fsh[f].async;
+
+	if ( a ) {
+		Sys_LockMutex( fs_asyncLock );
+		a->flushRequest++;
+		Sys_UnlockMutex( fs_asyncLock );
+		FS_AsyncWait( a );
+		return;
+	}
+
 	fflush(fsh[f].handleFiles.file.o);
 }
 
+/*
+================
+FS_Sync
+
+Makes sure everything written so far reaches the disk.  For async files
+wait = qfalse only queues the request for the writer thread.
+================
+*/
+qboolean FS_Sync( fileHandle_t f, qboolean wait ) {
+	fsAsync_t	*a = fsh[f].async;
+	int			errors;
+
+	if ( !a ) {
+		return Sys_FSync( FS_FileForHandle( f ) );
+	}
+
+	Sys_LockMutex( fs_asyncLock );
+	a->syncRequest++;
+	Sys_UnlockMutex( fs_asyncLock );
+
+	if ( !wait ) {
+		FS_AsyncSignal();
+		return qtrue;
+	}
+
+	Sys_LockMutex( fs_asyncLock );
+	errors = a->errors;
+	Sys_UnlockMutex( fs_asyncLock );
+
+	FS_AsyncWait( a );
+
+	Sys_LockMutex( fs_asyncLock );
+	errors = a->errors - errors;
+	Sys_UnlockMutex( fs_asyncLock );
+
+	return errors == 0;
+}
+
 void	FS_FilenameCompletion( const char *dir, const char *ext,
 		qboolean stripExt, void(*callback)(const char *s), qboolean allowNonPureFilesOnDisk ) {
 	char	**filenames;
@@ -29,14 +29,27 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 static int			bloc = 0;
 
-void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+/* Add a bit to the output file (buffered) */
+static void add_bit (char bit, byte *fout, int *offset) {
+	if ((*offset&7) == 0) {
+		fout[(*offset>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(*offset>>3)] |= bit << (*offset&7);
+	(*offset)++;
+}
+
+/* Receive one bit from the input file (buffered) */
+static int get_bit (byte *fin, int *offset) {
+	int t;
+	t = (fin[(*offset>>3)] >> (*offset&7)) & 0x1;
+	(*offset)++;
+	return t;
+}
+
+/* The offset based functions only work on the caller's offset and never
+ * touch bloc, so several threads can write separate messages at once */
+void	Huff_putBit( int bit, byte *fout, int *offset) {
+	add_bit((char)bit, fout, offset);
 }
 
 int		Huff_getBloc(void)
@@ -50,29 +63,7 @@ void	Huff_setBloc(int _bloc)
 }
 
 int		Huff_getBit( byte *fin, int *offset) {
-	int t;
-	bloc = *offset;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
-	*offset = bloc;
-	return t;
-}
-
-/* Add a bit to the output file (buffered) */
-static void add_bit (char bit, byte *fout) {
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
-	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-}
-
-/* Receive one bit from the input file (buffered) */
-static int get_bit (byte *fin) {
-	int t;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
-	return t;
+	return get_bit(fin, offset);
 }
 
 static node_t **get_ppnode(huff_t* huff) {
@@ -265,7 +256,7 @@ void Huff_addRef(huff_t* huff, byte ch) {
 /* Get a symbol */
 int Huff_Receive (node_t *node, int *ch, byte *fin) {
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if (get_bit(fin, &bloc)) {
 			node = node->right;
 		} else {
 			node = node->left;
@@ -280,14 +271,14 @@ int Huff_Receive (node_t *node, int *ch, byte *fin) {
 
 /* Get a symbol */
 void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxoffset) {
-	bloc = *offset;
+	int	offs = *offset;
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (bloc >= maxoffset) {
+		if (offs >= maxoffset) {
 			*ch = 0;
 			*offset = maxoffset + 1;
 			return;
 		}
-		if (get_bit(fin)) {
+		if (get_bit(fin, &offs)) {
 			node = node->right;
 		} else {
 			node = node->left;
@@ -299,23 +290,23 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxo
 //		Com_Error(ERR_DROP, "Illegal tree!");
 	}
 	*ch = node->symbol;
-	*offset = bloc;
+	*offset = offs;
 }
 
 /* Send the prefix code for this node */
-static void send(node_t *node, node_t *child, byte *fout, int maxoffset) {
+static void send(node_t *node, node_t *child, byte *fout, int *offset, int maxoffset) {
 	if (node->parent) {
-		send(node->parent, node, fout, maxoffset);
+		send(node->parent, node, fout, offset, maxoffset);
 	}
 	if (child) {
-		if (bloc >= maxoffset) {
-			bloc = maxoffset + 1;
+		if (*offset >= maxoffset) {
+			*offset = maxoffset + 1;
 			return;
 		}
 		if (node->right == child) {
-			add_bit(1, fout);
+			add_bit(1, fout, offset);
 		} else {
-			add_bit(0, fout);
+			add_bit(0, fout, offset);
 		}
 	}
 }
@@ -327,17 +318,139 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout, int maxoffset) {
 		/* node_t hasn't been transmitted, send a NYT, then the symbol */
 		Huff_transmit(huff, NYT, fout, maxoffset);
 		for (i = 7; i >= 0; i--) {
-			add_bit((char)((ch >> i) & 0x1), fout);
+			add_bit((char)((ch >> i) & 0x1), fout, &bloc);
 		}
 	} else {
-		send(huff->loc[ch], NULL, fout, maxoffset);
+		send(huff->loc[ch], NULL, fout, &bloc, maxoffset);
 	}
 }
 
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset, int maxoffset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout, maxoffset);
-	*offset = bloc;
+	send(huff->loc[ch], NULL, fout, offset, maxoffset);
+}
+
+/* Fill in the table entries for everything below this node, code holds the
+ * bits that lead to it in the order they are sent */
+static void build_table(huffTable_t *table, node_t *node, unsigned int code, int depth) {
+	int i;
+
+	if (!node) {
+		return;
+	}
+
+	if (node->symbol != INTERNAL_NODE) {
+		if (depth > 32) {
+			Com_Error(ERR_FATAL, "Huff_BuildTable: code for %i is %i bits", node->symbol, depth);
+		}
+		if (node->symbol < HMAX) {
+			table->codes[node->symbol] = code;
+			table->lengths[node->symbol] = depth;
+		}
+		if (depth <= HUFF_LOOKUP_BITS) {
+			/* every index that starts with this code */
+			for (i = 0; i < 1 << (HUFF_LOOKUP_BITS - depth); i++) {
+				table->symbols[code | (i << depth)] = node->symbol;
+				table->symbolLengths[code | (i << depth)] = depth;
+			}
+		}
+		return;
+	}
+
+	if (depth == HUFF_LOOKUP_BITS) {
+		/* longer codes go on in the tree from here */
+		table->nodes[code] = node;
+		table->symbolLengths[code] = 0;
+	}
+
+	build_table(table, node->left, code, depth + 1);
+	build_table(table, node->right, code | (1U << depth), depth + 1);
+}
+
+/* Build the lookup tables for a tree that isn't updated anymore */
+void Huff_BuildTable(huff_t *huff, huffTable_t *table) {
+	Com_Memset(table, 0, sizeof(*table));
+	table->tree = huff->tree;
+	build_table(table, huff->tree, 0, 0);
+}
+
+/* Get a symbol, HUFF_LOOKUP_BITS at a time */
+void Huff_tableReceive (const huffTable_t *table, int *ch, byte *fin, int *offset, int maxoffset) {
+	node_t	*node;
+	int		offs = *offset;
+	int		index, bits;
+
+	if (offs + 24 <= maxoffset) {
+		/* the next three bytes are all in the message */
+		index = offs >> 3;
+		bits = (fin[index] | (fin[index + 1] << 8) | (fin[index + 2] << 16)) >> (offs & 7);
+		bits &= (1 << HUFF_LOOKUP_BITS) - 1;
+
+		if (table->symbolLengths[bits]) {
+			*ch = table->symbols[bits];
+			*offset = offs + table->symbolLengths[bits];
+			return;
+		}
+
+		node = table->nodes[bits];
+		offs += HUFF_LOOKUP_BITS;
+	} else {
+		node = table->tree;
+	}
+
+	/* near the end of the message or a long code, same as Huff_offsetReceive */
+	while (node && node->symbol == INTERNAL_NODE) {
+		if (offs >= maxoffset) {
+			*ch = 0;
+			*offset = maxoffset + 1;
+			return;
+		}
+		if (get_bit(fin, &offs)) {
+			node = node->right;
+		} else {
+			node = node->left;
+		}
+	}
+	if (!node) {
+		*ch = 0;
+		return;
+	}
+	*ch = node->symbol;
+	*offset = offs;
+}
+
+/* Send a symbol with its precomputed code, the same bits as Huff_offsetTransmit */
+void Huff_tableTransmit (const huffTable_t *table, int ch, byte *fout, int *offset, int maxoffset) {
+	unsigned int	code = table->codes[ch];
+	int				length = table->lengths[ch];
+	int				offs = *offset;
+	int				bit, count;
+
+	if (offs + length > maxoffset) {
+		/* send what fits, then flag the overflow like send() */
+		while (offs < maxoffset && length--) {
+			add_bit((char)(code & 1), fout, &offs);
+			code >>= 1;
+		}
+		*offset = maxoffset + 1;
+		return;
+	}
+
+	while (length > 0) {
+		bit = offs & 7;
+		if (!bit) {
+			fout[offs >> 3] = 0;
+		}
+		count = 8 - bit;
+		if (count > length) {
+			count = length;
+		}
+		fout[offs >> 3] |= (code & ((1 << count) - 1)) << bit;
+		code >>= count;
+		length -= count;
+		offs += count;
+	}
+
+	*offset = offs;
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
@@ -380,7 +493,7 @@ void Huff_Decompress(msg_t *mbuf, int offset) {
 		if ( ch == NYT ) {								/* We got a NYT, get the symbol associated with it */
 			ch = 0;
 			for ( i = 0; i < 8; i++ ) {
-				ch = (ch<<1) + get_bit(buffer);
+				ch = (ch<<1) + get_bit(buffer, &bloc);
 			}
 		}
     
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "qcommon.h"
 
 static huffman_t		msgHuff;
+static huffTable_t		msgHuffTable;		// codes of the msgHuff trees, which never change
 
 static qboolean			msgInit = qfalse;
 
@@ -37,7 +38,15 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
+// bits written, for tuning the encoding by hand.  Snapshots are encoded on
+// the job threads with sv_snapshotThreads, so the count is only kept in
+// builds that define MSG_BIT_STATS.
+#ifdef MSG_BIT_STATS
 int oldsize = 0;
+#define	MSG_CountBits( bits )	( oldsize += ( bits ) )
+#else
+#define	MSG_CountBits( bits )	( (void)0 )
+#endif
 
 void MSG_initHuffman( void );
 
@@ -101,11 +110,101 @@ bit functions
 =============================================================================
 */
 
+// the Huffman coded bits of a value are gathered in a 64-bit word and
+// stored a byte at a time instead of going through add_bit for every bit
+#define MSG_BUFFERED_BITS	56
+
+/*
+=================
+MSG_LoadBits
+
+Little endian load of the 8 bytes at p
+=================
+*/
+static ID_INLINE uint64_t MSG_LoadBits( const byte *p ) {
+	return (uint64_t)p[0] | ( (uint64_t)p[1] << 8 ) | ( (uint64_t)p[2] << 16 ) | ( (uint64_t)p[3] << 24 ) |
+		( (uint64_t)p[4] << 32 ) | ( (uint64_t)p[5] << 40 ) | ( (uint64_t)p[6] << 48 ) | ( (uint64_t)p[7] << 56 );
+}
+
+/*
+=================
+MSG_FlushBits
+
+Appends the low count bits of acc to the bitstream, count <= MSG_BUFFERED_BITS.
+Stores what fits and flags the overflow like Huff_offsetTransmit.
+=================
+*/
+static qboolean MSG_FlushBits( msg_t *msg, uint64_t acc, int count ) {
+	const int	maxBits = msg->maxsize << 3;
+	byte		*p;
+	int			shift, n;
+	qboolean	fits = qtrue;
+
+	if ( msg->bit + count > maxBits ) {
+		count = maxBits - msg->bit;
+		acc &= ( (uint64_t)1 << count ) - 1;
+		fits = qfalse;
+	}
+
+	if ( count > 0 ) {
+		// keep the bits already written to the first byte, the rest of it is stale
+		p = msg->data + ( msg->bit >> 3 );
+		shift = msg->bit & 7;
+		acc = ( acc << shift ) | ( *p & ( ( 1 << shift ) - 1 ) );
+
+		for ( n = count + shift; n > 0; n -= 8 ) {
+			*p++ = (byte)acc;
+			acc >>= 8;
+		}
+	}
+
+	if ( !fits ) {
+		msg->bit = maxBits + 1;
+		msg->overflowed = qtrue;
+		return qfalse;
+	}
+
+	msg->bit += count;
+	return qtrue;
+}
+
+/*
+=================
+MSG_WriteBitstream
+
+Appends bits written to another Huffman coded message, which don't depend
+on where in the message they start
+=================
+*/
+void MSG_WriteBitstream( msg_t *msg, const byte *data, int bits ) {
+	uint64_t	acc;
+	int			n, i;
+
+	if ( msg->overflowed || bits <= 0 ) {
+		return;
+	}
+
+	// whole bytes at a time, so data stays aligned
+	for ( ; bits > 0; bits -= n, data += n >> 3 ) {
+		n = MIN( bits, 48 );
+		acc = 0;
+		for ( i = 0; i < ( n + 7 ) >> 3; i++ ) {
+			acc |= (uint64_t)data[i] << ( i << 3 );
+		}
+		acc &= ( (uint64_t)1 << n ) - 1;
+
+		if ( !MSG_FlushBits( msg, acc, n ) ) {
+			return;
+		}
+	}
+	msg->cursize = (msg->bit >> 3) + 1;
+}
+
 // negative bit values include signs
 void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 	int	i;
 
-	oldsize += bits;
+	MSG_CountBits( bits );
 
 	if ( msg->overflowed ) {
 		return;
@@ -143,30 +242,38 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 			Com_Error( ERR_DROP, "can't write %d bits", bits );
 		}
 	} else {
-		value &= (0xffffffff >> (32 - bits));
-		if ( bits&7 ) {
-			int nbits;
-			nbits = bits&7;
-			if ( msg->bit + nbits > msg->maxsize << 3 ) {
-				msg->overflowed = qtrue;
-				return;
-			}
-			for( i = 0; i < nbits; i++ ) {
-				Huff_putBit( (value & 1), msg->data, &msg->bit );
-				value = (value >> 1);
-			}
-			bits = bits - nbits;
+		unsigned int	uvalue;
+		uint64_t		acc;
+		int				nbits, count, length;
+
+		uvalue = (unsigned int)value & (0xffffffff >> (32 - bits));
+		nbits = bits & 7;
+		if ( msg->bit + nbits > msg->maxsize << 3 ) {
+			msg->overflowed = qtrue;
+			return;
 		}
-		if ( bits ) {
-			for( i = 0; i < bits; i += 8 ) {
-				Huff_offsetTransmit( &msgHuff.compressor, (value & 0xff), msg->data, &msg->bit, msg->maxsize << 3 );
-				value = (value >> 8);
 
-				if ( msg->bit > msg->maxsize << 3 ) {
-					msg->overflowed = qtrue;
+		// the odd bits go out raw, then every byte as its Huffman code
+		acc = uvalue & ( ( 1 << nbits ) - 1 );
+		count = nbits;
+		uvalue >>= nbits;
+
+		for ( i = nbits; i < bits; i += 8 ) {
+			length = msgHuffTable.lengths[ uvalue & 0xff ];
+			if ( count + length > MSG_BUFFERED_BITS ) {
+				if ( !MSG_FlushBits( msg, acc, count ) ) {
 					return;
 				}
+				acc = 0;
+				count = 0;
 			}
+			acc |= (uint64_t)msgHuffTable.codes[ uvalue & 0xff ] << count;
+			count += length;
+			uvalue >>= 8;
+		}
+
+		if ( !MSG_FlushBits( msg, acc, count ) ) {
+			return;
 		}
 		msg->cursize = (msg->bit >> 3) + 1;
 	}
@@ -223,7 +330,29 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 			Com_Error(ERR_DROP, "can't read %d bits", bits);
 	} else {
 		nbits = 0;
-		if (bits&7) {
+		i = 0;
+		if ( ( msg->bit >> 3 ) + 8 <= msg->cursize ) {
+			// decode from a window of the next 57 or more bits while the
+			// codes are short enough for the lookup table
+			uint64_t	window = MSG_LoadBits( msg->data + ( msg->bit >> 3 ) ) >> ( msg->bit & 7 );
+			int			avail = 64 - ( msg->bit & 7 );
+			int			used, index;
+
+			nbits = bits & 7;
+			value = (int)( window & ( ( 1 << nbits ) - 1 ) );
+			used = nbits;
+			bits -= nbits;
+
+			for ( ; i < bits && used + HUFF_LOOKUP_BITS <= avail; i += 8 ) {
+				index = (int)( window >> used ) & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 );
+				if ( !msgHuffTable.symbolLengths[ index ] ) {
+					break;
+				}
+				value = (unsigned int)value | ( (unsigned int)msgHuffTable.symbols[ index ] << ( i + nbits ) );
+				used += msgHuffTable.symbolLengths[ index ];
+			}
+			msg->bit += used;
+		} else if (bits&7) {
 			nbits = bits&7;
 			if (msg->bit + nbits > msg->cursize << 3) {
 				msg->readcount = msg->cursize + 1;
@@ -233,11 +362,12 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 				value |= (Huff_getBit(msg->data, &msg->bit)<<i);
 			}
 			bits = bits - nbits;
+			i = 0;
 		}
-		if (bits) {
+		if (i < bits) {
 //			fp = fopen("c:\\netchan.bin", "a");
-			for(i=0;i<bits;i+=8) {
-				Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit, msg->cursize<<3);
+			for(;i<bits;i+=8) {
+				Huff_tableReceive (&msgHuffTable, &get, msg->data, &msg->bit, msg->cursize<<3);
 //				fwrite(&get, 1, 1, fp);
 				value = (unsigned int)value | ((unsigned int)get<<(i+nbits));
 
@@ -287,6 +417,14 @@ void MSG_WriteByte( msg_t *sb, int c ) {
 
 void MSG_WriteData( msg_t *buf, const void *data, int length ) {
 	int i;
+
+	if ( buf->oob && !buf->overflowed && length > 0 && buf->cursize + length <= buf->maxsize ) {
+		Com_Memcpy( buf->data + buf->cursize, data, length );
+		buf->cursize += length;
+		buf->bit += length << 3;
+		return;
+	}
+
 	for(i=0;i<length;i++) {
 		MSG_WriteByte(buf, ((byte *)data)[i]);
 	}
@@ -541,6 +679,13 @@ float MSG_ReadAngle16( msg_t *msg ) {
 void MSG_ReadData( msg_t *msg, void *data, int len ) {
 	int		i;
 
+	if ( msg->oob && len > 0 && msg->readcount + len <= msg->cursize ) {
+		Com_Memcpy( data, msg->data + msg->readcount, len );
+		msg->readcount += len;
+		msg->bit += len << 3;
+		return;
+	}
+
 	for (i=0 ; i<len ; i++) {
 		((byte *)data)[i] = MSG_ReadByte (msg);
 	}
@@ -653,7 +798,7 @@ void MSG_WriteDeltaUsercmdKey( msg_t *msg, int key, usercmd_t *from, usercmd_t *
 		from->buttons == to->buttons &&
 		from->weapon == to->weapon) {
 			MSG_WriteBits( msg, 0, 1 );				// no change
-			oldsize += 7;
+			MSG_CountBits( 7 );
 			return;
 	}
 	key ^= to->serverTime;
@@ -872,7 +1017,7 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 
 	MSG_WriteByte( msg, lc );	// # of changes
 
-	oldsize += numFields;
+	MSG_CountBits( numFields );
 
 	for ( i = 0, field = entityStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
@@ -892,7 +1037,7 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 
 			if (fullFloat == 0.0f) {
 					MSG_WriteBits( msg, 0, 1 );
-					oldsize += FLOAT_INT_BITS;
+					MSG_CountBits( FLOAT_INT_BITS );
 			} else {
 				MSG_WriteBits( msg, 1, 1 );
 				if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && 
@@ -1147,7 +1292,7 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 
 	MSG_WriteByte( msg, lc );	// # of changes
 
-	oldsize += numFields - lc;
+	MSG_CountBits( numFields - lc );
 
 	for ( i = 0, field = playerStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
@@ -1213,7 +1358,7 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 
 	if (!statsbits && !persistantbits && !ammobits && !powerupbits) {
 		MSG_WriteBits( msg, 0, 1 );	// no change
-		oldsize += 4;
+		MSG_CountBits( 4 );
 		return;
 	}
 	MSG_WriteBits( msg, 1, 1 );	// changed
@@ -1677,6 +1822,9 @@ void MSG_initHuffman( void ) {
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+
+	// both trees are the same
+	Huff_BuildTable(&msgHuff.decompressor, &msgHuffTable);
 }
 
 /*
@@ -1715,3 +1863,921 @@ void MSG_NUinitHuffman() {
 */
 
 //===========================================================================
+
+#define HUFFBENCH_MAXDATA		( 256 * 1024 )
+#define HUFFBENCH_SYMBOLS		( HUFFBENCH_MAXDATA * 8 + HUFFBENCH_MAXDATA / 16 )	// every symbol is at least a bit
+
+typedef struct {
+	int		numMessages;
+	int		*offsets;		// into data, numMessages + 1 of them
+	byte	*data;
+	int		numSymbols;
+	short	*symbols;		// numMessages runs, ending with -1
+} huffBench_t;
+
+/*
+=================
+MSG_HuffBenchLoadDemo
+
+Takes the messages of a demo, or as many as fit in HUFFBENCH_MAXDATA
+=================
+*/
+static qboolean MSG_HuffBenchLoadDemo( huffBench_t *bench, const char *name, byte *data ) {
+	byte	*file;
+	int		length, pos, size, out;
+
+	length = FS_ReadFile( va( "demos/%s", name ), (void **)&file );
+	if ( length <= 0 ) {
+		length = FS_ReadFile( name, (void **)&file );
+		if ( length <= 0 ) {
+			Com_Printf( "Couldn't read %s\n", name );
+			return qfalse;
+		}
+	}
+
+	// sequence number and size before every message, -1 at the end
+	pos = out = 0;
+	while ( pos + 8 <= length && bench->numMessages < HUFFBENCH_MAXDATA / 16 ) {
+		size = LittleLong( *(int *)( file + pos + 4 ) );
+		if ( size < 0 || size > MAX_MSGLEN || pos + 8 + size > length || out + size > HUFFBENCH_MAXDATA ) {
+			break;
+		}
+
+		Com_Memcpy( data + out, file + pos + 8, size );
+		bench->offsets[ bench->numMessages++ ] = out;
+		out += size;
+		pos += 8 + size;
+	}
+	bench->offsets[ bench->numMessages ] = out;
+
+	FS_FreeFile( file );
+
+	return bench->numMessages > 0;
+}
+
+/*
+=================
+MSG_HuffBenchSynthesize
+
+Encodes bytes drawn from the msg_hData distribution
+=================
+*/
+static void MSG_HuffBenchSynthesize( huffBench_t *bench, byte *data ) {
+	int		total, i, j, r, ch, bit, seed;
+
+	for ( total = 0, i = 0; i < 256; i++ ) {
+		total += msg_hData[ i ];
+	}
+
+	seed = 0x5eed;
+	bit = 0;
+	for ( i = 0; i < 200; i++ ) {
+		bench->offsets[ bench->numMessages++ ] = bit >> 3;
+
+		for ( j = 0; j < 1000; j++ ) {
+			r = (int)( Q_random( &seed ) * total );
+			for ( ch = 0; ch < 255 && r >= msg_hData[ ch ]; ch++ ) {
+				r -= msg_hData[ ch ];
+			}
+			Huff_offsetTransmit( &msgHuff.compressor, ch, data, &bit, HUFFBENCH_MAXDATA << 3 );
+		}
+
+		// start the next message on a byte
+		bit = ( bit + 7 ) & ~7;
+	}
+	bench->offsets[ bench->numMessages ] = bit >> 3;
+}
+
+/*
+=================
+MSG_HuffBenchDecode
+=================
+*/
+static int MSG_HuffBenchDecode( huffBench_t *bench, qboolean table, short *symbols ) {
+	int		i, n, ch, bit, lastBit, maxBit;
+	byte	*data;
+
+	for ( n = 0, i = 0; i < bench->numMessages; i++ ) {
+		data = bench->data + bench->offsets[ i ];
+		maxBit = ( bench->offsets[ i + 1 ] - bench->offsets[ i ] ) << 3;
+
+		for ( bit = 0; bit < maxBit; ) {
+			lastBit = bit;
+			if ( table ) {
+				Huff_tableReceive( &msgHuffTable, &ch, data, &bit, maxBit );
+			} else {
+				Huff_offsetReceive( msgHuff.decompressor.tree, &ch, data, &bit, maxBit );
+			}
+			if ( bit == lastBit ) {
+				break;
+			}
+			symbols[ n++ ] = ch;
+		}
+		symbols[ n++ ] = -1;
+	}
+
+	return n;
+}
+
+/*
+=================
+MSG_HuffBenchEncode
+
+Returns the number of bits written
+=================
+*/
+static int MSG_HuffBenchEncode( huffBench_t *bench, qboolean table, byte *out ) {
+	int		i, ch, bit;
+
+	for ( bit = 0, i = 0; i < bench->numSymbols; i++ ) {
+		ch = bench->symbols[ i ];
+		if ( ch < 0 ) {
+			bit = ( bit + 7 ) & ~7;
+			continue;
+		}
+
+		// the ends of the messages may decode to NYT
+		ch &= 0xff;
+
+		if ( table ) {
+			Huff_tableTransmit( &msgHuffTable, ch, out, &bit, HUFFBENCH_MAXDATA << 3 );
+		} else {
+			Huff_offsetTransmit( &msgHuff.compressor, ch, out, &bit, HUFFBENCH_MAXDATA << 3 );
+		}
+	}
+
+	return bit;
+}
+
+/*
+=================
+MSG_HuffmanBench_f
+
+huffbench [demo]
+
+Decodes and encodes the messages of a demo, or synthetic messages with the
+byte frequencies of msg_hData, with the tree walk and with the lookup
+tables, checks that both give the same results and prints their speed
+=================
+*/
+void MSG_HuffmanBench_f( void ) {
+	huffBench_t		bench;
+	short			*symbols;
+	byte			*encoded[2];
+	int				bits[2];
+	int64_t			start, usec[2][2];
+	int				method, pass, passes, mismatches, i, bytes;
+
+	if ( !msgInit ) {
+		MSG_initHuffman();
+	}
+
+	Com_Memset( &bench, 0, sizeof( bench ) );
+	bench.offsets = Z_Malloc( ( HUFFBENCH_MAXDATA / 16 + 1 ) * sizeof( int ) );
+	bench.data = Z_Malloc( HUFFBENCH_MAXDATA + 4 );
+	symbols = Z_Malloc( HUFFBENCH_SYMBOLS * sizeof( short ) );
+	bench.symbols = Z_Malloc( HUFFBENCH_SYMBOLS * sizeof( short ) );
+	encoded[0] = Z_Malloc( HUFFBENCH_MAXDATA + 4 );
+	encoded[1] = Z_Malloc( HUFFBENCH_MAXDATA + 4 );
+
+	if ( Cmd_Argc() > 1 ) {
+		if ( !MSG_HuffBenchLoadDemo( &bench, Cmd_Argv( 1 ), bench.data ) ) {
+			goto done;
+		}
+	} else {
+		MSG_HuffBenchSynthesize( &bench, bench.data );
+	}
+
+	bytes = bench.offsets[ bench.numMessages ];
+
+	passes = MAX( 1, 64 * 1024 * 1024 / MAX( bytes, 1 ) );
+	passes = MIN( passes, 200 );
+
+	bench.numSymbols = MSG_HuffBenchDecode( &bench, qfalse, bench.symbols );
+
+	for ( method = 0; method < 2; method++ ) {
+		start = Sys_Microseconds();
+		for ( pass = 0; pass < passes; pass++ ) {
+			i = MSG_HuffBenchDecode( &bench, method, symbols );
+		}
+		usec[ method ][ 0 ] = MAX( Sys_Microseconds() - start, 1 );
+
+		mismatches = ( i != bench.numSymbols ) ? 1 : 0;
+		for ( i = 0; !mismatches && i < bench.numSymbols; i++ ) {
+			if ( symbols[ i ] != bench.symbols[ i ] ) {
+				mismatches++;
+			}
+		}
+		if ( mismatches ) {
+			Com_Printf( "^1%s decoder disagrees with the tree walk at symbol %i\n", method ? "table" : "tree", i );
+		}
+
+		start = Sys_Microseconds();
+		for ( pass = 0; pass < passes; pass++ ) {
+			bits[ method ] = MSG_HuffBenchEncode( &bench, method, encoded[ method ] );
+		}
+		usec[ method ][ 1 ] = MAX( Sys_Microseconds() - start, 1 );
+	}
+
+	if ( bits[0] != bits[1] || memcmp( encoded[0], encoded[1], bits[0] >> 3 ) ) {
+		Com_Printf( "^1table encoder output differs from the tree walk\n" );
+	}
+
+	Com_Printf( "%i messages, %i bytes, %i symbols, %i passes\n", bench.numMessages, bytes,
+		bench.numSymbols - bench.numMessages, passes );
+	for ( method = 0; method < 2; method++ ) {
+		Com_Printf( "%-10s decode %7.1f MB/s  encode %7.1f MB/s\n", method ? "table:" : "tree walk:",
+			(double)bytes * passes / usec[ method ][ 0 ], (double)( bits[ method ] >> 3 ) * passes / usec[ method ][ 1 ] );
+	}
+
+done:
+	Z_Free( encoded[1] );
+	Z_Free( encoded[0] );
+	Z_Free( bench.symbols );
+	Z_Free( symbols );
+	Z_Free( bench.data );
+	Z_Free( bench.offsets );
+}
+
+/*
+=================
+MSG_WriteBitsBitwise
+
+The Huffman coded path of MSG_WriteBits a bit and a tree walk at a time,
+to check the buffered one against
+=================
+*/
+static void MSG_WriteBitsBitwise( msg_t *msg, int value, int bits ) {
+	int	i, nbits;
+
+	if ( msg->overflowed ) {
+		return;
+	}
+
+	if ( bits < 0 ) {
+		bits = -bits;
+	}
+
+	value &= (0xffffffff >> (32 - bits));
+	if ( bits&7 ) {
+		nbits = bits&7;
+		if ( msg->bit + nbits > msg->maxsize << 3 ) {
+			msg->overflowed = qtrue;
+			return;
+		}
+		for( i = 0; i < nbits; i++ ) {
+			Huff_putBit( (value & 1), msg->data, &msg->bit );
+			value = (value >> 1);
+		}
+		bits = bits - nbits;
+	}
+	for( i = 0; i < bits; i += 8 ) {
+		Huff_offsetTransmit( &msgHuff.compressor, (value & 0xff), msg->data, &msg->bit, msg->maxsize << 3 );
+		value = (value >> 8);
+
+		if ( msg->bit > msg->maxsize << 3 ) {
+			msg->overflowed = qtrue;
+			return;
+		}
+	}
+	msg->cursize = (msg->bit >> 3) + 1;
+}
+
+/*
+=================
+MSG_ReadBitsBitwise
+=================
+*/
+static int MSG_ReadBitsBitwise( msg_t *msg, int bits ) {
+	int			value, get, i, nbits;
+	qboolean	sgn;
+
+	if ( msg->readcount > msg->cursize ) {
+		return 0;
+	}
+
+	value = 0;
+	sgn = ( bits < 0 );
+	if ( bits < 0 ) {
+		bits = -bits;
+	}
+
+	nbits = 0;
+	if (bits&7) {
+		nbits = bits&7;
+		if (msg->bit + nbits > msg->cursize << 3) {
+			msg->readcount = msg->cursize + 1;
+			return 0;
+		}
+		for(i=0;i<nbits;i++) {
+			value |= (Huff_getBit(msg->data, &msg->bit)<<i);
+		}
+		bits = bits - nbits;
+	}
+	for(i=0;i<bits;i+=8) {
+		Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit, msg->cursize<<3);
+		value = (unsigned int)value | ((unsigned int)get<<(i+nbits));
+
+		if (msg->bit > msg->cursize<<3) {
+			msg->readcount = msg->cursize + 1;
+			return 0;
+		}
+	}
+	msg->readcount = (msg->bit>>3)+1;
+
+	if ( sgn && bits > 0 && bits < 32 ) {
+		if ( value & ( 1 << ( bits - 1 ) ) ) {
+			value |= -1 ^ ( ( 1 << bits ) - 1 );
+		}
+	}
+
+	return value;
+}
+
+static unsigned int MSG_FuzzRand( unsigned int *state ) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+#define MSGFUZZ_MAXVALUES	512
+
+/*
+=================
+MSG_FuzzIteration
+
+Returns qfalse when the buffered and the bitwise paths disagree
+=================
+*/
+static qboolean MSG_FuzzIteration( unsigned int seed, int *numValues ) {
+	static byte		data[2][MAX_MSGLEN], spliceData[MAX_MSGLEN];
+	static int		values[MSGFUZZ_MAXVALUES], widths[MSGFUZZ_MAXVALUES];
+	msg_t			msg[2], splice;
+	unsigned int	state = seed;
+	int				count, written, maxsize, i, r, a, b;
+
+	maxsize = 1 + MSG_FuzzRand( &state ) % ( ( MSG_FuzzRand( &state ) & 3 ) ? 1400 : 64 );
+	count = 1 + MSG_FuzzRand( &state ) % MSGFUZZ_MAXVALUES;
+
+	// both buffers start out with the same stale bytes
+	for ( i = 0; i < maxsize; i++ ) {
+		data[0][i] = data[1][i] = (byte)MSG_FuzzRand( &state );
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		r = MSG_FuzzRand( &state );
+		do {
+			widths[i] = (int)( MSG_FuzzRand( &state ) % 64 ) - 31;
+		} while ( !widths[i] );
+
+		// mostly small values, like the delta compressed fields
+		switch ( r & 3 ) {
+		case 0:		values[i] = MSG_FuzzRand( &state ); break;
+		case 1:		values[i] = MSG_FuzzRand( &state ) & 0xff; break;
+		case 2:		values[i] = (int)( MSG_FuzzRand( &state ) % 16 ) - 8; break;
+		default:	values[i] = 0; break;
+		}
+	}
+	*numValues += count;
+
+	MSG_Init( &msg[0], data[0], maxsize );
+	MSG_Init( &msg[1], data[1], maxsize );
+	written = 0;
+	for ( i = 0; i < count; i++ ) {
+		MSG_WriteBits( &msg[0], values[i], widths[i] );
+		if ( !msg[0].overflowed ) {
+			written++;
+		}
+		MSG_WriteBitsBitwise( &msg[1], values[i], widths[i] );
+		if ( msg[0].bit != msg[1].bit || msg[0].cursize != msg[1].cursize || msg[0].overflowed != msg[1].overflowed ) {
+			Com_Printf( "msgfuzz %u: writing value %i of %i bits left bit %i/%i cursize %i/%i\n", seed,
+				values[i], widths[i], msg[0].bit, msg[1].bit, msg[0].cursize, msg[1].cursize );
+			return qfalse;
+		}
+	}
+	if ( memcmp( data[0], data[1], maxsize ) ) {
+		Com_Printf( "msgfuzz %u: written bytes differ\n", seed );
+		return qfalse;
+	}
+
+	// read back what was written, cut short or replaced by noise now and then
+	msg[0].cursize = msg[1].cursize = MIN( msg[0].cursize, maxsize );
+	r = MSG_FuzzRand( &state ) & 7;
+	if ( r == 0 ) {
+		msg[0].cursize = msg[1].cursize = MSG_FuzzRand( &state ) % ( msg[0].cursize + 1 );
+	} else if ( r == 1 ) {
+		for ( i = 0; i < maxsize; i++ ) {
+			data[0][i] = (byte)MSG_FuzzRand( &state );
+		}
+	}
+	msg[1].data = data[0];
+
+	MSG_BeginReading( &msg[0] );
+	MSG_BeginReading( &msg[1] );
+	for ( i = 0; i < count; i++ ) {
+		a = MSG_ReadBits( &msg[0], widths[i] );
+		b = MSG_ReadBitsBitwise( &msg[1], widths[i] );
+		if ( a != b || msg[0].bit != msg[1].bit || msg[0].readcount != msg[1].readcount ) {
+			Com_Printf( "msgfuzz %u: reading %i bits gave %i/%i bit %i/%i readcount %i/%i\n", seed,
+				widths[i], a, b, msg[0].bit, msg[1].bit, msg[0].readcount, msg[1].readcount );
+			return qfalse;
+		}
+
+		// negative widths that aren't whole bytes only sign extend the
+		// Huffman coded part, so just check the rest
+		if ( r > 1 && i < written && msg[0].readcount <= msg[0].cursize && ( widths[i] > 0 || !( widths[i] & 7 ) ) ) {
+			if ( widths[i] == 32 || widths[i] == -32 ) {
+				b = values[i];
+			} else if ( widths[i] < 0 ) {
+				b = (int)( (unsigned int)values[i] << ( 32 + widths[i] ) ) >> ( 32 + widths[i] );
+			} else {
+				b = values[i] & ( ( 1 << widths[i] ) - 1 );
+			}
+			if ( a != b ) {
+				Com_Printf( "msgfuzz %u: value %i of %i bits read back as %i\n", seed, values[i], widths[i], a );
+				return qfalse;
+			}
+		}
+	}
+
+	// the second half written elsewhere and spliced in
+	r = MSG_FuzzRand( &state ) % ( count + 1 );
+	MSG_Init( &msg[0], data[0], maxsize );
+	MSG_Init( &msg[1], data[1], maxsize );
+	MSG_Init( &splice, spliceData, sizeof( spliceData ) );
+	for ( i = 0; i < count; i++ ) {
+		MSG_WriteBits( &msg[0], values[i], widths[i] );
+		MSG_WriteBits( i < r ? &msg[1] : &splice, values[i], widths[i] );
+	}
+	MSG_WriteBitstream( &msg[1], spliceData, splice.bit );
+	// an overflow can leave bit anywhere
+	if ( msg[0].overflowed != msg[1].overflowed || ( !msg[0].overflowed && ( msg[0].bit != msg[1].bit ||
+		msg[0].cursize != msg[1].cursize || memcmp( data[0], data[1], msg[0].bit >> 3 ) ) ) ) {
+		Com_Printf( "msgfuzz %u: spliced bits at %i differ\n", seed, r );
+		return qfalse;
+	}
+
+	// whole buffer copies of the out of band path
+	MSG_InitOOB( &msg[0], data[0], maxsize );
+	MSG_InitOOB( &msg[1], data[1], maxsize );
+	for ( i = 0; i < count; i += r ) {
+		r = 1 + MSG_FuzzRand( &state ) % 64;
+		MSG_WriteData( &msg[0], values, MIN( r, count - i ) );
+		for ( a = 0; a < MIN( r, count - i ); a++ ) {
+			MSG_WriteByte( &msg[1], ( (byte *)values )[a] );
+		}
+	}
+	if ( msg[0].cursize != msg[1].cursize || msg[0].overflowed != msg[1].overflowed ||
+		memcmp( data[0], data[1], MIN( msg[0].cursize, maxsize ) ) ) {
+		Com_Printf( "msgfuzz %u: out of band writes differ\n", seed );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+MSG_Fuzz_f
+
+msgfuzz [iterations] [seed]
+
+Writes and reads back random values of random widths with MSG_WriteBits and
+MSG_ReadBits and with the bit at a time Huffman coder they replace, and
+checks that both give the same bytes, values and offsets.  Also checks
+that bits spliced in with MSG_WriteBitstream match writing them directly.
+=================
+*/
+void MSG_Fuzz_f( void ) {
+	int				iterations, i, failures, numValues;
+	unsigned int	seed;
+
+	if ( !msgInit ) {
+		MSG_initHuffman();
+	}
+
+	iterations = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 10000;
+	seed = Cmd_Argc() > 2 ? strtoul( Cmd_Argv( 2 ), NULL, 10 ) : (unsigned int)Sys_Milliseconds();
+
+	failures = numValues = 0;
+	for ( i = 0; i < iterations && failures < 10; i++ ) {
+		// never 0, which xorshift can't leave
+		if ( !MSG_FuzzIteration( seed + i ? seed + i : 1, &numValues ) ) {
+			failures++;
+		}
+	}
+
+	Com_Printf( "msgfuzz: %i iterations from seed %u, %i values, %i failures\n", i, seed, numValues, failures );
+}
+
+/*
+=============================================================================
+
+Snapshot encoding benchmark
+
+snapbench parses the snapshots out of a demo the same way the client does,
+then times encoding them again the way the server does, with the same delta
+frames the demo was recorded with
+
+=============================================================================
+*/
+
+#define SNAPBENCH_SNAPSHOTS		2048
+#define SNAPBENCH_ENTITIES		( 32 * 1024 )	// room for one more snapshot is always kept
+
+typedef struct {
+	int				messageNum;
+	int				delta;				// index of the snapshot this one is delta compressed from, or -1
+	int				serverTime;
+	int				snapFlags;
+	int				areabytes;
+	byte			areamask[MAX_MAP_AREA_BYTES];
+	playerState_t	ps;
+	int				firstEntity;		// into snapBench_t.entities
+	int				numEntities;
+} benchSnapshot_t;
+
+typedef struct {
+	entityState_t	baselines[MAX_GENTITIES];
+
+	int				numSnapshots;
+	benchSnapshot_t	*snapshots;			// [SNAPBENCH_SNAPSHOTS]
+
+	int				numEntities;
+	entityState_t	*entities;			// [SNAPBENCH_ENTITIES]
+
+	int				numDropped;			// valid snapshots that didn't fit
+} snapBench_t;
+
+/*
+=================
+MSG_SnapBenchParseGamestate
+=================
+*/
+static void MSG_SnapBenchParseGamestate( snapBench_t *bench, msg_t *msg ) {
+	entityState_t	nullstate;
+	int				cmd, newnum;
+
+	MSG_ReadLong( msg );		// server command sequence
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	Com_Memset( bench->baselines, 0, sizeof( bench->baselines ) );
+	bench->numSnapshots = 0;
+	bench->numEntities = 0;
+
+	while ( msg->readcount <= msg->cursize ) {
+		cmd = MSG_ReadByte( msg );
+
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		if ( cmd == svc_configstring ) {
+			MSG_ReadShort( msg );
+			MSG_ReadBigString( msg );
+		} else if ( cmd == svc_baseline ) {
+			newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			if ( newnum < 0 || newnum >= MAX_GENTITIES ) {
+				Com_Error( ERR_DROP, "Baseline number out of range: %i", newnum );
+			}
+			MSG_ReadDeltaEntity( msg, &nullstate, &bench->baselines[newnum], newnum );
+		} else {
+			Com_Error( ERR_DROP, "MSG_SnapBenchParseGamestate: bad command byte" );
+		}
+	}
+
+	MSG_ReadLong( msg );		// client number
+	MSG_ReadLong( msg );		// checksum feed
+}
+
+/*
+=================
+MSG_SnapBenchParseSnapshot
+
+Same as CL_ParseSnapshot and CL_ParsePacketEntities.  The delta frame is
+looked for in the first numSnapshots snapshots and the entities go after all
+the stored ones.  Returns qfalse if the snapshot can't be used, it still has
+to be parsed to get to the rest of the message.
+=================
+*/
+static qboolean MSG_SnapBenchParseSnapshot( snapBench_t *bench, msg_t *msg, int messageNum,
+	int numSnapshots, benchSnapshot_t *snap ) {
+	benchSnapshot_t	*old;
+	entityState_t	*oldstate, *state;
+	int				deltaNum, oldindex, oldnum, newnum, len, i;
+	qboolean		valid;
+
+	Com_Memset( snap, 0, sizeof( *snap ) );
+	snap->messageNum = messageNum;
+	snap->serverTime = MSG_ReadLong( msg );
+
+	deltaNum = MSG_ReadByte( msg );
+	snap->snapFlags = MSG_ReadByte( msg );
+
+	old = NULL;
+	snap->delta = -1;
+	valid = qtrue;
+	if ( deltaNum ) {
+		// the delta frame has to be one that was kept
+		valid = qfalse;
+		for ( i = numSnapshots - 1; i >= 0 && i >= numSnapshots - PACKET_BACKUP; i-- ) {
+			if ( bench->snapshots[i].messageNum == messageNum - deltaNum ) {
+				old = &bench->snapshots[i];
+				snap->delta = i;
+				valid = qtrue;
+				break;
+			}
+		}
+	}
+
+	len = MSG_ReadByte( msg );
+	if ( len > sizeof( snap->areamask ) ) {
+		Com_Error( ERR_DROP, "MSG_SnapBenchParseSnapshot: Invalid size %d for areamask", len );
+	}
+	snap->areabytes = len;
+	MSG_ReadData( msg, snap->areamask, len );
+
+	MSG_ReadDeltaPlayerstate( msg, old ? &old->ps : NULL, &snap->ps );
+
+	snap->firstEntity = bench->numEntities;
+	oldindex = 0;
+	oldstate = NULL;
+	oldnum = 99999;
+	if ( old && old->numEntities ) {
+		oldstate = &bench->entities[old->firstEntity];
+		oldnum = oldstate->number;
+	}
+
+	while ( 1 ) {
+		newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( newnum == MAX_GENTITIES - 1 || msg->readcount > msg->cursize ) {
+			newnum = 99999;
+		}
+
+		// unchanged entities from the old frame
+		while ( oldnum < newnum ) {
+			if ( snap->numEntities < MAX_SNAPSHOT_ENTITIES ) {
+				bench->entities[snap->firstEntity + snap->numEntities++] = *oldstate;
+			}
+			if ( ++oldindex >= old->numEntities ) {
+				oldnum = 99999;
+			} else {
+				oldstate = &bench->entities[old->firstEntity + oldindex];
+				oldnum = oldstate->number;
+			}
+		}
+
+		if ( newnum == 99999 ) {
+			break;
+		}
+
+		// the last one is overwritten if there are too many, that snapshot is dropped then
+		state = &bench->entities[snap->firstEntity + MIN( snap->numEntities, MAX_SNAPSHOT_ENTITIES - 1 )];
+		if ( oldnum == newnum ) {
+			MSG_ReadDeltaEntity( msg, oldstate, state, newnum );
+			if ( ++oldindex >= old->numEntities ) {
+				oldnum = 99999;
+			} else {
+				oldstate = &bench->entities[old->firstEntity + oldindex];
+				oldnum = oldstate->number;
+			}
+		} else {
+			MSG_ReadDeltaEntity( msg, &bench->baselines[newnum], state, newnum );
+		}
+
+		if ( state->number != MAX_GENTITIES - 1 ) {
+			if ( snap->numEntities == MAX_SNAPSHOT_ENTITIES ) {
+				valid = qfalse;
+			} else {
+				snap->numEntities++;
+			}
+		}
+	}
+
+	return valid && msg->readcount <= msg->cursize;
+}
+
+/*
+=================
+MSG_SnapBenchParseDemo
+
+Returns qfalse if the demo couldn't be read
+=================
+*/
+static qboolean MSG_SnapBenchParseDemo( snapBench_t *bench, const char *name ) {
+	static byte		bufData[MAX_MSGLEN];
+	benchSnapshot_t	snap;
+	msg_t			msg;
+	byte			*file;
+	int				length, pos, size, cmd, messageNum;
+
+	length = FS_ReadFile( va( "demos/%s", name ), (void **)&file );
+	if ( length <= 0 ) {
+		length = FS_ReadFile( name, (void **)&file );
+		if ( length <= 0 ) {
+			Com_Printf( "Couldn't read %s\n", name );
+			return qfalse;
+		}
+	}
+
+	// messages the way CL_WriteDemoMessage stores them
+	for ( pos = 0; pos + 8 <= length; pos += 8 + size ) {
+		messageNum = LittleLong( *(int *)( file + pos ) );
+		size = LittleLong( *(int *)( file + pos + 4 ) );
+		if ( size < 0 || size > MAX_MSGLEN || pos + 8 + size > length ) {
+			break;
+		}
+
+		MSG_Init( &msg, bufData, sizeof( bufData ) );
+		Com_Memcpy( bufData, file + pos + 8, size );
+		msg.cursize = size;
+		MSG_Bitstream( &msg );
+
+		MSG_ReadLong( &msg );		// reliable acknowledge
+
+		while ( msg.readcount <= msg.cursize ) {
+			cmd = MSG_ReadByte( &msg );
+			if ( cmd == svc_EOF ) {
+				break;
+			}
+
+			if ( cmd == svc_nop ) {
+				continue;
+			} else if ( cmd == svc_serverCommand ) {
+				MSG_ReadLong( &msg );
+				MSG_ReadString( &msg );
+			} else if ( cmd == svc_gamestate ) {
+				MSG_SnapBenchParseGamestate( bench, &msg );
+			} else if ( cmd == svc_snapshot ) {
+				// keep it while there is room for another one after it
+				if ( !MSG_SnapBenchParseSnapshot( bench, &msg, messageNum, bench->numSnapshots, &snap ) ) {
+					continue;
+				}
+				if ( bench->numSnapshots < SNAPBENCH_SNAPSHOTS &&
+					bench->numEntities + snap.numEntities <= SNAPBENCH_ENTITIES - 2 * MAX_SNAPSHOT_ENTITIES ) {
+					bench->numEntities += snap.numEntities;
+					bench->snapshots[bench->numSnapshots++] = snap;
+				} else {
+					bench->numDropped++;
+				}
+			} else {
+				// downloads and voice don't get recorded in the middle of a game
+				break;
+			}
+		}
+	}
+
+	FS_FreeFile( file );
+
+	return qtrue;
+}
+
+/*
+=================
+MSG_SnapBenchEncode
+
+Writes a snapshot the way SV_WriteSnapshotToClient and SV_EmitPacketEntities
+do, returns the number of entity deltas
+=================
+*/
+static int MSG_SnapBenchEncode( snapBench_t *bench, benchSnapshot_t *snap, msg_t *msg ) {
+	benchSnapshot_t	*old;
+	entityState_t	*oldent, *newent;
+	int				oldindex, newindex, oldnum, newnum, deltas;
+
+	old = snap->delta >= 0 ? &bench->snapshots[snap->delta] : NULL;
+
+	MSG_WriteByte( msg, svc_snapshot );
+	MSG_WriteLong( msg, snap->serverTime );
+	MSG_WriteByte( msg, old ? snap->messageNum - old->messageNum : 0 );
+	MSG_WriteByte( msg, snap->snapFlags );
+	MSG_WriteByte( msg, snap->areabytes );
+	MSG_WriteData( msg, snap->areamask, snap->areabytes );
+
+	MSG_WriteDeltaPlayerstate( msg, old ? &old->ps : NULL, &snap->ps );
+
+	oldent = newent = NULL;
+	oldindex = newindex = 0;
+	deltas = 0;
+	while ( newindex < snap->numEntities || ( old && oldindex < old->numEntities ) ) {
+		if ( newindex >= snap->numEntities ) {
+			newnum = 9999;
+		} else {
+			newent = &bench->entities[snap->firstEntity + newindex];
+			newnum = newent->number;
+		}
+
+		if ( !old || oldindex >= old->numEntities ) {
+			oldnum = 9999;
+		} else {
+			oldent = &bench->entities[old->firstEntity + oldindex];
+			oldnum = oldent->number;
+		}
+
+		deltas++;
+		if ( newnum == oldnum ) {
+			MSG_WriteDeltaEntity( msg, oldent, newent, qfalse );
+			oldindex++;
+			newindex++;
+		} else if ( newnum < oldnum ) {
+			MSG_WriteDeltaEntity( msg, &bench->baselines[newnum], newent, qtrue );
+			newindex++;
+		} else {
+			MSG_WriteDeltaEntity( msg, oldent, NULL, qtrue );
+			oldindex++;
+		}
+	}
+
+	MSG_WriteBits( msg, MAX_GENTITIES - 1, GENTITYNUM_BITS );
+
+	return deltas;
+}
+
+/*
+=================
+MSG_SnapBench_f
+
+snapbench <demo> [passes]
+
+Prints the encoding speed, ns per entity delta and the average snapshot size.
+Every snapshot is also decoded again once to make sure it comes back the same.
+=================
+*/
+void MSG_SnapBench_f( void ) {
+	static byte		bufData[MAX_MSGLEN];
+	snapBench_t		*bench;
+	benchSnapshot_t	*snap, check;
+	msg_t			msg;
+	int64_t			start, usec, bytes, deltas;
+	int				passes, pass, i, mismatches;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: snapbench <demo> [passes]\n" );
+		return;
+	}
+
+	passes = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 10;
+	passes = MAX( passes, 1 );
+
+	if ( !msgInit ) {
+		MSG_initHuffman();
+	}
+
+	bench = Z_Malloc( sizeof( *bench ) );
+	bench->snapshots = Z_Malloc( SNAPBENCH_SNAPSHOTS * sizeof( *bench->snapshots ) );
+	bench->entities = Z_Malloc( SNAPBENCH_ENTITIES * sizeof( *bench->entities ) );
+
+	if ( !MSG_SnapBenchParseDemo( bench, Cmd_Argv( 1 ) ) ) {
+		goto done;
+	}
+	if ( !bench->numSnapshots ) {
+		Com_Printf( "No snapshots in %s\n", Cmd_Argv( 1 ) );
+		goto done;
+	}
+
+	// make sure the encoding gives back the parsed snapshots
+	mismatches = 0;
+	for ( i = 0, snap = bench->snapshots; i < bench->numSnapshots; i++, snap++ ) {
+		MSG_Init( &msg, bufData, sizeof( bufData ) );
+		MSG_SnapBenchEncode( bench, snap, &msg );
+
+		// its entities go in the room left after the stored ones
+		MSG_BeginReading( &msg );
+		MSG_ReadByte( &msg );
+		if ( !MSG_SnapBenchParseSnapshot( bench, &msg, snap->messageNum, i, &check ) ||
+			check.delta != snap->delta || check.numEntities != snap->numEntities ||
+			memcmp( &check.ps, &snap->ps, sizeof( snap->ps ) ) ||
+			memcmp( &bench->entities[check.firstEntity], &bench->entities[snap->firstEntity],
+				snap->numEntities * sizeof( entityState_t ) ) ) {
+			mismatches++;
+		}
+	}
+
+	bytes = deltas = 0;
+	start = Sys_Microseconds();
+	for ( pass = 0; pass < passes; pass++ ) {
+		for ( i = 0, snap = bench->snapshots; i < bench->numSnapshots; i++, snap++ ) {
+			MSG_Init( &msg, bufData, sizeof( bufData ) );
+			deltas += MSG_SnapBenchEncode( bench, snap, &msg );
+			bytes += msg.cursize;
+		}
+	}
+	usec = MAX( Sys_Microseconds() - start, 1 );
+
+	Com_Printf( "%i snapshots, %i entity states, %i passes\n", bench->numSnapshots, bench->numEntities, passes );
+	if ( bench->numDropped ) {
+		Com_Printf( "the last %i snapshots of the demo didn't fit\n", bench->numDropped );
+	}
+	Com_Printf( "%.1f MB/s, %.1f ns per entity delta, %.0f ns and %.0f bits per snapshot\n",
+		(double)bytes / usec, usec * 1000.0 / MAX( deltas, 1 ),
+		usec * 1000.0 / ( (double)bench->numSnapshots * passes ), bytes * 8.0 / ( (double)bench->numSnapshots * passes ) );
+	if ( mismatches ) {
+		Com_Printf( "^1%i snapshots didn't decode to the same states\n", mismatches );
+	}
+
+done:
+	Z_Free( bench->entities );
+	Z_Free( bench->snapshots );
+	Z_Free( bench );
+}
@@ -20,6 +20,10 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
 
+#ifdef __linux__
+#	define _GNU_SOURCE		// recvmmsg and sendmmsg
+#endif
+
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
 
@@ -81,6 +85,25 @@ static qboolean	winsockInitialized = qfalse;
 #		include <sys/filio.h>
 #	endif
 
+#	if defined(__linux__) && defined(MSG_WAITFORONE)
+#		define NET_MMSG		// recvmmsg and sendmmsg are available
+#	endif
+
+#	ifdef __linux__
+#		include <sys/epoll.h>
+#		include <sys/timerfd.h>
+#		define NET_EPOLL	// NET_Sleep waits with epoll instead of select
+#		if __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 35 )
+#			define NET_EPOLL_PWAIT2
+#		endif
+#	endif
+
+#	if defined(__linux__) && defined(SO_REUSEPORT)
+#		include <poll.h>
+#		include <sys/eventfd.h>
+#		define NET_RECVTHREADS	// SO_REUSEPORT sockets read by their own threads
+#	endif
+
 typedef int SOCKET;
 #	define INVALID_SOCKET		-1
 #	define SOCKET_ERROR			-1
@@ -111,6 +134,14 @@ static cvar_t	*net_mcast6iface;
 
 static cvar_t	*net_dropsim;
 
+#ifdef NET_MMSG
+static cvar_t	*net_mmsg;
+#endif
+
+#ifdef NET_RECVTHREADS
+static cvar_t	*net_recvThreads;
+#endif
+
 static struct sockaddr	socksRelayAddr;
 
 static SOCKET	ip_socket = INVALID_SOCKET;
@@ -127,6 +158,96 @@ static struct sockaddr_in6 boundto;
   #define IF_NAMESIZE 16
 #endif
 
+#ifdef NET_MMSG
+/*
+With net_mmsg 1, the ip and ip6 sockets are drained with recvmmsg into a
+ring of buffers that NET_GetPacket hands out one at a time, and packets
+sent between NET_BeginSendBatch and NET_FlushSendBatch are queued and sent
+with sendmmsg.
+*/
+#define	NET_MMSG_BATCH		32		// datagrams per recvmmsg or sendmmsg call
+#define	NET_BATCH_PACKETLEN	1400	// MAX_PACKETLEN, larger packets aren't queued
+
+typedef struct {
+	int						count;		// received by the last recvmmsg
+	int						next;		// next one for NET_GetPacket
+	struct mmsghdr			msgs[NET_MMSG_BATCH];
+	struct iovec			iovecs[NET_MMSG_BATCH];
+	struct sockaddr_storage	addrs[NET_MMSG_BATCH];
+	byte					data[NET_MMSG_BATCH][MAX_MSGLEN + 1];
+} netRecvRing_t;
+
+typedef struct {
+	int						count;
+	netadrtype_t			types[NET_MMSG_BATCH];
+	struct mmsghdr			msgs[NET_MMSG_BATCH];
+	struct iovec			iovecs[NET_MMSG_BATCH];
+	struct sockaddr_storage	addrs[NET_MMSG_BATCH];
+	byte					data[NET_MMSG_BATCH][NET_BATCH_PACKETLEN];
+} netSendQueue_t;
+
+static netRecvRing_t	ipRecvRing;
+static netRecvRing_t	ip6RecvRing;
+static netSendQueue_t	ipSendQueue;
+static netSendQueue_t	ip6SendQueue;
+static qboolean			sendBatching;
+#endif
+
+#ifdef NET_EPOLL
+/*
+The ip and ip6 sockets stay registered with epollFd from NET_Config to
+NET_Config. Timeouts with a fraction of a millisecond use epoll_pwait2,
+or a timerfd in the same set on kernels without it.
+*/
+static int				epollFd = -1;
+static int				epollTimerFd = -1;
+#ifdef NET_EPOLL_PWAIT2
+static qboolean			epollNoPwait2;
+#endif
+#endif
+
+#ifdef NET_RECVTHREADS
+/*
+With net_recvThreads N, the ip and ip6 ports are opened N times with
+SO_REUSEPORT so the kernel spreads the flows over the sockets, and each
+pair of sockets is read by its own thread.  The threads drop what
+SV_FilterPacket rejects and queue the rest for the main thread, which
+wakes up on recvEventFd and reads the queues instead of the sockets.
+*/
+#define	MAX_RECV_THREADS		8
+#define	NET_QUEUE_SIZE			128		// power of two
+// clients never send more than MAX_PACKETLEN, and slots of MAX_MSGLEN would
+// take 2MB of zone per thread.  Bigger datagrams are queued without their
+// data so the main thread reports them like NET_GetPacket does.
+#define	NET_QUEUE_PACKETLEN		2048
+
+// each queue has one writer, its thread, and one reader, the main thread
+#define	NET_AtomicLoad( p )			__atomic_load_n( p, __ATOMIC_ACQUIRE )
+#define	NET_AtomicStore( p, v )		__atomic_store_n( p, v, __ATOMIC_RELEASE )
+
+typedef struct {
+	netadr_t	from;
+	int			length;			// -1 if it was too big for the slot
+	byte		data[NET_QUEUE_PACKETLEN];
+} netQueuedPacket_t;
+
+typedef struct {
+	void				*thread;
+	SOCKET				sockets[2];		// ip and ip6, slot 0 are ip_socket and ip6_socket
+	unsigned int		head;			// written by the thread
+	unsigned int		tail;			// written by the main thread
+	int					oversize;		// too big for a slot
+	int					filtered;		// rejected by SV_FilterPacket
+	netQueuedPacket_t	packets[NET_QUEUE_SIZE];
+} netRecvThread_t;
+
+static netRecvThread_t	*recvThreads[MAX_RECV_THREADS];
+static int				numRecvThreads;
+static int				nextRecvThread;		// where the main thread reads next
+static int				recvEventFd = -1;
+static qboolean			recvThreadsQuit;
+#endif
+
 // use an admin local address per default so that network admins can decide on how to handle quake3 traffic.
 #define NET_MULTICAST_IP6 "ff04::696f:7175:616b:6533"
 
@@ -513,6 +634,113 @@ qboolean	NET_IsLocalAddress( netadr_t adr ) {
 
 //=============================================================================
 
+/*
+==================
+NET_RecvFrom
+
+Same as recvfrom, but with net_mmsg set the packets come from a ring
+that is filled with one recvmmsg call
+==================
+*/
+#ifdef NET_MMSG
+static int NET_RecvFrom( SOCKET sock, netRecvRing_t *ring, void *buf, int len, struct sockaddr *from, socklen_t *fromlen )
+{
+	struct mmsghdr	*m;
+	int		i, ret, size;
+
+	// a ring still holding packets is emptied even if net_mmsg was turned off
+	if( !ring || ( !net_mmsg->integer && ring->next >= ring->count ) )
+		return recvfrom( sock, buf, len, 0, from, fromlen );
+
+	if( ring->next >= ring->count )
+	{
+		for( i = 0; i < NET_MMSG_BATCH; i++ )
+		{
+			ring->iovecs[i].iov_base = ring->data[i];
+			ring->iovecs[i].iov_len = sizeof( ring->data[i] );
+			memset( &ring->msgs[i].msg_hdr, 0, sizeof( ring->msgs[i].msg_hdr ) );
+			ring->msgs[i].msg_hdr.msg_name = &ring->addrs[i];
+			ring->msgs[i].msg_hdr.msg_namelen = sizeof( ring->addrs[i] );
+			ring->msgs[i].msg_hdr.msg_iov = &ring->iovecs[i];
+			ring->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		ring->count = ring->next = 0;
+		ret = recvmmsg( sock, ring->msgs, NET_MMSG_BATCH, MSG_DONTWAIT, NULL );
+		if( ret <= 0 )
+		{
+			if( !ret )
+				errno = EAGAIN;
+			return SOCKET_ERROR;
+		}
+		ring->count = ret;
+	}
+
+	m = &ring->msgs[ring->next];
+
+	// truncated like recvfrom would
+	size = m->msg_len;
+	if( size > len )
+		size = len;
+	memcpy( buf, ring->data[ring->next], size );
+
+	if( *fromlen > m->msg_hdr.msg_namelen )
+		*fromlen = m->msg_hdr.msg_namelen;
+	memcpy( from, &ring->addrs[ring->next], *fromlen );
+
+	ring->next++;
+
+	return size;
+}
+#else
+#define NET_RecvFrom( sock, ring, buf, len, from, fromlen )		recvfrom( sock, buf, len, 0, from, fromlen )
+#endif
+
+#ifdef NET_RECVTHREADS
+/*
+==================
+NET_GetQueuedPacket
+
+Takes a packet off the receive thread queues, taking turns between them
+==================
+*/
+static qboolean NET_GetQueuedPacket( netadr_t *net_from, msg_t *net_message )
+{
+	netRecvThread_t		*thread;
+	netQueuedPacket_t	*packet;
+	int					i;
+
+	for( i = 0; i < numRecvThreads; i++ )
+	{
+		thread = recvThreads[( nextRecvThread + i ) % numRecvThreads];
+
+		if( thread->tail == NET_AtomicLoad( &thread->head ) )
+			continue;
+
+		packet = &thread->packets[thread->tail & ( NET_QUEUE_SIZE - 1 )];
+
+		if( packet->length < 0 ) {
+			Com_Printf( "Oversize packet from %s\n", NET_AdrToString( packet->from ) );
+			NET_AtomicStore( &thread->tail, thread->tail + 1 );
+			i--;	// same thread again
+			continue;
+		}
+
+		Com_Memcpy( net_message->data, packet->data, packet->length );
+		net_message->cursize = packet->length;
+		net_message->readcount = 0;
+		*net_from = packet->from;
+
+		NET_AtomicStore( &thread->tail, thread->tail + 1 );
+		nextRecvThread = ( nextRecvThread + i + 1 ) % numRecvThreads;
+
+		return qtrue;
+	}
+
+	return qfalse;
+}
+#endif
+
 /*
 ==================
 NET_GetPacket
@@ -527,10 +755,16 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	socklen_t	fromlen;
 	int		err;
 	
+#ifdef NET_RECVTHREADS
+	// the ip and ip6 sockets are read by the receive threads
+	if(numRecvThreads)
+		return NET_GetQueuedPacket(net_from, net_message);
+#endif
+
 	if(ip_socket != INVALID_SOCKET && FD_ISSET(ip_socket, fdr))
 	{
 		fromlen = sizeof(from);
-		ret = recvfrom( ip_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen );
+		ret = NET_RecvFrom( ip_socket, &ipRecvRing, (void *)net_message->data, net_message->maxsize, (struct sockaddr *) &from, &fromlen );
 		
 		if (ret == SOCKET_ERROR)
 		{
@@ -574,7 +808,7 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	if(ip6_socket != INVALID_SOCKET && FD_ISSET(ip6_socket, fdr))
 	{
 		fromlen = sizeof(from);
-		ret = recvfrom(ip6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
+		ret = NET_RecvFrom(ip6_socket, &ip6RecvRing, (void *)net_message->data, net_message->maxsize, (struct sockaddr *) &from, &fromlen);
 		
 		if (ret == SOCKET_ERROR)
 		{
@@ -602,7 +836,7 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	if(multicast6_socket != INVALID_SOCKET && multicast6_socket != ip6_socket && FD_ISSET(multicast6_socket, fdr))
 	{
 		fromlen = sizeof(from);
-		ret = recvfrom(multicast6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
+		ret = NET_RecvFrom(multicast6_socket, NULL, (void *)net_message->data, net_message->maxsize, (struct sockaddr *) &from, &fromlen);
 		
 		if (ret == SOCKET_ERROR)
 		{
@@ -635,6 +869,132 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 
 static char socksBuf[4096];
 
+/*
+==================
+NET_SendError
+==================
+*/
+static void NET_SendError( netadrtype_t type ) {
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( ( err == EADDRNOTAVAIL ) && ( ( type == NA_BROADCAST ) ) ) {
+		return;
+	}
+
+	Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+}
+
+#ifdef NET_MMSG
+/*
+==================
+NET_FlushSendQueue
+==================
+*/
+static void NET_FlushSendQueue( SOCKET sock, netSendQueue_t *queue ) {
+	int		sent, ret;
+
+	if( sock == INVALID_SOCKET ) {
+		queue->count = 0;
+		return;
+	}
+
+	for( sent = 0; sent < queue->count; ) {
+		ret = sendmmsg( sock, &queue->msgs[sent], queue->count - sent, 0 );
+		if( ret == SOCKET_ERROR ) {
+			// the first one failed, skip it and send the rest
+			NET_SendError( queue->types[sent] );
+			sent++;
+			continue;
+		}
+		sent += ret;
+	}
+
+	queue->count = 0;
+}
+
+/*
+==================
+NET_QueuePacket
+
+Returns qfalse if the packet has to be sent right away
+==================
+*/
+static qboolean NET_QueuePacket( int length, const void *data, netadrtype_t type, const struct sockaddr_storage *addr ) {
+	netSendQueue_t	*queue;
+	struct mmsghdr	*m;
+	SOCKET			sock;
+	int				i;
+
+	if( addr->ss_family == AF_INET ) {
+		queue = &ipSendQueue;
+		sock = ip_socket;
+	} else if( addr->ss_family == AF_INET6 ) {
+		queue = &ip6SendQueue;
+		sock = ip6_socket;
+	} else {
+		return qfalse;
+	}
+
+	if( length > NET_BATCH_PACKETLEN ) {
+		// keep the order of the packets on the socket
+		NET_FlushSendQueue( sock, queue );
+		return qfalse;
+	}
+
+	if( queue->count == NET_MMSG_BATCH ) {
+		NET_FlushSendQueue( sock, queue );
+	}
+
+	i = queue->count++;
+	memcpy( queue->data[i], data, length );
+	queue->addrs[i] = *addr;
+	queue->types[i] = type;
+	queue->iovecs[i].iov_base = queue->data[i];
+	queue->iovecs[i].iov_len = length;
+
+	m = &queue->msgs[i];
+	memset( &m->msg_hdr, 0, sizeof( m->msg_hdr ) );
+	m->msg_hdr.msg_name = &queue->addrs[i];
+	m->msg_hdr.msg_namelen = addr->ss_family == AF_INET ? sizeof( struct sockaddr_in ) : sizeof( struct sockaddr_in6 );
+	m->msg_hdr.msg_iov = &queue->iovecs[i];
+	m->msg_hdr.msg_iovlen = 1;
+
+	return qtrue;
+}
+#endif
+
+/*
+==================
+NET_BeginSendBatch
+
+With net_mmsg set, packets are queued until NET_FlushSendBatch
+==================
+*/
+void NET_BeginSendBatch( void ) {
+#ifdef NET_MMSG
+	sendBatching = net_mmsg && net_mmsg->integer;
+#endif
+}
+
+/*
+==================
+NET_FlushSendBatch
+==================
+*/
+void NET_FlushSendBatch( void ) {
+#ifdef NET_MMSG
+	NET_FlushSendQueue( ip_socket, &ipSendQueue );
+	NET_FlushSendQueue( ip6_socket, &ip6SendQueue );
+	sendBatching = qfalse;
+#endif
+}
+
 /*
 ==================
 Sys_SendPacket
@@ -673,28 +1033,211 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 		ret = sendto( ip_socket, socksBuf, length+10, 0, &socksRelayAddr, sizeof(socksRelayAddr) );
 	}
 	else {
+#ifdef NET_MMSG
+		if( sendBatching && NET_QueuePacket( length, data, to.type, &addr ) )
+			return;
+#endif
 		if(addr.ss_family == AF_INET)
 			ret = sendto( ip_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in) );
 		else if(addr.ss_family == AF_INET6)
 			ret = sendto( ip6_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in6) );
 	}
 	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
+		NET_SendError( to.type );
+	}
+}
 
-		// wouldblock is silent
-		if( err == EAGAIN ) {
-			return;
+
+/*
+=============================================================================
+
+EXTRA CLIENT SOCKETS
+
+Non-blocking sockets on ephemeral ports that are owned and polled by the caller
+instead of Com_EventLoop, so a single process can speak to a server from
+many source ports at once (see the loadtest command).
+
+=============================================================================
+*/
+
+#define	MAX_EXTRA_SOCKETS	1024
+
+typedef struct {
+	qboolean	inuse;
+	SOCKET		sock;
+} extraSocket_t;
+
+static extraSocket_t	extraSockets[MAX_EXTRA_SOCKETS];
+
+/*
+==================
+NET_OpenExtraSocket
+
+Returns a handle for a socket bound to an ephemeral port, or -1
+==================
+*/
+int NET_OpenExtraSocket( netadrtype_t type ) {
+	struct sockaddr_storage	address;
+	ioctlarg_t	_true = 1;
+	SOCKET		newsocket;
+	int			i;
+
+	for( i = 0; i < MAX_EXTRA_SOCKETS; i++ ) {
+		if( !extraSockets[i].inuse )
+			break;
+	}
+	if( i == MAX_EXTRA_SOCKETS ) {
+		Com_Printf( "WARNING: NET_OpenExtraSocket: out of sockets\n" );
+		return -1;
+	}
+
+	memset( &address, 0, sizeof( address ) );
+	address.ss_family = ( type == NA_IP6 ) ? AF_INET6 : AF_INET;
+
+	if( ( newsocket = socket( address.ss_family, SOCK_DGRAM, IPPROTO_UDP ) ) == INVALID_SOCKET ) {
+		Com_Printf( "WARNING: NET_OpenExtraSocket: socket: %s\n", NET_ErrorString() );
+		return -1;
+	}
+	if( ioctlsocket( newsocket, FIONBIO, &_true ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_OpenExtraSocket: ioctl FIONBIO: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return -1;
+	}
+	if( bind( newsocket, (struct sockaddr *) &address, ( type == NA_IP6 ) ?
+		sizeof( struct sockaddr_in6 ) : sizeof( struct sockaddr_in ) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_OpenExtraSocket: bind: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return -1;
+	}
+
+	extraSockets[i].inuse = qtrue;
+	extraSockets[i].sock = newsocket;
+	return i;
+}
+
+/*
+==================
+NET_CloseExtraSocket
+==================
+*/
+void NET_CloseExtraSocket( int handle ) {
+	if( handle < 0 || handle >= MAX_EXTRA_SOCKETS || !extraSockets[handle].inuse )
+		return;
+
+	closesocket( extraSockets[handle].sock );
+	extraSockets[handle].inuse = qfalse;
+	extraSockets[handle].sock = INVALID_SOCKET;
+}
+
+/*
+==================
+NET_SendExtra
+==================
+*/
+void NET_SendExtra( int handle, int length, const void *data, const netadr_t *to ) {
+	struct sockaddr_storage	addr;
+	int		ret;
+
+	if( handle < 0 || handle >= MAX_EXTRA_SOCKETS || !extraSockets[handle].inuse )
+		return;
+	if( to->type != NA_IP && to->type != NA_IP6 )
+		return;
+
+	memset( &addr, 0, sizeof( addr ) );
+	NetadrToSockadr( (netadr_t *) to, (struct sockaddr *) &addr );
+
+	ret = sendto( extraSockets[handle].sock, data, length, 0, (struct sockaddr *) &addr,
+		( addr.ss_family == AF_INET6 ) ? sizeof( struct sockaddr_in6 ) : sizeof( struct sockaddr_in ) );
+	if( ret == SOCKET_ERROR ) {
+		NET_SendError( to->type );
+	}
+}
+
+/*
+==================
+NET_GetExtraPacket
+
+Reads one waiting datagram into msg; returns qfalse when there is none
+==================
+*/
+qboolean NET_GetExtraPacket( int handle, netadr_t *from, msg_t *msg ) {
+	struct sockaddr_storage	addr;
+	socklen_t	addrlen;
+	int			ret;
+	int			err;
+
+	if( handle < 0 || handle >= MAX_EXTRA_SOCKETS || !extraSockets[handle].inuse )
+		return qfalse;
+
+	while( 1 ) {
+		addrlen = sizeof( addr );
+		ret = recvfrom( extraSockets[handle].sock, (void *) msg->data, msg->maxsize, 0,
+			(struct sockaddr *) &addr, &addrlen );
+
+		if( ret == SOCKET_ERROR ) {
+			err = socketError;
+			if( err != EAGAIN && err != ECONNRESET )
+				Com_Printf( "NET_GetExtraPacket: %s\n", NET_ErrorString() );
+			return qfalse;
 		}
 
-		// some PPP links do not allow broadcasts and return an error
-		if( ( err == EADDRNOTAVAIL ) && ( ( to.type == NA_BROADCAST ) ) ) {
-			return;
+		SockadrToNetadr( (struct sockaddr *) &addr, from );
+		if( ret >= msg->maxsize ) {
+			Com_Printf( "Oversize packet from %s\n", NET_AdrToString( *from ) );
+			continue;
 		}
 
-		Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+		msg->readcount = 0;
+		msg->cursize = ret;
+		return qtrue;
 	}
 }
 
+/*
+==================
+NET_WaitExtraSockets
+
+Sleeps up to usec microseconds or until one of the sockets is readable.
+Sockets that do not fit in an fd_set are not waited on, the caller keeps
+polling them on every wakeup.
+==================
+*/
+void NET_WaitExtraSockets( const int *handles, int count, int usec ) {
+	struct timeval	timeout;
+	fd_set		fdr;
+	SOCKET		highestfd = INVALID_SOCKET;
+	SOCKET		sock;
+	int			numSet = 0;
+	int			i;
+
+	if( usec < 0 )
+		usec = 0;
+
+	FD_ZERO( &fdr );
+	for( i = 0; i < count && numSet < FD_SETSIZE; i++ ) {
+		if( handles[i] < 0 || handles[i] >= MAX_EXTRA_SOCKETS || !extraSockets[handles[i]].inuse )
+			continue;
+
+		sock = extraSockets[handles[i]].sock;
+#ifndef _WIN32
+		if( sock >= FD_SETSIZE )
+			continue;
+#endif
+		FD_SET( sock, &fdr );
+		numSet++;
+		if( highestfd == INVALID_SOCKET || sock > highestfd )
+			highestfd = sock;
+	}
+
+	if( !numSet ) {
+		Sys_Sleep( usec / 1000 );
+		return;
+	}
+
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_usec = usec % 1000000;
+	select( highestfd + 1, &fdr, NULL, NULL, &timeout );
+}
 
 //=============================================================================
 
@@ -810,7 +1353,7 @@ void Sys_ShowIP(void) {
 NET_IPSocket
 ====================
 */
-SOCKET NET_IPSocket( char *net_interface, int port, int *err ) {
+SOCKET NET_IPSocket( char *net_interface, int port, qboolean reusePort, int *err ) {
 	SOCKET				newsocket;
 	struct sockaddr_in	address;
 	ioctlarg_t			_true = 1;
@@ -843,6 +1386,16 @@ SOCKET NET_IPSocket( char *net_interface, int port, int *err ) {
 		Com_Printf( "WARNING: NET_IPSocket: setsockopt SO_BROADCAST: %s\n", NET_ErrorString() );
 	}
 
+#ifdef NET_RECVTHREADS
+	// share the port with the other receive thread sockets
+	if( reusePort && setsockopt( newsocket, SOL_SOCKET, SO_REUSEPORT, (char *) &i, sizeof(i) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_IPSocket: setsockopt SO_REUSEPORT: %s\n", NET_ErrorString() );
+		*err = socketError;
+		closesocket( newsocket );
+		return INVALID_SOCKET;
+	}
+#endif
+
 	if( !net_interface || !net_interface[0]) {
 		address.sin_family = AF_INET;
 		address.sin_addr.s_addr = INADDR_ANY;
@@ -878,7 +1431,7 @@ SOCKET NET_IPSocket( char *net_interface, int port, int *err ) {
 NET_IP6Socket
 ====================
 */
-SOCKET NET_IP6Socket( char *net_interface, int port, struct sockaddr_in6 *bindto, int *err ) {
+SOCKET NET_IP6Socket( char *net_interface, int port, struct sockaddr_in6 *bindto, qboolean reusePort, int *err ) {
 	SOCKET				newsocket;
 	struct sockaddr_in6	address;
 	ioctlarg_t			_true = 1;
@@ -923,6 +1476,22 @@ SOCKET NET_IP6Socket( char *net_interface, int port, struct sockaddr_in6 *bindto
 	}
 #endif
 
+#ifdef NET_RECVTHREADS
+	if( reusePort )
+	{
+		int i = 1;
+
+		// share the port with the other receive thread sockets
+		if(setsockopt(newsocket, SOL_SOCKET, SO_REUSEPORT, (char *) &i, sizeof(i)) == SOCKET_ERROR)
+		{
+			Com_Printf( "WARNING: NET_IP6Socket: setsockopt SO_REUSEPORT: %s\n", NET_ErrorString() );
+			*err = socketError;
+			closesocket( newsocket );
+			return INVALID_SOCKET;
+		}
+	}
+#endif
+
 	if( !net_interface || !net_interface[0]) {
 		address.sin6_family = AF_INET6;
 		address.sin6_addr = in6addr_any;
@@ -1010,7 +1579,7 @@ void NET_JoinMulticast6(void)
 	}
 	else
 	{
-		if((multicast6_socket = NET_IP6Socket(net_mcast6addr->string, ntohs(boundto.sin6_port), NULL, &err)) == INVALID_SOCKET)
+		if((multicast6_socket = NET_IP6Socket(net_mcast6addr->string, ntohs(boundto.sin6_port), NULL, qfalse, &err)) == INVALID_SOCKET)
 		{
 			// If the OS does not support binding to multicast addresses, like WinXP, at least try with the normal file descriptor.
 			multicast6_socket = ip6_socket;
@@ -1366,7 +1935,7 @@ void NET_OpenIP( void ) {
 	{
 		for( i = 0 ; i < 10 ; i++ )
 		{
-			ip6_socket = NET_IP6Socket(net_ip6->string, port6 + i, &boundto, &err);
+			ip6_socket = NET_IP6Socket(net_ip6->string, port6 + i, &boundto, qfalse, &err);
 			if (ip6_socket != INVALID_SOCKET)
 			{
 				Cvar_SetValue( "net_port6", port6 + i );
@@ -1385,7 +1954,7 @@ void NET_OpenIP( void ) {
 	if(net_enabled->integer & NET_ENABLEV4)
 	{
 		for( i = 0 ; i < 10 ; i++ ) {
-			ip_socket = NET_IPSocket( net_ip->string, port + i, &err );
+			ip_socket = NET_IPSocket( net_ip->string, port + i, qfalse, &err );
 			if (ip_socket != INVALID_SOCKET) {
 				Cvar_SetValue( "net_port", port + i );
 
@@ -1406,32 +1975,290 @@ void NET_OpenIP( void ) {
 	}
 }
 
-
-//===================================================================
-
-
+#ifdef NET_RECVTHREADS
 /*
 ====================
-NET_GetCvars
+NET_RecvThread
+
+Reads the sockets of one receive thread into its queue
 ====================
 */
-static qboolean NET_GetCvars( void ) {
-	int modified;
+static void NET_RecvThread( void *arg ) {
+	netRecvThread_t			*thread = arg;
+	netQueuedPacket_t		*packet;
+	struct pollfd			fds[2];
+	struct sockaddr_storage	from;
+	socklen_t				fromlen;
+	uint64_t				one = 1;
+	int						i, numfds, ret;
+	qboolean				queued;
+
+	numfds = 0;
+	for( i = 0; i < 2; i++ ) {
+		if( thread->sockets[i] != INVALID_SOCKET ) {
+			fds[numfds].fd = thread->sockets[i];
+			fds[numfds].events = POLLIN;
+			numfds++;
+		}
+	}
 
-#ifdef DEDICATED
-	// I want server owners to explicitly turn on ipv6 support.
-	net_enabled = Cvar_Get( "net_enabled", "1", CVAR_LATCH | CVAR_ARCHIVE );
-#else
-	/* End users have it enabled so they can connect to ipv6-only hosts, but ipv4 will be
-	 * used if available due to ping */
-	net_enabled = Cvar_Get( "net_enabled", "3", CVAR_LATCH | CVAR_ARCHIVE );
-#endif
-	modified = net_enabled->modified;
-	net_enabled->modified = qfalse;
+	while( !NET_AtomicLoad( &recvThreadsQuit ) ) {
+		// the timeout is how long NET_StopRecvThreads waits at most
+		if( poll( fds, numfds, 100 ) <= 0 ) {
+			continue;
+		}
 
-	net_ip = Cvar_Get( "net_ip", "0.0.0.0", CVAR_LATCH );
-	modified += net_ip->modified;
-	net_ip->modified = qfalse;
+		queued = qfalse;
+
+		for( i = 0; i < numfds; i++ ) {
+			if( !( fds[i].revents & POLLIN ) ) {
+				continue;
+			}
+
+			while( 1 ) {
+				if( thread->head - NET_AtomicLoad( &thread->tail ) >= NET_QUEUE_SIZE ) {
+					// the main thread is behind, leave the rest to the kernel buffer
+					break;
+				}
+
+				packet = &thread->packets[thread->head & ( NET_QUEUE_SIZE - 1 )];
+
+				fromlen = sizeof( from );
+				ret = recvfrom( fds[i].fd, packet->data, sizeof( packet->data ), 0, (struct sockaddr *)&from, &fromlen );
+				if( ret == SOCKET_ERROR ) {
+					break;
+				}
+
+				SockadrToNetadr( (struct sockaddr *)&from, &packet->from );
+				packet->length = ret;
+
+				if( com_sv_running->integer && SV_FilterPacket( &packet->from, packet->data, ret ) ) {
+					thread->filtered++;
+					continue;
+				}
+
+				if( ret >= sizeof( packet->data ) ) {
+					thread->oversize++;
+					packet->length = -1;
+				}
+
+				NET_AtomicStore( &thread->head, thread->head + 1 );
+				queued = qtrue;
+			}
+		}
+
+		if( queued && write( recvEventFd, &one, sizeof( one ) ) == -1 ) {
+			// the counter is already nonzero
+		}
+
+		if( thread->head - NET_AtomicLoad( &thread->tail ) >= NET_QUEUE_SIZE ) {
+			// don't spin on the sockets until the main thread has caught up
+			usleep( 1000 );
+		}
+	}
+}
+
+/*
+====================
+NET_StopRecvThreads
+====================
+*/
+static void NET_StopRecvThreads( void ) {
+	int		i;
+
+	if( !numRecvThreads ) {
+		return;
+	}
+
+	NET_AtomicStore( &recvThreadsQuit, qtrue );
+
+	for( i = 0; i < numRecvThreads; i++ ) {
+		Sys_JoinThread( recvThreads[i]->thread );
+
+		// slot 0 are ip_socket and ip6_socket, closed by NET_Config
+		if( i ) {
+			if( recvThreads[i]->sockets[0] != INVALID_SOCKET )
+				closesocket( recvThreads[i]->sockets[0] );
+			if( recvThreads[i]->sockets[1] != INVALID_SOCKET )
+				closesocket( recvThreads[i]->sockets[1] );
+		}
+
+		Z_Free( recvThreads[i] );
+		recvThreads[i] = NULL;
+	}
+
+	numRecvThreads = 0;
+	nextRecvThread = 0;
+
+	close( recvEventFd );
+	recvEventFd = -1;
+}
+
+/*
+====================
+NET_ReopenReusePort
+
+ip_socket and ip6_socket pick their ports without SO_REUSEPORT, so a port
+another server already shares is skipped, then they are opened again with
+it so the other receive thread sockets can join them
+====================
+*/
+static qboolean NET_ReopenReusePort( void ) {
+	SOCKET	newsocket;
+	int		err, on = 1;
+
+	// the old sockets keep the ports until the new ones are bound, so a
+	// failure leaves the server listening as before.  Linux lets a new
+	// SO_REUSEPORT socket share the port once the bound one has it set.
+	if( ip_socket != INVALID_SOCKET ) {
+		if( setsockopt( ip_socket, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on) ) == SOCKET_ERROR ) {
+			return qfalse;
+		}
+		newsocket = NET_IPSocket( net_ip->string, net_port->integer, qtrue, &err );
+		if( newsocket == INVALID_SOCKET ) {
+			return qfalse;
+		}
+		closesocket( ip_socket );
+		ip_socket = newsocket;
+	}
+
+	if( ip6_socket != INVALID_SOCKET ) {
+		if( setsockopt( ip6_socket, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on) ) == SOCKET_ERROR ) {
+			return qfalse;
+		}
+		newsocket = NET_IP6Socket( net_ip6->string, net_port6->integer, &boundto, qtrue, &err );
+		if( newsocket == INVALID_SOCKET ) {
+			return qfalse;
+		}
+		closesocket( ip6_socket );
+		ip6_socket = newsocket;
+	}
+
+	return qtrue;
+}
+
+/*
+====================
+NET_StartRecvThreads
+====================
+*/
+static void NET_StartRecvThreads( void ) {
+	netRecvThread_t		*thread;
+	int					count, i, err;
+
+	count = net_recvThreads->integer;
+	if( count > MAX_RECV_THREADS ) {
+		count = MAX_RECV_THREADS;
+	}
+
+	if( count < 1 || usingSocks || ( ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET ) ) {
+		return;
+	}
+
+	if( !NET_ReopenReusePort() ) {
+		Com_Printf( "WARNING: NET_StartRecvThreads: couldn't reopen the ports with SO_REUSEPORT\n" );
+		return;
+	}
+
+	recvEventFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	if( recvEventFd == -1 ) {
+		Com_Printf( "WARNING: NET_StartRecvThreads: eventfd: %s\n", NET_ErrorString() );
+		return;
+	}
+
+	recvThreadsQuit = qfalse;
+
+	for( i = 0; i < count; i++ ) {
+		thread = Z_Malloc( sizeof( *thread ) );
+
+		if( i == 0 ) {
+			thread->sockets[0] = ip_socket;
+			thread->sockets[1] = ip6_socket;
+		} else {
+			thread->sockets[0] = thread->sockets[1] = INVALID_SOCKET;
+
+			if( ip_socket != INVALID_SOCKET )
+				thread->sockets[0] = NET_IPSocket( net_ip->string, net_port->integer, qtrue, &err );
+			if( ip6_socket != INVALID_SOCKET )
+				thread->sockets[1] = NET_IP6Socket( net_ip6->string, net_port6->integer, NULL, qtrue, &err );
+
+			if( thread->sockets[0] == INVALID_SOCKET && thread->sockets[1] == INVALID_SOCKET ) {
+				Z_Free( thread );
+				break;
+			}
+		}
+
+		thread->thread = Sys_CreateThread( NET_RecvThread, thread );
+		if( !thread->thread ) {
+			Com_Printf( "WARNING: couldn't start receive thread %i\n", i );
+			if( i ) {
+				if( thread->sockets[0] != INVALID_SOCKET )
+					closesocket( thread->sockets[0] );
+				if( thread->sockets[1] != INVALID_SOCKET )
+					closesocket( thread->sockets[1] );
+			}
+			Z_Free( thread );
+			break;
+		}
+
+		recvThreads[numRecvThreads++] = thread;
+	}
+
+	if( !numRecvThreads ) {
+		close( recvEventFd );
+		recvEventFd = -1;
+		return;
+	}
+
+	Com_Printf( "Started %i network receive threads\n", numRecvThreads );
+}
+
+/*
+====================
+NET_RecvThreadStats_f
+====================
+*/
+static void NET_RecvThreadStats_f( void ) {
+	int		i;
+
+	if( !numRecvThreads ) {
+		Com_Printf( "No network receive threads, see net_recvThreads\n" );
+		return;
+	}
+
+	for( i = 0; i < numRecvThreads; i++ ) {
+		Com_Printf( "thread %i: %u queued, %i filtered, %i oversize\n", i,
+			NET_AtomicLoad( &recvThreads[i]->head ), recvThreads[i]->filtered, recvThreads[i]->oversize );
+	}
+}
+#endif
+
+
+//===================================================================
+
+
+/*
+====================
+NET_GetCvars
+====================
+*/
+static qboolean NET_GetCvars( void ) {
+	int modified;
+
+#ifdef DEDICATED
+	// I want server owners to explicitly turn on ipv6 support.
+	net_enabled = Cvar_Get( "net_enabled", "1", CVAR_LATCH | CVAR_ARCHIVE );
+#else
+	/* End users have it enabled so they can connect to ipv6-only hosts, but ipv4 will be
+	 * used if available due to ping */
+	net_enabled = Cvar_Get( "net_enabled", "3", CVAR_LATCH | CVAR_ARCHIVE );
+#endif
+	modified = net_enabled->modified;
+	net_enabled->modified = qfalse;
+
+	net_ip = Cvar_Get( "net_ip", "0.0.0.0", CVAR_LATCH );
+	modified += net_ip->modified;
+	net_ip->modified = qfalse;
 	
 	net_ip6 = Cvar_Get( "net_ip6", "::", CVAR_LATCH );
 	modified += net_ip6->modified;
@@ -1480,10 +2307,104 @@ static qboolean NET_GetCvars( void ) {
 
 	net_dropsim = Cvar_Get("net_dropsim", "", CVAR_TEMP);
 
+#ifdef NET_MMSG
+	net_mmsg = Cvar_Get( "net_mmsg", "0", CVAR_ARCHIVE );
+#endif
+
+#ifdef NET_RECVTHREADS
+	net_recvThreads = Cvar_Get( "net_recvThreads", "0", CVAR_LATCH | CVAR_ARCHIVE );
+	Cvar_CheckRange( net_recvThreads, 0, MAX_RECV_THREADS, qtrue );
+	modified += net_recvThreads->modified;
+	net_recvThreads->modified = qfalse;
+#endif
+
 	return modified ? qtrue : qfalse;
 }
 
 
+#ifdef NET_EPOLL
+/*
+====================
+NET_EpollClose
+====================
+*/
+static void NET_EpollClose( void ) {
+	if( epollTimerFd != -1 ) {
+		close( epollTimerFd );
+		epollTimerFd = -1;
+	}
+
+	if( epollFd != -1 ) {
+		close( epollFd );
+		epollFd = -1;
+	}
+}
+
+/*
+====================
+NET_EpollAdd
+====================
+*/
+static qboolean NET_EpollAdd( int fd ) {
+	struct epoll_event event;
+
+	memset( &event, 0, sizeof( event ) );
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	if( epoll_ctl( epollFd, EPOLL_CTL_ADD, fd, &event ) == -1 ) {
+		Com_Printf( "WARNING: NET_EpollAdd: epoll_ctl: %s\n", NET_ErrorString() );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+====================
+NET_EpollOpen
+
+Registers the open sockets, NET_Sleep falls back to select if this fails
+====================
+*/
+static void NET_EpollOpen( void ) {
+	NET_EpollClose();
+
+	if( ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET ) {
+		return;
+	}
+
+	epollFd = epoll_create1( EPOLL_CLOEXEC );
+	if( epollFd == -1 ) {
+		Com_Printf( "WARNING: NET_EpollOpen: epoll_create1: %s\n", NET_ErrorString() );
+		return;
+	}
+
+#ifdef NET_RECVTHREADS
+	if( numRecvThreads ) {
+		// the receive threads read the sockets and signal what they queued
+		if( !NET_EpollAdd( recvEventFd ) ) {
+			NET_EpollClose();
+			return;
+		}
+	}
+	else
+#endif
+	if( ( ip_socket != INVALID_SOCKET && !NET_EpollAdd( ip_socket ) ) ||
+		( ip6_socket != INVALID_SOCKET && !NET_EpollAdd( ip6_socket ) ) ) {
+		NET_EpollClose();
+		return;
+	}
+
+	// without a timer the sub millisecond part of a timeout is rounded down
+	epollTimerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+	if( epollTimerFd != -1 && !NET_EpollAdd( epollTimerFd ) ) {
+		close( epollTimerFd );
+		epollTimerFd = -1;
+	}
+}
+#endif
+
 /*
 ====================
 NET_Config
@@ -1529,6 +2450,11 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if( stop ) {
+#ifdef NET_RECVTHREADS
+		// before their sockets are closed
+		NET_StopRecvThreads();
+#endif
+
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -1551,7 +2477,17 @@ void NET_Config( qboolean enableNetworking ) {
 			closesocket( socks_socket );
 			socks_socket = INVALID_SOCKET;
 		}
-		
+
+#ifdef NET_MMSG
+		// nothing taken off or meant for the old sockets is left over
+		ipRecvRing.count = ipRecvRing.next = 0;
+		ip6RecvRing.count = ip6RecvRing.next = 0;
+		ipSendQueue.count = ip6SendQueue.count = 0;
+#endif
+
+#ifdef NET_EPOLL
+		NET_EpollClose();
+#endif
 	}
 
 	if( start )
@@ -1559,12 +2495,161 @@ void NET_Config( qboolean enableNetworking ) {
 		if (net_enabled->integer)
 		{
 			NET_OpenIP();
+#ifdef NET_RECVTHREADS
+			NET_StartRecvThreads();
+#endif
 			NET_SetMulticast6();
+#ifdef NET_EPOLL
+			NET_EpollOpen();
+#endif
 		}
 	}
 }
 
 
+#ifdef NET_MMSG
+/*
+====================
+NET_MmsgBenchSocket
+====================
+*/
+static SOCKET NET_MmsgBenchSocket( struct sockaddr_in *addr ) {
+	SOCKET		sock;
+	socklen_t	len;
+	ioctlarg_t	_true = 1;
+	int			size = 4 * 1024 * 1024;
+
+	sock = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+	if( sock == INVALID_SOCKET ) {
+		return INVALID_SOCKET;
+	}
+
+	memset( addr, 0, sizeof( *addr ) );
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	addr->sin_port = 0;
+
+	len = sizeof( *addr );
+	if( ioctlsocket( sock, FIONBIO, &_true ) == SOCKET_ERROR ||
+		bind( sock, (struct sockaddr *)addr, sizeof( *addr ) ) == SOCKET_ERROR ||
+		getsockname( sock, (struct sockaddr *)addr, &len ) == SOCKET_ERROR ) {
+		closesocket( sock );
+		return INVALID_SOCKET;
+	}
+
+	// the receiver falls behind between batches otherwise
+	setsockopt( sock, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof( size ) );
+
+	return sock;
+}
+
+/*
+====================
+NET_MmsgBench_f
+
+net_mmsgbench [packets]
+
+Sends packets over loopback with sendto and recvfrom, then with sendmmsg
+and recvmmsg, in batches of NET_MMSG_BATCH, and prints the packets per
+second of both
+====================
+*/
+static void NET_MmsgBench_f( void ) {
+	static byte				data[NET_MMSG_BATCH][NET_BATCH_PACKETLEN];
+	struct mmsghdr			msgs[NET_MMSG_BATCH];
+	struct iovec			iovecs[NET_MMSG_BATCH];
+	struct sockaddr_in		src, dest;
+	SOCKET					sender, receiver;
+	int64_t					start, usec;
+	int						packets, sent, received, batch, mode, i, ret, idle;
+
+	packets = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 100000;
+	if( packets < NET_MMSG_BATCH ) {
+		packets = NET_MMSG_BATCH;
+	}
+
+	sender = NET_MmsgBenchSocket( &src );
+	receiver = NET_MmsgBenchSocket( &dest );
+	if( sender == INVALID_SOCKET || receiver == INVALID_SOCKET ) {
+		Com_Printf( "net_mmsgbench: couldn't open loopback sockets: %s\n", NET_ErrorString() );
+		if( sender != INVALID_SOCKET )
+			closesocket( sender );
+		if( receiver != INVALID_SOCKET )
+			closesocket( receiver );
+		return;
+	}
+
+	memset( data, 0x55, sizeof( data ) );
+
+	for( mode = 0; mode < 2; mode++ ) {
+		sent = received = 0;
+		start = Sys_Microseconds();
+
+		while( sent < packets ) {
+			batch = MIN( NET_MMSG_BATCH, packets - sent );
+
+			if( mode ) {
+				for( i = 0; i < batch; i++ ) {
+					iovecs[i].iov_base = data[i];
+					iovecs[i].iov_len = 1200;
+					memset( &msgs[i].msg_hdr, 0, sizeof( msgs[i].msg_hdr ) );
+					msgs[i].msg_hdr.msg_name = &dest;
+					msgs[i].msg_hdr.msg_namelen = sizeof( dest );
+					msgs[i].msg_hdr.msg_iov = &iovecs[i];
+					msgs[i].msg_hdr.msg_iovlen = 1;
+				}
+				ret = sendmmsg( sender, msgs, batch, 0 );
+				sent += ret > 0 ? ret : batch;
+			} else {
+				for( i = 0; i < batch; i++ ) {
+					sendto( sender, data[i], 1200, 0, (struct sockaddr *)&dest, sizeof( dest ) );
+				}
+				sent += batch;
+			}
+
+			// drain what arrived, the last batch until it is all in or
+			// the kernel has clearly dropped the rest
+			for( idle = 0; idle < ( sent < packets ? 1 : 1000 ) && received < sent; ) {
+				if( mode ) {
+					for( i = 0; i < NET_MMSG_BATCH; i++ ) {
+						iovecs[i].iov_base = data[i];
+						iovecs[i].iov_len = sizeof( data[i] );
+						memset( &msgs[i].msg_hdr, 0, sizeof( msgs[i].msg_hdr ) );
+						msgs[i].msg_hdr.msg_iov = &iovecs[i];
+						msgs[i].msg_hdr.msg_iovlen = 1;
+					}
+					ret = recvmmsg( receiver, msgs, NET_MMSG_BATCH, MSG_DONTWAIT, NULL );
+				} else {
+					ret = recvfrom( receiver, data[0], sizeof( data[0] ), 0, NULL, NULL );
+					if( ret >= 0 ) {
+						ret = 1;
+					}
+				}
+
+				if( ret > 0 ) {
+					received += ret;
+					idle = 0;
+				} else {
+					idle++;
+				}
+			}
+		}
+
+		usec = Sys_Microseconds() - start;
+		if( usec < 1 ) {
+			usec = 1;
+		}
+
+		Com_Printf( "%-18s %i sent, %i received in %.1f msec, %.0f packets/sec\n",
+			mode ? "sendmmsg/recvmmsg:" : "sendto/recvfrom:", sent, received,
+			usec / 1000.0, received * 1000000.0 / usec );
+	}
+
+	closesocket( sender );
+	closesocket( receiver );
+}
+#endif
+
 /*
 ====================
 NET_Init
@@ -1587,6 +2672,12 @@ void NET_Init( void ) {
 	NET_Config( qtrue );
 	
 	Cmd_AddCommand ("net_restart", NET_Restart_f);
+#ifdef NET_MMSG
+	Cmd_AddCommand ("net_mmsgbench", NET_MmsgBench_f);
+#endif
+#ifdef NET_RECVTHREADS
+	Cmd_AddCommand ("net_recvstats", NET_RecvThreadStats_f);
+#endif
 }
 
 
@@ -1612,7 +2703,7 @@ void NET_Shutdown( void ) {
 ====================
 NET_Event
 
-Called from NET_Sleep which uses select() to determine which sockets have seen action.
+Called from NET_Sleep which uses select() or epoll to determine which sockets have seen action.
 ====================
 */
 
@@ -1645,57 +2736,223 @@ void NET_Event(fd_set *fdr)
 	}
 }
 
+#ifdef NET_EPOLL
 /*
 ====================
-NET_Sleep
+NET_EpollWait
 
-Sleeps msec or until something happens on the network
+Returns qfalse if NET_Sleep has to fall back to select
 ====================
 */
-void NET_Sleep(int msec)
+static qboolean NET_EpollWait( int usec ) {
+	struct epoll_event	events[4];
+	struct itimerspec	timer;
+	uint64_t			expirations;
+	fd_set				fdr;
+	int					i, retval, ready, err;
+	qboolean			armed = qfalse;
+
+	retval = -1;
+
+#ifdef NET_EPOLL_PWAIT2
+	if( !epollNoPwait2 ) {
+		struct timespec timeout;
+
+		timeout.tv_sec = usec / 1000000;
+		timeout.tv_nsec = ( usec % 1000000 ) * 1000;
+
+		retval = epoll_pwait2( epollFd, events, ARRAY_LEN( events ), &timeout, NULL );
+		if( retval == -1 && errno == ENOSYS ) {
+			// older kernel
+			epollNoPwait2 = qtrue;
+		}
+	}
+
+	if( epollNoPwait2 )
+#endif
+	{
+		if( usec % 1000 == 0 || epollTimerFd == -1 ) {
+			retval = epoll_wait( epollFd, events, ARRAY_LEN( events ), usec / 1000 );
+		} else {
+			memset( &timer, 0, sizeof( timer ) );
+			timer.it_value.tv_sec = usec / 1000000;
+			timer.it_value.tv_nsec = ( usec % 1000000 ) * 1000;
+
+			if( timerfd_settime( epollTimerFd, 0, &timer, NULL ) == -1 ) {
+				retval = epoll_wait( epollFd, events, ARRAY_LEN( events ), usec / 1000 );
+			} else {
+				armed = qtrue;
+				retval = epoll_wait( epollFd, events, ARRAY_LEN( events ), -1 );
+			}
+		}
+	}
+
+	err = retval == -1 ? errno : 0;
+
+	if( armed ) {
+		// disarm and clear an expiry that raced with a socket
+		memset( &timer, 0, sizeof( timer ) );
+		timerfd_settime( epollTimerFd, 0, &timer, NULL );
+		if( read( epollTimerFd, &expirations, sizeof( expirations ) ) == -1 ) {
+			// nothing expired
+		}
+	}
+
+	if( retval == -1 ) {
+		if( err == EINTR ) {
+			return qtrue;
+		}
+
+		Com_Printf( "Warning: epoll_wait() syscall failed: %s\n", strerror( err ) );
+		NET_EpollClose();
+		return qfalse;
+	}
+
+	FD_ZERO( &fdr );
+	ready = 0;
+
+	for( i = 0; i < retval; i++ ) {
+		if( events[i].data.fd == epollTimerFd ) {
+			continue;
+		}
+
+#ifdef NET_RECVTHREADS
+		if( events[i].data.fd == recvEventFd ) {
+			// reset before the queues are read, so nothing queued after it is missed
+			if( read( recvEventFd, &expirations, sizeof( expirations ) ) == -1 ) {
+				// already reset
+			}
+		}
+#endif
+
+		FD_SET( events[i].data.fd, &fdr );
+		ready++;
+	}
+
+	if( ready ) {
+		NET_Event( &fdr );
+	}
+
+	return qtrue;
+}
+#endif
+
+/*
+====================
+NET_SleepMicroseconds
+
+Sleeps usec or until something happens on the network
+====================
+*/
+void NET_SleepMicroseconds( int usec )
 {
 	struct timeval timeout;
 	fd_set fdr;
 	int retval;
 	SOCKET highestfd = INVALID_SOCKET;
 
-	if(msec < 0)
-		msec = 0;
+	if(usec < 0)
+		usec = 0;
 
 	FD_ZERO(&fdr);
 
-	if(ip_socket != INVALID_SOCKET)
+#ifdef NET_MMSG
+	// NET_Event drains the rings, so they are only left holding packets
+	// when handling one of them ended in Com_Error and longjmp'd out of
+	// it.  The socket may have nothing more to wake select up with, so
+	// pass the rest on now instead of leaving them until the next packet.
+	if(ipRecvRing.next < ipRecvRing.count || ip6RecvRing.next < ip6RecvRing.count)
 	{
-		FD_SET(ip_socket, &fdr);
+		if(ip_socket != INVALID_SOCKET && ipRecvRing.next < ipRecvRing.count)
+			FD_SET(ip_socket, &fdr);
+		if(ip6_socket != INVALID_SOCKET && ip6RecvRing.next < ip6RecvRing.count)
+			FD_SET(ip6_socket, &fdr);
 
-		highestfd = ip_socket;
+		NET_Event(&fdr);
+		return;
+	}
+#endif
+
+#ifdef NET_EPOLL
+	if(epollFd != -1 && NET_EpollWait(usec))
+		return;
+#endif
+
+#ifdef NET_RECVTHREADS
+	if(numRecvThreads)
+	{
+		FD_SET(recvEventFd, &fdr);
+
+		highestfd = recvEventFd;
 	}
-	if(ip6_socket != INVALID_SOCKET)
+	else
+#endif
 	{
-		FD_SET(ip6_socket, &fdr);
+		if(ip_socket != INVALID_SOCKET)
+		{
+			FD_SET(ip_socket, &fdr);
+
+			highestfd = ip_socket;
+		}
+		if(ip6_socket != INVALID_SOCKET)
+		{
+			FD_SET(ip6_socket, &fdr);
 
-		if(highestfd == INVALID_SOCKET || ip6_socket > highestfd)
-			highestfd = ip6_socket;
+			if(highestfd == INVALID_SOCKET || ip6_socket > highestfd)
+				highestfd = ip6_socket;
+		}
 	}
 
 #ifdef _WIN32
 	if(highestfd == INVALID_SOCKET)
 	{
 		// windows ain't happy when select is called without valid FDs
-		SleepEx(msec, 0);
+		SleepEx(usec / 1000, 0);
 		return;
 	}
 #endif
 
-	timeout.tv_sec = msec/1000;
-	timeout.tv_usec = (msec%1000)*1000;
+	timeout.tv_sec = usec/1000000;
+	timeout.tv_usec = usec%1000000;
 
 	retval = select(highestfd + 1, &fdr, NULL, NULL, &timeout);
 
 	if(retval == SOCKET_ERROR)
 		Com_Printf("Warning: select() syscall failed: %s\n", NET_ErrorString());
 	else if(retval > 0)
+	{
+#ifdef NET_RECVTHREADS
+		if(numRecvThreads)
+		{
+			uint64_t count;
+
+			// reset before the queues are read, so nothing queued after it is missed
+			if(read(recvEventFd, &count, sizeof(count)) == -1)
+			{
+				// already reset
+			}
+		}
+#endif
+
 		NET_Event(&fdr);
+	}
+}
+
+/*
+====================
+NET_Sleep
+
+Sleeps msec or until something happens on the network
+====================
+*/
+void NET_Sleep(int msec)
+{
+	if(msec < 0)
+		msec = 0;
+	else if(msec > 1000000)
+		msec = 1000000;
+
+	NET_SleepMicroseconds(msec * 1000);
 }
 
 /*
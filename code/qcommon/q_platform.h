@@ -32,6 +32,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define idppc 0
 #define idppc_altivec 0
 #define idsparc 0
+#define idsse 0
 
 #else
 
@@ -67,6 +68,13 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define idsparc 0
 #endif
 
+// only where scalar float math is done with SSE too, so both give the same results
+#if (defined __x86_64__ || defined _M_X64 || defined __SSE_MATH__) && !defined(C_ONLY)
+#define idsse 1
+#else
+#define idsse 0
+#endif
+
 #endif
 
 #ifndef __ASM_I386__ // don't include the C bits if included from qasm.h
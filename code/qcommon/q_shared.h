@@ -1036,6 +1036,16 @@ typedef struct {
 // trace->entityNum can also be 0 to (MAX_GENTITIES-1)
 // or ENTITYNUM_NONE, ENTITYNUM_WORLD
 
+// one trace of a batch, the arguments of a single trace call
+typedef struct {
+	vec3_t		start;
+	vec3_t		end;
+	vec3_t		mins;		// relative to start and end
+	vec3_t		maxs;
+	int			passEntityNum;
+	int			contentmask;
+} traceRequest_t;
+
 
 // markfragments are returned by R_MarkFragments()
 typedef struct {
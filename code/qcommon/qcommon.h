@@ -67,6 +67,7 @@ struct entityState_s;
 struct playerState_s;
 
 void MSG_WriteBits( msg_t *msg, int value, int bits );
+void MSG_WriteBitstream( msg_t *msg, const byte *data, int bits );
 
 void MSG_WriteChar (msg_t *sb, int c);
 void MSG_WriteByte (msg_t *sb, int c);
@@ -108,6 +109,9 @@ void MSG_ReadDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct pl
 
 
 void MSG_ReportChangeVectors_f( void );
+void MSG_HuffmanBench_f( void );
+void MSG_Fuzz_f( void );
+void MSG_SnapBench_f( void );
 
 //============================================================================
 
@@ -171,6 +175,8 @@ void		NET_Shutdown( void );
 void		NET_Restart_f( void );
 void		NET_Config( qboolean enableNetworking );
 void		NET_FlushPacketQueue(void);
+void		NET_BeginSendBatch( void );
+void		NET_FlushSendBatch( void );
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
 void		QDECL NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
@@ -186,6 +192,13 @@ qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_messag
 void		NET_JoinMulticast6(void);
 void		NET_LeaveMulticast6(void);
 void		NET_Sleep(int msec);
+void		NET_SleepMicroseconds( int usec );
+
+int			NET_OpenExtraSocket( netadrtype_t type );
+void		NET_CloseExtraSocket( int handle );
+void		NET_SendExtra( int handle, int length, const void *data, const netadr_t *to );
+qboolean	NET_GetExtraPacket( int handle, netadr_t *from, msg_t *msg );
+void		NET_WaitExtraSockets( const int *handles, int count, int usec );
 
 
 #define	MAX_MSGLEN				16384		// max length of a message, which may
@@ -374,6 +387,7 @@ void	VM_Debug( int level );
 
 void	*VM_ArgPtr( intptr_t intValue );
 void	*VM_ExplicitArgPtr( vm_t *vm, intptr_t intValue );
+void	*VM_ArgArray( intptr_t intValue, size_t size, const char *caller );
 
 #define	VMA(x) VM_ArgPtr(args[x])
 static ID_INLINE float _vmf(intptr_t x)
@@ -644,6 +658,9 @@ void	FS_GetModDescription( const char *modDir, char *description, int descriptio
 fileHandle_t	FS_FOpenFileWrite( const char *qpath );
 fileHandle_t	FS_FOpenFileAppend( const char *filename );
 fileHandle_t	FS_FCreateOpenPipeFile( const char *filename );
+fileHandle_t	FS_OpenAsyncWrite( const char *filename, qboolean append, int bufferSize );
+// writes are queued for a writer thread, FS_Write only waits when bufferSize
+// bytes are pending and FS_FCloseFile doesn't wait at all
 // will properly create any needed paths and deal with seperater character issues
 
 fileHandle_t FS_SV_FOpenFileWrite( const char *filename );
@@ -692,6 +709,13 @@ int		FS_FTell( fileHandle_t f );
 // where are we?
 
 void	FS_Flush( fileHandle_t f );
+// waits until everything written has been handed to the OS
+
+qboolean	FS_Sync( fileHandle_t f, qboolean wait );
+// also waits for the disk, async files can queue the request instead
+
+void	FS_WaitAsyncWrites( void );
+// finishes all queued writes and closes, call before exiting
 
 void 	QDECL FS_Printf( fileHandle_t f, const char *fmt, ... ) __attribute__ ((format (printf, 2, 3)));
 // like fprintf
@@ -702,6 +726,12 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode );
 int		FS_Seek( fileHandle_t f, long offset, int origin );
 // seek on a file
 
+void	*FS_MapFile( const char *qpath, int *length );
+// maps a file read-only into memory, NULL if it isn't found or is in a pk3
+
+void	FS_UnmapFile( void *buffer, int length );
+// unmaps a file mapped with FS_MapFile
+
 qboolean FS_FilenameCompare( const char *s1, const char *s2 );
 
 const char *FS_LoadedPakNames( void );
@@ -839,6 +869,13 @@ int			Com_RealTime(qtime_t *qtime);
 qboolean	Com_SafeMode( void );
 void		Com_RunAndTimeServerPacket(netadr_t *evFrom, msg_t *buf);
 
+#define	MAX_JOB_THREADS		16
+
+typedef void (*jobFunc_t)( void *data, int index );
+void		Com_RunJobs( int numThreads, jobFunc_t func, void *data, int count );
+// runs func( data, 0 .. count - 1 ) on up to numThreads threads and waits
+// for all of them, job functions must not touch shared engine state
+
 qboolean	Com_IsVoipTarget(uint8_t *voipTargets, int voipTargetsSize, int clientNum);
 
 void		Com_StartupVariable( const char *match );
@@ -892,6 +929,9 @@ extern  cvar_t  *con_autochat;
 extern	int		time_game;
 extern	int		time_frontend;
 extern	int		time_backend;		// renderer backend time
+extern	int		time_snapBuild;		// server snapshot entity culling
+extern	int		time_snapEncode;	// server snapshot delta compression
+extern	int		time_snapSend;		// server snapshot transmission
 
 extern	int		com_frameTime;
 
@@ -1030,6 +1070,9 @@ void CL_StartHunkUsers( qboolean rendererOnly );
 void CL_Snd_Shutdown(void);
 // Restart sound subsystem
 
+void CL_LoadTest_f( void );
+// headless load test clients, only in the dedicated server
+
 void Key_KeynameCompletion( void(*callback)(const char *s) );
 // for keyname autocompletion
 
@@ -1051,6 +1094,7 @@ void SV_Init( void );
 void SV_Shutdown( char *finalmsg );
 void SV_Frame( int msec );
 void SV_PacketEvent( netadr_t from, msg_t *msg );
+qboolean SV_FilterPacket( const netadr_t *from, const byte *data, int length );
 int SV_FrameMsec(void);
 qboolean SV_GameCommand( void );
 int SV_SendQueuedPackets(void);
@@ -1099,6 +1143,7 @@ void	Sys_Print( const char *msg );
 // Sys_Milliseconds should only be used for profiling purposes,
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds (void);
+int64_t	Sys_Microseconds (void);	// monotonic, from an arbitrary origin
 
 qboolean Sys_RandomBytes( byte *string, int len );
 
@@ -1118,6 +1163,11 @@ qboolean	Sys_IsLANAddress (netadr_t adr);
 void		Sys_ShowIP(void);
 
 FILE	*Sys_FOpen( const char *ospath, const char *mode );
+qboolean Sys_FSync( FILE *f );	// fflush and wait for the disk
+qboolean Sys_FileStat( const char *ospath, int64_t *size, int64_t *mtime );
+int		Sys_PID( void );
+void	*Sys_MapFile( FILE *f, int length );	// read-only, NULL if it can't be mapped
+void	Sys_UnmapFile( void *buffer, int length );
 qboolean Sys_Mkdir( const char *path );
 FILE	*Sys_Mkfifo( const char *ospath );
 char	*Sys_Cwd( void );
@@ -1141,6 +1191,30 @@ char **Sys_ListFiles( const char *directory, const char *extension, char *filter
 void	Sys_FreeFileList( char **list );
 void	Sys_Sleep(int msec);
 
+// threads are only used by the optional worker pools, see Com_RunJobs
+void	*Sys_CreateThread( void (*function)( void *arg ), void *arg );
+void	Sys_JoinThread( void *thread );
+void	*Sys_CreateMutex( void );
+void	Sys_DestroyMutex( void *mutex );
+void	Sys_LockMutex( void *mutex );
+void	Sys_UnlockMutex( void *mutex );
+void	*Sys_CreateSemaphore( void );
+void	Sys_DestroySemaphore( void *sem );
+void	Sys_SemaphorePost( void *sem );
+void	Sys_SemaphoreWait( void *sem );
+
+// lock-free access to tables shared with those threads
+#ifdef _MSC_VER
+#include <intrin.h>
+#define Com_AtomicLoad64( p )				( (uint64_t)_InterlockedCompareExchange64( (volatile __int64 *)(p), 0, 0 ) )
+#define Com_AtomicCompareSwap64( p, o, n )	( _InterlockedCompareExchange64( (volatile __int64 *)(p), (__int64)(n), (__int64)(o) ) == (__int64)(o) )
+#define Com_AtomicIncrement( p )			( _InterlockedIncrement( (volatile long *)(p) ) - 1 )
+#else
+#define Com_AtomicLoad64( p )				__atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define Com_AtomicCompareSwap64( p, o, n )	__sync_bool_compare_and_swap( (p), (o), (n) )
+#define Com_AtomicIncrement( p )			__sync_fetch_and_add( (p), 1 )	// returns the old value
+#endif
+
 qboolean Sys_LowPhysicalMemory( void );
 
 void Sys_SetEnv(const char *name, const char *value);
@@ -1203,6 +1277,18 @@ typedef struct {
 	huff_t		decompressor;
 } huffman_t;
 
+#define HUFF_LOOKUP_BITS	11	/* bits decoded with one table lookup */
+
+/* Precomputed codes for a tree that doesn't change anymore */
+typedef struct {
+	node_t			*tree;
+	unsigned int	codes[HMAX];		/* in the order the bits are sent */
+	byte			lengths[HMAX];
+	short			symbols[1 << HUFF_LOOKUP_BITS];
+	byte			symbolLengths[1 << HUFF_LOOKUP_BITS];	/* 0 if the code is longer */
+	node_t			*nodes[1 << HUFF_LOOKUP_BITS];			/* where longer codes continue */
+} huffTable_t;
+
 void	Huff_Compress(msg_t *buf, int offset);
 void	Huff_Decompress(msg_t *buf, int offset);
 void	Huff_Init(huffman_t *huff);
@@ -1211,6 +1297,9 @@ int		Huff_Receive (node_t *node, int *ch, byte *fin);
 void	Huff_transmit (huff_t *huff, int ch, byte *fout, int maxoffset);
 void	Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxoffset);
 void	Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset, int maxoffset);
+void	Huff_BuildTable(huff_t *huff, huffTable_t *table);
+void	Huff_tableReceive (const huffTable_t *table, int *ch, byte *fin, int *offset, int maxoffset);
+void	Huff_tableTransmit (const huffTable_t *table, int ch, byte *fout, int *offset, int maxoffset);
 void	Huff_putBit( int bit, byte *fout, int *offset);
 int		Huff_getBit( byte *fout, int *offset);
 
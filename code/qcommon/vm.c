@@ -745,6 +745,31 @@ void VM_Forced_Unload_Done(void) {
 	forced_unload = 0;
 }
 
+/*
+=================
+VM_ArgArray
+
+Same as VM_ArgPtr, but the whole size bytes have to fit in the data
+segment of an interpreted or compiled vm, like VM_BlockCopy checks
+=================
+*/
+void *VM_ArgArray( intptr_t intValue, size_t size, const char *caller ) {
+	unsigned int dataMask;
+
+	if ( currentVM == NULL || currentVM->entryPoint ) {
+		return VM_ArgPtr( intValue );
+	}
+
+	dataMask = currentVM->dataMask;
+
+	if ( ( intValue & dataMask ) != intValue
+		|| size > (size_t)dataMask + 1 - intValue ) {
+		Com_Error( ERR_DROP, "%s: array out of range", caller );
+	}
+
+	return VM_ArgPtr( intValue );
+}
+
 void *VM_ArgPtr( intptr_t intValue ) {
 	if ( !intValue ) {
 		return NULL;
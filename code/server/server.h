@@ -48,16 +48,25 @@ typedef struct voipServerPacket_s
 } voipServerPacket_t;
 #endif
 
+typedef struct clusterLink_s {
+	struct clusterLink_s	*prev, *next;
+	int				entityNum;
+} clusterLink_t;
+
 typedef struct svEntity_s {
 	struct worldSector_s *worldSector;
 	struct svEntity_s *nextEntityInWorldSector;
+	struct octreeNode_s *octreeNode;		// instead of worldSector with sv_worldIndex 1
+	struct svEntity_s *nextEntityInOctreeNode;
+
+	clusterLink_t	clusterLinks[MAX_ENT_CLUSTERS];	// in sv.clusterEntities lists
+	int			numClusterLinks;
 	
 	entityState_t	baseline;		// for delta compression of initial sighting
 	int			numClusters;		// if -1, use headnode instead
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
 } svEntity_t;
 
 typedef enum {
@@ -75,12 +84,18 @@ typedef struct {
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=475
 	// the serverId associated with the current checksumFeed (always <= serverId)
 	int       checksumFeedServerId;	
-	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
+	int				frameUsecResidual;	// < 1000, frame time sv.time is behind by
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	char			*configstrings[MAX_CONFIGSTRINGS];
 	svEntity_t		svEntities[MAX_GENTITIES];
 
+	// linked entities by PVS cluster, so snapshots only have to look at
+	// entities in visible clusters.  The extra list at [numClusters] holds
+	// entities touching more clusters than fit in svEntity_t
+	clusterLink_t	*clusterEntities;
+	int				numClusters;
+
 	char			*entityParsePoint;	// used during game VM init
 
 	// the game virtual machine will update these on init and changes
@@ -110,6 +125,7 @@ typedef struct {
 	int				messageSent;		// time the message was transmitted
 	int				messageAcked;		// time the message was acked
 	int				messageSize;		// used to rate drop packets
+	int				entityTime;			// svs.time the entities were stored at
 } clientSnapshot_t;
 
 typedef enum {
@@ -291,6 +307,12 @@ extern	cvar_t	*sv_gametype;
 extern	cvar_t	*sv_pure;
 extern	cvar_t	*sv_floodProtect;
 extern	cvar_t	*sv_lanForceRate;
+extern	cvar_t	*sv_snapshotThreads;
+extern	cvar_t	*sv_worldIndex;
+extern	cvar_t	*sv_traceCache;
+extern	cvar_t	*sv_traceThreads;
+extern	cvar_t	*sv_deltaCache;
+extern	cvar_t	*sv_autoRecordDemo;
 #ifndef STANDALONE
 extern	cvar_t	*sv_strictAuth;
 #endif
@@ -312,25 +334,15 @@ extern	cvar_t	*sv_voipProtocol;
 //
 typedef struct leakyBucket_s leakyBucket_t;
 struct leakyBucket_s {
-	netadrtype_t	type;
-
-	union {
-		byte	_4[4];
-		byte	_6[16];
-	} ipv;
-
 	int						lastTime;
 	signed char		burst;
-
-	long					hash;
-
-	leakyBucket_t *prev, *next;
 };
 
 extern leakyBucket_t outboundLeakyBucket;
 
 qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period );
 qboolean SVC_RateLimitAddress( netadr_t from, int burst, int period );
+void SVC_RateLimitBench_f( void );
 
 void SV_FinalMessage (char *message);
 void QDECL SV_SendServerCommand( client_t *cl, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
@@ -339,6 +351,24 @@ void QDECL SV_SendServerCommand( client_t *cl, const char *fmt, ...) __attribute
 void SV_AddOperatorCommands (void);
 void SV_RemoveOperatorCommands (void);
 
+typedef enum {
+	PROF_PACKETS,		// SV_PacketEvent
+	PROF_BOTS,			// SV_BotFrame
+	PROF_GAME,			// GAME_RUN_FRAME
+	PROF_SNAPBUILD,		// snapshot entity culling
+	PROF_SNAPENCODE,	// snapshot delta compression
+	PROF_SEND,			// netchan transmission
+	PROF_FRAME,			// SV_Frame and the packets before it
+	PROF_NUMPHASES
+} profilePhase_t;
+
+extern	qboolean	sv_profiling;
+
+int64_t	SV_ProfileTime( void );
+void	SV_ProfileAdd( profilePhase_t phase, int64_t start );
+void	SV_ProfileShutdown( void );
+void	SV_Profile_f( void );
+
 
 void SV_MasterShutdown (void);
 int SV_RateMsec(client_t *client);
@@ -400,6 +430,20 @@ void SV_WriteFrameToClient (client_t *client, msg_t *msg);
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
 void SV_SendClientSnapshot( client_t *client );
+void SV_SnapshotCullBench_f( void );
+void SV_DeltaCache_f( void );
+
+//
+// sv_demo.c
+//
+void SV_DemoAutoRecord( void );
+void SV_DemoStopRecord( void );
+void SV_DemoConfigstring( int index );
+void SV_DemoServerCommand( client_t *cl, const char *cmd );
+void SV_DemoFrame( void );
+void SV_Record_f( void );
+void SV_StopRecord_f( void );
+void SV_DemoExtract_f( void );
 
 //
 // sv_game.c
@@ -456,6 +500,9 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 
 
 void SV_SectorList_f( void );
+void SV_WorldBench_f( void );
+void SV_TraceCacheNewFrame( void );
+void SV_TraceCache_f( void );
 
 
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
@@ -483,6 +530,10 @@ void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, c
 // passEntityNum is explicitly excluded from clipping checks (normally ENTITYNUM_NONE)
 
 
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests, int capsule );
+// same results as an SV_Trace for each request, but the entities
+// are only gathered once for the bounds of all of them
+
 void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, int capsule );
 // clip to a specific entity
 
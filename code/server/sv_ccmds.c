@@ -1544,6 +1544,16 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("worldbench", SV_WorldBench_f);
+	Cmd_AddCommand ("tracecache", SV_TraceCache_f);
+	Cmd_AddCommand ("deltacache", SV_DeltaCache_f);
+	Cmd_AddCommand ("sv_profile", SV_Profile_f);
+	Cmd_AddCommand ("cm_simdtest", CM_SimdTest_f);
+	Cmd_AddCommand ("snapcullbench", SV_SnapshotCullBench_f);
+	Cmd_AddCommand ("ratelimitbench", SVC_RateLimitBench_f);
+	Cmd_AddCommand ("svrecord", SV_Record_f);
+	Cmd_AddCommand ("svstoprecord", SV_StopRecord_f);
+	Cmd_AddCommand ("svdemoextract", SV_DemoExtract_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 	Cmd_SetCommandCompletionFunc( "map", SV_CompleteMapName );
 #ifndef PRE_RELEASE_DEMO
@@ -1593,6 +1603,16 @@ void SV_RemoveOperatorCommands( void ) {
 	Cmd_RemoveCommand ("dumpuser");
 	Cmd_RemoveCommand ("map_restart");
 	Cmd_RemoveCommand ("sectorlist");
+	Cmd_RemoveCommand ("worldbench");
+	Cmd_RemoveCommand ("tracecache");
+	Cmd_RemoveCommand ("deltacache");
+	Cmd_RemoveCommand ("sv_profile");
+	Cmd_RemoveCommand ("cm_simdtest");
+	Cmd_RemoveCommand ("snapcullbench");
+	Cmd_RemoveCommand ("ratelimitbench");
+	Cmd_RemoveCommand ("svrecord");
+	Cmd_RemoveCommand ("svstoprecord");
+	Cmd_RemoveCommand ("svdemoextract");
 	Cmd_RemoveCommand ("say");
 #endif
 }
@@ -0,0 +1,962 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_demo.c -- server demos holding every entity and playerstate
+
+#include "server.h"
+
+/*
+=============================================================================
+
+SERVER DEMOS
+
+A server demo is a sequence of length prefixed messages ended by a length
+of -1.  The first message holds the configstrings and baselines, every
+other one a game frame: the configstring changes and server commands since
+the last frame, then all entities that could be sent to any client, delta
+compressed against the last frame, and the playerstates of all active
+clients.
+
+Frames are encoded on the main thread and written through an async file,
+so SV_Frame doesn't wait for the disk.  svdemoextract turns a server demo
+into a client demo seen by any one of the players.
+
+=============================================================================
+*/
+
+#define	SVDEMO_VERSION		1
+#define	SVDEMO_EXT			"svdm_"
+#define	SVDEMO_MAX_MSG		( 256 * 1024 )	// a frame with every entity and playerstate
+#define	SVDEMO_WRITE_BUFFER	( 1024 * 1024 )	// queued for the writer thread
+#define	SVDEMO_ALLCLIENTS	255
+
+typedef enum {
+	svd_bad,
+	svd_EOF,
+	svd_gamestate,		// version, maxclients, checksumFeed
+	svd_configstring,	// index, string
+	svd_baseline,		// entity delta from the null state
+	svd_serverCommand,	// client number or SVDEMO_ALLCLIENTS, command
+	svd_frame			// serverTime, snapFlags, entities, visibility, playerstates
+} svDemoCmd_t;
+
+// the per client visibility of an entity, see SV_AddEntitiesVisibleFromPoint
+#define	SVDEMO_SINGLECLIENT		1
+#define	SVDEMO_NOTSINGLECLIENT	2
+#define	SVDEMO_CLIENTMASK		4
+
+typedef struct {
+	qboolean		recording;
+	char			name[MAX_QPATH];
+	fileHandle_t	file;
+
+	// configstrings and commands are added as they happen,
+	// SV_DemoFrame finishes the message
+	msg_t			msg;
+	byte			*msgData;
+
+	// the last frame, for delta compression
+	entityState_t	*entities;
+	byte			present[MAX_GENTITIES];
+	playerState_t	*ps;
+	qboolean		psValid[MAX_CLIENTS];
+
+	int				frames;
+	int				bytes;
+} svDemo_t;
+
+static svDemo_t	svd;
+
+/*
+==================
+SV_DemoWrite
+==================
+*/
+static void SV_DemoWrite( const void *data, int len ) {
+	svd.bytes += len;
+	FS_Write( data, len, svd.file );
+}
+
+/*
+==================
+SV_DemoWriteMessage
+
+Writes out svd.msg and starts the next one
+==================
+*/
+static void SV_DemoWriteMessage( void ) {
+	int		len;
+
+	len = LittleLong( svd.msg.cursize );
+	SV_DemoWrite( &len, 4 );
+	SV_DemoWrite( svd.msg.data, svd.msg.cursize );
+
+	MSG_Init( &svd.msg, svd.msgData, SVDEMO_MAX_MSG );
+}
+
+/*
+==================
+SV_DemoStartRecord
+==================
+*/
+static void SV_DemoStartRecord( const char *name ) {
+	char			path[MAX_QPATH];
+	entityState_t	nullstate;
+	entityState_t	*base;
+	int				i;
+
+	Com_sprintf( path, sizeof( path ), "demos/%s.%s%d", name, SVDEMO_EXT, com_protocol->integer );
+
+	svd.file = FS_OpenAsyncWrite( path, qfalse, SVDEMO_WRITE_BUFFER );
+	if ( !svd.file ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", path );
+		return;
+	}
+	Com_Printf( "recording server demo to %s.\n", path );
+
+	Q_strncpyz( svd.name, path, sizeof( svd.name ) );
+	svd.msgData = Z_Malloc( SVDEMO_MAX_MSG );
+	svd.entities = Z_Malloc( MAX_GENTITIES * sizeof( *svd.entities ) );
+	svd.ps = Z_Malloc( MAX_CLIENTS * sizeof( *svd.ps ) );
+
+	svd.recording = qtrue;
+
+	// the gamestate every client gets
+	MSG_Init( &svd.msg, svd.msgData, SVDEMO_MAX_MSG );
+	MSG_WriteByte( &svd.msg, svd_gamestate );
+	MSG_WriteLong( &svd.msg, SVDEMO_VERSION );
+	MSG_WriteLong( &svd.msg, sv_maxclients->integer );
+	MSG_WriteLong( &svd.msg, sv.checksumFeed );
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( sv.configstrings[i][0] ) {
+			MSG_WriteByte( &svd.msg, svd_configstring );
+			MSG_WriteShort( &svd.msg, i );
+			MSG_WriteBigString( &svd.msg, sv.configstrings[i] );
+		}
+	}
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		base = &sv.svEntities[i].baseline;
+		if ( !base->number ) {
+			continue;
+		}
+		MSG_WriteByte( &svd.msg, svd_baseline );
+		MSG_WriteDeltaEntity( &svd.msg, &nullstate, base, qtrue );
+	}
+
+	MSG_WriteByte( &svd.msg, svd_EOF );
+	SV_DemoWriteMessage();
+}
+
+/*
+==================
+SV_DemoStopRecord
+==================
+*/
+void SV_DemoStopRecord( void ) {
+	int		len;
+
+	if ( !svd.recording ) {
+		return;
+	}
+
+	len = -1;
+	SV_DemoWrite( &len, 4 );
+	FS_FCloseFile( svd.file );
+
+	Com_Printf( "Stopped server demo %s: %i frames, %i kB\n",
+		svd.name, svd.frames, svd.bytes / 1024 );
+
+	Z_Free( svd.msgData );
+	Z_Free( svd.entities );
+	Z_Free( svd.ps );
+	Com_Memset( &svd, 0, sizeof( svd ) );
+}
+
+/*
+==================
+SV_DemoAutoRecord
+
+Starts a demo named after the date and map, called once a map is loaded
+==================
+*/
+void SV_DemoAutoRecord( void ) {
+	qtime_t		now;
+
+	if ( svd.recording ) {
+		return;
+	}
+
+	Com_RealTime( &now );
+	SV_DemoStartRecord( va( "%04d%02d%02d%02d%02d%02d-%s",
+		1900 + now.tm_year, 1 + now.tm_mon, now.tm_mday,
+		now.tm_hour, now.tm_min, now.tm_sec, sv_mapname->string ) );
+}
+
+/*
+==================
+SV_DemoConfigstring
+==================
+*/
+void SV_DemoConfigstring( int index ) {
+	if ( !svd.recording ) {
+		return;
+	}
+
+	MSG_WriteByte( &svd.msg, svd_configstring );
+	MSG_WriteShort( &svd.msg, index );
+	MSG_WriteBigString( &svd.msg, sv.configstrings[index] );
+}
+
+/*
+==================
+SV_DemoServerCommand
+
+cl is NULL for commands that go to everyone
+==================
+*/
+void SV_DemoServerCommand( client_t *cl, const char *cmd ) {
+	if ( !svd.recording ) {
+		return;
+	}
+
+	// configstring updates are recorded once by SV_DemoConfigstring
+	if ( !strncmp( cmd, "cs ", 3 ) || !strncmp( cmd, "bcs", 3 ) ) {
+		return;
+	}
+
+	MSG_WriteByte( &svd.msg, svd_serverCommand );
+	MSG_WriteByte( &svd.msg, cl ? cl - svs.clients : SVDEMO_ALLCLIENTS );
+	MSG_WriteString( &svd.msg, cmd );
+}
+
+/*
+==================
+SV_DemoFrame
+
+Records the world after a game frame
+==================
+*/
+void SV_DemoFrame( void ) {
+	sharedEntity_t	*ent;
+	entityState_t	es;
+	playerState_t	*ps;
+	client_t		*cl;
+	int				i, flags;
+
+	if ( !svd.recording ) {
+		return;
+	}
+
+	MSG_WriteByte( &svd.msg, svd_frame );
+	MSG_WriteLong( &svd.msg, sv.time );
+	MSG_WriteByte( &svd.msg, svs.snapFlagServerBit );
+
+	// every entity some client could be sent, the same way
+	// SV_EmitPacketEntities deltas them
+	for ( i = 0 ; i < MAX_GENTITIES - 1 ; i++ ) {
+		ent = NULL;
+		if ( i < sv.num_entities ) {
+			ent = SV_GentityNum( i );
+			if ( !ent->r.linked || ( ent->r.svFlags & SVF_NOCLIENT ) ) {
+				ent = NULL;
+			}
+		}
+
+		if ( ent ) {
+			es = ent->s;
+			es.number = i;
+			if ( svd.present[i] ) {
+				MSG_WriteDeltaEntity( &svd.msg, &svd.entities[i], &es, qfalse );
+			} else {
+				MSG_WriteDeltaEntity( &svd.msg, &sv.svEntities[i].baseline, &es, qtrue );
+			}
+			svd.entities[i] = es;
+			svd.present[i] = qtrue;
+		} else if ( svd.present[i] ) {
+			MSG_WriteDeltaEntity( &svd.msg, &svd.entities[i], NULL, qtrue );
+			svd.present[i] = qfalse;
+		}
+	}
+	MSG_WriteBits( &svd.msg, MAX_GENTITIES - 1, GENTITYNUM_BITS );
+
+	// entities only some clients may see
+	for ( i = 0 ; i < MAX_GENTITIES - 1 ; i++ ) {
+		if ( !svd.present[i] ) {
+			continue;
+		}
+		ent = SV_GentityNum( i );
+
+		flags = 0;
+		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
+			flags |= SVDEMO_SINGLECLIENT;
+		}
+		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
+			flags |= SVDEMO_NOTSINGLECLIENT;
+		}
+		if ( ent->r.svFlags & SVF_CLIENTMASK ) {
+			flags |= SVDEMO_CLIENTMASK;
+		}
+		if ( !flags ) {
+			continue;
+		}
+
+		MSG_WriteBits( &svd.msg, i, GENTITYNUM_BITS );
+		MSG_WriteBits( &svd.msg, flags, 3 );
+		MSG_WriteLong( &svd.msg, ent->r.singleClient );
+	}
+	MSG_WriteBits( &svd.msg, MAX_GENTITIES - 1, GENTITYNUM_BITS );
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( cl->state != CS_ACTIVE ) {
+			MSG_WriteBits( &svd.msg, 0, 1 );
+			svd.psValid[i] = qfalse;
+			continue;
+		}
+
+		ps = SV_GameClientNum( i );
+		MSG_WriteBits( &svd.msg, 1, 1 );
+		MSG_WriteDeltaPlayerstate( &svd.msg, svd.psValid[i] ? &svd.ps[i] : NULL, ps );
+		svd.ps[i] = *ps;
+		svd.psValid[i] = qtrue;
+	}
+
+	MSG_WriteByte( &svd.msg, svd_EOF );
+
+	if ( svd.msg.overflowed ) {
+		Com_Printf( "WARNING: server demo frame overflowed\n" );
+		SV_DemoStopRecord();
+		return;
+	}
+
+	SV_DemoWriteMessage();
+	svd.frames++;
+}
+
+/*
+==================
+SV_Record_f
+
+svrecord [demoname]
+==================
+*/
+void SV_Record_f( void ) {
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "svrecord [demoname]\n" );
+		return;
+	}
+
+	if ( svd.recording ) {
+		Com_Printf( "Already recording a server demo.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() == 2 ) {
+		SV_DemoStartRecord( Cmd_Argv( 1 ) );
+	} else {
+		SV_DemoAutoRecord();
+	}
+}
+
+/*
+==================
+SV_StopRecord_f
+==================
+*/
+void SV_StopRecord_f( void ) {
+	if ( !svd.recording ) {
+		Com_Printf( "Not recording a server demo.\n" );
+		return;
+	}
+
+	SV_DemoStopRecord();
+}
+
+/*
+=============================================================================
+
+EXTRACTION
+
+=============================================================================
+*/
+
+typedef struct {
+	fileHandle_t	in;
+	fileHandle_t	out;
+	int				clientNum;
+	byte			*inData;
+
+	// the recorded world
+	int				maxclients;
+	int				checksumFeed;
+	char			*configstrings[MAX_CONFIGSTRINGS];
+	entityState_t	baselines[MAX_GENTITIES];
+	entityState_t	entities[MAX_GENTITIES];
+	byte			present[MAX_GENTITIES];
+	int				visibility[MAX_GENTITIES];
+	int				singleClient[MAX_GENTITIES];
+	playerState_t	ps[MAX_CLIENTS];
+	qboolean		psValid[MAX_CLIENTS];
+
+	// the client demo
+	msg_t			msg;
+	byte			msgData[MAX_MSGLEN];
+	qboolean		started;
+	qboolean		finished;
+	int				messageNum;
+	int				serverCommandSequence;
+	int				snapshots;
+	playerState_t	lastPs;
+	entityState_t	lastEntities[MAX_SNAPSHOT_ENTITIES];
+	int				numLastEntities;
+} svDemoExtract_t;
+
+typedef struct {
+	int		num;
+	float	dist;
+} svDemoEntityDist_t;
+
+/*
+==================
+SV_ExtractBeginMessage
+==================
+*/
+static void SV_ExtractBeginMessage( svDemoExtract_t *x ) {
+	MSG_Init( &x->msg, x->msgData, sizeof( x->msgData ) );
+	MSG_Bitstream( &x->msg );
+	MSG_WriteLong( &x->msg, 0 );	// reliable acknowledge
+}
+
+/*
+==================
+SV_ExtractWriteMessage
+
+Same layout as CL_WriteDemoMessage
+==================
+*/
+static void SV_ExtractWriteMessage( svDemoExtract_t *x, int sequence ) {
+	int		len;
+
+	len = LittleLong( sequence );
+	FS_Write( &len, 4, x->out );
+	len = LittleLong( x->msg.cursize );
+	FS_Write( &len, 4, x->out );
+	FS_Write( x->msg.data, x->msg.cursize, x->out );
+}
+
+/*
+==================
+SV_ExtractCommand
+==================
+*/
+static void SV_ExtractCommand( svDemoExtract_t *x, const char *cmd ) {
+	MSG_WriteByte( &x->msg, svc_serverCommand );
+	MSG_WriteLong( &x->msg, ++x->serverCommandSequence );
+	MSG_WriteString( &x->msg, cmd );
+}
+
+/*
+==================
+SV_ExtractConfigstring
+
+The commands SV_SendConfigstring would have sent
+==================
+*/
+static void SV_ExtractConfigstring( svDemoExtract_t *x, int index ) {
+	int		maxChunkSize = MAX_STRING_CHARS - 24;
+	int		sent, remaining;
+	char	*cmd;
+	char	buf[MAX_STRING_CHARS];
+
+	remaining = strlen( x->configstrings[index] );
+	if ( remaining < maxChunkSize ) {
+		SV_ExtractCommand( x, va( "cs %i \"%s\"\n", index, x->configstrings[index] ) );
+		return;
+	}
+
+	sent = 0;
+	while ( remaining > 0 ) {
+		if ( sent == 0 ) {
+			cmd = "bcs0";
+		} else if ( remaining < maxChunkSize ) {
+			cmd = "bcs2";
+		} else {
+			cmd = "bcs1";
+		}
+		Q_strncpyz( buf, &x->configstrings[index][sent], maxChunkSize );
+		SV_ExtractCommand( x, va( "%s %i \"%s\"\n", cmd, index, buf ) );
+
+		sent += maxChunkSize - 1;
+		remaining -= maxChunkSize - 1;
+	}
+}
+
+/*
+==================
+SV_ExtractGamestate
+
+Written when the player first shows up, like CL_Record_f
+==================
+*/
+static void SV_ExtractGamestate( svDemoExtract_t *x ) {
+	entityState_t	nullstate;
+	int				i;
+
+	SV_ExtractBeginMessage( x );
+	MSG_WriteByte( &x->msg, svc_gamestate );
+	MSG_WriteLong( &x->msg, x->serverCommandSequence );
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( x->configstrings[i] && x->configstrings[i][0] ) {
+			MSG_WriteByte( &x->msg, svc_configstring );
+			MSG_WriteShort( &x->msg, i );
+			MSG_WriteBigString( &x->msg, x->configstrings[i] );
+		}
+	}
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		if ( !x->baselines[i].number ) {
+			continue;
+		}
+		MSG_WriteByte( &x->msg, svc_baseline );
+		MSG_WriteDeltaEntity( &x->msg, &nullstate, &x->baselines[i], qtrue );
+	}
+
+	MSG_WriteByte( &x->msg, svc_EOF );
+	MSG_WriteLong( &x->msg, x->clientNum );
+	MSG_WriteLong( &x->msg, x->checksumFeed );
+	MSG_WriteByte( &x->msg, svc_EOF );
+
+	SV_ExtractWriteMessage( x, x->messageNum - 1 );
+}
+
+/*
+==================
+SV_ExtractCompareDist
+==================
+*/
+static int QDECL SV_ExtractCompareDist( const void *a, const void *b ) {
+	const svDemoEntityDist_t	*ea = a, *eb = b;
+
+	if ( ea->dist != eb->dist ) {
+		return ea->dist < eb->dist ? -1 : 1;
+	}
+	return ea->num - eb->num;
+}
+
+/*
+==================
+SV_ExtractCompareNum
+==================
+*/
+static int QDECL SV_ExtractCompareNum( const void *a, const void *b ) {
+	return ( (const svDemoEntityDist_t *)a )->num - ( (const svDemoEntityDist_t *)b )->num;
+}
+
+/*
+==================
+SV_ExtractSnapshot
+
+Everything the player may see goes into the snapshot; there is no PVS
+without the map loaded, so past MAX_SNAPSHOT_ENTITIES the nearest are kept.
+The areamask is left empty, which lets the client draw all areas.
+==================
+*/
+static void SV_ExtractSnapshot( svDemoExtract_t *x, int serverTime, int snapFlags ) {
+	static svDemoEntityDist_t	list[MAX_GENTITIES];
+	playerState_t	*ps;
+	entityState_t	*oldent, *newent;
+	vec3_t			delta;
+	int				viewer, count, num, vis;
+	int				oldindex, newindex, oldnum, newnum;
+
+	ps = &x->ps[x->clientNum];
+	viewer = ps->clientNum;
+
+	count = 0;
+	for ( num = 0 ; num < MAX_GENTITIES - 1 ; num++ ) {
+		// the player's own entity is regenerated from the playerstate
+		if ( !x->present[num] || num == viewer ) {
+			continue;
+		}
+
+		vis = x->visibility[num];
+		if ( ( vis & SVDEMO_SINGLECLIENT ) && x->singleClient[num] != viewer ) {
+			continue;
+		}
+		if ( ( vis & SVDEMO_NOTSINGLECLIENT ) && x->singleClient[num] == viewer ) {
+			continue;
+		}
+		if ( ( vis & SVDEMO_CLIENTMASK ) && ( viewer >= 32 || !( x->singleClient[num] & ( 1 << viewer ) ) ) ) {
+			continue;
+		}
+
+		list[count].num = num;
+		VectorSubtract( x->entities[num].pos.trBase, ps->origin, delta );
+		list[count].dist = VectorLengthSquared( delta );
+		count++;
+	}
+
+	if ( count > MAX_SNAPSHOT_ENTITIES ) {
+		qsort( list, count, sizeof( list[0] ), SV_ExtractCompareDist );
+		count = MAX_SNAPSHOT_ENTITIES;
+		qsort( list, count, sizeof( list[0] ), SV_ExtractCompareNum );
+	}
+
+	MSG_WriteByte( &x->msg, svc_snapshot );
+	MSG_WriteLong( &x->msg, serverTime );
+	MSG_WriteByte( &x->msg, x->snapshots ? 1 : 0 );	// delta from the previous message
+	MSG_WriteByte( &x->msg, snapFlags );
+	MSG_WriteByte( &x->msg, 0 );					// areabytes
+
+	MSG_WriteDeltaPlayerstate( &x->msg, x->snapshots ? &x->lastPs : NULL, ps );
+
+	// the same merge as SV_EmitPacketEntities
+	oldent = newent = NULL;
+	oldindex = newindex = 0;
+	while ( newindex < count || oldindex < x->numLastEntities ) {
+		if ( newindex >= count ) {
+			newnum = 9999;
+		} else {
+			newent = &x->entities[list[newindex].num];
+			newnum = newent->number;
+		}
+
+		if ( oldindex >= x->numLastEntities ) {
+			oldnum = 9999;
+		} else {
+			oldent = &x->lastEntities[oldindex];
+			oldnum = oldent->number;
+		}
+
+		if ( newnum == oldnum ) {
+			MSG_WriteDeltaEntity( &x->msg, oldent, newent, qfalse );
+			oldindex++;
+			newindex++;
+		} else if ( newnum < oldnum ) {
+			MSG_WriteDeltaEntity( &x->msg, &x->baselines[newnum], newent, qtrue );
+			newindex++;
+		} else {
+			MSG_WriteDeltaEntity( &x->msg, oldent, NULL, qtrue );
+			oldindex++;
+		}
+	}
+	MSG_WriteBits( &x->msg, MAX_GENTITIES - 1, GENTITYNUM_BITS );
+
+	x->lastPs = *ps;
+	for ( newindex = 0 ; newindex < count ; newindex++ ) {
+		x->lastEntities[newindex] = x->entities[list[newindex].num];
+	}
+	x->numLastEntities = count;
+	x->snapshots++;
+}
+
+/*
+==================
+SV_ExtractFrame
+==================
+*/
+static qboolean SV_ExtractFrame( svDemoExtract_t *x, msg_t *msg ) {
+	entityState_t	state;
+	playerState_t	ps;
+	int				serverTime, snapFlags;
+	int				num, i;
+
+	serverTime = MSG_ReadLong( msg );
+	snapFlags = MSG_ReadByte( msg );
+
+	while ( 1 ) {
+		num = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( num == MAX_GENTITIES - 1 ) {
+			break;
+		}
+		if ( msg->readcount > msg->cursize ) {
+			return qfalse;
+		}
+
+		MSG_ReadDeltaEntity( msg, x->present[num] ? &x->entities[num] : &x->baselines[num], &state, num );
+		if ( state.number == MAX_GENTITIES - 1 ) {
+			x->present[num] = qfalse;
+		} else {
+			x->entities[num] = state;
+			x->present[num] = qtrue;
+		}
+	}
+
+	Com_Memset( x->visibility, 0, sizeof( x->visibility ) );
+	while ( 1 ) {
+		num = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( num == MAX_GENTITIES - 1 ) {
+			break;
+		}
+		if ( msg->readcount > msg->cursize ) {
+			return qfalse;
+		}
+		x->visibility[num] = MSG_ReadBits( msg, 3 );
+		x->singleClient[num] = MSG_ReadLong( msg );
+	}
+
+	for ( i = 0 ; i < x->maxclients ; i++ ) {
+		if ( !MSG_ReadBits( msg, 1 ) ) {
+			x->psValid[i] = qfalse;
+			continue;
+		}
+		MSG_ReadDeltaPlayerstate( msg, x->psValid[i] ? &x->ps[i] : NULL, &ps );
+		x->ps[i] = ps;
+		x->psValid[i] = qtrue;
+	}
+
+	if ( !x->psValid[x->clientNum] ) {
+		// the demo ends when the player leaves
+		if ( x->started ) {
+			x->finished = qtrue;
+		}
+		return qtrue;
+	}
+
+	if ( !x->started ) {
+		// whatever came before is part of the gamestate
+		SV_ExtractGamestate( x );
+		SV_ExtractBeginMessage( x );
+		x->started = qtrue;
+	}
+
+	SV_ExtractSnapshot( x, serverTime, snapFlags );
+	MSG_WriteByte( &x->msg, svc_EOF );
+
+	if ( x->msg.overflowed ) {
+		Com_Printf( "Client message overflowed at %i ms\n", serverTime );
+		x->finished = qtrue;
+		return qtrue;
+	}
+
+	SV_ExtractWriteMessage( x, x->messageNum );
+	x->messageNum++;
+	return qtrue;
+}
+
+/*
+==================
+SV_ExtractMessage
+
+Returns qfalse if the server demo is broken
+==================
+*/
+static qboolean SV_ExtractMessage( svDemoExtract_t *x, msg_t *msg ) {
+	entityState_t	nullstate;
+	int				cmd, i;
+	char			*s;
+
+	SV_ExtractBeginMessage( x );
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+
+	while ( !x->finished ) {
+		if ( msg->readcount > msg->cursize ) {
+			Com_Printf( "Read past end of server demo message\n" );
+			return qfalse;
+		}
+
+		cmd = MSG_ReadByte( msg );
+		switch ( cmd ) {
+		case svd_EOF:
+			return qtrue;
+
+		case svd_gamestate:
+			i = MSG_ReadLong( msg );
+			if ( i != SVDEMO_VERSION ) {
+				Com_Printf( "Server demo version %i, expected %i\n", i, SVDEMO_VERSION );
+				return qfalse;
+			}
+			x->maxclients = MSG_ReadLong( msg );
+			x->checksumFeed = MSG_ReadLong( msg );
+			if ( x->maxclients < 1 || x->maxclients > MAX_CLIENTS ) {
+				Com_Printf( "Bad maxclients %i in server demo\n", x->maxclients );
+				return qfalse;
+			}
+			if ( x->clientNum >= x->maxclients ) {
+				Com_Printf( "The server demo only has %i client slots\n", x->maxclients );
+				return qfalse;
+			}
+			break;
+
+		case svd_configstring:
+			i = MSG_ReadShort( msg );
+			s = MSG_ReadBigString( msg );
+			if ( i < 0 || i >= MAX_CONFIGSTRINGS ) {
+				Com_Printf( "Bad configstring %i in server demo\n", i );
+				return qfalse;
+			}
+			if ( x->configstrings[i] ) {
+				Z_Free( x->configstrings[i] );
+			}
+			x->configstrings[i] = CopyString( s );
+			if ( x->started ) {
+				SV_ExtractConfigstring( x, i );
+			}
+			break;
+
+		case svd_baseline:
+			i = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			MSG_ReadDeltaEntity( msg, &nullstate, &x->baselines[i], i );
+			break;
+
+		case svd_serverCommand:
+			i = MSG_ReadByte( msg );
+			s = MSG_ReadString( msg );
+			if ( x->started && ( i == SVDEMO_ALLCLIENTS || i == x->clientNum ) ) {
+				SV_ExtractCommand( x, s );
+			}
+			break;
+
+		case svd_frame:
+			if ( !x->maxclients ) {
+				Com_Printf( "Server demo frame before the gamestate\n" );
+				return qfalse;
+			}
+			if ( !SV_ExtractFrame( x, msg ) ) {
+				Com_Printf( "Read past end of server demo frame\n" );
+				return qfalse;
+			}
+			break;
+
+		default:
+			Com_Printf( "Bad server demo command %i\n", cmd );
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+==================
+SV_DemoExtract_f
+
+svdemoextract <serverdemo> <clientnum> [demoname]
+==================
+*/
+void SV_DemoExtract_f( void ) {
+	svDemoExtract_t	*x;
+	char			inName[MAX_OSPATH];
+	char			outName[MAX_OSPATH];
+	char			base[MAX_QPATH];
+	msg_t			msg;
+	int				len, i;
+
+	if ( Cmd_Argc() < 3 || Cmd_Argc() > 4 ) {
+		Com_Printf( "svdemoextract <serverdemo> <clientnum> [demoname]\n" );
+		return;
+	}
+
+	COM_StripExtension( Cmd_Argv( 1 ), base, sizeof( base ) );
+	if ( !Q_stricmpn( COM_GetExtension( Cmd_Argv( 1 ) ), SVDEMO_EXT, strlen( SVDEMO_EXT ) ) ) {
+		Com_sprintf( inName, sizeof( inName ), "demos/%s", Cmd_Argv( 1 ) );
+	} else {
+		Com_sprintf( inName, sizeof( inName ), "demos/%s.%s%d", Cmd_Argv( 1 ), SVDEMO_EXT, com_protocol->integer );
+		Q_strncpyz( base, Cmd_Argv( 1 ), sizeof( base ) );
+	}
+
+	x = Z_Malloc( sizeof( *x ) );
+	x->clientNum = atoi( Cmd_Argv( 2 ) );
+	if ( x->clientNum < 0 || x->clientNum >= MAX_CLIENTS ) {
+		Com_Printf( "Bad client number %i\n", x->clientNum );
+		Z_Free( x );
+		return;
+	}
+
+	FS_FOpenFileRead( inName, &x->in, qtrue );
+	if ( !x->in ) {
+		Com_Printf( "Couldn't open %s\n", inName );
+		Z_Free( x );
+		return;
+	}
+
+	if ( Cmd_Argc() == 4 ) {
+		Com_sprintf( outName, sizeof( outName ), "demos/%s.%s%d", Cmd_Argv( 3 ), DEMOEXT, com_protocol->integer );
+	} else {
+		Com_sprintf( outName, sizeof( outName ), "demos/%s-%i.%s%d", base, x->clientNum, DEMOEXT, com_protocol->integer );
+	}
+	x->out = FS_FOpenFileWrite( outName );
+	if ( !x->out ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", outName );
+		FS_FCloseFile( x->in );
+		Z_Free( x );
+		return;
+	}
+
+	x->inData = Z_Malloc( SVDEMO_MAX_MSG );
+	x->messageNum = 1;
+
+	while ( !x->finished ) {
+		if ( FS_Read( &len, 4, x->in ) != 4 ) {
+			Com_Printf( "Server demo file is truncated\n" );
+			break;
+		}
+		len = LittleLong( len );
+		if ( len == -1 ) {
+			break;
+		}
+		if ( len < 0 || len > SVDEMO_MAX_MSG ) {
+			Com_Printf( "Bad server demo message length %i\n", len );
+			break;
+		}
+		if ( FS_Read( x->inData, len, x->in ) != len ) {
+			Com_Printf( "Server demo file is truncated\n" );
+			break;
+		}
+
+		MSG_Init( &msg, x->inData, SVDEMO_MAX_MSG );
+		msg.cursize = len;
+		MSG_BeginReading( &msg );
+		if ( !SV_ExtractMessage( x, &msg ) ) {
+			break;
+		}
+	}
+
+	// the end marker CL_StopRecord_f writes
+	len = -1;
+	FS_Write( &len, 4, x->out );
+	FS_Write( &len, 4, x->out );
+	FS_FCloseFile( x->out );
+	FS_FCloseFile( x->in );
+
+	if ( x->started ) {
+		Com_Printf( "Wrote %i snapshots of client %i to %s\n", x->snapshots, x->clientNum, outName );
+	} else {
+		Com_Printf( "Client %i is never in the game in %s\n", x->clientNum, inName );
+	}
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( x->configstrings[i] ) {
+			Z_Free( x->configstrings[i] );
+		}
+	}
+	Z_Free( x->inData );
+	Z_Free( x );
+}
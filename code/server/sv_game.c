@@ -365,6 +365,21 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 	case G_TRACECAPSULE:
 		SV_Trace( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], /*int capsule*/ qtrue );
 		return 0;
+	case G_TRACE_BATCH:
+		if ( args[3] < 0 || args[3] > MAX_GENTITIES ) {
+			Com_Error( ERR_DROP, "G_TRACE_BATCH: bad numRequests %i", (int)args[3] );
+		}
+		if ( args[3] ) {
+			// VMA only masks the base pointer, the whole arrays have to be in the vm
+			trace_t			*results = VM_ArgArray( args[1], args[3] * sizeof( trace_t ), "G_TRACE_BATCH" );
+			traceRequest_t	*requests = VM_ArgArray( args[2], args[3] * sizeof( traceRequest_t ), "G_TRACE_BATCH" );
+
+			if ( !results || !requests ) {
+				Com_Error( ERR_DROP, "G_TRACE_BATCH: NULL array" );
+			}
+			SV_TraceBatch( results, requests, args[3], /*int capsule*/ qfalse );
+		}
+		return 0;
 	case G_POINT_CONTENTS:
 		return SV_PointContents( VMA(1), args[2] );
 	case G_SET_BRUSH_MODEL:
@@ -127,6 +127,7 @@ void SV_SetConfigstring (int index, const char *val) {
 	// send it to all the clients if we aren't
 	// spawning a new server
 	if ( sv.state == SS_GAME || sv.restarting ) {
+		SV_DemoConfigstring( index );
 
 		// send the data to all relevant clients
 		for (i = 0, client = svs.clients; i < sv_maxclients->integer ; i++, client++) {
@@ -403,6 +404,7 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 	const char	*p;
 
 	// shut down the existing game if it is running
+	SV_DemoStopRecord();
 	SV_ShutdownGameProgs();
 
 	Com_Printf ("------ Server Initialization ------\n");
@@ -603,6 +605,10 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 	// send a heartbeat now so the master will get up to date info
 	SV_Heartbeat_f();
 
+	if ( sv_autoRecordDemo->integer ) {
+		SV_DemoAutoRecord();
+	}
+
 	Hunk_SetMark();
 
 #ifndef DEDICATED
@@ -683,6 +689,18 @@ void SV_Init (void)
 	sv_killserver = Cvar_Get ("sv_killserver", "0", 0);
 	sv_mapChecksum = Cvar_Get ("sv_mapChecksum", "", CVAR_ROM);
 	sv_lanForceRate = Cvar_Get ("sv_lanForceRate", "1", CVAR_ARCHIVE );
+	sv_snapshotThreads = Cvar_Get ("sv_snapshotThreads", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_snapshotThreads, 0, MAX_JOB_THREADS, qtrue );
+	sv_worldIndex = Cvar_Get ("sv_worldIndex", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_worldIndex, 0, 1, qtrue );
+	sv_traceCache = Cvar_Get ("sv_traceCache", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_traceCache, 0, 1, qtrue );
+	sv_traceThreads = Cvar_Get ("sv_traceThreads", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_traceThreads, 0, MAX_JOB_THREADS, qtrue );
+	sv_deltaCache = Cvar_Get ("sv_deltaCache", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_deltaCache, 0, 1, qtrue );
+	sv_autoRecordDemo = Cvar_Get ("sv_autoRecordDemo", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_autoRecordDemo, 0, 1, qtrue );
 #ifndef STANDALONE
 	sv_strictAuth = Cvar_Get ("sv_strictAuth", "1", CVAR_ARCHIVE );
 #endif
@@ -754,6 +772,8 @@ void SV_Shutdown( char *finalmsg ) {
 
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
+	SV_ProfileShutdown();
+	SV_DemoStopRecord();
 	SV_ShutdownGameProgs();
 
 	// free current level
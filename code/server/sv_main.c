@@ -58,6 +58,12 @@ cvar_t	*sv_gametype;
 cvar_t	*sv_pure;
 cvar_t	*sv_floodProtect;
 cvar_t	*sv_lanForceRate; // dedicated 1 (LAN) server forces local client rates to 99999 (bug #491)
+cvar_t	*sv_snapshotThreads;	// build and encode client snapshots on this many threads
+cvar_t	*sv_worldIndex;			// 0 = area node tree, 1 = loose octree, used from the next map on
+cvar_t	*sv_traceCache;			// remember identical SV_Trace results within a frame
+cvar_t	*sv_traceThreads;		// clip trace batches to the world on this many threads
+cvar_t	*sv_deltaCache;			// share encoded entity deltas between clients within a frame
+cvar_t	*sv_autoRecordDemo;		// record a server demo of every map
 #ifndef STANDALONE
 cvar_t	*sv_strictAuth;
 #endif
@@ -205,6 +211,8 @@ void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
 		return;
 	}
 
+	SV_DemoServerCommand( cl, (char *)message );
+
 	if ( cl != NULL ) {
 		SV_AddServerCommand( cl, (char *)message );
 		return;
@@ -360,121 +368,189 @@ CONNECTIONLESS COMMANDS
 ==============================================================================
 */
 
-// This is deliberately quite large to make it more of an effort to DoS
-#define MAX_BUCKETS			16384
-#define MAX_HASHES			1024
+/*
+The per address buckets live in an open addressed table that the network
+receive threads use too, without locks.  It is split into shards of
+RATE_SHARD_SLOTS slots, a cache line aligned block that an address is
+looked up in from the slot its hash points to, and is only ever stored
+in.  When a shard is full a clock hand goes round it, giving slots that
+were used since its last pass a second chance, so a flood of spoofed
+sources can't push out the addresses that are actually playing.  Hits
+over the limit count as use too, so a source that is being refused
+keeps its full bucket instead of being evicted and starting over.
+
+IPv6 addresses are limited by their /64 prefix, which is what a single
+host usually gets.
+
+A slot is a key and a state word, both only changed with compare and
+swap.  Two threads racing on one address may both be let through where
+a lock would have let only one, which is fine for rate limiting.
+*/
+#define RATE_SHARDS			1024
+#define RATE_SHARD_SLOTS	16		// 256 bytes, 16384 slots in all like the old table
+
+// state word layout
+#define RATE_BURST_MASK		0xff
+#define RATE_REFERENCED		0x100
+#define RATE_TIME_SHIFT		32
+
+typedef struct {
+	uint64_t	key;		// 0 if free, see SVC_KeyForAddress
+	uint64_t	state;		// last time << RATE_TIME_SHIFT | referenced | burst
+} rateSlot_t;
 
-static leakyBucket_t buckets[ MAX_BUCKETS ];
-static leakyBucket_t *bucketHashes[ MAX_HASHES ];
+typedef struct {
+	rateSlot_t	slots[RATE_SHARD_SLOTS];
+} rateShard_t;
+
+typedef struct {
+	rateShard_t	shards[ RATE_SHARDS ];
+	int			clockHands[ RATE_SHARDS ];
+} rateTable_t;
+
+static rateTable_t rateLimits QALIGN( 64 );
 leakyBucket_t outboundLeakyBucket;
 
 /*
 ================
-SVC_HashForAddress
+SVC_KeyForAddress
+
+Returns 0 for addresses that aren't rate limited
 ================
 */
-static long SVC_HashForAddress( netadr_t address ) {
-	byte 		*ip = NULL;
-	size_t	size = 0;
+static uint64_t SVC_KeyForAddress( netadr_t address ) {
+	uint64_t	key = 0;
 	int			i;
-	long		hash = 0;
 
 	switch ( address.type ) {
-		case NA_IP:  ip = address.ip;  size = 4; break;
-		case NA_IP6: ip = address.ip6; size = 16; break;
-		default: break;
-	}
+		case NA_IP:
+			// ::ffff:0:0/96, where an ipv6 prefix can't collide with it
+			key = 0xffff00000000ULL | ( (uint64_t)address.ip[0] << 24 ) |
+				( address.ip[1] << 16 ) | ( address.ip[2] << 8 ) | address.ip[3];
+			break;
+
+		case NA_IP6:
+			for ( i = 0; i < 8; i++ ) {
+				key = ( key << 8 ) | address.ip6[ i ];
+			}
+			if ( !key ) {
+				key = 1;	// ::/64, loopback and mapped addresses
+			}
+			break;
 
-	for ( i = 0; i < size; i++ ) {
-		hash += (long)( ip[ i ] ) * ( i + 119 );
+		default:
+			break;
 	}
 
-	hash = ( hash ^ ( hash >> 10 ) ^ ( hash >> 20 ) );
-	hash &= ( MAX_HASHES - 1 );
+	return key;
+}
 
-	return hash;
+/*
+================
+SVC_HashForKey
+================
+*/
+static unsigned int SVC_HashForKey( uint64_t key ) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+
+	return (unsigned int)key;
 }
 
 /*
 ================
-SVC_BucketForAddress
+SVC_LeakBucket
 
-Find or allocate a bucket for an address
+Returns the burst left in a bucket after the time since it was last used
 ================
 */
-static leakyBucket_t *SVC_BucketForAddress( netadr_t address, int burst, int period ) {
-	leakyBucket_t	*bucket = NULL;
-	int						i;
-	long					hash = SVC_HashForAddress( address );
-	int						now = Sys_Milliseconds();
-
-	for ( bucket = bucketHashes[ hash ]; bucket; bucket = bucket->next ) {
-		switch ( bucket->type ) {
-			case NA_IP:
-				if ( memcmp( bucket->ipv._4, address.ip, 4 ) == 0 ) {
-					return bucket;
-				}
-				break;
+static int SVC_LeakBucket( uint64_t state, int now, int period ) {
+	int		interval = now - (int)( state >> RATE_TIME_SHIFT );
+	int		burst = state & RATE_BURST_MASK;
 
-			case NA_IP6:
-				if ( memcmp( bucket->ipv._6, address.ip6, 16 ) == 0 ) {
-					return bucket;
-				}
-				break;
-
-			default:
-				break;
-		}
+	if ( interval < 0 || interval / period > burst ) {
+		return 0;
 	}
 
-	for ( i = 0; i < MAX_BUCKETS; i++ ) {
-		int interval;
+	return burst - interval / period;
+}
 
-		bucket = &buckets[ i ];
-		interval = now - bucket->lastTime;
+/*
+================
+SVC_FindSlot
 
-		// Reclaim expired buckets
-		if ( bucket->lastTime > 0 && ( interval > ( burst * period ) ||
-					interval < 0 ) ) {
-			if ( bucket->prev != NULL ) {
-				bucket->prev->next = bucket->next;
-			} else {
-				bucketHashes[ bucket->hash ] = bucket->next;
-			}
-			
-			if ( bucket->next != NULL ) {
-				bucket->next->prev = bucket->prev;
-			}
+Looks for the address in its shard and optionally takes a free slot for
+it, NULL if it isn't there
+================
+*/
+static rateSlot_t *SVC_FindSlot( rateTable_t *table, uint64_t key, qboolean add ) {
+	unsigned int	hash = SVC_HashForKey( key );
+	rateShard_t		*shard = &table->shards[ hash % RATE_SHARDS ];
+	rateSlot_t		*slot;
+	uint64_t		slotKey;
+	int				i, start;
+
+	start = ( hash / RATE_SHARDS ) % RATE_SHARD_SLOTS;
+
+	for ( i = 0; i < RATE_SHARD_SLOTS; i++ ) {
+		slot = &shard->slots[ ( start + i ) % RATE_SHARD_SLOTS ];
+		slotKey = Com_AtomicLoad64( &slot->key );
 
-			Com_Memset( bucket, 0, sizeof( leakyBucket_t ) );
+		if ( slotKey == key ) {
+			return slot;
 		}
 
-		if ( bucket->type == NA_BAD ) {
-			bucket->type = address.type;
-			switch ( address.type ) {
-				case NA_IP:  Com_Memcpy( bucket->ipv._4, address.ip, 4 );   break;
-				case NA_IP6: Com_Memcpy( bucket->ipv._6, address.ip6, 16 ); break;
-				default: break;
+		if ( !slotKey && add ) {
+			if ( Com_AtomicCompareSwap64( &slot->key, 0, key ) ) {
+				return slot;
 			}
 
-			bucket->lastTime = now;
-			bucket->burst = 0;
-			bucket->hash = hash;
-
-			// Add to the head of the relevant hash chain
-			bucket->next = bucketHashes[ hash ];
-			if ( bucketHashes[ hash ] != NULL ) {
-				bucketHashes[ hash ]->prev = bucket;
+			// somebody else took it, maybe for the same address
+			if ( Com_AtomicLoad64( &slot->key ) == key ) {
+				return slot;
 			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+================
+SVC_EvictSlot
 
-			bucket->prev = NULL;
-			bucketHashes[ hash ] = bucket;
+Runs the shard's clock hand to a slot that is expired or wasn't used since
+the hand last passed it, and gives it to the address
+================
+*/
+static rateSlot_t *SVC_EvictSlot( rateTable_t *table, uint64_t key, int now, int burst, int period ) {
+	unsigned int	hash = SVC_HashForKey( key );
+	int				shardNum = hash % RATE_SHARDS;
+	rateShard_t		*shard = &table->shards[ shardNum ];
+	rateSlot_t		*slot;
+	uint64_t		slotKey, state;
+	int				i, hand;
+
+	for ( i = 0; i < RATE_SHARD_SLOTS * 2; i++ ) {
+		hand = Com_AtomicIncrement( &table->clockHands[ shardNum ] );
+		slot = &shard->slots[ (unsigned int)hand % RATE_SHARD_SLOTS ];
+
+		slotKey = Com_AtomicLoad64( &slot->key );
+		state = Com_AtomicLoad64( &slot->state );
+
+		if ( ( state & RATE_REFERENCED ) &&
+			now - (int)( state >> RATE_TIME_SHIFT ) <= burst * period ) {
+			// second chance
+			Com_AtomicCompareSwap64( &slot->state, state, state & ~RATE_REFERENCED );
+			continue;
+		}
 
-			return bucket;
+		if ( Com_AtomicCompareSwap64( &slot->key, slotKey, key ) ) {
+			return slot;
 		}
 	}
 
-	// Couldn't allocate a bucket for this address
 	return NULL;
 }
 
@@ -508,17 +584,252 @@ qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period ) {
 	return qtrue;
 }
 
+/*
+================
+SVC_RateLimitInTable
+================
+*/
+static qboolean SVC_RateLimitInTable( rateTable_t *table, netadr_t from, int burst, int period ) {
+	uint64_t	key = SVC_KeyForAddress( from );
+	rateSlot_t	*slot;
+	uint64_t	state, newState;
+	int			now, left, interval, lastTime;
+
+	if ( !key ) {
+		return qfalse;
+	}
+
+	now = Sys_Milliseconds();
+
+	slot = SVC_FindSlot( table, key, qtrue );
+	if ( !slot ) {
+		slot = SVC_EvictSlot( table, key, now, burst, period );
+		if ( !slot ) {
+			// the whole shard is busy, like running out of buckets
+			return qtrue;
+		}
+
+		// a fresh bucket with this packet in it, unless another thread
+		// already counted a packet in it
+		state = Com_AtomicLoad64( &slot->state );
+		newState = ( (uint64_t)(unsigned int)now << RATE_TIME_SHIFT ) | RATE_REFERENCED | 1;
+		Com_AtomicCompareSwap64( &slot->state, state, newState );
+		return qfalse;
+	}
+
+	do {
+		state = Com_AtomicLoad64( &slot->state );
+		left = SVC_LeakBucket( state, now, period );
+
+		if ( left >= burst ) {
+			// a source that keeps hitting its limit is still in use, don't
+			// let the clock hand take its slot and hand it a fresh bucket
+			if ( !( state & RATE_REFERENCED ) ) {
+				Com_AtomicCompareSwap64( &slot->state, state, state | RATE_REFERENCED );
+			}
+			return qtrue;
+		}
+
+		// keep the part of a period that hasn't leaked yet, like SVC_RateLimit
+		lastTime = (int)( state >> RATE_TIME_SHIFT );
+		interval = now - lastTime;
+		if ( !left || interval < 0 ) {
+			lastTime = now;
+		} else {
+			lastTime = now - interval % period;
+		}
+
+		newState = ( (uint64_t)(unsigned int)lastTime << RATE_TIME_SHIFT ) | RATE_REFERENCED | ( left + 1 );
+	} while ( !Com_AtomicCompareSwap64( &slot->state, state, newState ) );
+
+	return qfalse;
+}
+
 /*
 ================
 SVC_RateLimitAddress
 
-Rate limit for a particular address
+Rate limit for a particular address, safe to call from any thread
 ================
 */
 qboolean SVC_RateLimitAddress( netadr_t from, int burst, int period ) {
-	leakyBucket_t *bucket = SVC_BucketForAddress( from, burst, period );
+	return SVC_RateLimitInTable( &rateLimits, from, burst, period );
+}
+
+/*
+================
+SVC_AddressOverLimit
+
+True if the address has no room left in its bucket, without counting
+anything against it
+================
+*/
+static qboolean SVC_AddressOverLimit( netadr_t from, int burst, int period ) {
+	uint64_t	key = SVC_KeyForAddress( from );
+	rateSlot_t	*slot;
+
+	if ( !key ) {
+		return qfalse;
+	}
+
+	slot = SVC_FindSlot( &rateLimits, key, qfalse );
+	if ( !slot ) {
+		return qfalse;
+	}
+
+	return SVC_LeakBucket( Com_AtomicLoad64( &slot->state ), Sys_Milliseconds(), period ) >= burst;
+}
+
+#define RATEBENCH_JOBS_PER_THREAD	8
+
+typedef struct {
+	rateTable_t	*table;			// private, the clients' buckets are left alone
+	int			mode;
+	int			packets;		// per job
+	int			jobs;
+	int			limited[ MAX_JOB_THREADS * RATEBENCH_JOBS_PER_THREAD ];
+} rateBench_t;
+
+/*
+================
+SVC_RateLimitBenchJob
+================
+*/
+static void SVC_RateLimitBenchJob( void *data, int index ) {
+	rateBench_t		*bench = data;
+	netadr_t		from;
+	unsigned int	seed = 0x5eed + index * 7919;
+	int				i, limited = 0;
+
+	Com_Memset( &from, 0, sizeof( from ) );
+
+	for ( i = 0; i < bench->packets; i++ ) {
+		seed = seed * 1103515245 + 12345;
+
+		switch ( bench->mode ) {
+			case 0:		// spoofed, a new source nearly every packet
+				from.type = NA_IP;
+				from.ip[0] = seed >> 24;
+				from.ip[1] = seed >> 16;
+				from.ip[2] = seed >> 8;
+				from.ip[3] = i;
+				break;
+
+			case 1:		// a few hot sources, all threads on the same buckets
+				from.type = NA_IP;
+				from.ip[0] = 10;
+				from.ip[1] = from.ip[2] = 0;
+				from.ip[3] = ( seed >> 16 ) & 63;
+				break;
+
+			default:	// random hosts in a few ipv6 /64s
+				from.type = NA_IP6;
+				from.ip6[0] = 0x20;
+				from.ip6[1] = 0x01;
+				from.ip6[7] = ( seed >> 28 );
+				from.ip6[8] = seed >> 8;
+				from.ip6[15] = seed;
+				break;
+		}
+
+		if ( SVC_RateLimitInTable( bench->table, from, 10, 1000 ) ) {
+			limited++;
+		}
+	}
+
+	bench->limited[ index ] = limited;
+}
+
+/*
+================
+SVC_RateLimitBench_f
+
+ratelimitbench [packets] [threads]
+
+Floods SVC_RateLimitAddress with spoofed, hot and ipv6 sources.  The flood
+goes into a table of its own, so the rate limits of real clients and the
+receive threads using them aren't touched
+================
+*/
+void SVC_RateLimitBench_f( void ) {
+	static const char	*modes[] = { "spoofed", "hot", "ipv6" };
+	rateBench_t			bench;
+	void				*buffer;
+	int					packets, threads, limited, i;
+	int64_t				start, usec;
+
+	packets = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 1000000;
+	threads = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1;
+	threads = Com_Clamp( 1, MAX_JOB_THREADS, threads );
+
+	bench.jobs = threads * RATEBENCH_JOBS_PER_THREAD;
+	bench.packets = MAX( packets, bench.jobs ) / bench.jobs;
+
+	// cache line aligned like rateLimits
+	buffer = Z_Malloc( sizeof( rateTable_t ) + 63 );
+	bench.table = (rateTable_t *)( ( (intptr_t)buffer + 63 ) & ~63 );
+
+	for ( bench.mode = 0; bench.mode < ARRAY_LEN( modes ); bench.mode++ ) {
+		Com_Memset( bench.table, 0, sizeof( rateTable_t ) );
+
+		start = Sys_Microseconds();
+		Com_RunJobs( threads, SVC_RateLimitBenchJob, &bench, bench.jobs );
+		usec = MAX( Sys_Microseconds() - start, 1 );
+
+		limited = 0;
+		for ( i = 0; i < bench.jobs; i++ ) {
+			limited += bench.limited[ i ];
+		}
 
-	return SVC_RateLimit( bucket, burst, period );
+		Com_Printf( "%-8s %i packets on %i threads in %.1f msec, %.1f ns per packet, %i limited\n",
+			modes[ bench.mode ], bench.packets * bench.jobs, threads, usec / 1000.0,
+			usec * 1000.0 / ( bench.packets * bench.jobs ), limited );
+	}
+
+	Z_Free( buffer );
+}
+
+/*
+================
+SV_FilterPacket
+
+Called by the net_recvThreads receive threads before a packet is queued
+for the server frame, returns qtrue to drop it.  Connectionless commands
+that SVC_RateLimitAddress would refuse anyway are dropped here, so a flood
+of them never reaches the main thread.  Everything else is left to
+SV_PacketEvent
+================
+*/
+qboolean SV_FilterPacket( const netadr_t *from, const byte *data, int length ) {
+	static const char	*limited[] = { "getstatus", "getinfo", "getchallenge", "rcon" };
+	const char			*s, *end;
+	int					i, len;
+
+	if ( length < 4 ) {
+		return qtrue;
+	}
+
+	if ( *(const int *)data != -1 ) {
+		return qfalse;
+	}
+
+	s = (const char *)data + 4;
+	end = (const char *)data + length;
+	while ( s < end && *s > 0 && *s <= ' ' ) {
+		s++;
+	}
+
+	for ( i = 0; i < ARRAY_LEN( limited ); i++ ) {
+		len = strlen( limited[i] );
+
+		if ( end - s >= len && !Q_stricmpn( s, limited[i], len ) &&
+			( end - s == len || (unsigned char)s[len] <= ' ' ) ) {
+			// the limit all of these commands check first
+			return SVC_AddressOverLimit( *from, 10, 1000 );
+		}
+	}
+
+	return qfalse;
 }
 
 /*
@@ -827,10 +1138,10 @@ static void SV_ConnectionlessPacket( netadr_t from, msg_t *msg ) {
 
 /*
 =================
-SV_PacketEvent
+SV_ProcessPacket
 =================
 */
-void SV_PacketEvent( netadr_t from, msg_t *msg ) {
+static void SV_ProcessPacket( netadr_t from, msg_t *msg ) {
 	int			i;
 	client_t	*cl;
 	int			qport;
@@ -883,6 +1194,19 @@ void SV_PacketEvent( netadr_t from, msg_t *msg ) {
 	}
 }
 
+/*
+=================
+SV_PacketEvent
+=================
+*/
+void SV_PacketEvent( netadr_t from, msg_t *msg ) {
+	int64_t		start;
+
+	start = SV_ProfileTime();
+	SV_ProcessPacket( from, msg );
+	SV_ProfileAdd( PROF_PACKETS, start );
+}
+
 
 /*
 ===================
@@ -1033,7 +1357,7 @@ int SV_FrameMsec()
 	{
 		int frameMsec;
 		
-		frameMsec = 1000.0f / sv_fps->value;
+		frameMsec = (sv.frameUsecResidual + (int)(1000000.0f / sv_fps->value)) / 1000;
 		
 		if(frameMsec < sv.timeResidual)
 			return 0;
@@ -1044,6 +1368,283 @@ int SV_FrameMsec()
 		return 1;
 }
 
+/*
+===============================================================================
+
+PROFILER
+
+"sv_profile start" times the phases of every server frame in microseconds
+and keeps a histogram of each, "sv_profile" prints their percentiles and how
+many frames took longer than the sv_fps budget.  Phases that happen several
+times in a frame, like packets and sends, are summed over the frame.  The
+histograms have 16 buckets for every power of two, so a percentile is
+reported within about 6%.
+
+===============================================================================
+*/
+
+#define	PROFILE_SUB_BITS	4
+#define	PROFILE_BUCKETS		( ( 31 - PROFILE_SUB_BITS + 1 ) << PROFILE_SUB_BITS )
+
+typedef struct {
+	int			counts[PROFILE_BUCKETS];
+	int			numSamples;
+	int64_t		total;
+	int			max;
+} profileHistogram_t;
+
+static const char *profilePhaseNames[PROF_NUMPHASES] = {
+	"packets",
+	"bots",
+	"game",
+	"snapbuild",
+	"snapencode",
+	"send",
+	"frame"
+};
+
+qboolean					sv_profiling;
+static profileHistogram_t	profileHistograms[PROF_NUMPHASES];
+static int64_t				profileFrame[PROF_NUMPHASES];	// this frame so far
+static int					profileOverruns;
+static fileHandle_t			profileLog;
+
+/*
+==================
+SV_ProfileTime
+
+Returns the time to pass to SV_ProfileAdd, or 0 when not profiling
+==================
+*/
+int64_t SV_ProfileTime( void ) {
+	return sv_profiling ? Sys_Microseconds() : 0;
+}
+
+/*
+==================
+SV_ProfileAdd
+
+Adds the time since start to the phase for this frame
+==================
+*/
+void SV_ProfileAdd( profilePhase_t phase, int64_t start ) {
+	if ( !sv_profiling || !start ) {
+		return;
+	}
+	profileFrame[phase] += Sys_Microseconds() - start;
+}
+
+/*
+==================
+SV_ProfileBucket
+==================
+*/
+static int SV_ProfileBucket( int usec ) {
+	int		bits;
+
+	if ( usec < ( 1 << PROFILE_SUB_BITS ) ) {
+		return usec < 0 ? 0 : usec;
+	}
+
+	for ( bits = PROFILE_SUB_BITS ; bits < 30 && usec >= ( 2 << bits ) ; bits++ ) {
+	}
+
+	return ( ( bits - PROFILE_SUB_BITS + 1 ) << PROFILE_SUB_BITS )
+		+ ( ( usec >> ( bits - PROFILE_SUB_BITS ) ) & ( ( 1 << PROFILE_SUB_BITS ) - 1 ) );
+}
+
+/*
+==================
+SV_ProfileBucketMax
+
+Largest time that goes in the bucket
+==================
+*/
+static int SV_ProfileBucketMax( int bucket ) {
+	int		shift;
+	int64_t	low;
+
+	if ( bucket < ( 1 << PROFILE_SUB_BITS ) ) {
+		return bucket;
+	}
+
+	shift = ( bucket >> PROFILE_SUB_BITS ) - 1;
+	low = (int64_t)( ( 1 << PROFILE_SUB_BITS ) + ( bucket & ( ( 1 << PROFILE_SUB_BITS ) - 1 ) ) ) << shift;
+
+	return MIN( low + ( ( 1 << shift ) - 1 ), INT_MAX );
+}
+
+/*
+==================
+SV_ProfilePercentile
+==================
+*/
+static int SV_ProfilePercentile( const profileHistogram_t *h, float fraction ) {
+	int		i, target, count;
+
+	if ( !h->numSamples ) {
+		return 0;
+	}
+
+	target = ceil( h->numSamples * fraction );
+	if ( target < 1 ) {
+		target = 1;
+	}
+
+	count = 0;
+	for ( i = 0 ; i < PROFILE_BUCKETS ; i++ ) {
+		count += h->counts[i];
+		if ( count >= target ) {
+			break;
+		}
+	}
+
+	// the top bucket can't go past the largest sample
+	return MIN( SV_ProfileBucketMax( i ), h->max );
+}
+
+/*
+==================
+SV_ProfileReset
+==================
+*/
+static void SV_ProfileReset( void ) {
+	Com_Memset( profileHistograms, 0, sizeof( profileHistograms ) );
+	Com_Memset( profileFrame, 0, sizeof( profileFrame ) );
+	profileOverruns = 0;
+}
+
+/*
+==================
+SV_ProfileCloseLog
+==================
+*/
+static void SV_ProfileCloseLog( void ) {
+	if ( profileLog ) {
+		FS_FCloseFile( profileLog );
+		profileLog = 0;
+	}
+}
+
+/*
+==================
+SV_ProfileFrame
+
+Moves the times of this frame into the histograms
+==================
+*/
+static void SV_ProfileFrame( int frameMsec ) {
+	profileHistogram_t	*h;
+	int		i, usec;
+
+	// packets come in before SV_Frame
+	profileFrame[PROF_FRAME] += profileFrame[PROF_PACKETS];
+
+	for ( i = 0 ; i < PROF_NUMPHASES ; i++ ) {
+		usec = profileFrame[i] > INT_MAX ? INT_MAX : profileFrame[i];
+		h = &profileHistograms[i];
+		h->counts[SV_ProfileBucket( usec )]++;
+		h->numSamples++;
+		h->total += usec;
+		if ( usec > h->max ) {
+			h->max = usec;
+		}
+	}
+
+	if ( profileFrame[PROF_FRAME] > frameMsec * 1000 ) {
+		profileOverruns++;
+	}
+
+	if ( profileLog ) {
+		FS_Printf( profileLog, "%i,%i", sv.time, frameMsec * 1000 );
+		for ( i = 0 ; i < PROF_NUMPHASES ; i++ ) {
+			FS_Printf( profileLog, ",%i", (int)profileFrame[i] );
+		}
+		FS_Printf( profileLog, "\n" );
+	}
+
+	Com_Memset( profileFrame, 0, sizeof( profileFrame ) );
+}
+
+/*
+==================
+SV_ProfileShutdown
+==================
+*/
+void SV_ProfileShutdown( void ) {
+	sv_profiling = qfalse;
+	SV_ProfileCloseLog();
+}
+
+/*
+==================
+SV_Profile_f
+
+sv_profile [start | stop | reset | csv [file]]
+==================
+*/
+void SV_Profile_f( void ) {
+	const profileHistogram_t	*h;
+	const char	*cmd;
+	char		filename[MAX_QPATH];
+	int			i;
+
+	cmd = Cmd_Argv( 1 );
+
+	if ( !Q_stricmp( cmd, "start" ) ) {
+		SV_ProfileReset();
+		sv_profiling = qtrue;
+		return;
+	}
+	if ( !Q_stricmp( cmd, "stop" ) ) {
+		SV_ProfileShutdown();
+		return;
+	}
+	if ( !Q_stricmp( cmd, "reset" ) ) {
+		SV_ProfileReset();
+		return;
+	}
+	if ( !Q_stricmp( cmd, "csv" ) ) {
+		SV_ProfileCloseLog();
+		if ( Cmd_Argc() < 3 ) {
+			return;
+		}
+		Q_strncpyz( filename, Cmd_Argv( 2 ), sizeof( filename ) );
+		COM_DefaultExtension( filename, sizeof( filename ), ".csv" );
+		profileLog = FS_FOpenFileWrite( filename );
+		if ( !profileLog ) {
+			Com_Printf( "Couldn't open %s\n", filename );
+			return;
+		}
+		FS_Printf( profileLog, "time,budget" );
+		for ( i = 0 ; i < PROF_NUMPHASES ; i++ ) {
+			FS_Printf( profileLog, ",%s", profilePhaseNames[i] );
+		}
+		FS_Printf( profileLog, "\n" );
+		if ( !sv_profiling ) {
+			SV_ProfileReset();
+			sv_profiling = qtrue;
+		}
+		Com_Printf( "Logging server frame times to %s\n", filename );
+		return;
+	}
+	if ( *cmd ) {
+		Com_Printf( "usage: sv_profile [start | stop | reset | csv [file]]\n" );
+		return;
+	}
+
+	Com_Printf( "profiling is %s%s\n", sv_profiling ? "on" : "off", profileLog ? ", logging to csv" : "" );
+	Com_Printf( "phase        samples      p50      p99      max     mean (usec)\n" );
+	for ( i = 0 ; i < PROF_NUMPHASES ; i++ ) {
+		h = &profileHistograms[i];
+		Com_Printf( "%-10s %9i %8i %8i %8i %8i\n", profilePhaseNames[i], h->numSamples,
+			SV_ProfilePercentile( h, 0.5f ), SV_ProfilePercentile( h, 0.99f ), h->max,
+			h->numSamples ? (int)( h->total / h->numSamples ) : 0 );
+	}
+	h = &profileHistograms[PROF_FRAME];
+	Com_Printf( "%i of %i frames over the frame budget\n", profileOverruns, h->numSamples );
+}
+
 /*
 ==================
 SV_Frame
@@ -1054,7 +1655,10 @@ happen before SV_Frame is called
 */
 void SV_Frame( int msec ) {
 	int		frameMsec;
+	int		frameUsec;
 	int		startTime;
+	int		numFrames;
+	int64_t	frameStart, profileStart;
 
 	// the menu kills the server with this cvar
 	if ( sv_killserver->integer ) {
@@ -1084,17 +1688,27 @@ void SV_Frame( int msec ) {
 		Cvar_Set( "sv_fps", "10" );
 	}
 
-	frameMsec = 1000 / sv_fps->integer * com_timescale->value;
+	frameUsec = 1000000 / sv_fps->integer * com_timescale->value;
 	// don't let it scale below 1ms
-	if(frameMsec < 1)
+	if(frameUsec < 1000)
 	{
 		Cvar_Set("timescale", va("%f", sv_fps->integer / 1000.0f));
-		frameMsec = 1;
+		frameUsec = 1000;
 	}
 
+	// 1000000 / sv_fps is rarely whole milliseconds, so some frames are a
+	// millisecond longer to keep sv.time at the exact rate on average
+	frameMsec = (sv.frameUsecResidual + frameUsec) / 1000;
+
 	sv.timeResidual += msec;
 
-	if (!com_dedicated->integer) SV_BotFrame (sv.time + sv.timeResidual);
+	frameStart = SV_ProfileTime();
+
+	if (!com_dedicated->integer) {
+		profileStart = SV_ProfileTime();
+		SV_BotFrame (sv.time + sv.timeResidual);
+		SV_ProfileAdd( PROF_BOTS, profileStart );
+	}
 
 	// if time is about to hit the 32nd bit, kick all clients
 	// and clear sv.time, rather
@@ -1137,17 +1751,29 @@ void SV_Frame( int msec ) {
 	// update ping based on the all received frames
 	SV_CalcPings();
 
-	if (com_dedicated->integer) SV_BotFrame (sv.time);
+	if (com_dedicated->integer) {
+		profileStart = SV_ProfileTime();
+		SV_BotFrame (sv.time);
+		SV_ProfileAdd( PROF_BOTS, profileStart );
+	}
 
 	// run the game simulation in chunks
+	numFrames = 0;
+	profileStart = SV_ProfileTime();
 	while ( sv.timeResidual >= frameMsec ) {
 		sv.timeResidual -= frameMsec;
 		svs.time += frameMsec;
 		sv.time += frameMsec;
+		sv.frameUsecResidual += frameUsec - frameMsec * 1000;
+		frameMsec = (sv.frameUsecResidual + frameUsec) / 1000;
 
 		// let everything in the world think and move
+		SV_TraceCacheNewFrame();
 		VM_Call (gvm, GAME_RUN_FRAME, sv.time);
+		SV_DemoFrame();
+		numFrames++;
 	}
+	SV_ProfileAdd( PROF_GAME, profileStart );
 
 	if ( com_speeds->integer ) {
 		time_game = Sys_Milliseconds () - startTime;
@@ -1161,6 +1787,13 @@ void SV_Frame( int msec ) {
 
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat(HEARTBEAT_FOR_MASTER);
+
+	// a listen server runs this more often than it runs frames,
+	// so the times add up until there was one
+	SV_ProfileAdd( PROF_FRAME, frameStart );
+	if ( sv_profiling && numFrames ) {
+		SV_ProfileFrame( frameMsec );
+	}
 }
 
 /*
@@ -195,14 +195,20 @@ Return number of ms until next message can be sent based on throughput given by
 
 int SV_Netchan_TransmitNextFragment(client_t *client)
 {
+	int64_t start;
+
 	if(client->netchan.unsentFragments)
 	{
+		start = SV_ProfileTime();
 		Netchan_TransmitNextFragment(&client->netchan);
+		SV_ProfileAdd(PROF_SEND, start);
 		return SV_RateMsec(client);
 	}
 	else if(client->netchan_start_queue)
 	{
+		start = SV_ProfileTime();
 		SV_Netchan_TransmitNextInQueue(client);
+		SV_ProfileAdd(PROF_SEND, start);
 		return SV_RateMsec(client);
 	}
 	
@@ -246,11 +252,14 @@ void SV_Netchan_Transmit( client_t *client, msg_t *msg)
 	}
 	else
 	{
+		int64_t start = SV_ProfileTime();
+
 #ifdef LEGACY_PROTOCOL
 		if(client->compat)
 			SV_Netchan_Encode(client, msg, client->lastClientCommandString);
 #endif
 		Netchan_Transmit( &client->netchan, msg->cursize, msg->data );
+		SV_ProfileAdd(PROF_SEND, start);
 	}
 }
 
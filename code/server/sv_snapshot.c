@@ -45,6 +45,144 @@ A normal server packet will look like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+DELTA CACHE
+
+With sv_deltaCache 1, the encoded delta of an entity between two server
+frames is kept for the rest of the frame, so the other clients that delta
+from the same frame get a copy of its bits instead of encoding it again.
+The entries are keyed on the entity number and the time the older frame was
+stored at, and also hold both states, so a different delta with the same key
+is never mistaken for it.  Snapshots encoded on job threads share the cache,
+an entry being filled by another thread is just skipped.
+
+=============================================================================
+*/
+
+#define	DELTA_CACHE_SIZE	4096		// must be a power of two
+#define DELTA_CACHE_BYTES	128			// longer deltas are encoded every time
+
+#define DELTA_CLAIMED		1			// low bits of the tag
+#define DELTA_READY			2
+
+typedef struct {
+	volatile uint64_t	tag;			// generation << 2 | DELTA_CLAIMED or DELTA_READY
+	int				fromTime;			// entityTime of the older frame, -1 for the baseline
+	qboolean		force;
+	entityState_t	from, to;
+	int				bits;				// -1 if the delta didn't fit
+	byte			data[DELTA_CACHE_BYTES];
+} deltaCacheEntry_t;
+
+static deltaCacheEntry_t	sv_deltaEntries[DELTA_CACHE_SIZE];
+static int			sv_deltaGeneration = 1;
+static int			sv_deltaHits, sv_deltaMisses, sv_deltaUnchanged;
+
+/*
+================
+SV_DeltaCacheNewFrame
+
+Entries only live for one round of snapshots
+================
+*/
+static void SV_DeltaCacheNewFrame( void ) {
+	sv_deltaGeneration++;
+	if ( sv_deltaGeneration <= 0 ) {
+		// wrapped around, so old entries could look valid again
+		Com_Memset( sv_deltaEntries, 0, sizeof( sv_deltaEntries ) );
+		sv_deltaGeneration = 1;
+	}
+}
+
+/*
+================
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity through the delta cache, safe to call from several
+job threads at once
+================
+*/
+static void SV_WriteDeltaEntity( msg_t *msg, int fromTime, entityState_t *from, entityState_t *to, qboolean force ) {
+	deltaCacheEntry_t	*entry;
+	uint64_t			tag, current;
+	unsigned int		hash;
+	msg_t				delta;
+
+	if ( !sv_deltaCache->integer ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	// all fields are 32 bits, so this is the same test MSG_WriteDeltaEntity makes
+	if ( !force && !memcmp( from, to, sizeof( *to ) ) ) {
+		Com_AtomicIncrement( &sv_deltaUnchanged );
+		return;
+	}
+
+	hash = (unsigned int)to->number * 2654435761U ^ (unsigned int)fromTime * 40503U;
+	hash ^= hash >> 15;
+	entry = &sv_deltaEntries[hash & ( DELTA_CACHE_SIZE - 1 )];
+
+	current = (uint64_t)sv_deltaGeneration << 2;
+	tag = Com_AtomicLoad64( &entry->tag );
+
+	if ( tag == ( current | DELTA_READY ) ) {
+		if ( entry->bits >= 0 && entry->fromTime == fromTime && entry->force == force &&
+			!memcmp( &entry->to, to, sizeof( *to ) ) && !memcmp( &entry->from, from, sizeof( *from ) ) ) {
+			Com_AtomicIncrement( &sv_deltaHits );
+			MSG_WriteBitstream( msg, entry->data, entry->bits );
+			return;
+		}
+	} else if ( ( tag & ~(uint64_t)3 ) != current &&
+		Com_AtomicCompareSwap64( &entry->tag, tag, current | DELTA_CLAIMED ) ) {
+		// an entry from an earlier frame, encode into it for the next clients
+		entry->fromTime = fromTime;
+		entry->force = force;
+		entry->from = *from;
+		entry->to = *to;
+
+		MSG_Init( &delta, entry->data, sizeof( entry->data ) );
+		MSG_WriteDeltaEntity( &delta, from, to, force );
+		entry->bits = delta.overflowed ? -1 : delta.bit;
+
+		Com_AtomicCompareSwap64( &entry->tag, current | DELTA_CLAIMED, current | DELTA_READY );
+
+		if ( entry->bits >= 0 ) {
+			Com_AtomicIncrement( &sv_deltaMisses );
+			MSG_WriteBitstream( msg, entry->data, entry->bits );
+			return;
+		}
+	}
+
+	Com_AtomicIncrement( &sv_deltaMisses );
+	MSG_WriteDeltaEntity( msg, from, to, force );
+}
+
+/*
+================
+SV_DeltaCache_f
+
+Prints the delta cache counters, "deltacache reset" clears them
+================
+*/
+void SV_DeltaCache_f( void ) {
+	int		total;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		sv_deltaHits = sv_deltaMisses = sv_deltaUnchanged = 0;
+		return;
+	}
+
+	total = sv_deltaHits + sv_deltaMisses;
+	Com_Printf( "delta cache is %s\n", sv_deltaCache->integer ? "on" : "off" );
+	Com_Printf( "%i hits, %i misses (%.1f%% hit rate), %i unchanged\n",
+		sv_deltaHits, sv_deltaMisses, total ? 100.0f * sv_deltaHits / total : 0.0f,
+		sv_deltaUnchanged );
+}
+
+
 /*
 =============
 SV_EmitPacketEntities
@@ -88,7 +226,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emitted if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			SV_WriteDeltaEntity (msg, from->entityTime, oldent, newent, qfalse );
 			oldindex++;
 			newindex++;
 			continue;
@@ -96,7 +234,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			SV_WriteDeltaEntity (msg, -1, &sv.svEntities[newnum].baseline, newent, qtrue );
 			newindex++;
 			continue;
 		}
@@ -116,42 +254,56 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_SnapshotDeltaFrame
+
+Picks the previous frame to delta compress the snapshot being created against,
+or NULL if it has to be sent uncompressed.  The snapshot entities of this frame
+must already have been stored.
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
-	int					lastframe;
-	int					i;
-	int					snapFlags;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+static clientSnapshot_t *SV_SnapshotDeltaFrame( client_t *client, int *lastframe ) {
+	clientSnapshot_t	*oldframe;
 
 	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
 		// client is asking for a retransmit
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else if ( client->netchan.outgoingSequence - client->deltaMessage 
 		>= (PACKET_BACKUP - 3) ) {
 		// client hasn't gotten a good message through in a long time
 		Com_DPrintf ("%s: Delta request from out of date packet.\n", client->name);
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else {
 		// we have a valid snapshot to delta from
 		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+		*lastframe = client->netchan.outgoingSequence - client->deltaMessage;
 
 		// the snapshot's entities may still have rolled off the buffer, though
 		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
 			Com_DPrintf ("%s: Delta request from out of date entities.\n", client->name);
 			oldframe = NULL;
-			lastframe = 0;
+			*lastframe = 0;
 		}
 	}
 
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+static void SV_WriteSnapshotToClient( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg ) {
+	clientSnapshot_t	*frame;
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -238,8 +390,14 @@ Build a client snapshot structure
 typedef struct {
 	int		numSnapshotEntities;
 	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];	
+	byte	added[MAX_GENTITIES/8];	// used to prevent double adding from portal views
+	char	*error;					// Com_Error can't be called from a job thread
+	qboolean	linearScan;			// check every entity instead of the visible clusters
 } snapshotEntityNumbers_t;
 
+// linked SVF_BROADCAST entities, which have to be checked wherever they are
+static unsigned int	broadcastEntities[MAX_GENTITIES/32];
+
 /*
 =======================
 SV_QsortEntityNumbers
@@ -268,12 +426,14 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddEntToSnapshot( sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+	int		e = gEnt->s.number;
+
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	if ( eNums->added[e >> 3] & ( 1 << ( e & 7 ) ) ) {
 		return;
 	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[e >> 3] |= 1 << ( e & 7 );
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
@@ -284,6 +444,79 @@ static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapsh
 	eNums->numSnapshotEntities++;
 }
 
+/*
+===============
+SV_PrepareSnapshotEntities
+
+Must be called on the main thread before building any snapshots
+after the game has run
+===============
+*/
+static void SV_PrepareSnapshotEntities( void ) {
+	sharedEntity_t	*ent;
+	int				e;
+
+	Com_Memset( broadcastEntities, 0, sizeof( broadcastEntities ) );
+
+	// nothing is added after the server has shut down
+	if ( !sv.state ) {
+		return;
+	}
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum(e);
+
+		if ( !ent->r.linked ) {
+			continue;
+		}
+
+		if (ent->s.number != e) {
+			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
+			ent->s.number = e;
+		}
+
+		if ( ent->r.svFlags & SVF_BROADCAST ) {
+			broadcastEntities[e >> 5] |= 1U << ( e & 31 );
+		}
+	}
+}
+
+/*
+===============
+SV_FindCandidateEntities
+
+Sets a bit for every entity that is either broadcast or linked
+into one of the clusters in the pvs
+===============
+*/
+static void SV_FindCandidateEntities( const byte *pvs, unsigned int *candidates ) {
+	clusterLink_t	*head, *link;
+	int				c;
+
+	Com_Memcpy( candidates, broadcastEntities, sizeof( broadcastEntities ) );
+
+	for ( c = 0 ; c < sv.numClusters ; c++ ) {
+		if ( !pvs[c >> 3] ) {
+			c |= 7;
+			continue;
+		}
+		if ( !( pvs[c >> 3] & ( 1 << ( c & 7 ) ) ) ) {
+			continue;
+		}
+
+		head = &sv.clusterEntities[c];
+		for ( link = head->next ; link != head ; link = link->next ) {
+			candidates[link->entityNum >> 5] |= 1U << ( link->entityNum & 31 );
+		}
+	}
+
+	// the overflow list is always checked
+	head = &sv.clusterEntities[sv.numClusters];
+	for ( link = head->next ; link != head ; link = link->next ) {
+		candidates[link->entityNum >> 5] |= 1U << ( link->entityNum & 31 );
+	}
+}
+
 /*
 ===============
 SV_AddEntitiesVisibleFromPoint
@@ -299,6 +532,7 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 	int		leafnum;
 	byte	*clientpvs;
 	byte	*bitvector;
+	unsigned int	candidates[MAX_GENTITIES/32];
 
 	// during an error shutdown message we may need to transmit
 	// the shutdown message after the server has shutdown, so
@@ -316,7 +550,22 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 
 	clientpvs = CM_ClusterPVS (clientcluster);
 
+	// only entities in visible clusters can pass the PVS test below
+	if ( !eNums->linearScan ) {
+		SV_FindCandidateEntities( clientpvs, candidates );
+	}
+
 	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		if ( !eNums->linearScan ) {
+			if ( !candidates[e >> 5] ) {
+				e |= 31;
+				continue;
+			}
+			if ( !( candidates[e >> 5] & ( 1U << ( e & 31 ) ) ) ) {
+				continue;
+			}
+		}
+
 		ent = SV_GentityNum(e);
 
 		// never send entities that aren't linked in
@@ -324,11 +573,6 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			continue;
 		}
 
-		if (ent->s.number != e) {
-			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
-		}
-
 		// entities can be flagged to explicitly not be sent to the client
 		if ( ent->r.svFlags & SVF_NOCLIENT ) {
 			continue;
@@ -348,22 +592,24 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 		}
 		// entities can be flagged to be sent to a given mask of clients
 		if ( ent->r.svFlags & SVF_CLIENTMASK ) {
-			if (frame->ps.clientNum >= 32)
-				Com_Error( ERR_DROP, "SVF_CLIENTMASK: clientNum >= 32" );
+			if (frame->ps.clientNum >= 32) {
+				eNums->error = "SVF_CLIENTMASK: clientNum >= 32";
+				return;
+			}
 			if (~ent->r.singleClient & (1 << frame->ps.clientNum))
 				continue;
 		}
 
-		svEnt = SV_SvEntityForGentity( ent );
-
 		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+		if ( eNums->added[e >> 3] & ( 1 << ( e & 7 ) ) ) {
 			continue;
 		}
 
+		svEnt = &sv.svEntities[e];
+
 		// broadcast entities are always sent
 		if ( ent->r.svFlags & SVF_BROADCAST ) {
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
+			SV_AddEntToSnapshot( ent, eNums );
 			continue;
 		}
 
@@ -409,7 +655,7 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 		}
 
 		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+		SV_AddEntToSnapshot( ent, eNums );
 
 		// if it's a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL ) {
@@ -421,6 +667,9 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 				}
 			}
 			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, qtrue );
+			if ( eNums->error ) {
+				return;
+			}
 		}
 
 	}
@@ -428,37 +677,36 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 
 /*
 =============
-SV_BuildClientSnapshot
+SV_BuildSnapshotEntityNumbers
 
 Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
+copies off the playerstate and areabits.  Returns qfalse if the client
+has no entity to build a snapshot for.
 
 This properly handles multiple recursive portals, but the render
 currently doesn't.
 
 For viewing through other player's eyes, clent can be something other than client->gentity
+
+This may run on a job thread, so errors are returned in eNums->error
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static qboolean SV_BuildSnapshotEntityNumbers( client_t *client, snapshotEntityNumbers_t *eNums ) {
 	vec3_t						org;
 	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
 	int							i;
-	sharedEntity_t				*ent;
-	entityState_t				*state;
-	svEntity_t					*svEnt;
 	sharedEntity_t				*clent;
 	int							clientNum;
 	playerState_t				*ps;
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
-
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
+	eNums->numSnapshotEntities = 0;
+	eNums->error = NULL;
+	eNums->linearScan = qfalse;
+	Com_Memset( eNums->added, 0, sizeof( eNums->added ) );
 	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
 
   // https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=62
@@ -466,7 +714,7 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	
 	clent = client->gentity;
 	if ( !clent || client->state == CS_ZOMBIE ) {
-		return;
+		return qfalse;
 	}
 
 	// grab the current playerState_t
@@ -477,11 +725,10 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// be regenerated from the playerstate
 	clientNum = frame->ps.clientNum;
 	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
-		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
+		eNums->error = "SV_SvEntityForGentity: bad gEnt";
+		return qfalse;
 	}
-	svEnt = &sv.svEntities[ clientNum ];
-
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[clientNum >> 3] |= 1 << ( clientNum & 7 );
 
 	// find the client's viewpoint
 	VectorCopy( ps->origin, org );
@@ -489,14 +736,17 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
+	SV_AddEntitiesVisibleFromPoint( org, frame, eNums, qfalse );
+	if ( eNums->error ) {
+		return qfalse;
+	}
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities, 
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
+	qsort( eNums->snapshotEntities, eNums->numSnapshotEntities, 
+		sizeof( eNums->snapshotEntities[0] ), SV_QsortEntityNumbers );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
@@ -504,11 +754,30 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		((int *)frame->areabits)[i] = ((int *)frame->areabits)[i] ^ -1;
 	}
 
+	return qtrue;
+}
+
+/*
+=============
+SV_StoreSnapshotEntities
+
+Copies the entity states out into the circular svs.snapshotEntities
+=============
+*/
+static void SV_StoreSnapshotEntities( client_t *client, snapshotEntityNumbers_t *eNums ) {
+	clientSnapshot_t			*frame;
+	int							i;
+	sharedEntity_t				*ent;
+	entityState_t				*state;
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	// copy the entity states out
 	frame->num_entities = 0;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
+	frame->entityTime = svs.time;
+	for ( i = 0 ; i < eNums->numSnapshotEntities ; i++ ) {
+		ent = SV_GentityNum(eNums->snapshotEntities[i]);
 		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
 		*state = ent->s;
 		svs.nextSnapshotEntities++;
@@ -520,6 +789,120 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	}
 }
 
+/*
+=============
+SV_BuildClientSnapshot
+=============
+*/
+static void SV_BuildClientSnapshot( client_t *client ) {
+	snapshotEntityNumbers_t		entityNumbers;
+
+	if ( SV_BuildSnapshotEntityNumbers( client, &entityNumbers ) ) {
+		SV_StoreSnapshotEntities( client, &entityNumbers );
+	} else if ( entityNumbers.error ) {
+		Com_Error( ERR_DROP, "%s", entityNumbers.error );
+	}
+}
+
+/*
+=============
+SV_SnapshotCullBench_f
+
+Times finding the visible entities for every active client with
+the cluster lists against checking every entity, and makes
+sure both find the same ones
+=============
+*/
+void SV_SnapshotCullBench_f( void ) {
+	static snapshotEntityNumbers_t	linear, indexed;
+	clientSnapshot_t	frame;
+	client_t			*client;
+	playerState_t		*ps;
+	vec3_t				org;
+	int					i, j, iterations, views;
+	int					linearMsec, indexedMsec, start;
+	int					numEntities, mismatches;
+
+	if ( !com_sv_running->integer || sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	iterations = 100;
+	if ( Cmd_Argc() > 1 ) {
+		iterations = atoi( Cmd_Argv( 1 ) );
+		if ( iterations < 1 ) {
+			iterations = 1;
+		}
+	}
+
+	SV_PrepareSnapshotEntities();
+
+	linearMsec = indexedMsec = 0;
+	views = numEntities = mismatches = 0;
+
+	for ( i = 0, client = svs.clients ; i < sv_maxclients->integer ; i++, client++ ) {
+		if ( client->state != CS_ACTIVE || !client->gentity ) {
+			continue;
+		}
+
+		// same viewpoint as SV_BuildSnapshotEntityNumbers, but into
+		// a scratch frame so the client's snapshots are not touched
+		ps = SV_GameClientNum( i );
+		Com_Memset( &frame, 0, sizeof( frame ) );
+		frame.ps = *ps;
+		if ( frame.ps.clientNum < 0 || frame.ps.clientNum >= MAX_GENTITIES ) {
+			continue;
+		}
+		VectorCopy( ps->origin, org );
+		org[2] += ps->viewheight;
+
+		start = Sys_Milliseconds();
+		for ( j = 0 ; j < iterations ; j++ ) {
+			Com_Memset( &linear, 0, sizeof( linear ) );
+			linear.linearScan = qtrue;
+			linear.added[frame.ps.clientNum >> 3] |= 1 << ( frame.ps.clientNum & 7 );
+			SV_AddEntitiesVisibleFromPoint( org, &frame, &linear, qfalse );
+		}
+		linearMsec += Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		for ( j = 0 ; j < iterations ; j++ ) {
+			Com_Memset( &indexed, 0, sizeof( indexed ) );
+			indexed.added[frame.ps.clientNum >> 3] |= 1 << ( frame.ps.clientNum & 7 );
+			SV_AddEntitiesVisibleFromPoint( org, &frame, &indexed, qfalse );
+		}
+		indexedMsec += Sys_Milliseconds() - start;
+
+		if ( linear.error || indexed.error ) {
+			Com_Printf( "%s: %s\n", client->name, linear.error ? linear.error : indexed.error );
+			continue;
+		}
+
+		views++;
+		numEntities += linear.numSnapshotEntities;
+		if ( linear.numSnapshotEntities != indexed.numSnapshotEntities ||
+			memcmp( linear.snapshotEntities, indexed.snapshotEntities,
+				linear.numSnapshotEntities * sizeof( linear.snapshotEntities[0] ) ) ) {
+			Com_Printf( "MISMATCH: %s\n", client->name );
+			mismatches++;
+		}
+	}
+
+	if ( !views ) {
+		Com_Printf( "No active clients.\n" );
+		return;
+	}
+
+	Com_Printf( "%i views x %i iterations, %i entities avg, %i linked in %i clusters\n",
+		views, iterations, numEntities / views, sv.num_entities, sv.numClusters );
+	Com_Printf( "linear scan:   %5i msec\n", linearMsec );
+	Com_Printf( "cluster lists: %5i msec\n", indexedMsec );
+	if ( mismatches ) {
+		Com_Printf( "%i mismatches\n", mismatches );
+	}
+}
+
 #ifdef USE_VOIP
 /*
 ==================
@@ -588,50 +971,267 @@ void SV_SendMessageToClient(msg_t *msg, client_t *client)
 
 /*
 =======================
-SV_SendClientSnapshot
+SV_WriteSnapshotMessage
 
-Also called by SV_FinalMessage
+Writes everything but the VoIP data of a snapshot message,
+may run on a job thread
+=======================
+*/
+static void SV_WriteSnapshotMessage( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg ) {
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
 
+	// send over all the relevant entityState_t
+	// and the playerState_t
+	SV_WriteSnapshotToClient( client, oldframe, lastframe, msg );
+}
+
+/*
+=======================
+SV_FinishSnapshotMessage
 =======================
 */
-void SV_SendClientSnapshot( client_t *client ) {
+static void SV_FinishSnapshotMessage( client_t *client, msg_t *msg ) {
+#ifdef USE_VOIP
+	SV_WriteVoipToClient( client, msg );
+#endif
+
+	// check for overflow
+	if ( msg->overflowed ) {
+		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
+		MSG_Clear (msg);
+	}
+
+	SV_SendMessageToClient( msg, client );
+}
+
+
+// com_speeds times summed over all the snapshots of the frame.  A single
+// client's snapshot takes well under a millisecond, so they are summed in
+// microseconds and only the totals are rounded.
+static int64_t	snapBuildUsec, snapEncodeUsec, snapSendUsec;
+
+/*
+=======================
+SV_SnapshotSpeeds
+=======================
+*/
+static void SV_SnapshotSpeeds( int64_t build, int64_t encode, int64_t send ) {
+	snapBuildUsec += build;
+	snapEncodeUsec += encode;
+	snapSendUsec += send;
+
+	time_snapBuild = snapBuildUsec / 1000;
+	time_snapEncode = snapEncodeUsec / 1000;
+	time_snapSend = snapSendUsec / 1000;
+}
+
+/*
+=======================
+SV_SendPreparedSnapshot
+
+SV_SendClientSnapshot without SV_PrepareSnapshotEntities, for
+sending to several clients in a row
+=======================
+*/
+static void SV_SendPreparedSnapshot( client_t *client ) {
 	byte		msg_buf[MAX_MSGLEN];
 	msg_t		msg;
+	clientSnapshot_t	*oldframe;
+	int			lastframe;
+	int64_t		t1, t2, t3, t4;
+	int64_t		profileStart;
+
+	t1 = com_speeds->integer ? Sys_Microseconds() : 0;
+	profileStart = SV_ProfileTime();
 
 	// build the snapshot
 	SV_BuildClientSnapshot( client );
 
+	SV_ProfileAdd( PROF_SNAPBUILD, profileStart );
+	t2 = com_speeds->integer ? Sys_Microseconds() : 0;
+
 	// bots need to have their snapshots build, but
 	// the query them directly without needing to be sent
 	if ( client->gentity && client->gentity->r.svFlags & SVF_BOT ) {
+		if ( com_speeds->integer ) {
+			SV_SnapshotSpeeds( t2 - t1, 0, 0 );
+		}
 		return;
 	}
 
+	profileStart = SV_ProfileTime();
+
 	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
 	msg.allowoverflow = qtrue;
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	oldframe = SV_SnapshotDeltaFrame( client, &lastframe );
+	SV_WriteSnapshotMessage( client, oldframe, lastframe, &msg );
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	SV_ProfileAdd( PROF_SNAPENCODE, profileStart );
+	t3 = com_speeds->integer ? Sys_Microseconds() : 0;
 
-	// send over all the relevant entityState_t
-	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+	SV_FinishSnapshotMessage( client, &msg );
 
-#ifdef USE_VOIP
-	SV_WriteVoipToClient( client, &msg );
-#endif
+	if ( com_speeds->integer ) {
+		t4 = Sys_Microseconds();
+		SV_SnapshotSpeeds( t2 - t1, t3 - t2, t4 - t3 );
+	}
+}
 
-	// check for overflow
-	if ( msg.overflowed ) {
-		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		MSG_Clear (&msg);
+/*
+=======================
+SV_SendClientSnapshot
+
+Also called by SV_FinalMessage
+
+=======================
+*/
+void SV_SendClientSnapshot( client_t *client ) {
+	SV_PrepareSnapshotEntities();
+	SV_SendPreparedSnapshot( client );
+}
+
+
+/*
+=============================================================================
+
+Parallel snapshots
+
+With sv_snapshotThreads set, the snapshots of all clients due for one are
+built and encoded on job threads.  Everything that depends on the order
+clients are handled in (the circular svs.snapshotEntities, delta frame
+selection, printing, VoIP and transmitting) is still done on the main thread
+in client order, so the messages are identical to the serial path.
+
+=============================================================================
+*/
+
+typedef struct {
+	client_t				*client;
+	snapshotEntityNumbers_t	entityNumbers;
+	qboolean				built;
+	qboolean				encoded;
+	clientSnapshot_t		*oldframe;
+	int						lastframe;
+	msg_t					msg;
+	byte					msgBuffer[MAX_MSGLEN];
+} snapshotJob_t;
+
+static snapshotJob_t	snapshotJobs[MAX_CLIENTS];
+static snapshotJob_t	*encodeJobs[MAX_CLIENTS];
+
+/*
+=======================
+SV_BuildSnapshotJob
+=======================
+*/
+static void SV_BuildSnapshotJob( void *data, int index ) {
+	snapshotJob_t	*job = &snapshotJobs[index];
+
+	job->built = SV_BuildSnapshotEntityNumbers( job->client, &job->entityNumbers );
+}
+
+/*
+=======================
+SV_EncodeSnapshotJob
+=======================
+*/
+static void SV_EncodeSnapshotJob( void *data, int index ) {
+	snapshotJob_t	*job = encodeJobs[index];
+
+	SV_WriteSnapshotMessage( job->client, job->oldframe, job->lastframe, &job->msg );
+}
+
+/*
+=======================
+SV_SendClientSnapshots
+
+Same as calling SV_SendClientSnapshot for each of the first numJobs entries
+of snapshotJobs, but with building and encoding spread over several threads
+=======================
+*/
+static void SV_SendClientSnapshots( int numJobs ) {
+	snapshotJob_t	*job;
+	client_t		*client;
+	int				i, numEncodes;
+	int				endSnapshotEntities;
+	int64_t			t1, t2, t3;
+	int64_t			profileStart;
+
+	t1 = com_speeds->integer ? Sys_Microseconds() : 0;
+	profileStart = SV_ProfileTime();
+
+	Com_RunJobs( sv_snapshotThreads->integer, SV_BuildSnapshotJob, NULL, numJobs );
+
+	// the first error is the one the serial path would have dropped with
+	endSnapshotEntities = svs.nextSnapshotEntities;
+	for ( i = 0, job = snapshotJobs ; i < numJobs ; i++, job++ ) {
+		if ( job->entityNumbers.error ) {
+			Com_Error( ERR_DROP, "%s", job->entityNumbers.error );
+		}
+		if ( job->built ) {
+			endSnapshotEntities += job->entityNumbers.numSnapshotEntities;
+		}
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	// store the entities and pick the delta frames in client order
+	numEncodes = 0;
+	for ( i = 0, job = snapshotJobs ; i < numJobs ; i++, job++ ) {
+		client = job->client;
+
+		if ( job->built ) {
+			SV_StoreSnapshotEntities( client, &job->entityNumbers );
+		}
+
+		job->encoded = qfalse;
+		if ( client->gentity && client->gentity->r.svFlags & SVF_BOT ) {
+			continue;
+		}
+
+		MSG_Init( &job->msg, job->msgBuffer, sizeof( job->msgBuffer ) );
+		job->msg.allowoverflow = qtrue;
+		job->oldframe = SV_SnapshotDeltaFrame( client, &job->lastframe );
+
+		// if the entities of the delta frame are going to be overwritten
+		// by clients stored after this one, encode it right away
+		if ( job->oldframe && job->oldframe->num_entities &&
+			job->oldframe->first_entity <= endSnapshotEntities - svs.numSnapshotEntities ) {
+			SV_WriteSnapshotMessage( client, job->oldframe, job->lastframe, &job->msg );
+			job->encoded = qtrue;
+			continue;
+		}
+
+		encodeJobs[numEncodes++] = job;
+	}
+
+	SV_ProfileAdd( PROF_SNAPBUILD, profileStart );
+	t2 = com_speeds->integer ? Sys_Microseconds() : 0;
+
+	profileStart = SV_ProfileTime();
+	Com_RunJobs( sv_snapshotThreads->integer, SV_EncodeSnapshotJob, NULL, numEncodes );
+	for ( i = 0 ; i < numEncodes ; i++ ) {
+		encodeJobs[i]->encoded = qtrue;
+	}
+	SV_ProfileAdd( PROF_SNAPENCODE, profileStart );
+
+	t3 = com_speeds->integer ? Sys_Microseconds() : 0;
+
+	for ( i = 0, job = snapshotJobs ; i < numJobs ; i++, job++ ) {
+		if ( job->encoded ) {
+			SV_FinishSnapshotMessage( job->client, &job->msg );
+		}
+		job->client->lastSnapshotTime = svs.time;
+		job->client->rateDelayed = qfalse;
+	}
+
+	if ( com_speeds->integer ) {
+		SV_SnapshotSpeeds( t2 - t1, t3 - t2, Sys_Microseconds() - t3 );
+	}
 }
 
 
@@ -644,6 +1244,23 @@ void SV_SendClientMessages(void)
 {
 	int		i;
 	client_t	*c;
+	int		numJobs;
+	qboolean	prepared;
+
+	if ( com_speeds->integer ) {
+		time_snapBuild = time_snapEncode = time_snapSend = 0;
+		snapBuildUsec = snapEncodeUsec = snapSendUsec = 0;
+	}
+
+	numJobs = 0;
+	prepared = qfalse;
+
+	if ( sv_deltaCache->integer ) {
+		SV_DeltaCacheNewFrame();
+	}
+
+	// with net_mmsg the snapshots go out together at the end
+	NET_BeginSendBatch();
 
 	// send a message to each connected client
 	for(i=0; i < sv_maxclients->integer; i++)
@@ -677,9 +1294,30 @@ void SV_SendClientMessages(void)
 			}
 		}
 
+		if(!prepared)
+		{
+			int64_t profileStart = SV_ProfileTime();
+
+			SV_PrepareSnapshotEntities();
+			SV_ProfileAdd(PROF_SNAPBUILD, profileStart);
+			prepared = qtrue;
+		}
+
+		if(sv_snapshotThreads->integer > 0)
+		{
+			// built, encoded and sent below
+			snapshotJobs[numJobs++].client = c;
+			continue;
+		}
+
 		// generate and send a new message
-		SV_SendClientSnapshot(c);
+		SV_SendPreparedSnapshot(c);
 		c->lastSnapshotTime = svs.time;
 		c->rateDelayed = qfalse;
 	}
+
+	if(numJobs)
+		SV_SendClientSnapshots(numJobs);
+
+	NET_FlushSendBatch();
 }
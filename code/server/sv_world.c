@@ -48,6 +48,216 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
 
 
 
+/*
+===============================================================================
+
+TRACE CACHE
+
+With sv_traceCache 1, SV_Trace remembers its results so that an identical
+query gives back the stored trace.  Bots in particular repeat the same line
+of sight traces many times in a frame.  All entries are dropped at the start
+of every server frame and whenever an entity is linked or unlinked.  That
+happens even while the cache is off, so turning it back on can't revive
+entries from before entities moved.
+
+Game code changes r.contents without relinking, like a gibbed body or a
+picked up item going non solid, so each entry also keeps the contents,
+svFlags and ownerNum of the entities the area query gave the move.  The
+entry is only used while all of them still match.  A move near more than
+TRACE_CACHE_ENTITIES entities isn't stored.  Moving an entity still needs
+a relink, as the area queries wouldn't find it in its new place either.
+
+Trace batches are looked up and stored as well, so a batch issued ahead of
+time, like the bots' line of sight checks for a frame, answers the single
+traces that follow it.
+
+===============================================================================
+*/
+
+#define	TRACE_CACHE_SIZE	4096		// must be a power of two
+#define	TRACE_CACHE_ENTITIES	8		// entities near a move that can be checked on a hit
+
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+} traceKey_t;
+
+typedef struct {
+	int			number;
+	int			contents;
+	int			svFlags;
+	int			ownerNum;
+} traceEntityState_t;
+
+typedef struct {
+	traceKey_t	key;
+	int			generation;			// valid while it matches sv_traceGeneration
+	trace_t		trace;
+	int			numEntities;
+	traceEntityState_t	entities[TRACE_CACHE_ENTITIES];	// as they were clipped against
+} traceCacheEntry_t;
+
+static traceCacheEntry_t	sv_traceEntries[TRACE_CACHE_SIZE];
+static int			sv_traceGeneration = 1;
+static int			sv_traceHits, sv_traceMisses, sv_traceInvalidations;
+
+/*
+================
+SV_InvalidateTraceCache
+================
+*/
+static void SV_InvalidateTraceCache( void ) {
+	sv_traceInvalidations++;
+	sv_traceGeneration++;
+	if ( sv_traceGeneration <= 0 ) {
+		// wrapped around, so old entries could look valid again
+		Com_Memset( sv_traceEntries, 0, sizeof( sv_traceEntries ) );
+		sv_traceGeneration = 1;
+	}
+}
+
+/*
+================
+SV_TraceCacheNewFrame
+
+Nothing carries over from one server frame to the next
+================
+*/
+void SV_TraceCacheNewFrame( void ) {
+	SV_InvalidateTraceCache();
+}
+
+/*
+================
+SV_SetTraceKey
+================
+*/
+static void SV_SetTraceKey( traceKey_t *key, const vec3_t start, const vec3_t mins, const vec3_t maxs,
+	const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
+	VectorCopy( start, key->start );
+	VectorCopy( end, key->end );
+	VectorCopy( mins, key->mins );
+	VectorCopy( maxs, key->maxs );
+	key->passEntityNum = passEntityNum;
+	key->contentmask = contentmask;
+	key->capsule = capsule;
+}
+
+/*
+================
+SV_TraceCacheEntry
+
+Returns the slot the key would be stored in
+================
+*/
+static traceCacheEntry_t *SV_TraceCacheEntry( const traceKey_t *key ) {
+	const unsigned int	*words;
+	unsigned int		hash;
+	int					i;
+
+	words = (const unsigned int *)key;
+	hash = 0;
+	for ( i = 0 ; i < sizeof( *key ) / sizeof( *words ) ; i++ ) {
+		hash = ( hash ^ words[i] ) * 16777619;
+	}
+	hash ^= hash >> 15;
+
+	return &sv_traceEntries[hash & ( TRACE_CACHE_SIZE - 1 )];
+}
+
+/*
+================
+SV_TraceCacheLookup
+
+Gives back a stored trace for the key, if none of the entities it was
+clipped against have changed since
+================
+*/
+static qboolean SV_TraceCacheLookup( const traceKey_t *key, trace_t *trace ) {
+	traceCacheEntry_t	*entry;
+	traceEntityState_t	*state;
+	sharedEntity_t		*ent;
+	int					i;
+
+	entry = SV_TraceCacheEntry( key );
+	if ( entry->generation != sv_traceGeneration || memcmp( &entry->key, key, sizeof( *key ) ) ) {
+		sv_traceMisses++;
+		return qfalse;
+	}
+
+	for ( i = 0, state = entry->entities ; i < entry->numEntities ; i++, state++ ) {
+		ent = SV_GentityNum( state->number );
+		if ( ent->r.contents != state->contents || ent->r.svFlags != state->svFlags
+			|| ent->r.ownerNum != state->ownerNum ) {
+			entry->generation = 0;
+			sv_traceMisses++;
+			return qfalse;
+		}
+	}
+
+	sv_traceHits++;
+	*trace = entry->trace;
+	return qtrue;
+}
+
+/*
+================
+SV_TraceCacheStore
+
+Remembers a trace along with the entities the area query gave its move
+================
+*/
+static void SV_TraceCacheStore( const traceKey_t *key, const trace_t *trace, const int *touchlist, int numTouch ) {
+	traceCacheEntry_t	*entry;
+	traceEntityState_t	*state;
+	sharedEntity_t		*ent;
+	int					i;
+
+	if ( numTouch > TRACE_CACHE_ENTITIES ) {
+		return;		// too much to check on every hit
+	}
+
+	entry = SV_TraceCacheEntry( key );
+	entry->key = *key;
+	entry->generation = sv_traceGeneration;
+	entry->trace = *trace;
+	entry->numEntities = numTouch;
+	for ( i = 0, state = entry->entities ; i < numTouch ; i++, state++ ) {
+		ent = SV_GentityNum( touchlist[i] );
+		state->number = touchlist[i];
+		state->contents = ent->r.contents;
+		state->svFlags = ent->r.svFlags;
+		state->ownerNum = ent->r.ownerNum;
+	}
+}
+
+/*
+================
+SV_TraceCache_f
+
+Prints the trace cache counters, "tracecache reset" clears them
+================
+*/
+void SV_TraceCache_f( void ) {
+	int		total;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		sv_traceHits = sv_traceMisses = sv_traceInvalidations = 0;
+		return;
+	}
+
+	total = sv_traceHits + sv_traceMisses;
+	Com_Printf( "trace cache is %s\n", sv_traceCache->integer ? "on" : "off" );
+	Com_Printf( "%i hits, %i misses (%.1f%% hit rate), %i invalidations\n",
+		sv_traceHits, sv_traceMisses, total ? 100.0f * sv_traceHits / total : 0.0f,
+		sv_traceInvalidations );
+}
+
+
+
 /*
 ===============================================================================
 
@@ -58,6 +268,10 @@ the world is carved up with an evenly spaced, axially aligned bsp tree.  Entitie
 are kept in chains either at the final leafs, or at the first node that splits
 them, which prevents having to deal with multiple fragments of a single entity.
 
+With sv_worldIndex 1 a loose octree is used instead.  Each cell's bounds are
+doubled, so an entity can always be kept at the level matching its size, in the
+cell holding its center, and big entities don't pile up on the top nodes.
+
 ===============================================================================
 */
 
@@ -74,6 +288,60 @@ typedef struct worldSector_s {
 worldSector_t	sv_worldSectors[AREA_NODES];
 int			sv_numworldSectors;
 
+typedef struct octreeNode_s {
+	struct octreeNode_s	*parent;
+	struct octreeNode_s	*children;	// 8 consecutive nodes, NULL at the last level
+	vec3_t		center;
+	float		halfSize;			// of the cell, the loose bounds are twice that
+	int			numEntities;		// in this node and all nodes below
+	svEntity_t	*entities;
+} octreeNode_t;
+
+#define	OCTREE_DEPTH	5
+#define	OCTREE_NODES	37449		// 1 + 8 + ... + 8^OCTREE_DEPTH
+
+static qboolean		sv_useOctree;	// sv_worldIndex when the map was loaded
+static octreeNode_t	*sv_octreeNodes;
+static int			sv_numOctreeNodes;
+
+static int			sv_areaCandidates;	// entity bounds tested by SV_AreaEntities
+
+
+/*
+===============
+SV_OctreeList
+===============
+*/
+static void SV_OctreeList( void ) {
+	int				i, depth, levelNodes;
+	int				nodes, entities, most;
+	octreeNode_t	*node;
+	svEntity_t		*ent;
+	int				c;
+
+	i = 0;
+	levelNodes = 1;
+	for ( depth = 0 ; depth <= OCTREE_DEPTH ; depth++ ) {
+		nodes = entities = most = 0;
+		for ( ; levelNodes && i < sv_numOctreeNodes ; levelNodes-- ) {
+			node = &sv_octreeNodes[i++];
+			c = 0;
+			for ( ent = node->entities ; ent ; ent = ent->nextEntityInOctreeNode ) {
+				c++;
+			}
+			if ( c ) {
+				nodes++;
+				entities += c;
+				if ( c > most ) {
+					most = c;
+				}
+			}
+		}
+		Com_Printf( "level %i (%5.0f units): %i entities in %i nodes, at most %i in one\n",
+			depth, sv_octreeNodes[0].halfSize * 2 / ( 1 << depth ), entities, nodes, most );
+		levelNodes = 1 << ( 3 * ( depth + 1 ) );
+	}
+}
 
 /*
 ===============
@@ -85,6 +353,11 @@ void SV_SectorList_f( void ) {
 	worldSector_t	*sec;
 	svEntity_t		*ent;
 
+	if ( sv_useOctree ) {
+		SV_OctreeList();
+		return;
+	}
+
 	for ( i = 0 ; i < AREA_NODES ; i++ ) {
 		sec = &sv_worldSectors[i];
 
@@ -138,6 +411,53 @@ static worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs
 	return anode;
 }
 
+/*
+===============
+SV_CreateOctree
+
+Builds all levels of a loose octree around the given world size,
+every level is stored after the one above it
+===============
+*/
+static void SV_CreateOctree( vec3_t mins, vec3_t maxs ) {
+	octreeNode_t	*node, *child;
+	int				i, j, k;
+	float			size;
+
+	sv_octreeNodes = Hunk_Alloc( OCTREE_NODES * sizeof( *sv_octreeNodes ), h_high );
+
+	// the root cell is a cube around the whole world
+	node = &sv_octreeNodes[0];
+	size = 0;
+	for ( k = 0 ; k < 3 ; k++ ) {
+		node->center[k] = 0.5 * ( mins[k] + maxs[k] );
+		if ( maxs[k] - mins[k] > size ) {
+			size = maxs[k] - mins[k];
+		}
+	}
+	node->halfSize = 0.5 * size + 1;
+	sv_numOctreeNodes = 1;
+
+	for ( i = 0 ; sv_numOctreeNodes + 8 <= OCTREE_NODES ; i++ ) {
+		node = &sv_octreeNodes[i];
+		node->children = &sv_octreeNodes[sv_numOctreeNodes];
+		sv_numOctreeNodes += 8;
+
+		for ( j = 0 ; j < 8 ; j++ ) {
+			child = &node->children[j];
+			child->parent = node;
+			child->halfSize = 0.5 * node->halfSize;
+			for ( k = 0 ; k < 3 ; k++ ) {
+				if ( j & ( 1 << k ) ) {
+					child->center[k] = node->center[k] + child->halfSize;
+				} else {
+					child->center[k] = node->center[k] - child->halfSize;
+				}
+			}
+		}
+	}
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -147,6 +467,7 @@ SV_ClearWorld
 void SV_ClearWorld( void ) {
 	clipHandle_t	h;
 	vec3_t			mins, maxs;
+	int				i;
 
 	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
 	sv_numworldSectors = 0;
@@ -155,6 +476,167 @@ void SV_ClearWorld( void ) {
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
 	SV_CreateworldSector( 0, mins, maxs );
+
+	// nothing from the last map can be reused
+	SV_InvalidateTraceCache();
+
+	sv_useOctree = ( sv_worldIndex->integer == 1 );
+	sv_octreeNodes = NULL;
+	sv_numOctreeNodes = 0;
+	if ( sv_useOctree ) {
+		SV_CreateOctree( mins, maxs );
+	}
+
+	// one empty list per cluster, plus the overflow list
+	sv.numClusters = CM_NumClusters();
+	sv.clusterEntities = Hunk_Alloc( ( sv.numClusters + 1 ) * sizeof( *sv.clusterEntities ), h_high );
+	for ( i = 0 ; i <= sv.numClusters ; i++ ) {
+		sv.clusterEntities[i].prev = sv.clusterEntities[i].next = &sv.clusterEntities[i];
+		sv.clusterEntities[i].entityNum = -1;
+	}
+}
+
+
+/*
+===============
+SV_UnlinkEntityClusters
+
+===============
+*/
+static void SV_UnlinkEntityClusters( svEntity_t *ent ) {
+	clusterLink_t	*link;
+	int				i;
+
+	for ( i = 0 ; i < ent->numClusterLinks ; i++ ) {
+		link = &ent->clusterLinks[i];
+		link->prev->next = link->next;
+		link->next->prev = link->prev;
+	}
+	ent->numClusterLinks = 0;
+}
+
+
+/*
+===============
+SV_LinkEntityClusters
+
+Puts the entity in the lists of the clusters it touches.  Entities
+with overflowed clusters go in the extra list that is always checked.
+===============
+*/
+static void SV_LinkEntityClusters( svEntity_t *ent ) {
+	clusterLink_t	*link, *head;
+	int				i;
+
+	for ( i = 0 ; i < ent->numClusters ; i++ ) {
+		if ( ent->clusternums[i] >= sv.numClusters ) {
+			break;
+		}
+	}
+
+	if ( ent->lastCluster || i != ent->numClusters ) {
+		ent->clusterLinks[0].entityNum = ent - sv.svEntities;
+		head = &sv.clusterEntities[sv.numClusters];
+		link = &ent->clusterLinks[0];
+		link->prev = head;
+		link->next = head->next;
+		head->next->prev = link;
+		head->next = link;
+		ent->numClusterLinks = 1;
+		return;
+	}
+
+	for ( i = 0 ; i < ent->numClusters ; i++ ) {
+		ent->clusterLinks[i].entityNum = ent - sv.svEntities;
+		head = &sv.clusterEntities[ent->clusternums[i]];
+		link = &ent->clusterLinks[i];
+		link->prev = head;
+		link->next = head->next;
+		head->next->prev = link;
+		head->next = link;
+	}
+	ent->numClusterLinks = ent->numClusters;
+}
+
+
+/*
+===============
+SV_UnlinkEntityOctree
+
+===============
+*/
+static void SV_UnlinkEntityOctree( svEntity_t *ent ) {
+	octreeNode_t	*node;
+	svEntity_t		**prev;
+
+	node = ent->octreeNode;
+	ent->octreeNode = NULL;
+
+	for ( prev = &node->entities ; *prev ; prev = &(*prev)->nextEntityInOctreeNode ) {
+		if ( *prev == ent ) {
+			*prev = ent->nextEntityInOctreeNode;
+			for ( ; node ; node = node->parent ) {
+				node->numEntities--;
+			}
+			return;
+		}
+	}
+
+	Com_Printf( "WARNING: SV_UnlinkEntity: not found in octree node\n" );
+}
+
+
+/*
+===============
+SV_LinkEntityOctree
+
+Puts the entity in the deepest cell that is at least as big as the
+entity and holds its center.  The loose bounds of that cell then
+contain the whole entity.
+===============
+*/
+static void SV_LinkEntityOctree( svEntity_t *ent, sharedEntity_t *gEnt ) {
+	octreeNode_t	*node, *child;
+	vec3_t			center;
+	float			size;
+	int				j, k;
+
+	size = 0;
+	for ( k = 0 ; k < 3 ; k++ ) {
+		center[k] = 0.5 * ( gEnt->r.absmin[k] + gEnt->r.absmax[k] );
+		if ( gEnt->r.absmax[k] - gEnt->r.absmin[k] > size ) {
+			size = gEnt->r.absmax[k] - gEnt->r.absmin[k];
+		}
+	}
+
+	// anything with its center outside the world stays at the root,
+	// which is always checked
+	node = sv_octreeNodes;
+	for ( k = 0 ; k < 3 ; k++ ) {
+		if ( fabs( center[k] - node->center[k] ) > node->halfSize ) {
+			break;
+		}
+	}
+
+	if ( k == 3 ) {
+		while ( node->children && size <= node->halfSize ) {
+			j = 0;
+			for ( k = 0 ; k < 3 ; k++ ) {
+				if ( center[k] >= node->center[k] ) {
+					j |= 1 << k;
+				}
+			}
+			node = &node->children[j];
+		}
+	}
+
+	ent->octreeNode = node;
+	ent->nextEntityInOctreeNode = node->entities;
+	node->entities = ent;
+
+	for ( child = node ; child ; child = child->parent ) {
+		child->numEntities++;
+	}
 }
 
 
@@ -173,6 +655,17 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linked = qfalse;
 
+	if ( ent->worldSector || ent->octreeNode ) {
+		SV_InvalidateTraceCache();
+	}
+
+	SV_UnlinkEntityClusters( ent );
+
+	if ( ent->octreeNode ) {
+		SV_UnlinkEntityOctree( ent );
+		return;
+	}
+
 	ws = ent->worldSector;
 	if ( !ws ) {
 		return;		// not linked in anywhere
@@ -215,10 +708,14 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	ent = SV_SvEntityForGentity( gEnt );
 
-	if ( ent->worldSector ) {
+	if ( ent->worldSector || ent->octreeNode ) {
 		SV_UnlinkEntity( gEnt );	// unlink from old position
 	}
 
+	// even without contents, it's in the area lists the cached traces
+	// were clipped against from now on
+	SV_InvalidateTraceCache();
+
 	// encode the size into the entityState_t for client prediction
 	if ( gEnt->r.bmodel ) {
 		gEnt->s.solid = SOLID_BMODEL;		// a solid_box will never create this value
@@ -332,6 +829,13 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linkcount++;
 
+	if ( sv_useOctree ) {
+		SV_LinkEntityOctree( ent, gEnt );
+		SV_LinkEntityClusters( ent );
+		gEnt->r.linked = qtrue;
+		return;
+	}
+
 	// find the first world sector node that the ent's box crosses
 	node = sv_worldSectors;
 	while (1)
@@ -351,6 +855,8 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	ent->nextEntityInWorldSector = node->entities;
 	node->entities = ent;
 
+	SV_LinkEntityClusters( ent );
+
 	gEnt->r.linked = qtrue;
 }
 
@@ -369,6 +875,7 @@ typedef struct {
 	const float	*maxs;
 	int			*list;
 	int			count, maxcount;
+	int			tested;
 } areaParms_t;
 
 
@@ -386,6 +893,7 @@ static void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
 		next = check->nextEntityInWorldSector;
 
 		gcheck = SV_GEntityForSvEntity( check );
+		ap->tested++;
 
 		if ( gcheck->r.absmin[0] > ap->maxs[0]
 		|| gcheck->r.absmin[1] > ap->maxs[1]
@@ -418,6 +926,66 @@ static void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
 	}
 }
 
+/*
+====================
+SV_AreaEntitiesOctree_r
+
+====================
+*/
+static void SV_AreaEntitiesOctree_r( octreeNode_t *node, areaParms_t *ap ) {
+	svEntity_t	*check;
+	sharedEntity_t *gcheck;
+	octreeNode_t	*child;
+	float		loose;
+	int			j;
+
+	for ( check = node->entities ; check ; check = check->nextEntityInOctreeNode ) {
+		gcheck = SV_GEntityForSvEntity( check );
+		ap->tested++;
+
+		if ( gcheck->r.absmin[0] > ap->maxs[0]
+		|| gcheck->r.absmin[1] > ap->maxs[1]
+		|| gcheck->r.absmin[2] > ap->maxs[2]
+		|| gcheck->r.absmax[0] < ap->mins[0]
+		|| gcheck->r.absmax[1] < ap->mins[1]
+		|| gcheck->r.absmax[2] < ap->mins[2]) {
+			continue;
+		}
+
+		if ( ap->count == ap->maxcount ) {
+			Com_Printf ("SV_AreaEntities: MAXCOUNT\n");
+			return;
+		}
+
+		ap->list[ap->count] = check - sv.svEntities;
+		ap->count++;
+	}
+
+	if ( !node->children ) {
+		return;		// terminal node
+	}
+
+	// recurse into the children whose loose bounds touch the area
+	for ( j = 0 ; j < 8 ; j++ ) {
+		child = &node->children[j];
+		if ( !child->numEntities ) {
+			continue;
+		}
+
+		loose = 2 * child->halfSize;
+		if ( child->center[0] - loose > ap->maxs[0]
+		|| child->center[1] - loose > ap->maxs[1]
+		|| child->center[2] - loose > ap->maxs[2]
+		|| child->center[0] + loose < ap->mins[0]
+		|| child->center[1] + loose < ap->mins[1]
+		|| child->center[2] + loose < ap->mins[2] ) {
+			continue;
+		}
+
+		SV_AreaEntitiesOctree_r( child, ap );
+	}
+}
+
 /*
 ================
 SV_AreaEntities
@@ -431,12 +999,97 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.list = entityList;
 	ap.count = 0;
 	ap.maxcount = maxcount;
+	ap.tested = 0;
+
+	if ( sv_useOctree ) {
+		SV_AreaEntitiesOctree_r( sv_octreeNodes, &ap );
+	} else {
+		SV_AreaEntities_r( sv_worldSectors, &ap );
+	}
 
-	SV_AreaEntities_r( sv_worldSectors, &ap );
+	sv_areaCandidates += ap.tested;
 
 	return ap.count;
 }
 
+/*
+================
+SV_WorldBench_f
+
+Runs the entity part of a fixed series of pseudo random traces
+through SV_AreaEntities, so the area node tree and the octree can
+be compared on the same map with different sv_worldIndex values
+================
+*/
+void SV_WorldBench_f( void ) {
+	int				touchlist[MAX_GENTITIES];
+	vec3_t			worldMins, worldMaxs;
+	vec3_t			start, end, dir, boxmins, boxmaxs;
+	const float		*mins, *maxs;
+	vec3_t			playerMins = { -15, -15, -24 };
+	vec3_t			playerMaxs = { 15, 15, 32 };
+	int				i, k, traces, seed;
+	int				found, msec;
+	float			length;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	traces = 100000;
+	if ( Cmd_Argc() > 1 ) {
+		traces = atoi( Cmd_Argv( 1 ) );
+		if ( traces < 1 ) {
+			traces = 1;
+		}
+	}
+
+	CM_ModelBounds( CM_InlineModel( 0 ), worldMins, worldMaxs );
+
+	seed = 0x5eed;
+	found = 0;
+	sv_areaCandidates = 0;
+	msec = Sys_Milliseconds();
+
+	for ( i = 0 ; i < traces ; i++ ) {
+		// alternate short and long, point and player sized traces
+		for ( k = 0 ; k < 3 ; k++ ) {
+			start[k] = worldMins[k] + Q_random( &seed ) * ( worldMaxs[k] - worldMins[k] );
+			dir[k] = Q_crandom( &seed );
+		}
+		VectorNormalize( dir );
+		length = Q_random( &seed ) * ( ( i & 1 ) ? 8192 : 256 );
+		VectorMA( start, length, dir, end );
+
+		if ( i & 2 ) {
+			mins = playerMins;
+			maxs = playerMaxs;
+		} else {
+			mins = maxs = vec3_origin;
+		}
+
+		// same bounds as SV_Trace uses for the entity clipping
+		for ( k = 0 ; k < 3 ; k++ ) {
+			if ( end[k] > start[k] ) {
+				boxmins[k] = start[k] + mins[k] - 1;
+				boxmaxs[k] = end[k] + maxs[k] + 1;
+			} else {
+				boxmins[k] = end[k] + mins[k] - 1;
+				boxmaxs[k] = start[k] + maxs[k] + 1;
+			}
+		}
+
+		found += SV_AreaEntities( boxmins, boxmaxs, touchlist, MAX_GENTITIES );
+	}
+
+	msec = Sys_Milliseconds() - msec;
+
+	Com_Printf( "%s: %i traces in %i msec, %.1f candidates tested and %.1f found per trace\n",
+		sv_useOctree ? "octree" : "area nodes", traces, msec,
+		(float)sv_areaCandidates / traces, (float)found / traces );
+}
+
 
 
 //===========================================================================
@@ -499,21 +1152,20 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 
 /*
 ====================
-SV_ClipMoveToEntities
+SV_ClipMoveToEntityList
 
+Clips the move against the entities in touchlist, which must be
+in the order SV_AreaEntities returned them
 ====================
 */
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	int			i, num;
-	int			touchlist[MAX_GENTITIES];
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace;
 	clipHandle_t	clipHandle;
 	float		*origin, *angles;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -585,6 +1237,90 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 }
 
 
+/*
+====================
+SV_ClipMoveToEntities
+
+====================
+*/
+static int SV_ClipMoveToEntities( moveclip_t *clip, int *touchlist ) {
+	int			num;
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+
+	return num;
+}
+
+
+/*
+==================
+SV_SetupMoveClip
+
+Fills in everything but the trace of a moveclip
+==================
+*/
+static void SV_SetupMoveClip( moveclip_t *clip, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
+	int			i;
+
+	clip->contentmask = contentmask;
+	clip->start = start;
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
+
+	// create the bounding box of the entire move
+	// we can limit it to the part of the move not
+	// already clipped off by the world, which can be
+	// a significant savings for line of sight and shot traces
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			clip->boxmins[i] = clip->start[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->end[i] + clip->maxs[i] + 1;
+		} else {
+			clip->boxmins[i] = clip->end[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->start[i] + clip->maxs[i] + 1;
+		}
+	}
+}
+
+
+/*
+==================
+SV_TraceUncached
+
+Returns how many entities the area query put in touchlist
+==================
+*/
+static int SV_TraceUncached( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int *touchlist ) {
+	moveclip_t	clip;
+	int			num;
+
+	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
+
+	// clip to world
+	CM_BoxTrace( &clip.trace, start, end, (float *)mins, (float *)maxs, 0, contentmask, capsule );
+	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	if ( clip.trace.fraction == 0 ) {
+		*results = clip.trace;
+		return 0;		// blocked immediately by the world
+	}
+
+	SV_SetupMoveClip( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule );
+
+	// clip to other solid entities
+	num = SV_ClipMoveToEntities ( &clip, touchlist );
+
+	*results = clip.trace;
+
+	return num;
+}
+
+
 /*
 ==================
 SV_Trace
@@ -594,8 +1330,9 @@ passEntityNum and entities owned by passEntityNum are explicitly not checked.
 ==================
 */
 void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
-	moveclip_t	clip;
-	int			i;
+	traceKey_t			key;
+	int					touchlist[MAX_GENTITIES];
+	int					num;
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -604,43 +1341,200 @@ void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, c
 		maxs = vec3_origin;
 	}
 
-	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
+	if ( !sv_traceCache->integer ) {
+		SV_TraceUncached( results, start, mins, maxs, end, passEntityNum, contentmask, capsule, touchlist );
+		return;
+	}
 
-	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, capsule );
-	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
-	if ( clip.trace.fraction == 0 ) {
-		*results = clip.trace;
-		return;		// blocked immediately by the world
+	SV_SetTraceKey( &key, start, mins, maxs, end, passEntityNum, contentmask, capsule );
+
+	if ( SV_TraceCacheLookup( &key, results ) ) {
+		return;
 	}
 
-	clip.contentmask = contentmask;
-	clip.start = start;
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+	num = SV_TraceUncached( results, start, mins, maxs, end, passEntityNum, contentmask, capsule, touchlist );
 
-	// create the bounding box of the entire move
-	// we can limit it to the part of the move not
-	// already clipped off by the world, which can be
-	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
+	SV_TraceCacheStore( &key, results, touchlist, num );
+}
+
+
+#define	TRACE_BATCH_JOB_SIZE	16		// world traces per job
+
+typedef struct {
+	trace_t					*results;
+	const traceRequest_t	*requests;
+	const int				*pending;
+	int						numPending;
+	int						capsule;
+} traceBatch_t;
+
+/*
+==================
+SV_TraceBatchJob
+
+Clips a run of pending traces to the world on a worker thread
+==================
+*/
+static void SV_TraceBatchJob( void *data, int index ) {
+	traceBatch_t			*batch;
+	const traceRequest_t	*req;
+	trace_t					*tr;
+	int						i, last;
+
+	batch = (traceBatch_t *)data;
+	last = ( index + 1 ) * TRACE_BATCH_JOB_SIZE;
+	if ( last > batch->numPending ) {
+		last = batch->numPending;
+	}
+
+	for ( i = index * TRACE_BATCH_JOB_SIZE ; i < last ; i++ ) {
+		req = &batch->requests[batch->pending[i]];
+		tr = &batch->results[batch->pending[i]];
+		CM_BoxTraceConcurrent( tr, req->start, req->end, (float *)req->mins, (float *)req->maxs,
+			0, req->contentmask, batch->capsule );
+		tr->entityNum = tr->fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	}
+}
+
+/*
+==================
+SV_TraceBatch
+
+Gives the same results as calling SV_Trace for each request.  The
+area query is done once over the bounds of all the moves, and each
+move clips against the entities of that list that touch its own
+bounds.  Filtering keeps the order SV_AreaEntities would have
+returned for the move alone, so ties between entities still resolve
+the same way.
+
+With sv_traceThreads set, the world part of the traces is spread over
+that many threads.  Clipping to entities stays on the calling thread.
+==================
+*/
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests, int capsule ) {
+	moveclip_t	clip;
+	const traceRequest_t	*req;
+	sharedEntity_t	*touch;
+	traceBatch_t	batch;
+	traceKey_t		key;
+	int			touchlist[MAX_GENTITIES];
+	int			movelist[MAX_GENTITIES];
+	int			*pending;
+	vec3_t		mins, maxs;
+	int			i, j, k, num, count, numPending;
+	qboolean	first;
+
+	if ( numRequests <= 0 ) {
+		return;
+	}
+
+	pending = Hunk_AllocateTempMemory( numRequests * sizeof( *pending ) );
+
+	// answer what the trace cache already has
+	numPending = 0;
+	for ( i = 0, req = requests ; i < numRequests ; i++, req++ ) {
+		if ( sv_traceCache->integer ) {
+			SV_SetTraceKey( &key, req->start, req->mins, req->maxs, req->end,
+				req->passEntityNum, req->contentmask, capsule );
+			if ( SV_TraceCacheLookup( &key, &results[i] ) ) {
+				continue;
+			}
+		}
+		pending[numPending++] = i;
+	}
+
+	// clip the rest to the world
+	if ( sv_traceThreads->integer > 1 && numPending > TRACE_BATCH_JOB_SIZE ) {
+		batch.results = results;
+		batch.requests = requests;
+		batch.pending = pending;
+		batch.numPending = numPending;
+		batch.capsule = capsule;
+		Com_RunJobs( sv_traceThreads->integer, SV_TraceBatchJob, &batch,
+			( numPending + TRACE_BATCH_JOB_SIZE - 1 ) / TRACE_BATCH_JOB_SIZE );
+	} else {
+		for ( k = 0 ; k < numPending ; k++ ) {
+			i = pending[k];
+			req = &requests[i];
+			CM_BoxTrace( &results[i], req->start, req->end, (float *)req->mins, (float *)req->maxs,
+				0, req->contentmask, capsule );
+			results[i].entityNum = results[i].fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+		}
+	}
+
+	// find the bounds of the moves that still need the entities
+	first = qtrue;
+	VectorClear( mins );
+	VectorClear( maxs );
+	for ( k = 0 ; k < numPending ; k++ ) {
+		i = pending[k];
+		req = &requests[i];
+		if ( results[i].fraction == 0 ) {
+			// blocked immediately by the world, no entities to check
+			if ( sv_traceCache->integer ) {
+				SV_SetTraceKey( &key, req->start, req->mins, req->maxs, req->end,
+					req->passEntityNum, req->contentmask, capsule );
+				SV_TraceCacheStore( &key, &results[i], NULL, 0 );
+			}
+			continue;
+		}
+
+		SV_SetupMoveClip( &clip, req->start, req->mins, req->maxs, req->end,
+			req->passEntityNum, req->contentmask, capsule );
+		if ( first ) {
+			VectorCopy( clip.boxmins, mins );
+			VectorCopy( clip.boxmaxs, maxs );
+			first = qfalse;
 		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+			AddPointToBounds( clip.boxmins, mins, maxs );
+			AddPointToBounds( clip.boxmaxs, mins, maxs );
 		}
 	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+	if ( !first ) {
+		num = SV_AreaEntities( mins, maxs, touchlist, MAX_GENTITIES );
 
-	*results = clip.trace;
+		for ( k = 0 ; k < numPending ; k++ ) {
+			i = pending[k];
+			req = &requests[i];
+			if ( results[i].fraction == 0 ) {
+				continue;
+			}
+
+			Com_Memset( &clip, 0, sizeof( clip ) );
+			clip.trace = results[i];
+			SV_SetupMoveClip( &clip, req->start, req->mins, req->maxs, req->end,
+				req->passEntityNum, req->contentmask, capsule );
+
+			// the same test SV_AreaEntities does
+			count = 0;
+			for ( j = 0 ; j < num ; j++ ) {
+				touch = SV_GentityNum( touchlist[j] );
+				if ( touch->r.absmin[0] > clip.boxmaxs[0]
+				|| touch->r.absmin[1] > clip.boxmaxs[1]
+				|| touch->r.absmin[2] > clip.boxmaxs[2]
+				|| touch->r.absmax[0] < clip.boxmins[0]
+				|| touch->r.absmax[1] < clip.boxmins[1]
+				|| touch->r.absmax[2] < clip.boxmins[2] ) {
+					continue;
+				}
+				movelist[count++] = touchlist[j];
+			}
+
+			SV_ClipMoveToEntityList( &clip, movelist, count );
+
+			results[i] = clip.trace;
+
+			// remember it for the single traces that follow
+			if ( sv_traceCache->integer ) {
+				SV_SetTraceKey( &key, req->start, req->mins, req->maxs, req->end,
+					req->passEntityNum, req->contentmask, capsule );
+				SV_TraceCacheStore( &key, &results[i], movelist, count );
+			}
+		}
+	}
+
+	Hunk_FreeTempMemory( pending );
 }
 
 
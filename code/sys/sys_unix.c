@@ -39,6 +39,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <fenv.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <pthread.h>
 
 qboolean stdinIsATTY;
 
@@ -200,6 +201,20 @@ int Sys_Milliseconds (void)
 	return curtime;
 }
 
+/*
+================
+Sys_Microseconds
+================
+*/
+int64_t Sys_Microseconds (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /*
 ==================
 Sys_RandomBytes
@@ -289,6 +304,71 @@ FILE *Sys_FOpen( const char *ospath, const char *mode ) {
 	return fopen( ospath, mode );
 }
 
+/*
+==============
+Sys_FSync
+
+Flushes the stdio buffer and waits for the data to reach the disk
+==============
+*/
+qboolean Sys_FSync( FILE *f ) {
+	if ( fflush( f ) ) {
+		return qfalse;
+	}
+
+	return fsync( fileno( f ) ) == 0;
+}
+
+/*
+==============
+Sys_FileStat
+
+Size and modification time of a regular file.  The status change time is
+used when it is later, so a copy that kept the old modification time still
+counts as changed.
+==============
+*/
+qboolean Sys_FileStat( const char *ospath, int64_t *size, int64_t *mtime ) {
+	struct stat buf;
+
+	if ( stat( ospath, &buf ) || !S_ISREG( buf.st_mode ) ) {
+		return qfalse;
+	}
+
+	*size = buf.st_size;
+	*mtime = buf.st_mtime > buf.st_ctime ? buf.st_mtime : buf.st_ctime;
+	return qtrue;
+}
+
+/*
+==============
+Sys_MapFile
+==============
+*/
+void *Sys_MapFile( FILE *f, int length ) {
+	void	*buffer;
+
+	if ( length <= 0 ) {
+		return NULL;
+	}
+
+	buffer = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fileno( f ), 0 );
+	if ( buffer == MAP_FAILED ) {
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/*
+==============
+Sys_UnmapFile
+==============
+*/
+void Sys_UnmapFile( void *buffer, int length ) {
+	munmap( buffer, length );
+}
+
 /*
 ==================
 Sys_Mkdir
@@ -593,6 +673,185 @@ void Sys_Sleep( int msec )
 	}
 }
 
+/*
+==============================================================================
+
+THREADS
+
+==============================================================================
+*/
+
+typedef struct
+{
+	pthread_t	handle;
+	void		(*function)( void *arg );
+	void		*arg;
+} sysThread_t;
+
+typedef struct
+{
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int				count;
+} sysSemaphore_t;
+
+/*
+==================
+Sys_ThreadMain
+==================
+*/
+static void *Sys_ThreadMain( void *arg )
+{
+	sysThread_t *thread = arg;
+
+	thread->function( thread->arg );
+
+	return NULL;
+}
+
+/*
+==================
+Sys_CreateThread
+
+Returns NULL if the thread could not be started
+==================
+*/
+void *Sys_CreateThread( void (*function)( void *arg ), void *arg )
+{
+	sysThread_t *thread = Z_Malloc( sizeof( *thread ) );
+
+	thread->function = function;
+	thread->arg = arg;
+
+	if( pthread_create( &thread->handle, NULL, Sys_ThreadMain, thread ) != 0 )
+	{
+		Z_Free( thread );
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+==================
+Sys_JoinThread
+==================
+*/
+void Sys_JoinThread( void *thread )
+{
+	pthread_join( ((sysThread_t *)thread)->handle, NULL );
+	Z_Free( thread );
+}
+
+/*
+==================
+Sys_CreateMutex
+==================
+*/
+void *Sys_CreateMutex( void )
+{
+	pthread_mutex_t *mutex = Z_Malloc( sizeof( *mutex ) );
+
+	pthread_mutex_init( mutex, NULL );
+
+	return mutex;
+}
+
+/*
+==================
+Sys_DestroyMutex
+==================
+*/
+void Sys_DestroyMutex( void *mutex )
+{
+	pthread_mutex_destroy( mutex );
+	Z_Free( mutex );
+}
+
+/*
+==================
+Sys_LockMutex
+==================
+*/
+void Sys_LockMutex( void *mutex )
+{
+	pthread_mutex_lock( mutex );
+}
+
+/*
+==================
+Sys_UnlockMutex
+==================
+*/
+void Sys_UnlockMutex( void *mutex )
+{
+	pthread_mutex_unlock( mutex );
+}
+
+/*
+==================
+Sys_CreateSemaphore
+
+Unnamed POSIX semaphores are not available everywhere (OS X),
+so build a counting semaphore from a mutex and a condition
+==================
+*/
+void *Sys_CreateSemaphore( void )
+{
+	sysSemaphore_t *sem = Z_Malloc( sizeof( *sem ) );
+
+	pthread_mutex_init( &sem->lock, NULL );
+	pthread_cond_init( &sem->cond, NULL );
+	sem->count = 0;
+
+	return sem;
+}
+
+/*
+==================
+Sys_DestroySemaphore
+==================
+*/
+void Sys_DestroySemaphore( void *sem )
+{
+	sysSemaphore_t *s = sem;
+
+	pthread_cond_destroy( &s->cond );
+	pthread_mutex_destroy( &s->lock );
+	Z_Free( s );
+}
+
+/*
+==================
+Sys_SemaphorePost
+==================
+*/
+void Sys_SemaphorePost( void *sem )
+{
+	sysSemaphore_t *s = sem;
+
+	pthread_mutex_lock( &s->lock );
+	s->count++;
+	pthread_cond_signal( &s->cond );
+	pthread_mutex_unlock( &s->lock );
+}
+
+/*
+==================
+Sys_SemaphoreWait
+==================
+*/
+void Sys_SemaphoreWait( void *sem )
+{
+	sysSemaphore_t *s = sem;
+
+	pthread_mutex_lock( &s->lock );
+	while( s->count == 0 )
+		pthread_cond_wait( &s->cond, &s->lock );
+	s->count--;
+	pthread_mutex_unlock( &s->lock );
+}
+
 /*
 ==============
 Sys_ErrorDialog
@@ -36,6 +36,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <stdio.h>
 #include <direct.h>
 #include <io.h>
+#include <sys/stat.h>
 #include <conio.h>
 #include <wincrypt.h>
 #include <shlobj.h>
@@ -293,6 +294,26 @@ int Sys_Milliseconds (void)
 	return sys_curtime;
 }
 
+/*
+================
+Sys_Microseconds
+================
+*/
+int64_t Sys_Microseconds (void)
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+
+	// split to keep the multiply from overflowing
+	return counter.QuadPart / frequency.QuadPart * 1000000 +
+		counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+}
+
 /*
 ================
 Sys_RandomBytes
@@ -419,6 +440,76 @@ FILE *Sys_FOpen( const char *ospath, const char *mode ) {
 	return fopen( ospath, mode );
 }
 
+/*
+==============
+Sys_FSync
+
+Flushes the stdio buffer and waits for the data to reach the disk
+==============
+*/
+qboolean Sys_FSync( FILE *f ) {
+	if ( fflush( f ) ) {
+		return qfalse;
+	}
+
+	return _commit( _fileno( f ) ) == 0;
+}
+
+/*
+==============
+Sys_FileStat
+
+Size and modification time of a regular file.  The creation time is used
+when it is later, so a copy that kept the old modification time still
+counts as changed.
+==============
+*/
+qboolean Sys_FileStat( const char *ospath, int64_t *size, int64_t *mtime ) {
+	struct __stat64 buf;
+
+	if ( _stat64( ospath, &buf ) || !( buf.st_mode & _S_IFREG ) ) {
+		return qfalse;
+	}
+
+	*size = buf.st_size;
+	*mtime = buf.st_mtime > buf.st_ctime ? buf.st_mtime : buf.st_ctime;
+	return qtrue;
+}
+
+/*
+==============
+Sys_MapFile
+==============
+*/
+void *Sys_MapFile( FILE *f, int length ) {
+	HANDLE	mapping;
+	void	*buffer;
+
+	if ( length <= 0 ) {
+		return NULL;
+	}
+
+	mapping = CreateFileMapping( (HANDLE)_get_osfhandle( _fileno( f ) ), NULL, PAGE_READONLY, 0, length, NULL );
+	if ( !mapping ) {
+		return NULL;
+	}
+
+	// the view keeps the mapping alive
+	buffer = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, length );
+	CloseHandle( mapping );
+
+	return buffer;
+}
+
+/*
+==============
+Sys_UnmapFile
+==============
+*/
+void Sys_UnmapFile( void *buffer, int length ) {
+	UnmapViewOfFile( buffer );
+}
+
 /*
 ==============
 Sys_Mkdir
@@ -718,6 +809,158 @@ void Sys_Sleep( int msec )
 #endif
 }
 
+/*
+==============================================================================
+
+THREADS
+
+==============================================================================
+*/
+
+typedef struct
+{
+	HANDLE		handle;
+	void		(*function)( void *arg );
+	void		*arg;
+} sysThread_t;
+
+/*
+==================
+Sys_ThreadMain
+==================
+*/
+static DWORD WINAPI Sys_ThreadMain( LPVOID arg )
+{
+	sysThread_t *thread = arg;
+
+	thread->function( thread->arg );
+
+	return 0;
+}
+
+/*
+==================
+Sys_CreateThread
+
+Returns NULL if the thread could not be started
+==================
+*/
+void *Sys_CreateThread( void (*function)( void *arg ), void *arg )
+{
+	sysThread_t *thread = Z_Malloc( sizeof( *thread ) );
+
+	thread->function = function;
+	thread->arg = arg;
+	thread->handle = CreateThread( NULL, 0, Sys_ThreadMain, thread, 0, NULL );
+
+	if( !thread->handle )
+	{
+		Z_Free( thread );
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+==================
+Sys_JoinThread
+==================
+*/
+void Sys_JoinThread( void *thread )
+{
+	sysThread_t *t = thread;
+
+	WaitForSingleObject( t->handle, INFINITE );
+	CloseHandle( t->handle );
+	Z_Free( t );
+}
+
+/*
+==================
+Sys_CreateMutex
+==================
+*/
+void *Sys_CreateMutex( void )
+{
+	CRITICAL_SECTION *mutex = Z_Malloc( sizeof( *mutex ) );
+
+	InitializeCriticalSection( mutex );
+
+	return mutex;
+}
+
+/*
+==================
+Sys_DestroyMutex
+==================
+*/
+void Sys_DestroyMutex( void *mutex )
+{
+	DeleteCriticalSection( mutex );
+	Z_Free( mutex );
+}
+
+/*
+==================
+Sys_LockMutex
+==================
+*/
+void Sys_LockMutex( void *mutex )
+{
+	EnterCriticalSection( mutex );
+}
+
+/*
+==================
+Sys_UnlockMutex
+==================
+*/
+void Sys_UnlockMutex( void *mutex )
+{
+	LeaveCriticalSection( mutex );
+}
+
+/*
+==================
+Sys_CreateSemaphore
+==================
+*/
+void *Sys_CreateSemaphore( void )
+{
+	return CreateSemaphore( NULL, 0, 0x7fffffff, NULL );
+}
+
+/*
+==================
+Sys_DestroySemaphore
+==================
+*/
+void Sys_DestroySemaphore( void *sem )
+{
+	CloseHandle( sem );
+}
+
+/*
+==================
+Sys_SemaphorePost
+==================
+*/
+void Sys_SemaphorePost( void *sem )
+{
+	ReleaseSemaphore( sem, 1, NULL );
+}
+
+/*
+==================
+Sys_SemaphoreWait
+==================
+*/
+void Sys_SemaphoreWait( void *sem )
+{
+	WaitForSingleObject( sem, INFINITE );
+}
+
 /*
 ==============
 Sys_ErrorDialog